@@ -0,0 +1,56 @@
+# Runs the lexer and XML benchmarks for the 'bench' target and collects the
+# JSON records of all drivers in ${BENCH_OUTPUT}.
+#
+#   cmake -DQJSM=... -DBENCH_LEXER=... -DSOURCE_DIR=... -DBINARY_DIR=...
+#         -DBENCH_SIZE=... -DBENCH_OUTPUT=... -P RunBench.cmake
+
+set(ENV{QUICKJS_MODULE_PATH} "${SOURCE_DIR}:${BINARY_DIR}")
+
+file(WRITE "${BENCH_OUTPUT}" "")
+
+set(C_CORPORA
+    "${SOURCE_DIR}/src/lexer.c" "${SOURCE_DIR}/quickjs-lexer.c"
+    "${SOURCE_DIR}/tests/ANSI-C-grammar-2011.y"
+    "${SOURCE_DIR}/tests/Shell-Grammar.y")
+
+execute_process(
+  COMMAND "${QJSM}" tests/bench_lexer.js --rules c
+  WORKING_DIRECTORY "${SOURCE_DIR}"
+  OUTPUT_FILE "${BINARY_DIR}/c.rules"
+  RESULT_VARIABLE RESULT)
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "Dumping the C lexer rules failed: ${RESULT}")
+endif(NOT RESULT EQUAL 0)
+
+execute_process(
+  COMMAND "${BENCH_LEXER}" -g c -m 2 -s ${BENCH_SIZE} "${BINARY_DIR}/c.rules"
+          ${C_CORPORA}
+  OUTPUT_VARIABLE NATIVE
+  RESULT_VARIABLE RESULT)
+file(APPEND "${BENCH_OUTPUT}" "${NATIVE}")
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "Native lexer benchmark failed: ${RESULT}")
+endif(NOT RESULT EQUAL 0)
+
+execute_process(
+  COMMAND "${QJSM}" --allocs tests/bench_lexer.js -s ${BENCH_SIZE}
+  WORKING_DIRECTORY "${SOURCE_DIR}"
+  OUTPUT_VARIABLE SCRIPT
+  RESULT_VARIABLE RESULT)
+file(APPEND "${BENCH_OUTPUT}" "${SCRIPT}")
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "JS lexer benchmark failed: ${RESULT}")
+endif(NOT RESULT EQUAL 0)
+
+execute_process(
+  COMMAND "${QJSM}" --allocs tests/bench_xml.js -s ${BENCH_SIZE}
+  WORKING_DIRECTORY "${SOURCE_DIR}"
+  OUTPUT_VARIABLE XML
+  RESULT_VARIABLE RESULT)
+file(APPEND "${BENCH_OUTPUT}" "${XML}")
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "XML benchmark failed: ${RESULT}")
+endif(NOT RESULT EQUAL 0)
+
+message("${NATIVE}${SCRIPT}${XML}")
+message(STATUS "Benchmark results written to ${BENCH_OUTPUT}")
@@ -262,14 +262,7 @@ typedef struct InputBuffer {
   OffsetLength range;
 } InputBuffer;
 
-static inline void
-input_buffer_free_default(JSContext* ctx, const char* str, JSValue val) {
-  if(JS_IsString(val))
-    JS_FreeCString(ctx, str);
-
-  if(!JS_IsUndefined(val))
-    JS_FreeValue(ctx, val);
-}
+void input_buffer_free_default(JSContext*, const char*, JSValue);
 
 InputBuffer js_input_buffer(JSContext* ctx, JSValueConst value);
 InputBuffer js_input_chars(JSContext* ctx, JSValueConst value);
@@ -280,6 +273,7 @@ InputBuffer input_buffer_clone(const InputBuffer* in, JSContext* ctx);
 BOOL input_buffer_valid(const InputBuffer* in);
 void input_buffer_dump(const InputBuffer* in, DynBuf* db);
 void input_buffer_free(InputBuffer* in, JSContext* ctx);
+void input_buffer_free_rt(InputBuffer* in, JSRuntime* rt);
 
 static inline uint8_t*
 input_buffer_data(const InputBuffer* in) {
@@ -132,14 +132,8 @@ byte_rchr(const void* str, size_t len, char c) {
   return len;
 }*/
 
-static inline size_t
-byte_chrs(const void* str, size_t len, const char needle[], size_t nl) {
-  const char *s, *t;
-  for(s = str, t = str + len; s != t; s++)
-    if(byte_chr(needle, nl, *s) < nl)
-      break;
-  return s - (const char*)str;
-}
+size_t byte_chrs(const void*, size_t, const char needle[], size_t nl);
+size_t byte_spn(const void*, size_t, const char accept[], size_t na);
 
 static inline size_t
 str_chr(const char* in, char needle) {
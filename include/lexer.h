@@ -17,10 +17,57 @@ typedef struct lexical_rule {
   uint8_t* bytecode;
   void* opaque;
   char* expansion;
+  uint32_t first[8];
+  uint8_t* literal;
+  size_t literal_length;
+  size_t bytecode_length;
+  BOOL run;
+  struct lexical_prefix* prefix;
 } LexerRule;
 
+typedef struct lexical_trie {
+  int32_t child, next, rule;
+  uint8_t byte;
+} LexerTrie;
+
+/* bytes for which a single-class rule is the only candidate, so a run of
+ * them can be skipped at once */
+typedef struct lexical_run {
+  int32_t rule;
+  uint32_t length;
+  char bytes[256];
+} LexerRun;
+
+/* candidate regex rules for each first input byte, in rule order, and a trie
+ * of the literal rules, where chain[] links rules with the same literal */
+typedef struct lexical_dispatch {
+  uint32_t index[257];
+  int32_t* rules;
+  Vector trie;
+  int32_t* chain;
+  Vector runs;
+} LexerDispatch;
+
+typedef struct lexical_line {
+  size_t pos;
+  int64_t char_offset;
+} LexerLine;
+
+/* line starts found in the input after the base location, used to resolve
+ * byte positions to line/column when locations are tracked lazily */
+typedef struct lexical_lines {
+  size_t start, end;
+  uint32_t line, column;
+  int64_t char_offset, byte_offset;
+  uint32_t generation;
+  Vector index;
+} LexerLines;
+
 static const uint64_t MASK_ALL = ~(uint64_t)0;
 
+/* lexemes up to this many bytes are interned as atoms by default */
+#define LEXER_INTERN_MAX 32
+
 enum lexer_mode {
   LEXER_FIRST = 0,
   LEXER_LAST = 1,
@@ -33,6 +80,13 @@ enum {
   LEXER_ERROR_NOMATCH = -3,
   LEXER_ERROR_COMPILE = -4,
   LEXER_ERROR_EXEC = -5,
+  LEXER_NEED_INPUT = -6,
+};
+
+enum lexer_stream {
+  LEXER_STREAM_NONE = 0,
+  LEXER_STREAM_OPEN,
+  LEXER_STREAM_END,
 };
 
 typedef struct lexical_scanner {
@@ -49,6 +103,15 @@ typedef struct lexical_scanner {
   Vector states;
   Vector state_stack;
   uint64_t seq;
+  LexerDispatch* dispatch;
+  uint32_t dispatch_states, dispatch_rules;
+  enum lexer_stream stream;
+  DynBuf buffer;
+  BOOL lazy;
+  size_t loc_pos;
+  LexerLines lines;
+  struct token_source* source;
+  uint32_t intern;
 } Lexer;
 
 int lexer_state_findb(Lexer*, const char*, size_t slen);
@@ -60,6 +123,8 @@ char* lexer_states_skip(char*);
 void lexer_states_dump(Lexer*, uint64_t, DynBuf* dbuf);
 char* lexer_rule_regex(LexerRule*);
 BOOL lexer_rule_expand(Lexer*, char*, DynBuf* db);
+void lexer_rule_first(const char*, uint32_t set[8]);
+BOOL lexer_rule_literal(const char*, DynBuf* db);
 int lexer_rule_add(Lexer*, char*, char* expr);
 LexerRule* lexer_rule_find(Lexer*, const char*);
 void lexer_rule_free(LexerRule*, JSContext*);
@@ -67,15 +132,29 @@ void lexer_rule_free_rt(LexerRule*, JSRuntime*);
 void lexer_rule_dump(Lexer*, LexerRule*, DynBuf* dbuf);
 void lexer_init(Lexer*, enum lexer_mode, JSContext* ctx);
 void lexer_set_input(Lexer*, InputBuffer, int32_t file_atom);
+BOOL lexer_feed(Lexer*, const uint8_t*, size_t, JSContext* ctx);
+void lexer_end(Lexer*);
+struct token_source* lexer_source(Lexer*, JSContext*);
+void lexer_source_drop(Lexer*);
 void lexer_define(Lexer*, char*, char* expr);
 LexerRule* lexer_find_definition(Lexer*, const char*, size_t namelen);
 BOOL lexer_compile_rules(Lexer*, JSContext*);
+uint32_t lexer_hash(Lexer*);
+BOOL lexer_serialize(Lexer*, DynBuf*, JSContext*);
+BOOL lexer_deserialize(Lexer*, const uint8_t*, size_t, JSContext*);
+BOOL lexer_dispatch_build(Lexer*, JSContext*);
+void lexer_dispatch_free(Lexer*, JSRuntime*);
 int lexer_peek(Lexer*, uint64_t, int, JSContext* ctx);
 size_t lexer_skip(Lexer*);
+size_t lexer_skip_run(Lexer*);
 size_t lexer_charlen(Lexer*);
 char* lexer_lexeme(Lexer*, size_t*);
 int lexer_next(Lexer*, uint64_t, JSContext* ctx);
 void lexer_set_location(Lexer*, const Location*, JSContext* ctx);
+void lexer_set_lazy(Lexer*, BOOL);
+void lexer_lines_reset(Lexer*);
+BOOL lexer_location_at(Lexer*, size_t, Location*);
+Location* lexer_location(Lexer*);
 void lexer_release(Lexer*, JSContext*);
 void lexer_free(Lexer*, JSContext*);
 void lexer_release_rt(Lexer*, JSRuntime*);
@@ -2,6 +2,7 @@
 #define TOKEN_H
 
 #include <quickjs.h>
+#include "buffer-utils.h"
 
 struct lexical_scanner;
 
@@ -9,6 +10,14 @@ struct lexical_scanner;
  * \defgroup token
  * @{
  */
+
+/* input shared by a lexer and the tokens which point into it */
+typedef struct token_source {
+  int ref_count;
+  InputBuffer input;
+  JSRuntime* rt;
+} TokenSource;
+
 typedef struct {
   int ref_count, id;
   uint8_t* lexeme;
@@ -16,10 +25,17 @@ typedef struct {
   struct lexical_scanner* lexer;
   Location* loc;
   uint64_t seq;
+  size_t pos;
+  uint32_t generation;
+  TokenSource* source;
+  JSAtom atom;
 } Token;
 
+TokenSource* token_source_new(InputBuffer*, JSContext*);
+void token_source_release(TokenSource*);
 Token* token_new(JSContext*);
 Token* token_create(int, Location*, const char*, size_t len, JSContext* ctx);
+Token* token_slice(int, Location*, TokenSource*, const char*, size_t len, JSContext* ctx);
 BOOL token_release_rt(Token*, JSRuntime*);
 void token_free_rt(Token*, JSRuntime*);
 
@@ -50,6 +66,12 @@ token_byte_range(Token* tok) {
   return ret;
 }
 
+static inline TokenSource*
+token_source_dup(TokenSource* src) {
+  ++src->ref_count;
+  return src;
+}
+
 static inline Token*
 token_dup(Token* tok) {
   ++tok->ref_count;
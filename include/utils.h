@@ -241,6 +241,7 @@ RegExp regexp_from_argv(int argc, JSValueConst argv[], JSContext* ctx);
 RegExp regexp_from_string(char* str, int flags);
 RegExp regexp_from_dbuf(DynBuf* dbuf, int flags);
 uint8_t* regexp_compile(RegExp re, JSContext* ctx);
+uint8_t* regexp_compile_len(RegExp re, size_t* lenp, JSContext* ctx);
 JSValue regexp_to_value(RegExp re, JSContext* ctx);
 void regexp_free_rt(RegExp re, JSRuntime* rt);
 BOOL regexp_match(const uint8_t* bc, const void* cbuf, size_t clen, JSContext* ctx);
@@ -403,6 +404,14 @@ js_cstring_free(JSContext* ctx, const char* ptr) {
   JS_FreeValue(ctx, JS_MKPTR(JS_TAG_STRING, (void*)(ptr - offsetof(JSString, u))));
 }
 
+static inline void
+js_cstring_free_rt(JSRuntime* rt, const char* ptr) {
+  if(!ptr)
+    return;
+
+  JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, (void*)(ptr - offsetof(JSString, u))));
+}
+
 static inline int64_t
 js_toint64(JSContext* ctx, JSValueConst value) {
   int64_t ret = 0;
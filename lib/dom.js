@@ -1,7 +1,7 @@
 import deep from 'deep';
 import { TreeWalker } from 'tree_walker';
 import { isObject, define, quote, range, assert, memoize, getset, modifier, gettersetter, arrayFacade, lazyProperties } from 'util';
-import { read as readXML, write as writeXML } from 'xml';
+import { read as readXML, write as writeXML, select, selectFirst, XmlDocument, RETURN_PATH } from 'xml';
 import { readFileSync } from 'fs';
 import { parseSelectors } from './css3-selectors.js';
 
@@ -164,7 +164,7 @@ export class Parser {
   }
 
   parseFromString(str, file) {
-    let data = readXML(str, file);
+    let data = str instanceof XmlDocument ? str.children : readXML(str, file);
 
     if(Array.isArray(data)) {
       if(data.length > 1)
@@ -312,6 +312,10 @@ export class Interface {
 
   querySelector(...selectors) {
     let node = Node.raw(this);
+    if(selectors.length == 1 && typeof selectors[0] == 'string') {
+      let path = selectFirst(node, selectors[0], RETURN_PATH);
+      return path ? applyPath(path, this) : null;
+    }
     if(typeof selectors[0] == 'string') selectors = [...parseSelectors(...selectors)];
     console.log('selectors', console.config({ depth: Infinity, compact: 0 }), selectors);
     let gen = query(node, selectors);
@@ -322,6 +326,8 @@ export class Interface {
   querySelectorAll(...selectors) {
     let node = Node.raw(this);
 
+    if(selectors.length == 1 && typeof selectors[0] == 'string') return select(node, selectors[0], RETURN_PATH).map(p => applyPath(p, this));
+
     if(typeof selectors[0] == 'string') selectors = [...parseSelectors(...selectors)];
 
     console.log('selectors', selectors);
@@ -6,9 +6,11 @@
 #include "include/pointer.h"
 #include "include/virtual-properties.h"
 #include "quickjs-predicate.h"
+#include "quickjs-pointer.h"
 #include "include/debug.h"
 
 #include <stdint.h>
+#include <inttypes.h>
 
 /**
  * \defgroup quickjs-deep QuickJS module: deep - Deep object
@@ -283,6 +285,8 @@ js_deep_iterator_tostring(JSContext* ctx, JSValueConst this_val, int argc, JSVal
   //  return property_enumeration_pathstr_value(&it->frames, ctx);
 }
 
+static JSValue deep_query(JSContext*, JSValueConst, JSValueConst, uint32_t, BOOL);
+
 static JSValue
 js_deep_find(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   JSValue ret = JS_UNDEFINED;
@@ -294,6 +298,9 @@ js_deep_find(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[
   if(argc > 2)
     flags = js_deep_getflags(ctx, this_val, argc - 2, argv + 2);
 
+  if(JS_IsString(argv[1]))
+    return deep_query(ctx, argv[0], argv[1], flags, TRUE);
+
   if((max_depth = (flags & MAXDEPTH_MASK)) == 0)
     max_depth = INT32_MAX;
 
@@ -336,6 +343,9 @@ js_deep_select(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst arg
   if(argc > 2)
     flags = js_deep_getflags(ctx, this_val, argc - 2, argv + 2);
 
+  if(JS_IsString(argv[1]))
+    return deep_query(ctx, argv[0], argv[1], flags, FALSE);
+
   if((max_depth = (flags & MAXDEPTH_MASK)) == 0)
     max_depth = INT32_MAX;
 
@@ -576,131 +586,3205 @@ js_deep_foreach(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
   return JS_UNDEFINED;
 }
 
-static JSValue
-js_deep_equals(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  JSValue ret = JS_TRUE;
-  PropertyEnumeration *aenum, *benum;
-  Vector aframes, bframes;
+typedef struct {
+  JSValue a, b;
+} DeepPair;
 
-  vector_init(&aframes, ctx);
-  vector_init(&bframes, ctx);
+/* the object pairs compared so far, so that cycles and shared subtrees are entered once */
+typedef struct {
+  struct DeepVisitedEntry {
+    JSObject *a, *b;
+  } * tab;
+  uint32_t size, count;
+} DeepVisited;
 
-  aenum = property_enumeration_push(&aframes, ctx, JS_DupValue(ctx, argv[0]), PROPENUM_DEFAULT_FLAGS | PROPENUM_SORT_ATOMS);
-  benum = property_enumeration_push(&bframes, ctx, JS_DupValue(ctx, argv[1]), PROPENUM_DEFAULT_FLAGS | PROPENUM_SORT_ATOMS);
-  do {
-    JSValue aval, bval;
-    JSAtom akey, bkey;
-    const char *astr, *bstr, *avstr, *bvstr;
-    BOOL result = TRUE;
+static inline uint32_t
+deep_visited_hash(JSObject* a, JSObject* b) {
+  uintptr_t h = ((uintptr_t)a >> 4) * 0x9e3779b1u ^ ((uintptr_t)b >> 4);
 
-    if(!aenum || !benum) {
-      ret = JS_FALSE;
-      break;
+  return h ^ (h >> 16);
+}
+
+/* returns 1 when the pair has been seen before, 0 when it was added */
+static int
+deep_visited_add(JSContext* ctx, DeepVisited* v, JSObject* a, JSObject* b) {
+  uint32_t i, mask;
+
+  if(v->count * 2 >= v->size) {
+    uint32_t j, size = v->size ? v->size * 2 : 64;
+    struct DeepVisitedEntry* tab;
+
+    if(!(tab = js_mallocz(ctx, size * sizeof(struct DeepVisitedEntry))))
+      return -1;
+
+    for(j = 0; j < v->size; j++) {
+      if(!v->tab[j].a)
+        continue;
+
+      for(i = deep_visited_hash(v->tab[j].a, v->tab[j].b) & (size - 1); tab[i].a; i = (i + 1) & (size - 1)) {}
+
+      tab[i] = v->tab[j];
     }
 
-    akey = aenum->tab_atom[aenum->idx].atom;
-    bkey = benum->tab_atom[benum->idx].atom;
+    js_free(ctx, v->tab);
+    v->tab = tab;
+    v->size = size;
+  }
+
+  mask = v->size - 1;
+
+  for(i = deep_visited_hash(a, b) & mask; v->tab[i].a; i = (i + 1) & mask)
+    if(v->tab[i].a == a && v->tab[i].b == b)
+      return 1;
+
+  v->tab[i] = (struct DeepVisitedEntry){a, b};
+  v->count++;
+  return 0;
+}
+
+/* drops the pair, moving back the entries after it so that no probe sequence is broken */
+static void
+deep_visited_remove(DeepVisited* v, JSObject* a, JSObject* b) {
+  uint32_t i, j, k, mask = v->size - 1;
+
+  if(!v->size)
+    return;
+
+  for(i = deep_visited_hash(a, b) & mask; v->tab[i].a; i = (i + 1) & mask)
+    if(v->tab[i].a == a && v->tab[i].b == b)
+      break;
+
+  if(!v->tab[i].a)
+    return;
+
+  for(j = (i + 1) & mask; v->tab[j].a; j = (j + 1) & mask) {
+    k = deep_visited_hash(v->tab[j].a, v->tab[j].b) & mask;
+
+    /* the entry stays when its home slot lies cyclically in (i, j] */
+    if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+
+    v->tab[i] = v->tab[j];
+    i = j;
+  }
+
+  v->tab[i] = (struct DeepVisitedEntry){0, 0};
+  v->count--;
+}
+
+static void
+deep_visited_free(JSContext* ctx, DeepVisited* v) {
+  js_free(ctx, v->tab);
+  v->tab = 0;
+  v->size = v->count = 0;
+}
+
+static BOOL
+deep_push(Vector* stack, JSValue a, JSValue b) {
+  DeepPair* pair;
+
+  if(!(pair = vector_emplace(stack, sizeof(DeepPair))))
+    return FALSE;
+
+  pair->a = a;
+  pair->b = b;
+  return TRUE;
+}
+
+static BOOL
+deep_string_equals(JSValueConst a, JSValueConst b) {
+  JSString *p = JS_VALUE_GET_PTR(a), *q = JS_VALUE_GET_PTR(b);
+  uint32_t i;
+
+  if(p == q)
+    return TRUE;
+
+  if(p->len != q->len)
+    return FALSE;
+
+  if(p->is_wide_char == q->is_wide_char)
+    return !memcmp(p->u.str8, q->u.str8, (size_t)p->len << p->is_wide_char);
 
-    aval = property_enumeration_value(aenum, ctx);
-    bval = property_enumeration_value(benum, ctx);
+  for(i = 0; i < p->len; i++)
+    if((p->is_wide_char ? p->u.str16[i] : p->u.str8[i]) != (q->is_wide_char ? q->u.str16[i] : q->u.str8[i]))
+      return FALSE;
 
-    astr = JS_AtomToCString(ctx, akey);
-    bstr = JS_AtomToCString(ctx, bkey);
-    avstr = JS_ToCString(ctx, aval);
-    bvstr = JS_ToCString(ctx, bval);
+  return TRUE;
+}
+
+/* the bytes viewed by an ArrayBuffer, a typed array or a DataView, 0 when detached */
+static const uint8_t*
+deep_bytes(JSObject* p, size_t* lenp) {
+  JSArrayBuffer* abuf;
+  JSTypedArray* ta = 0;
+
+  if(p->class_id == JS_CLASS_ARRAY_BUFFER || p->class_id == JS_CLASS_SHARED_ARRAY_BUFFER) {
+    abuf = p->u.array_buffer;
+  } else {
+    ta = p->u.typed_array;
+    abuf = ta->buffer->u.array_buffer;
+  }
+
+  if(abuf->detached) {
+    *lenp = 0;
+    return 0;
+  }
+
+  *lenp = ta ? ta->length : abuf->byte_length;
+  return abuf->data + (ta ? ta->offset : 0);
+}
+
+static int
+deep_atom_cmp(const void* a, const void* b) {
+  JSAtom x = ((const JSPropertyEnum*)a)->atom, y = ((const JSPropertyEnum*)b)->atom;
+
+  return x < y ? -1 : x > y;
+}
+
+/* drops the array indices from a key list, returns the number of keys left */
+static uint32_t
+deep_named_keys(JSContext* ctx, JSPropertyEnum* tab, uint32_t len) {
+  uint32_t i, n = 0;
 
-    if(JS_IsObject(aval) && JS_IsObject(bval))
-      result = TRUE;
+  for(i = 0; i < len; i++) {
+    if(js_atom_isint(tab[i].atom))
+      JS_FreeAtom(ctx, tab[i].atom);
     else
-      result = js_value_equals(ctx, aval, bval);
+      tab[n++] = tab[i];
+  }
 
-    JS_FreeValue(ctx, aval);
-    JS_FreeValue(ctx, bval);
+  return n;
+}
+
+/* compares the sets of own enumerable keys and queues the value pairs, only the named ones when the elements were queued already */
+static int
+deep_equals_keys(JSContext* ctx, JSValueConst a, JSValueConst b, Vector* stack, BOOL named) {
+  JSPropertyEnum *atab, *btab;
+  uint32_t alen, blen, i;
+  int ret;
+
+  if(JS_GetOwnPropertyNames(ctx, &atab, &alen, a, JS_GPN_STRING_MASK | JS_GPN_SYMBOL_MASK | JS_GPN_ENUM_ONLY))
+    return -1;
+
+  if(JS_GetOwnPropertyNames(ctx, &btab, &blen, b, JS_GPN_STRING_MASK | JS_GPN_SYMBOL_MASK | JS_GPN_ENUM_ONLY)) {
+    js_propertyenums_free(ctx, atab, alen);
+    js_free(ctx, atab);
+    return -1;
+  }
+
+  if(named) {
+    alen = deep_named_keys(ctx, atab, alen);
+    blen = deep_named_keys(ctx, btab, blen);
+  }
+
+  if((ret = alen == blen)) {
+    /* objects of the same shape list their keys in the same order, sort only when they don't */
+    for(i = 0; i < alen && atab[i].atom == btab[i].atom; i++) {}
+
+    if(i < alen) {
+      qsort(atab, alen, sizeof(JSPropertyEnum), deep_atom_cmp);
+      qsort(btab, blen, sizeof(JSPropertyEnum), deep_atom_cmp);
+
+      for(i = 0; i < alen && atab[i].atom == btab[i].atom; i++) {}
+
+      ret = i == alen;
+    }
+  }
+
+  for(i = alen; ret == 1 && i-- > 0;) {
+    JSValue x = JS_GetProperty(ctx, a, atab[i].atom), y = JS_GetProperty(ctx, b, atab[i].atom);
+
+    if(JS_IsException(x) || JS_IsException(y) || !deep_push(stack, x, y)) {
+      JS_FreeValue(ctx, x);
+      JS_FreeValue(ctx, y);
+      ret = -1;
+    }
+  }
 
-    // printf("a %s: %s b %s: %s result: %d\n", astr, avstr, bstr, bvstr,
-    // result);
+  js_propertyenums_free(ctx, atab, alen);
+  js_propertyenums_free(ctx, btab, blen);
+  js_free(ctx, atab);
+  js_free(ctx, btab);
+  return ret;
+}
+
+static int deep_equals(JSContext*, JSValueConst, JSValueConst, DeepVisited*);
+
+/* the members of 'b' with object keys, the candidates for the members of 'a' which aren't in 'b' by identity */
+typedef struct {
+  JSMapRecord** records;
+  uint8_t* used;
+  uint32_t count;
+} DeepMembers;
+
+/* a record is used when a member of 'a' has it by identity, those never match another one by structure */
+static int
+deep_members_init(JSContext* ctx, DeepMembers* m, JSValueConst a, JSMapState* t) {
+  JSValue has;
+  struct list_head* el;
+  int ret = 0;
+
+  if(!(m->records = js_malloc(ctx, t->record_count * sizeof(JSMapRecord*))) || !(m->used = js_malloc(ctx, t->record_count)))
+    return -1;
+
+  has = JS_GetPropertyStr(ctx, a, "has");
 
-    JS_FreeCString(ctx, astr);
-    JS_FreeCString(ctx, bstr);
-    JS_FreeCString(ctx, avstr);
-    JS_FreeCString(ctx, bvstr);
+  list_for_each(el, &t->records) {
+    JSMapRecord* other = list_entry(el, JSMapRecord, link);
+    JSValue found;
 
-    if(!result) {
-      ret = JS_FALSE;
+    if(other->empty || !JS_IsObject(other->key))
+      continue;
+
+    if(JS_IsException(found = JS_Call(ctx, has, a, 1, &other->key))) {
+      ret = -1;
       break;
     }
-  } while(((aenum = property_enumeration_recurse(&aframes, ctx)), (benum = property_enumeration_recurse(&bframes, ctx))));
 
-  property_enumeration_free(&aframes, JS_GetRuntime(ctx));
-  property_enumeration_free(&bframes, JS_GetRuntime(ctx));
+    m->used[m->count] = JS_ToBool(ctx, found);
+    m->records[m->count++] = other;
+  }
+
+  JS_FreeValue(ctx, has);
   return ret;
 }
 
-static JSValue
-js_deep_iterate(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  return js_deep_iterator_constructor(ctx, deep_iterator_ctor, argc, argv);
+static void
+deep_members_free(JSContext* ctx, DeepMembers* m) {
+  js_free(ctx, m->records);
+  js_free(ctx, m->used);
 }
 
-static JSValue
-js_deep_clone(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+/* a member of 'a' which is not in 'b' by identity, matched by structure with a record of 'b' not used yet */
+static int
+deep_equals_member(JSContext* ctx, JSMapRecord* mr, DeepMembers* m, BOOL is_set) {
+  uint32_t i;
+  int ret = 0;
+
+  for(i = 0; i < m->count; i++) {
+    /* each attempt starts a table of its own, a failed one must not leave its pairs behind as equal */
+    DeepVisited v = {0, 0, 0};
+
+    if(m->used[i])
+      continue;
+
+    if((ret = deep_equals(ctx, mr->key, m->records[i]->key, &v)) == 1 && !is_set)
+      ret = deep_equals(ctx, mr->value, m->records[i]->value, &v);
+
+    deep_visited_free(ctx, &v);
 
-  return js_value_clone(ctx, argv[0]);
+    if(ret == 1)
+      m->used[i] = 1;
+
+    if(ret != 0)
+      break;
+  }
+
+  return ret;
 }
 
-JSValue
-js_deep_call(JSContext* ctx, JSValueConst func_obj, JSValueConst this_val, int argc, JSValueConst argv[], int flags) {
+static int
+deep_equals_map(JSContext* ctx, JSValueConst a, JSValueConst b, Vector* stack) {
+  JSMapState *s = JS_VALUE_GET_OBJ(a)->u.map_state, *t = JS_VALUE_GET_OBJ(b)->u.map_state;
+  BOOL is_set = JS_VALUE_GET_OBJ(a)->class_id == JS_CLASS_SET;
+  JSValue has, get = JS_UNDEFINED;
+  DeepMembers members = {0, 0, 0};
+  BOOL searched = FALSE;
+  struct list_head* el;
+  int ret = 1;
 
-  return JS_UNDEFINED;
+  if(s->record_count != t->record_count)
+    return 0;
+
+  has = JS_GetPropertyStr(ctx, b, "has");
+
+  if(!is_set)
+    get = JS_GetPropertyStr(ctx, b, "get");
+
+  list_for_each(el, &s->records) {
+    JSMapRecord* mr = list_entry(el, JSMapRecord, link);
+    JSValue found;
+
+    if(mr->empty)
+      continue;
+
+    if(JS_IsException(found = JS_Call(ctx, has, b, 1, &mr->key))) {
+      ret = -1;
+      break;
+    }
+
+    if(!JS_ToBool(ctx, found)) {
+      if(!JS_IsObject(mr->key)) {
+        ret = 0;
+        break;
+      }
+
+      /* collected on the first member searched for by structure */
+      if(!searched) {
+        searched = TRUE;
+
+        if(deep_members_init(ctx, &members, a, t)) {
+          ret = -1;
+          break;
+        }
+      }
+
+      if((ret = deep_equals_member(ctx, mr, &members, is_set)) != 1) {
+        ret = ret == -1 ? -1 : 0;
+        break;
+      }
+
+      continue;
+    }
+
+    if(!is_set) {
+      if(JS_IsException(found = JS_Call(ctx, get, b, 1, &mr->key)) || !deep_push(stack, JS_DupValue(ctx, mr->value), found)) {
+        JS_FreeValue(ctx, found);
+        ret = -1;
+        break;
+      }
+    }
+  }
+
+  deep_members_free(ctx, &members);
+  JS_FreeValue(ctx, has);
+  JS_FreeValue(ctx, get);
+  return ret;
 }
 
-static JSClassDef js_deep_iterator_class = {.class_name = "DeepIterator", .finalizer = js_deep_iterator_finalizer};
+static int
+deep_equals_object(JSContext* ctx, JSValueConst a, JSValueConst b, Vector* stack, DeepVisited* visited) {
+  JSObject *p = JS_VALUE_GET_OBJ(a), *q = JS_VALUE_GET_OBJ(b);
+  const uint8_t *x, *y;
+  size_t xlen, ylen;
+  int ret;
 
-static const JSCFunctionListEntry js_deep_funcs[] = {
-    JS_CFUNC_DEF("find", 2, js_deep_find),
-    JS_CFUNC_DEF("select", 2, js_deep_select),
-    JS_CFUNC_DEF("get", 2, js_deep_get),
-    JS_CFUNC_DEF("set", 3, js_deep_set),
-    JS_CFUNC_DEF("unset", 2, js_deep_unset),
-    JS_CFUNC_DEF("flatten", 1, js_deep_flatten),
-    JS_CFUNC_DEF("pathOf", 2, js_deep_pathof),
-    JS_CFUNC_DEF("equals", 2, js_deep_equals),
-    JS_CFUNC_DEF("iterate", 1, js_deep_iterate),
-    JS_CFUNC_DEF("forEach", 2, js_deep_foreach),
-    JS_CFUNC_DEF("clone", 1, js_deep_clone),
-    JS_PROP_INT32_DEF("TYPE_UNDEFINED", TYPE_UNDEFINED, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_NULL", TYPE_NULL, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_BOOL", TYPE_BOOL, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_INT", TYPE_INT, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_OBJECT", TYPE_OBJECT, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_STRING", TYPE_STRING, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_SYMBOL", TYPE_SYMBOL, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_BIG_FLOAT", TYPE_BIG_FLOAT, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_BIG_INT", TYPE_BIG_INT, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_BIG_DECIMAL", TYPE_BIG_DECIMAL, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_FLOAT64", TYPE_FLOAT64, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_NUMBER", TYPE_NUMBER, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_NAN", TYPE_NAN, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_ALL", TYPE_ALL, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_PRIMITIVE", TYPE_PRIMITIVE, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_ARRAY", TYPE_ARRAY, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("TYPE_FUNCTION", TYPE_FUNCTION, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("RETURN_VALUE", RETURN_VALUE, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("RETURN_PATH", RETURN_PATH, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("RETURN_VALUE_PATH", RETURN_VALUE_PATH, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("RETURN_PATH_VALUE", RETURN_PATH_VALUE, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("PATH_AS_STRING", PATH_AS_STRING, JS_PROP_ENUMERABLE),
-    JS_PROP_INT32_DEF("NO_THROW", NO_THROW, JS_PROP_ENUMERABLE),
-};
+  if(p == q)
+    return 1;
 
-static const JSCFunctionListEntry js_deep_iterator_proto_funcs[] = {
-    JS_ITERATOR_NEXT_DEF("next", 0, js_deep_iterator_next, 0),
-    JS_CFUNC_DEF("toString", 0, js_deep_iterator_tostring),
-    JS_CFUNC_DEF("[Symbol.iterator]", 0, js_deep_iterator_iterator),
-    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "Deep Iterator", JS_PROP_CONFIGURABLE),
-};
+  if(p->class_id != q->class_id || JS_IsFunction(ctx, a))
+    return 0;
+
+  if((ret = deep_visited_add(ctx, visited, p, q)))
+    return ret;
+
+  if(js_is_typedarray(a) || p->class_id == JS_CLASS_DATAVIEW || p->class_id == JS_CLASS_ARRAY_BUFFER || p->class_id == JS_CLASS_SHARED_ARRAY_BUFFER) {
+    x = deep_bytes(p, &xlen);
+    y = deep_bytes(q, &ylen);
+
+    return xlen == ylen && (xlen == 0 || !memcmp(x, y, xlen));
+  }
+
+  switch(p->class_id) {
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS: {
+      uint32_t i;
+
+      if(!p->fast_array || !q->fast_array) {
+        if(js_array_length(ctx, a) != js_array_length(ctx, b))
+          return 0;
+
+        break;
+      }
+
+      if(p->u.array.count != q->u.array.count)
+        return 0;
+
+      for(i = p->u.array.count; i-- > 0;)
+        if(!deep_push(stack, JS_DupValue(ctx, p->u.array.u.values[i]), JS_DupValue(ctx, q->u.array.u.values[i])))
+          return -1;
+
+      /* an array whose only property is 'length' has no named keys to compare */
+      if(p->class_id == JS_CLASS_ARRAY && p->shape->prop_count == 1 && q->shape->prop_count == 1)
+        return 1;
+
+      /* properties like the 'index' of a match result */
+      return deep_equals_keys(ctx, a, b, stack, TRUE);
+    }
+
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET: {
+      if((ret = deep_equals_map(ctx, a, b, stack)) != 1)
+        return ret;
+
+      break;
+    }
+
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE: {
+      if(!deep_push(stack, JS_DupValue(ctx, p->u.object_data), JS_DupValue(ctx, q->u.object_data)))
+        return -1;
+
+      break;
+    }
+
+    case JS_CLASS_REGEXP: {
+      if(!deep_string_equals(JS_MKPTR(JS_TAG_STRING, p->u.regexp.pattern), JS_MKPTR(JS_TAG_STRING, q->u.regexp.pattern)) ||
+         !deep_string_equals(JS_MKPTR(JS_TAG_STRING, p->u.regexp.bytecode), JS_MKPTR(JS_TAG_STRING, q->u.regexp.bytecode)))
+        return 0;
+
+      break;
+    }
+  }
+
+  return deep_equals_keys(ctx, a, b, stack, FALSE);
+}
 
 static int
-js_deep_init(JSContext* ctx, JSModuleDef* m) {
+deep_equals_step(JSContext* ctx, JSValueConst a, JSValueConst b, Vector* stack, DeepVisited* visited) {
+  int32_t tag = JS_VALUE_GET_NORM_TAG(a);
+
+  if(tag != JS_VALUE_GET_NORM_TAG(b)) {
+    double x, y;
+
+    /* 1 and 1.0 may be stored differently */
+    if(JS_IsNumber(a) && JS_IsNumber(b) && !JS_ToFloat64(ctx, &x, a) && !JS_ToFloat64(ctx, &y, b))
+      return x == y;
+
+    return 0;
+  }
+
+  switch(tag) {
+    case JS_TAG_INT: return JS_VALUE_GET_INT(a) == JS_VALUE_GET_INT(b);
+    case JS_TAG_BOOL: return !JS_VALUE_GET_BOOL(a) == !JS_VALUE_GET_BOOL(b);
+    case JS_TAG_NULL:
+    case JS_TAG_UNDEFINED: return 1;
+    case JS_TAG_FLOAT64: {
+      double x = JS_VALUE_GET_FLOAT64(a), y = JS_VALUE_GET_FLOAT64(b);
+
+      return x == y || (isnan(x) && isnan(y));
+    }
+    case JS_TAG_STRING: return deep_string_equals(a, b);
+    case JS_TAG_SYMBOL: return JS_VALUE_GET_PTR(a) == JS_VALUE_GET_PTR(b);
+    case JS_TAG_OBJECT: return deep_equals_object(ctx, a, b, stack, visited);
+    default: return js_value_equals(ctx, a, b);
+  }
+}
+
+/**
+ * Compares 'a' and 'b' structurally without recursion: atoms and values are
+ * compared as they are, objects of different classes or key counts differ
+ * right away and buffers are compared bytewise.
+ *
+ * Returns 1 when equal, 0 when not and -1 on exception.
+ */
+static int
+deep_equals(JSContext* ctx, JSValueConst a, JSValueConst b, DeepVisited* visited) {
+  Vector stack = VECTOR(ctx);
+  DeepPair pair = {JS_DupValue(ctx, a), JS_DupValue(ctx, b)}, *ptr;
+  int ret = 1;
+
+  if(!deep_push(&stack, pair.a, pair.b)) {
+    JS_FreeValue(ctx, pair.a);
+    JS_FreeValue(ctx, pair.b);
+    return -1;
+  }
+
+  while(ret == 1 && !vector_empty(&stack)) {
+    pair = *(DeepPair*)vector_back(&stack, sizeof(DeepPair));
+    vector_pop(&stack, sizeof(DeepPair));
+
+    ret = deep_equals_step(ctx, pair.a, pair.b, &stack, visited);
+
+    JS_FreeValue(ctx, pair.a);
+    JS_FreeValue(ctx, pair.b);
+  }
+
+  vector_foreach_t(&stack, ptr) {
+    JS_FreeValue(ctx, ptr->a);
+    JS_FreeValue(ctx, ptr->b);
+  }
+
+  vector_free(&stack);
+  return ret;
+}
+
+static JSValue
+js_deep_equals(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  DeepVisited visited = {0, 0, 0};
+  int ret = deep_equals(ctx, argv[0], argv[1], &visited);
+
+  deep_visited_free(ctx, &visited);
+  return ret < 0 ? JS_EXCEPTION : JS_NewBool(ctx, ret);
+}
+
+/* 64-bit FNV-1a, or the 128-bit variant with the hash in 'hi' and 'lo' */
+typedef struct {
+  uint64_t lo, hi;
+} DeepHash;
+
+enum {
+  HASH_UNDEFINED = 1,
+  HASH_NULL,
+  HASH_BOOL,
+  HASH_NUMBER,
+  HASH_NAN,
+  HASH_STRING,
+  HASH_SYMBOL,
+  HASH_BIGNUM,
+  HASH_FUNCTION,
+  HASH_BYTES,
+  HASH_OBJECT,
+  HASH_CYCLE,
+  HASH_TRUNCATED,
+};
+
+typedef struct {
+  int bits;
+  BOOL unordered;
+  int32_t max_depth;
+  JSAtom* ignore;
+  uint32_t nignore;
+  JSValue cache, cache_get, cache_set;
+  uint32_t fingerprint; /* of the options above, cached hashes are only valid for equal ones */
+} DeepHashOptions;
+
+/* the state of an object being hashed, parallel to its PropertyEnumeration */
+typedef struct {
+  DeepHash hash, sum; /* ordered entries are hashed in, unordered ones summed */
+  DeepHash key;       /* hash of the key in the parent */
+  JSValue owner;      /* differs from the enumerated object for Map and Set */
+  uint32_t count;
+  int32_t back; /* lowest frame a cycle out of this subtree leads to */
+  BOOL keyless, unordered, truncated;
+} DeepHashFrame;
+
+static BOOL
+deep_hash_ignored(const DeepHashOptions* opts, JSAtom atom) {
+  uint32_t i;
+
+  for(i = 0; i < opts->nignore; i++)
+    if(opts->ignore[i] == atom)
+      return TRUE;
+
+  return FALSE;
+}
+
+static inline DeepHash
+deep_hash_basis(int bits) {
+  return bits == 128 ? (DeepHash){0x62b821756295c58dULL, 0x6c62272e07bb0142ULL} : (DeepHash){0xcbf29ce484222325ULL, 0};
+}
+
+static inline void
+deep_hash_unit(DeepHash* h, int bits, uint32_t unit) {
+  h->lo ^= unit;
+
+  if(bits == 128) {
+    /* multiply by 2^88 + 0x13b */
+    uint64_t l0 = (h->lo & 0xffffffff) * 0x13b, l1 = (h->lo >> 32) * 0x13b, lo = l0 + (l1 << 32);
+
+    h->hi = h->hi * 0x13b + (l1 >> 32) + (lo < l0) + (h->lo << 24);
+    h->lo = lo;
+  } else {
+    h->lo *= 0x100000001b3ULL;
+  }
+}
+
+static void
+deep_hash_bytes(DeepHash* h, int bits, const uint8_t* s, size_t n) {
+  size_t i;
+
+  for(i = 0; i < n; i++) deep_hash_unit(h, bits, s[i]);
+}
+
+static void
+deep_hash_u64(DeepHash* h, int bits, uint64_t x) {
+  int i;
+
+  for(i = 0; i < 64; i += 8) deep_hash_unit(h, bits, (x >> i) & 0xff);
+}
+
+static void
+deep_hash_hash(DeepHash* h, int bits, const DeepHash* x) {
+  deep_hash_u64(h, bits, x->lo);
+
+  if(bits == 128)
+    deep_hash_u64(h, bits, x->hi);
+}
+
+/* by code unit, so that 8-bit and wide strings of the same content agree */
+static void
+deep_hash_string(DeepHash* h, int bits, JSValueConst str) {
+  JSString* p = JS_VALUE_GET_PTR(str);
+  uint32_t i;
+
+  for(i = 0; i < p->len; i++) deep_hash_unit(h, bits, p->is_wide_char ? p->u.str16[i] : p->u.str8[i]);
+
+  deep_hash_unit(h, bits, 0x10000);
+}
+
+static DeepHash
+deep_hash_leaf(JSContext* ctx, JSValueConst value, int bits) {
+  DeepHash h = deep_hash_basis(bits);
+  double d;
+
+  switch(JS_VALUE_GET_NORM_TAG(value)) {
+    case JS_TAG_UNDEFINED: deep_hash_unit(&h, bits, HASH_UNDEFINED); break;
+    case JS_TAG_NULL: deep_hash_unit(&h, bits, HASH_NULL); break;
+    case JS_TAG_BOOL: {
+      deep_hash_unit(&h, bits, HASH_BOOL);
+      deep_hash_unit(&h, bits, JS_VALUE_GET_BOOL(value) != 0);
+      break;
+    }
+
+    case JS_TAG_INT:
+    case JS_TAG_FLOAT64: {
+      uint64_t u;
+
+      /* 1 and 1.0, 0 and -0 hash alike, as deep.equals() considers them equal */
+      JS_ToFloat64(ctx, &d, value);
+
+      if(isnan(d)) {
+        deep_hash_unit(&h, bits, HASH_NAN);
+        break;
+      }
+
+      if(d == 0)
+        d = 0;
+
+      memcpy(&u, &d, sizeof(u));
+      deep_hash_unit(&h, bits, HASH_NUMBER);
+      deep_hash_u64(&h, bits, u);
+      break;
+    }
+
+    case JS_TAG_STRING: {
+      deep_hash_unit(&h, bits, HASH_STRING);
+      deep_hash_string(&h, bits, value);
+      break;
+    }
+
+    case JS_TAG_SYMBOL: {
+      JSAtom atom = JS_ValueToAtom(ctx, value);
+      JSValue desc = JS_AtomToString(ctx, atom);
+
+      deep_hash_unit(&h, bits, HASH_SYMBOL);
+
+      if(JS_IsString(desc))
+        deep_hash_string(&h, bits, desc);
+
+      JS_FreeValue(ctx, desc);
+      JS_FreeAtom(ctx, atom);
+      break;
+    }
+
+    default: {
+      JSValue str = JS_ToString(ctx, value);
+
+      deep_hash_unit(&h, bits, HASH_BIGNUM);
+
+      if(JS_IsString(str))
+        deep_hash_string(&h, bits, str);
+
+      JS_FreeValue(ctx, str);
+      break;
+    }
+  }
+
+  return h;
+}
+
+static DeepHash
+deep_hash_atom(JSContext* ctx, JSAtom atom, int bits) {
+  JSValue key = JS_AtomToValue(ctx, atom);
+  DeepHash h = deep_hash_leaf(ctx, key, bits);
+
+  JS_FreeValue(ctx, key);
+  return h;
+}
+
+static inline DeepHash
+deep_hash_tag(int bits, int tag, uint32_t arg) {
+  DeepHash h = deep_hash_basis(bits);
+
+  deep_hash_unit(&h, bits, tag);
+  deep_hash_u64(&h, bits, arg);
+  return h;
+}
+
+static JSValue
+deep_hash_tostring(JSContext* ctx, const DeepHash* h, int bits) {
+  char buf[33];
+
+  if(bits == 128)
+    snprintf(buf, sizeof(buf), "%016" PRIx64 "%016" PRIx64, h->hi, h->lo);
+  else
+    snprintf(buf, sizeof(buf), "%016" PRIx64, h->lo);
+
+  return JS_NewString(ctx, buf);
+}
+
+/* cache entries are the options fingerprint and the hash, "fingerprint:hash" */
+static JSValue
+deep_hash_cache_entry(JSContext* ctx, const DeepHash* h, const DeepHashOptions* opts) {
+  char buf[8 + 1 + 32 + 1];
+
+  if(opts->bits == 128)
+    snprintf(buf, sizeof(buf), "%08" PRIx32 ":%016" PRIx64 "%016" PRIx64, opts->fingerprint, h->hi, h->lo);
+  else
+    snprintf(buf, sizeof(buf), "%08" PRIx32 ":%016" PRIx64, opts->fingerprint, h->lo);
+
+  return JS_NewString(ctx, buf);
+}
+
+/* FALSE for anything but an entry made with the same options */
+static BOOL
+deep_hash_cache_lookup(JSContext* ctx, JSValueConst value, DeepHash* h, const DeepHashOptions* opts) {
+  char buf[17] = {0};
+  const char* str;
+  size_t len;
+  BOOL ret;
+
+  if(!JS_IsString(value) || !(str = JS_ToCStringLen(ctx, &len, value)))
+    return FALSE;
+
+  snprintf(buf, sizeof(buf), "%08" PRIx32 ":", opts->fingerprint);
+
+  if((ret = len == 9 + (size_t)opts->bits / 4 && !memcmp(str, buf, 9))) {
+    if(opts->bits == 128) {
+      memcpy(buf, str + 9, 16);
+      h->hi = strtoull(buf, 0, 16);
+    }
+
+    h->lo = strtoull(str + len - 16, 0, 16);
+  }
+
+  JS_FreeCString(ctx, str);
+  return ret;
+}
+
+/* FNV-1a of everything but the cache which changes the hash of a subtree that is hashed to the end */
+static uint32_t
+deep_hash_fingerprint(JSContext* ctx, const DeepHashOptions* opts) {
+  uint32_t i, h = 2166136261;
+  const uint8_t* p;
+  const char* str;
+
+  h = (h ^ opts->bits) * 16777619;
+  h = (h ^ opts->unordered) * 16777619;
+
+  for(i = 0; i < opts->nignore; i++) {
+    if((str = JS_AtomToCString(ctx, opts->ignore[i]))) {
+      for(p = (const uint8_t*)str; *p; p++) h = (h ^ *p) * 16777619;
+
+      JS_FreeCString(ctx, str);
+    }
+
+    h *= 16777619; /* the end of a key */
+  }
+
+  return h;
+}
+
+/* class ids of user classes depend on the order they were registered in */
+static inline uint32_t
+deep_hash_class(JSObject* p) {
+  return p->class_id < JS_CLASS_INIT_COUNT ? p->class_id : JS_CLASS_OBJECT;
+}
+
+/* an array of the members of a Set, or of [key, value] pairs of a Map */
+static JSValue
+deep_hash_entries(JSContext* ctx, JSObject* p) {
+  JSValue ret = JS_NewArray(ctx);
+  struct list_head* el;
+  uint32_t i = 0;
+
+  list_for_each(el, &p->u.map_state->records) {
+    JSMapRecord* mr = list_entry(el, JSMapRecord, link);
+
+    if(mr->empty)
+      continue;
+
+    if(p->class_id == JS_CLASS_SET) {
+      JS_SetPropertyUint32(ctx, ret, i++, JS_DupValue(ctx, mr->key));
+    } else {
+      JSValue pair = JS_NewArray(ctx);
+
+      JS_SetPropertyUint32(ctx, pair, 0, JS_DupValue(ctx, mr->key));
+      JS_SetPropertyUint32(ctx, pair, 1, JS_DupValue(ctx, mr->value));
+      JS_SetPropertyUint32(ctx, ret, i++, pair);
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * Hashes 'value' into 'h' and returns 0, or pushes a frame for it and
+ * returns 1.  Consumes 'value'.
+ */
+static int
+deep_hash_enter(JSContext* ctx, Vector* enums, Vector* frames, JSValue value, DeepHash key, const DeepHashOptions* opts, DeepHash* h) {
+  int32_t i, depth = vector_size(frames, sizeof(DeepHashFrame));
+  DeepHashFrame* frame = depth ? vector_back(frames, sizeof(DeepHashFrame)) : 0;
+  JSValue target;
+  JSObject* p;
+  int ret = 0;
+
+  if(!JS_IsObject(value)) {
+    *h = deep_hash_leaf(ctx, value, opts->bits);
+    JS_FreeValue(ctx, value);
+    return 0;
+  }
+
+  p = JS_VALUE_GET_OBJ(value);
+
+  /* a reference back to an object on the way */
+  for(i = depth; i-- > 0;) {
+    if(JS_VALUE_GET_OBJ(((DeepHashFrame*)vector_at(frames, sizeof(DeepHashFrame), i))->owner) == p) {
+      *h = deep_hash_tag(opts->bits, HASH_CYCLE, depth - i);
+      frame->back = MIN_NUM(frame->back, i);
+      goto done;
+    }
+  }
+
+  if(js_is_typedarray(value) || p->class_id == JS_CLASS_DATAVIEW || p->class_id == JS_CLASS_ARRAY_BUFFER || p->class_id == JS_CLASS_SHARED_ARRAY_BUFFER) {
+    const uint8_t* bytes;
+    size_t len;
+
+    *h = deep_hash_tag(opts->bits, HASH_BYTES, p->class_id);
+
+    if((bytes = deep_bytes(p, &len)))
+      deep_hash_bytes(h, opts->bits, bytes, len);
+
+    goto done;
+  }
+
+  if(JS_IsFunction(ctx, value)) {
+    *h = deep_hash_tag(opts->bits, HASH_FUNCTION, 0);
+    goto done;
+  }
+
+  if(depth >= opts->max_depth) {
+    *h = deep_hash_tag(opts->bits, HASH_TRUNCATED, deep_hash_class(p));
+
+    if(frame)
+      frame->truncated = TRUE;
+    goto done;
+  }
+
+  if(JS_IsObject(opts->cache)) {
+    JSValue cached = JS_Call(ctx, opts->cache_get, opts->cache, 1, &value);
+
+    if(JS_IsException(cached)) {
+      ret = -1;
+      goto done;
+    }
+
+    ret = deep_hash_cache_lookup(ctx, cached, h, opts);
+    JS_FreeValue(ctx, cached);
+
+    if(ret) {
+      ret = 0;
+      goto done;
+    }
+  }
+
+  target = p->class_id == JS_CLASS_MAP || p->class_id == JS_CLASS_SET ? deep_hash_entries(ctx, p) : JS_DupValue(ctx, value);
+
+  if(!(frame = vector_emplace(frames, sizeof(DeepHashFrame)))) {
+    JS_FreeValue(ctx, target);
+    ret = -1;
+    goto done;
+  }
+
+  if(!property_enumeration_push(enums, ctx, target, PROPENUM_DEFAULT_FLAGS)) {
+    vector_pop(frames, sizeof(DeepHashFrame));
+    JS_FreeValue(ctx, target);
+    ret = -1;
+    goto done;
+  }
+
+  frame->hash = deep_hash_tag(opts->bits, HASH_OBJECT, deep_hash_class(p));
+  frame->sum = (DeepHash){0, 0};
+  frame->key = key;
+  frame->owner = value;
+  frame->count = 0;
+  frame->back = INT32_MAX;
+  frame->keyless = !js_object_same(target, value);
+  frame->unordered = opts->unordered || frame->keyless;
+  frame->truncated = FALSE;
+
+  switch(p->class_id) {
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE: {
+      DeepHash data = deep_hash_leaf(ctx, p->u.object_data, opts->bits);
+
+      deep_hash_hash(&frame->hash, opts->bits, &data);
+      break;
+    }
+
+    case JS_CLASS_REGEXP: {
+      deep_hash_string(&frame->hash, opts->bits, JS_MKPTR(JS_TAG_STRING, p->u.regexp.pattern));
+      break;
+    }
+  }
+
+  return 1;
+
+done:
+  JS_FreeValue(ctx, value);
+  return ret;
+}
+
+static void
+deep_hash_add(DeepHashFrame* frame, const DeepHash* key, const DeepHash* h, int bits) {
+  frame->count++;
+
+  if(frame->unordered) {
+    DeepHash entry = deep_hash_basis(bits);
+
+    deep_hash_hash(&entry, bits, key);
+    deep_hash_hash(&entry, bits, h);
+
+    frame->sum.hi += entry.hi + (frame->sum.lo + entry.lo < entry.lo);
+    frame->sum.lo += entry.lo;
+  } else {
+    deep_hash_hash(&frame->hash, bits, key);
+    deep_hash_hash(&frame->hash, bits, h);
+  }
+}
+
+/* finishes the top frame, stores its hash in 'h' and its key in 'key' */
+static int
+deep_hash_leave(JSContext* ctx, Vector* enums, Vector* frames, const DeepHashOptions* opts, DeepHash* h, DeepHash* key) {
+  int32_t index = vector_size(frames, sizeof(DeepHashFrame)) - 1;
+  DeepHashFrame* frame = vector_back(frames, sizeof(DeepHashFrame));
+  int ret = 0;
+
+  *h = frame->hash;
+  *key = frame->key;
+
+  if(frame->unordered)
+    deep_hash_hash(h, opts->bits, &frame->sum);
+
+  deep_hash_u64(h, opts->bits, frame->count);
+
+  /* subtrees which are cut off or lead out of themselves hash differently elsewhere */
+  if(JS_IsObject(opts->cache) && frame->back >= index && !frame->truncated) {
+    JSValue args[2] = {frame->owner, deep_hash_cache_entry(ctx, h, opts)};
+    JSValue result = JS_Call(ctx, opts->cache_set, opts->cache, 2, args);
+
+    if(JS_IsException(result))
+      ret = -1;
+
+    JS_FreeValue(ctx, result);
+    JS_FreeValue(ctx, args[1]);
+  }
+
+  if(index > 0) {
+    DeepHashFrame* parent = frame - 1;
+
+    if(frame->back < index - 1)
+      parent->back = MIN_NUM(parent->back, frame->back);
+
+    parent->truncated |= frame->truncated;
+  }
+
+  JS_FreeValue(ctx, frame->owner);
+  vector_pop(frames, sizeof(DeepHashFrame));
+  property_enumeration_pop(enums, ctx);
+  return ret;
+}
+
+/**
+ * Computes a structural fingerprint of 'value', walking it with
+ * PropertyEnumeration frames.  Each object hashes its class and its
+ * entries, in order or, when unordered, as a sum which doesn't depend on
+ * the order of the keys.
+ */
+static int
+deep_hash(JSContext* ctx, JSValueConst value, const DeepHashOptions* opts, DeepHash* out) {
+  Vector enums = VECTOR(ctx), frames = VECTOR(ctx);
+  DeepHash h, key = {0, 0};
+  DeepHashFrame* frame;
+  int r;
+
+  for(r = deep_hash_enter(ctx, &enums, &frames, JS_DupValue(ctx, value), key, opts, &h); r >= 0;) {
+    PropertyEnumeration* it;
+
+    if(r == 0) {
+      if(vector_empty(&frames)) {
+        *out = h;
+        break;
+      }
+
+      deep_hash_add(vector_back(&frames, sizeof(DeepHashFrame)), &key, &h, opts->bits);
+    }
+
+    frame = vector_back(&frames, sizeof(DeepHashFrame));
+    it = vector_back(&enums, sizeof(PropertyEnumeration));
+
+    if(!frame->keyless)
+      while(it->idx < it->tab_atom_len && deep_hash_ignored(opts, it->tab_atom[it->idx].atom)) it->idx++;
+
+    if(it->idx < it->tab_atom_len) {
+      JSAtom atom = it->tab_atom[it->idx++].atom;
+      JSValue child = JS_GetProperty(ctx, it->obj, atom);
+
+      if(JS_IsException(child)) {
+        r = -1;
+        break;
+      }
+
+      key = frame->keyless ? (DeepHash){0, 0} : deep_hash_atom(ctx, atom, opts->bits);
+      r = deep_hash_enter(ctx, &enums, &frames, child, key, opts, &h);
+    } else {
+      r = deep_hash_leave(ctx, &enums, &frames, opts, &h, &key);
+    }
+  }
+
+  vector_foreach_t(&frames, frame) JS_FreeValue(ctx, frame->owner);
+  vector_free(&frames);
+  property_enumeration_free(&enums, JS_GetRuntime(ctx));
+  return r < 0 ? -1 : 0;
+}
+
+/**
+ * deep.hash(value, { algorithm, unordered, ignoreKeys, maxDepth, cache })
+ * returns a structural hash of 'value' as a hex string.  A WeakMap given as
+ * 'cache' keeps the hashes of subtrees for later calls; its entries are
+ * tagged with the options they were computed with and ignored under other
+ * ones.  The caller must delete the entries of objects it mutates, and of
+ * their ancestors.
+ */
+static JSValue
+js_deep_hash(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  DeepHashOptions opts = {64, FALSE, INT32_MAX, 0, 0, JS_UNDEFINED, JS_UNDEFINED, JS_UNDEFINED, 0};
+  JSValue ret = JS_EXCEPTION;
+  DeepHash h;
+  uint32_t i;
+
+  if(argc > 1 && JS_IsObject(argv[1])) {
+    JSValue algorithm = JS_GetPropertyStr(ctx, argv[1], "algorithm"), ignore = JS_GetPropertyStr(ctx, argv[1], "ignoreKeys"),
+            depth = JS_GetPropertyStr(ctx, argv[1], "maxDepth");
+
+    opts.unordered = js_get_propertystr_bool(ctx, argv[1], "unordered");
+
+    if(!JS_IsUndefined(algorithm)) {
+      const char* str = JS_ToCString(ctx, algorithm);
+
+      if(str && !strcmp(str, "fnv1a128"))
+        opts.bits = 128;
+      else if(!str || strcmp(str, "fnv1a64"))
+        opts.bits = 0;
+
+      JS_FreeCString(ctx, str);
+    }
+
+    if(!JS_IsUndefined(depth))
+      JS_ToInt32(ctx, &opts.max_depth, depth);
+
+    if(JS_IsArray(ctx, ignore) && (opts.nignore = js_array_length(ctx, ignore)) && (opts.ignore = js_mallocz(ctx, opts.nignore * sizeof(JSAtom)))) {
+      for(i = 0; i < opts.nignore; i++) {
+        JSValue name = JS_GetPropertyUint32(ctx, ignore, i);
+
+        opts.ignore[i] = JS_ValueToAtom(ctx, name);
+        JS_FreeValue(ctx, name);
+      }
+    } else {
+      opts.nignore = 0;
+    }
+
+    opts.cache = JS_GetPropertyStr(ctx, argv[1], "cache");
+
+    if(JS_IsObject(opts.cache)) {
+      opts.cache_get = JS_GetPropertyStr(ctx, opts.cache, "get");
+      opts.cache_set = JS_GetPropertyStr(ctx, opts.cache, "set");
+      opts.fingerprint = deep_hash_fingerprint(ctx, &opts);
+    }
+
+    JS_FreeValue(ctx, algorithm);
+    JS_FreeValue(ctx, ignore);
+    JS_FreeValue(ctx, depth);
+  }
+
+  if(opts.bits == 0)
+    JS_ThrowRangeError(ctx, "deep.hash(): algorithm must be 'fnv1a64' or 'fnv1a128'");
+  else if(deep_hash(ctx, argv[0], &opts, &h) == 0)
+    ret = deep_hash_tostring(ctx, &h, opts.bits);
+
+  for(i = 0; i < opts.nignore; i++) JS_FreeAtom(ctx, opts.ignore[i]);
+
+  js_free(ctx, opts.ignore);
+  JS_FreeValue(ctx, opts.cache);
+  JS_FreeValue(ctx, opts.cache_get);
+  JS_FreeValue(ctx, opts.cache_set);
+  return ret;
+}
+
+static JSValue
+js_deep_iterate(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  return js_deep_iterator_constructor(ctx, deep_iterator_ctor, argc, argv);
+}
+
+/* the clones made so far by original, so that shared objects and cycles are kept */
+typedef struct {
+  struct DeepCloneEntry {
+    JSObject* src;
+    JSValue dst;
+  } * tab;
+  uint32_t size, count;
+} DeepCloneMap;
+
+typedef struct {
+  DeepCloneMap map;
+  Vector tasks; /* DeepPair of an original and its clone still to be filled in */
+  Vector transfer;
+  BOOL prototypes, transfer_all;
+} DeepClone;
+
+static struct DeepCloneEntry*
+deep_clone_lookup(DeepCloneMap* m, JSObject* src) {
+  uint32_t i, mask = m->size - 1;
+
+  if(m->size == 0)
+    return 0;
+
+  for(i = deep_visited_hash(src, 0) & mask; m->tab[i].src; i = (i + 1) & mask)
+    if(m->tab[i].src == src)
+      return &m->tab[i];
+
+  return 0;
+}
+
+static int
+deep_clone_insert(JSContext* ctx, DeepCloneMap* m, JSObject* src, JSValueConst dst) {
+  uint32_t i, j, mask;
+
+  if(m->count * 2 >= m->size) {
+    uint32_t size = m->size ? m->size * 2 : 64;
+    struct DeepCloneEntry* tab;
+
+    if(!(tab = js_mallocz(ctx, size * sizeof(struct DeepCloneEntry))))
+      return -1;
+
+    for(j = 0; j < m->size; j++) {
+      if(!m->tab[j].src)
+        continue;
+
+      for(i = deep_visited_hash(m->tab[j].src, 0) & (size - 1); tab[i].src; i = (i + 1) & (size - 1)) {}
+
+      tab[i] = m->tab[j];
+    }
+
+    js_free(ctx, m->tab);
+    m->tab = tab;
+    m->size = size;
+  }
+
+  mask = m->size - 1;
+
+  for(i = deep_visited_hash(src, 0) & mask; m->tab[i].src; i = (i + 1) & mask) {}
+
+  m->tab[i] = (struct DeepCloneEntry){src, JS_DupValue(ctx, dst)};
+  m->count++;
+  return 0;
+}
+
+static void
+deep_clone_nofree(JSRuntime* rt, void* opaque, void* ptr) {
+}
+
+/* moves the data of the ArrayBuffer 'p' into a new one and detaches 'p' */
+static JSValue
+deep_clone_transfer(JSContext* ctx, JSValueConst value) {
+  JSArrayBuffer* abuf = JS_VALUE_GET_OBJ(value)->u.array_buffer;
+  JSValue ret;
+
+  if(abuf->detached)
+    return JS_ThrowTypeError(ctx, "deep.clone(): ArrayBuffer is detached");
+
+  ret = JS_NewArrayBuffer(ctx, abuf->data, abuf->byte_length, abuf->free_func, abuf->opaque, FALSE);
+
+  if(!JS_IsException(ret)) {
+    abuf->free_func = deep_clone_nofree;
+    JS_DetachArrayBuffer(ctx, value);
+  }
+
+  return ret;
+}
+
+/* the length of a view in elements, which stays known after its buffer was detached */
+static uint32_t
+deep_clone_count(JSObject* p) {
+  JSTypedArray* ta = p->u.typed_array;
+
+  switch(p->class_id) {
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY: return ta->length >> 1;
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+    case JS_CLASS_FLOAT32_ARRAY: return ta->length >> 2;
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_INT64_ARRAY:
+    case JS_CLASS_BIG_UINT64_ARRAY:
+#endif
+    case JS_CLASS_FLOAT64_ARRAY: return ta->length >> 3;
+    default: return ta->length;
+  }
+}
+
+static JSValue deep_clone_value(JSContext*, DeepClone*, JSValueConst);
+
+/* the global constructor of a view, the one of the value may have been replaced */
+static const char*
+deep_clone_view_class(JSObject* p) {
+  switch(p->class_id) {
+    case JS_CLASS_UINT8C_ARRAY: return "Uint8ClampedArray";
+    case JS_CLASS_INT8_ARRAY: return "Int8Array";
+    case JS_CLASS_UINT8_ARRAY: return "Uint8Array";
+    case JS_CLASS_INT16_ARRAY: return "Int16Array";
+    case JS_CLASS_UINT16_ARRAY: return "Uint16Array";
+    case JS_CLASS_INT32_ARRAY: return "Int32Array";
+    case JS_CLASS_UINT32_ARRAY: return "Uint32Array";
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_INT64_ARRAY: return "BigInt64Array";
+    case JS_CLASS_BIG_UINT64_ARRAY: return "BigUint64Array";
+#endif
+    case JS_CLASS_FLOAT32_ARRAY: return "Float32Array";
+    case JS_CLASS_FLOAT64_ARRAY: return "Float64Array";
+    default: return "DataView";
+  }
+}
+
+/* an empty object of the class of 'value', or its contents for those which are not filled in later */
+static JSValue
+deep_clone_shell(JSContext* ctx, DeepClone* dc, JSValueConst value, BOOL* fill) {
+  JSObject* p = JS_VALUE_GET_OBJ(value);
+  JSValue ret, proto, args[3];
+  JSObject** ptr;
+
+  *fill = FALSE;
+
+  if(js_is_typedarray(value) || p->class_id == JS_CLASS_DATAVIEW) {
+    JSTypedArray* ta = p->u.typed_array;
+    JSValue buffer;
+
+    /* views of the same buffer share its clone */
+    buffer = deep_clone_value(ctx, dc, JS_MKPTR(JS_TAG_OBJECT, ta->buffer));
+
+    if(JS_IsException(buffer))
+      return buffer;
+
+    args[0] = buffer;
+    args[1] = JS_NewUint32(ctx, ta->offset);
+    args[2] = JS_NewUint32(ctx, deep_clone_count(p));
+
+    ret = js_object_new(ctx, deep_clone_view_class(p), 3, args);
+    JS_FreeValue(ctx, buffer);
+
+  } else {
+    switch(p->class_id) {
+      case JS_CLASS_ARRAY_BUFFER: {
+        JSArrayBuffer* abuf = p->u.array_buffer;
+        BOOL transfer = dc->transfer_all;
+
+        vector_foreach_t(&dc->transfer, ptr) if(*ptr == p) transfer = TRUE;
+
+        ret = transfer ? deep_clone_transfer(ctx, value) : JS_NewArrayBufferCopy(ctx, abuf->data, abuf->detached ? 0 : abuf->byte_length);
+        break;
+      }
+
+      /* the memory is shared, like structured clone does */
+      case JS_CLASS_SHARED_ARRAY_BUFFER: return JS_DupValue(ctx, value);
+
+      case JS_CLASS_NUMBER:
+      case JS_CLASS_STRING:
+      case JS_CLASS_BOOLEAN:
+      case JS_CLASS_DATE: {
+        static const char* const names[] = {"Number", "String", "Boolean", "Date"};
+        int index = p->class_id == JS_CLASS_NUMBER ? 0 : p->class_id == JS_CLASS_STRING ? 1 : p->class_id == JS_CLASS_BOOLEAN ? 2 : 3;
+
+        ret = js_object_new(ctx, names[index], 1, &p->u.object_data);
+        break;
+      }
+
+      case JS_CLASS_REGEXP: {
+        ret = js_object_new(ctx, "RegExp", 1, &value);
+        break;
+      }
+
+      case JS_CLASS_MAP:
+      case JS_CLASS_SET: {
+        *fill = TRUE;
+        ret = js_object_new(ctx, p->class_id == JS_CLASS_MAP ? "Map" : "Set", 0, 0);
+        break;
+      }
+
+      case JS_CLASS_ARRAY:
+      case JS_CLASS_ARGUMENTS: {
+        *fill = TRUE;
+        ret = JS_NewArray(ctx);
+        break;
+      }
+
+      default: {
+        *fill = TRUE;
+
+        if(!dc->prototypes)
+          return JS_NewObject(ctx);
+
+        proto = JS_GetPrototype(ctx, value);
+        ret = JS_NewObjectProto(ctx, proto);
+        JS_FreeValue(ctx, proto);
+        return ret;
+      }
+    }
+  }
+
+  /* instances of subclasses of the built-in classes too */
+  if(dc->prototypes && !JS_IsException(ret)) {
+    proto = JS_GetPrototype(ctx, value);
+    JS_SetPrototype(ctx, ret, proto);
+    JS_FreeValue(ctx, proto);
+  }
+
+  return ret;
+}
+
+/**
+ * Returns the clone of 'value'.  Objects not seen before get an empty
+ * clone which is filled in when the task queued for it is run.
+ */
+static JSValue
+deep_clone_value(JSContext* ctx, DeepClone* dc, JSValueConst value) {
+  struct DeepCloneEntry* entry;
+  JSObject* p;
+  JSValue ret;
+  BOOL fill;
+
+  if(!JS_IsObject(value) || JS_IsFunction(ctx, value))
+    return JS_DupValue(ctx, value);
+
+  p = JS_VALUE_GET_OBJ(value);
+
+  if((entry = deep_clone_lookup(&dc->map, p)))
+    return JS_DupValue(ctx, entry->dst);
+
+  ret = deep_clone_shell(ctx, dc, value, &fill);
+
+  if(JS_IsException(ret))
+    return ret;
+
+  if(deep_clone_insert(ctx, &dc->map, p, ret) || (fill && !deep_push(&dc->tasks, JS_DupValue(ctx, value), JS_DupValue(ctx, ret)))) {
+    JS_FreeValue(ctx, ret);
+    return JS_EXCEPTION;
+  }
+
+  return ret;
+}
+
+/* copies the entries or properties of 'src' into its clone 'dst' */
+static int
+deep_clone_fill(JSContext* ctx, DeepClone* dc, JSValueConst src, JSValueConst dst) {
+  JSObject* p = JS_VALUE_GET_OBJ(src);
+  JSPropertyEnum* tab;
+  uint32_t i, len;
+  int ret = 0;
+
+  if(p->class_id == JS_CLASS_MAP || p->class_id == JS_CLASS_SET) {
+    JSAtom method = JS_NewAtom(ctx, p->class_id == JS_CLASS_MAP ? "set" : "add");
+    struct list_head* el;
+
+    list_for_each(el, &p->u.map_state->records) {
+      JSMapRecord* mr = list_entry(el, JSMapRecord, link);
+      JSValue args[2], result;
+
+      if(mr->empty)
+        continue;
+
+      args[0] = deep_clone_value(ctx, dc, mr->key);
+      args[1] = p->class_id == JS_CLASS_MAP ? deep_clone_value(ctx, dc, mr->value) : JS_UNDEFINED;
+
+      result = JS_IsException(args[0]) || JS_IsException(args[1]) ? JS_EXCEPTION : JS_Invoke(ctx, dst, method, 2, args);
+
+      JS_FreeValue(ctx, args[0]);
+      JS_FreeValue(ctx, args[1]);
+
+      if(JS_IsException(result)) {
+        ret = -1;
+        break;
+      }
+
+      JS_FreeValue(ctx, result);
+    }
+
+    JS_FreeAtom(ctx, method);
+    return ret;
+  }
+
+  if((p->class_id == JS_CLASS_ARRAY || p->class_id == JS_CLASS_ARGUMENTS) && p->fast_array) {
+    for(i = 0; i < p->u.array.count; i++) {
+      JSValue value = deep_clone_value(ctx, dc, p->u.array.u.values[i]);
+
+      if(JS_IsException(value) || JS_DefinePropertyValueUint32(ctx, dst, i, value, JS_PROP_C_W_E) < 0)
+        return -1;
+    }
+
+    return 0;
+  }
+
+  if(JS_GetOwnPropertyNames(ctx, &tab, &len, src, JS_GPN_STRING_MASK | JS_GPN_SYMBOL_MASK | JS_GPN_ENUM_ONLY))
+    return -1;
+
+  for(i = 0; i < len; i++) {
+    JSValue value = JS_GetProperty(ctx, src, tab[i].atom), clone;
+
+    clone = JS_IsException(value) ? JS_EXCEPTION : deep_clone_value(ctx, dc, value);
+    JS_FreeValue(ctx, value);
+
+    if(JS_IsException(clone) || JS_DefinePropertyValue(ctx, dst, tab[i].atom, clone, JS_PROP_C_W_E) < 0) {
+      ret = -1;
+      break;
+    }
+  }
+
+  /* trailing holes */
+  if(ret == 0 && p->class_id == JS_CLASS_ARRAY)
+    ret = JS_SetPropertyStr(ctx, dst, "length", JS_NewInt64(ctx, js_array_length(ctx, src))) < 0 ? -1 : 0;
+
+  js_propertyenums_free(ctx, tab, len);
+  js_free(ctx, tab);
+  return ret;
+}
+
+static JSValue
+js_deep_clone(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  DeepClone dc = {{0, 0, 0}, VECTOR(ctx), VECTOR(ctx), FALSE, FALSE};
+  DeepPair task, *ptr;
+  JSValue ret;
+  uint32_t i;
+
+  if(argc > 1 && JS_IsObject(argv[1])) {
+    JSValue transfer = JS_GetPropertyStr(ctx, argv[1], "transfer");
+
+    dc.prototypes = js_get_propertystr_bool(ctx, argv[1], "prototypes");
+
+    if(JS_IsArray(ctx, transfer)) {
+      int64_t n = js_array_length(ctx, transfer);
+
+      for(i = 0; i < n; i++) {
+        JSValue buffer = JS_GetPropertyUint32(ctx, transfer, i);
+
+        if(JS_IsObject(buffer)) {
+          JSObject* obj = JS_VALUE_GET_OBJ(buffer);
+
+          vector_push(&dc.transfer, obj);
+        }
+
+        JS_FreeValue(ctx, buffer);
+      }
+    } else {
+      dc.transfer_all = JS_ToBool(ctx, transfer);
+    }
+
+    JS_FreeValue(ctx, transfer);
+  }
+
+  ret = deep_clone_value(ctx, &dc, argv[0]);
+
+  while(!JS_IsException(ret) && !vector_empty(&dc.tasks)) {
+    task = *(DeepPair*)vector_back(&dc.tasks, sizeof(DeepPair));
+    vector_pop(&dc.tasks, sizeof(DeepPair));
+
+    if(deep_clone_fill(ctx, &dc, task.a, task.b) < 0) {
+      JS_FreeValue(ctx, ret);
+      ret = JS_EXCEPTION;
+    }
+
+    JS_FreeValue(ctx, task.a);
+    JS_FreeValue(ctx, task.b);
+  }
+
+  vector_foreach_t(&dc.tasks, ptr) {
+    JS_FreeValue(ctx, ptr->a);
+    JS_FreeValue(ctx, ptr->b);
+  }
+
+  for(i = 0; i < dc.map.size; i++)
+    if(dc.map.tab[i].src)
+      JS_FreeValue(ctx, dc.map.tab[i].dst);
+
+  js_free(ctx, dc.map.tab);
+  vector_free(&dc.tasks);
+  vector_free(&dc.transfer);
+  return ret;
+}
+
+/* the operations of a change list, as in JSON Patch */
+enum {
+  DIFF_ADD = 0,
+  DIFF_REMOVE,
+  DIFF_REPLACE,
+  DIFF_MOVE,
+};
+
+static const char* const deep_diff_ops[] = {"add", "remove", "replace", "move"};
+
+/* arrays with more than this many cells of LCS table left after trimming are compared by position */
+#define DEEP_DIFF_LCS_MAX (1 << 22)
+
+/* how an element of the new array was matched */
+enum {
+  DIFF_KEPT = 1,
+  DIFF_PAIRED = 2,
+};
+
+/* a task without a path marks the end of the pair's subtree */
+typedef struct {
+  JSValue a, b;
+  Pointer* path;
+} DeepDiffTask;
+
+typedef struct {
+  JSValue changes;
+  uint32_t count;
+  Vector tasks;
+  DeepVisited visited; /* the pairs being descended into, to stop at cycles */
+} DeepDiff;
+
+static JSValue
+deep_diff_pointer(JSContext* ctx, Pointer* path) {
+  Pointer* ptr;
+
+  if(!(ptr = pointer_clone(path, ctx)))
+    return JS_ThrowOutOfMemory(ctx);
+
+  return js_pointer_wrap(ctx, ptr);
+}
+
+static Pointer*
+deep_diff_child(JSContext* ctx, Pointer* path, JSAtom atom) {
+  Pointer* ptr;
+
+  if((ptr = pointer_clone(path, ctx)))
+    pointer_pushatom(ptr, ctx, JS_DupAtom(ctx, atom));
+
+  return ptr;
+}
+
+static Pointer*
+deep_diff_index(JSContext* ctx, Pointer* path, uint32_t index) {
+  Pointer* ptr;
+
+  if((ptr = pointer_clone(path, ctx)))
+    pointer_pushatom(ptr, ctx, JS_NewAtomUInt32(ctx, index));
+
+  return ptr;
+}
+
+/* appends { op, path, value } or, for moves, { op, from, path } */
+static int
+deep_diff_emit(JSContext* ctx, DeepDiff* dd, int op, Pointer* path, Pointer* from, JSValueConst value) {
+  JSValue change = JS_NewObject(ctx);
+
+  if(JS_IsException(change))
+    return -1;
+
+  JS_SetPropertyStr(ctx, change, "op", JS_NewString(ctx, deep_diff_ops[op]));
+
+  if(from)
+    JS_SetPropertyStr(ctx, change, "from", deep_diff_pointer(ctx, from));
+
+  JS_SetPropertyStr(ctx, change, "path", deep_diff_pointer(ctx, path));
+
+  if(op == DIFF_ADD || op == DIFF_REPLACE)
+    JS_SetPropertyStr(ctx, change, "value", JS_DupValue(ctx, value));
+
+  return JS_SetPropertyUint32(ctx, dd->changes, dd->count++, change) < 0 ? -1 : 0;
+}
+
+static int
+deep_diff_emit_index(JSContext* ctx, DeepDiff* dd, int op, Pointer* path, uint32_t index, JSValueConst value) {
+  Pointer* ptr;
+  int ret;
+
+  if(!(ptr = deep_diff_index(ctx, path, index)))
+    return -1;
+
+  ret = deep_diff_emit(ctx, dd, op, ptr, 0, value);
+  pointer_free(ptr, ctx);
+  return ret;
+}
+
+/* takes ownership of 'a', 'b' and 'path' */
+static BOOL
+deep_diff_push(JSContext* ctx, DeepDiff* dd, JSValue a, JSValue b, Pointer* path) {
+  DeepDiffTask* task;
+
+  if(!path || !(task = vector_emplace(&dd->tasks, sizeof(DeepDiffTask)))) {
+    JS_FreeValue(ctx, a);
+    JS_FreeValue(ctx, b);
+
+    if(path)
+      pointer_free(path, ctx);
+
+    return FALSE;
+  }
+
+  task->a = a;
+  task->b = b;
+  task->path = path;
+  return TRUE;
+}
+
+/*
+ * returns 1 when the pair is being descended into already, which is a
+ * cycle.  Otherwise marks it and queues the end of its subtree ahead of
+ * the children, so that a pair shared by several paths is diffed at each.
+ */
+static int
+deep_diff_enter(JSContext* ctx, DeepDiff* dd, JSValueConst a, JSValueConst b) {
+  DeepDiffTask* task;
+  int r;
+
+  if((r = deep_visited_add(ctx, &dd->visited, JS_VALUE_GET_OBJ(a), JS_VALUE_GET_OBJ(b))))
+    return r;
+
+  if(!(task = vector_emplace(&dd->tasks, sizeof(DeepDiffTask)))) {
+    deep_visited_remove(&dd->visited, JS_VALUE_GET_OBJ(a), JS_VALUE_GET_OBJ(b));
+    return -1;
+  }
+
+  task->a = JS_DupValue(ctx, a);
+  task->b = JS_DupValue(ctx, b);
+  task->path = 0;
+  return 0;
+}
+
+static int
+deep_diff_equals(JSContext* ctx, JSValueConst a, JSValueConst b) {
+  DeepVisited visited = {0, 0, 0};
+  int ret = deep_equals(ctx, a, b, &visited);
+
+  deep_visited_free(ctx, &visited);
+  return ret;
+}
+
+/* keys only in 'a' are removed, keys only in 'b' added and common keys compared in turn */
+static int
+deep_diff_object(JSContext* ctx, DeepDiff* dd, JSValueConst a, JSValueConst b, Pointer* path) {
+  JSPropertyEnum *tab_a = 0, *tab_b = 0;
+  uint32_t i, len_a = 0, len_b = 0;
+  int r, ret = -1;
+
+  if(JS_GetOwnPropertyNames(ctx, &tab_a, &len_a, a, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) ||
+     JS_GetOwnPropertyNames(ctx, &tab_b, &len_b, b, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+    goto fail;
+
+  for(i = 0; i < len_a; i++) {
+    JSAtom atom = tab_a[i].atom;
+
+    if((r = JS_GetOwnProperty(ctx, 0, b, atom)) < 0)
+      goto fail;
+
+    if(r == 0) {
+      Pointer* ptr;
+
+      if(!(ptr = deep_diff_child(ctx, path, atom)))
+        goto fail;
+
+      r = deep_diff_emit(ctx, dd, DIFF_REMOVE, ptr, 0, JS_UNDEFINED);
+      pointer_free(ptr, ctx);
+
+      if(r < 0)
+        goto fail;
+
+    } else {
+      JSValue va = JS_GetProperty(ctx, a, atom), vb = JS_GetProperty(ctx, b, atom);
+
+      if(!deep_diff_push(ctx, dd, va, vb, deep_diff_child(ctx, path, atom)))
+        goto fail;
+    }
+  }
+
+  for(i = 0; i < len_b; i++) {
+    JSAtom atom = tab_b[i].atom;
+
+    if((r = JS_GetOwnProperty(ctx, 0, a, atom)) < 0)
+      goto fail;
+
+    if(r == 0) {
+      JSValue vb = JS_GetProperty(ctx, b, atom);
+      Pointer* ptr;
+
+      if(!(ptr = deep_diff_child(ctx, path, atom))) {
+        JS_FreeValue(ctx, vb);
+        goto fail;
+      }
+
+      r = deep_diff_emit(ctx, dd, DIFF_ADD, ptr, 0, vb);
+      pointer_free(ptr, ctx);
+      JS_FreeValue(ctx, vb);
+
+      if(r < 0)
+        goto fail;
+    }
+  }
+
+  ret = 0;
+
+fail:
+  if(tab_a) {
+    js_propertyenums_free(ctx, tab_a, len_a);
+    js_free(ctx, tab_a);
+  }
+
+  if(tab_b) {
+    js_propertyenums_free(ctx, tab_b, len_b);
+    js_free(ctx, tab_b);
+  }
+
+  return ret;
+}
+
+static JSValue*
+deep_diff_elements(JSContext* ctx, JSValueConst array, uint32_t len) {
+  JSValue* values;
+  uint32_t i;
+
+  if(!(values = js_malloc(ctx, sizeof(JSValue) * (len + 1))))
+    return 0;
+
+  for(i = 0; i < len; i++) values[i] = JS_GetPropertyUint32(ctx, array, i);
+
+  return values;
+}
+
+static void
+deep_diff_elements_free(JSContext* ctx, JSValue* values, uint32_t len) {
+  uint32_t i;
+
+  if(values) {
+    for(i = 0; i < len; i++) JS_FreeValue(ctx, values[i]);
+
+    js_free(ctx, values);
+  }
+}
+
+/*
+ * Matches the elements of 'a' to those of 'b' by their deep.hash()
+ * fingerprints:
+ *
+ *   - a longest common subsequence stays in place;
+ *   - equal elements outside of it become moves;
+ *   - the elements left over between two kept ones are compared pairwise;
+ *   - whatever still remains is removed from 'a' or added from 'b'.
+ *
+ * The changes are emitted in order of application, removals first.  The
+ * elements compared pairwise are queued with their final index, which
+ * none of the later changes on this array shift.
+ */
+static int
+deep_diff_array(JSContext* ctx, DeepDiff* dd, JSValueConst a, JSValueConst b, Pointer* path) {
+  DeepHashOptions opts = {64, FALSE, INT32_MAX, 0, 0, JS_UNDEFINED, JS_UNDEFINED, JS_UNDEFINED, 0};
+  uint32_t n = js_array_length(ctx, a), m = js_array_length(ctx, b), p = 0, s = 0, na, nb, i, j, k, len;
+  JSValue *va = 0, *vb = 0;
+  DeepHash *ha = 0, *hb = 0;
+  uint32_t *lcs = 0, *cur = 0;
+  int32_t *src = 0, *dst = 0;
+  uint8_t* flags = 0;
+  int r = 1, ret = -1;
+
+  if(!(va = deep_diff_elements(ctx, a, n)) || !(vb = deep_diff_elements(ctx, b, m)))
+    goto fail;
+
+  for(; p < n && p < m; p++)
+    if((r = deep_diff_equals(ctx, va[p], vb[p])) <= 0)
+      break;
+
+  for(; r >= 0 && s < n - p && s < m - p; s++)
+    if((r = deep_diff_equals(ctx, va[n - 1 - s], vb[m - 1 - s])) <= 0)
+      break;
+
+  if(r < 0)
+    goto fail;
+
+  na = n - p - s;
+  nb = m - p - s;
+
+  if(!(src = js_malloc(ctx, sizeof(int32_t) * (nb + 1))) || !(dst = js_malloc(ctx, sizeof(int32_t) * (na + 1))) ||
+     !(flags = js_mallocz(ctx, nb + 1)) || !(cur = js_malloc(ctx, sizeof(uint32_t) * (na + nb + 1))))
+    goto fail;
+
+  for(i = 0; i < na; i++) dst[i] = -1;
+  for(j = 0; j < nb; j++) src[j] = -1;
+
+  if((uint64_t)(na + 1) * (nb + 1) <= DEEP_DIFF_LCS_MAX) {
+    uint32_t kept_a, kept_b;
+
+    if(!(ha = js_malloc(ctx, sizeof(DeepHash) * (na + 1))) || !(hb = js_malloc(ctx, sizeof(DeepHash) * (nb + 1))) ||
+       !(lcs = js_mallocz(ctx, sizeof(uint32_t) * (na + 1) * (nb + 1))))
+      goto fail;
+
+    for(i = 0; i < na; i++)
+      if(deep_hash(ctx, va[p + i], &opts, &ha[i]) < 0)
+        goto fail;
+
+    for(j = 0; j < nb; j++)
+      if(deep_hash(ctx, vb[p + j], &opts, &hb[j]) < 0)
+        goto fail;
+
+#define LCS(i, j) lcs[(i) * (nb + 1) + (j)]
+
+    for(i = na; i-- > 0;)
+      for(j = nb; j-- > 0;)
+        LCS(i, j) = ha[i].lo == hb[j].lo ? LCS(i + 1, j + 1) + 1 : MAX_NUM(LCS(i + 1, j), LCS(i, j + 1));
+
+    for(i = 0, j = 0; i < na && j < nb;) {
+      if(ha[i].lo == hb[j].lo) {
+        dst[i] = j;
+        src[j] = i;
+        flags[j] = DIFF_KEPT;
+        i++;
+        j++;
+      } else if(LCS(i + 1, j) >= LCS(i, j + 1)) {
+        i++;
+      } else {
+        j++;
+      }
+    }
+
+#undef LCS
+
+    /* equal elements outside of the common subsequence are moved */
+    for(j = 0; j < nb; j++)
+      if(src[j] < 0)
+        for(i = 0; i < na; i++)
+          if(dst[i] < 0 && ha[i].lo == hb[j].lo) {
+            dst[i] = j;
+            src[j] = i;
+            break;
+          }
+
+    /* pair up what is left between consecutive kept elements */
+    for(i = 0, j = 0;;) {
+      for(kept_a = i; kept_a < na && !(dst[kept_a] >= 0 && (flags[dst[kept_a]] & DIFF_KEPT)); kept_a++) {}
+      kept_b = kept_a < na ? (uint32_t)dst[kept_a] : nb;
+
+      while(i < kept_a && j < kept_b) {
+        if(dst[i] >= 0) {
+          i++;
+        } else if(src[j] >= 0) {
+          j++;
+        } else {
+          dst[i] = j;
+          src[j] = i;
+          flags[j] = DIFF_PAIRED;
+          i++;
+          j++;
+        }
+      }
+
+      if(kept_a >= na)
+        break;
+
+      i = kept_a + 1;
+      j = kept_b + 1;
+    }
+
+  } else {
+    for(i = 0; i < na && i < nb; i++) {
+      dst[i] = i;
+      src[i] = i;
+      flags[i] = DIFF_PAIRED;
+    }
+  }
+
+  /* removals, from the back so that the indices of the others stay valid */
+  for(len = na; len-- > 0;)
+    if(dst[len] < 0 && deep_diff_emit_index(ctx, dd, DIFF_REMOVE, path, p + len, JS_UNDEFINED) < 0)
+      goto fail;
+
+  for(i = 0, len = 0; i < na; i++)
+    if(dst[i] >= 0)
+      cur[len++] = i;
+
+  for(j = 0; j < nb; j++) {
+    if(src[j] < 0) {
+      if(deep_diff_emit_index(ctx, dd, DIFF_ADD, path, p + j, vb[p + j]) < 0)
+        goto fail;
+
+      memmove(&cur[j + 1], &cur[j], sizeof(uint32_t) * (len - j));
+      cur[j] = UINT32_MAX;
+      len++;
+      continue;
+    }
+
+    for(k = j; k < len && cur[k] != (uint32_t)src[j]; k++) {}
+
+    if(k != j) {
+      Pointer *from, *to;
+
+      if(!(from = deep_diff_index(ctx, path, p + k)))
+        goto fail;
+
+      if(!(to = deep_diff_index(ctx, path, p + j))) {
+        pointer_free(from, ctx);
+        goto fail;
+      }
+
+      r = deep_diff_emit(ctx, dd, DIFF_MOVE, to, from, JS_UNDEFINED);
+      pointer_free(from, ctx);
+      pointer_free(to, ctx);
+
+      if(r < 0)
+        goto fail;
+
+      memmove(&cur[j + 1], &cur[j], sizeof(uint32_t) * (k - j));
+      cur[j] = src[j];
+    }
+
+    /* also catches the unlikely elements matched by a colliding hash */
+    if((flags[j] & DIFF_PAIRED) || (r = deep_diff_equals(ctx, va[p + src[j]], vb[p + j])) == 0) {
+      if(!deep_diff_push(ctx, dd, JS_DupValue(ctx, va[p + src[j]]), JS_DupValue(ctx, vb[p + j]), deep_diff_index(ctx, path, p + j)))
+        goto fail;
+    } else if(r < 0) {
+      goto fail;
+    }
+  }
+
+  ret = 0;
+
+fail:
+  deep_diff_elements_free(ctx, va, n);
+  deep_diff_elements_free(ctx, vb, m);
+  js_free(ctx, ha);
+  js_free(ctx, hb);
+  js_free(ctx, lcs);
+  js_free(ctx, src);
+  js_free(ctx, dst);
+  js_free(ctx, flags);
+  js_free(ctx, cur);
+  return ret;
+}
+
+/* descends into plain objects and arrays of the same kind, replaces anything else that differs */
+static int
+deep_diff_step(JSContext* ctx, DeepDiff* dd, JSValueConst a, JSValueConst b, Pointer* path) {
+  if(JS_IsObject(a) && JS_IsObject(b)) {
+    JSObject *pa = JS_VALUE_GET_OBJ(a), *pb = JS_VALUE_GET_OBJ(b);
+    int r;
+
+    if(pa == pb)
+      return 0;
+
+    if(pa->class_id == JS_CLASS_ARRAY && pb->class_id == JS_CLASS_ARRAY) {
+      if((r = deep_diff_enter(ctx, dd, a, b)))
+        return r < 0 ? -1 : 0;
+
+      return deep_diff_array(ctx, dd, a, b, path);
+    }
+
+    if(deep_hash_class(pa) == JS_CLASS_OBJECT && deep_hash_class(pb) == JS_CLASS_OBJECT && !JS_IsFunction(ctx, a) && !JS_IsFunction(ctx, b)) {
+      if((r = deep_diff_enter(ctx, dd, a, b)))
+        return r < 0 ? -1 : 0;
+
+      return deep_diff_object(ctx, dd, a, b, path);
+    }
+  }
+
+  switch(deep_diff_equals(ctx, a, b)) {
+    case 0: return deep_diff_emit(ctx, dd, DIFF_REPLACE, path, 0, b);
+    case 1: return 0;
+    default: return -1;
+  }
+}
+
+/**
+ * deep.diff(a, b) returns the changes which turn 'a' into 'b', as a list
+ * of { op, path, value } objects with Pointer paths.
+ */
+static JSValue
+js_deep_diff(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  DeepDiff dd = {JS_NewArray(ctx), 0, VECTOR(ctx), {0, 0, 0}};
+  DeepDiffTask task, *ptr;
+  int ret = 0;
+
+  if(JS_IsException(dd.changes))
+    return JS_EXCEPTION;
+
+  if(!deep_diff_push(ctx, &dd, JS_DupValue(ctx, argv[0]), JS_DupValue(ctx, argv[1]), pointer_new(ctx)))
+    ret = -1;
+
+  while(ret == 0 && !vector_empty(&dd.tasks)) {
+    task = *(DeepDiffTask*)vector_back(&dd.tasks, sizeof(DeepDiffTask));
+    vector_pop(&dd.tasks, sizeof(DeepDiffTask));
+
+    if(task.path) {
+      ret = deep_diff_step(ctx, &dd, task.a, task.b, task.path);
+      pointer_free(task.path, ctx);
+    } else {
+      deep_visited_remove(&dd.visited, JS_VALUE_GET_OBJ(task.a), JS_VALUE_GET_OBJ(task.b));
+    }
+
+    JS_FreeValue(ctx, task.a);
+    JS_FreeValue(ctx, task.b);
+  }
+
+  vector_foreach_t(&dd.tasks, ptr) {
+    JS_FreeValue(ctx, ptr->a);
+    JS_FreeValue(ctx, ptr->b);
+
+    if(ptr->path)
+      pointer_free(ptr->path, ctx);
+  }
+
+  vector_free(&dd.tasks);
+  deep_visited_free(ctx, &dd.visited);
+
+  if(ret < 0) {
+    JS_FreeValue(ctx, dd.changes);
+    return JS_EXCEPTION;
+  }
+
+  return dd.changes;
+}
+
+static int
+deep_patch_insert(JSContext* ctx, JSValueConst parent, JSAtom key, JSValue value) {
+  int64_t index;
+
+  if(JS_IsArray(ctx, parent) && js_atom_is_index(ctx, &index, key)) {
+    JSValue args[] = {JS_NewInt64(ctx, index), JS_NewInt32(ctx, 0), value}, result;
+
+    result = js_invoke(ctx, parent, "splice", 3, args);
+    JS_FreeValue(ctx, value);
+
+    if(JS_IsException(result))
+      return -1;
+
+    JS_FreeValue(ctx, result);
+    return 0;
+  }
+
+  return JS_SetProperty(ctx, parent, key, value) < 0 ? -1 : 0;
+}
+
+/* returns the value removed */
+static JSValue
+deep_patch_remove(JSContext* ctx, JSValueConst parent, JSAtom key) {
+  JSValue value = JS_GetProperty(ctx, parent, key);
+  int64_t index;
+
+  if(JS_IsException(value))
+    return value;
+
+  if(JS_IsArray(ctx, parent) && js_atom_is_index(ctx, &index, key)) {
+    JSValue args[] = {JS_NewInt64(ctx, index), JS_NewInt32(ctx, 1)}, result;
+
+    result = js_invoke(ctx, parent, "splice", 2, args);
+
+    if(JS_IsException(result)) {
+      JS_FreeValue(ctx, value);
+      return JS_EXCEPTION;
+    }
+
+    JS_FreeValue(ctx, result);
+  } else if(JS_DeleteProperty(ctx, parent, key, JS_PROP_THROW) < 0) {
+    JS_FreeValue(ctx, value);
+    return JS_EXCEPTION;
+  }
+
+  return value;
+}
+
+/* resolves the parent of 'path' in 'root' and pops the last key into 'key' */
+static JSValue
+deep_patch_parent(JSContext* ctx, JSValueConst root, JSValueConst path, JSAtom* key) {
+  Pointer* ptr;
+  JSValue parent;
+
+  /* only an explicit empty path stands for the root */
+  if(JS_IsUndefined(path))
+    return JS_ThrowTypeError(ctx, "deep.patch: missing path");
+
+  if(!(ptr = pointer_new(ctx)))
+    return JS_ThrowOutOfMemory(ctx);
+
+  if(!pointer_from(ptr, ctx, path)) {
+    pointer_free(ptr, ctx);
+    return JS_ThrowTypeError(ctx, "deep.patch: invalid path");
+  }
+
+  *key = pointer_pop(ptr);
+  parent = *key == JS_ATOM_NULL ? JS_UNDEFINED : pointer_deref(ptr, ctx, root);
+
+  pointer_free(ptr, ctx);
+  return parent;
+}
+
+/* applies one change to '*root', replacing the root itself for an empty path */
+static int
+deep_patch_apply(JSContext* ctx, JSValue* root, JSValueConst change) {
+  JSValue op = JS_GetPropertyStr(ctx, change, "op"), path = JS_GetPropertyStr(ctx, change, "path");
+  JSValue parent = JS_UNDEFINED, value = JS_UNDEFINED;
+  JSAtom key = JS_ATOM_NULL;
+  const char* str;
+  int i, ret = -1;
+
+  if(!(str = JS_ToCString(ctx, op)))
+    goto fail;
+
+  for(i = 0; i < (int)countof(deep_diff_ops); i++)
+    if(!strcmp(str, deep_diff_ops[i]))
+      break;
+
+  JS_FreeCString(ctx, str);
+
+  if(i == (int)countof(deep_diff_ops)) {
+    JS_ThrowTypeError(ctx, "deep.patch: invalid op");
+    goto fail;
+  }
+
+  if(i == DIFF_MOVE) {
+    JSValue from = JS_GetPropertyStr(ctx, change, "from");
+
+    parent = deep_patch_parent(ctx, *root, from, &key);
+    JS_FreeValue(ctx, from);
+
+    if(JS_IsException(parent))
+      goto fail;
+
+    if(key == JS_ATOM_NULL) {
+      JS_ThrowTypeError(ctx, "deep.patch: cannot move the root");
+      goto fail;
+    }
+
+    value = deep_patch_remove(ctx, parent, key);
+    JS_FreeValue(ctx, parent);
+    JS_FreeAtom(ctx, key);
+    parent = JS_UNDEFINED;
+    key = JS_ATOM_NULL;
+
+    if(JS_IsException(value))
+      goto fail;
+
+  } else if(i != DIFF_REMOVE) {
+    JSValue arg = JS_GetPropertyStr(ctx, change, "value");
+
+    /* the target must not share objects with the list of changes */
+    value = js_deep_clone(ctx, JS_UNDEFINED, 1, &arg);
+    JS_FreeValue(ctx, arg);
+
+    if(JS_IsException(value))
+      goto fail;
+  }
+
+  parent = deep_patch_parent(ctx, *root, path, &key);
+
+  if(JS_IsException(parent))
+    goto fail;
+
+  if(key == JS_ATOM_NULL) {
+    JS_FreeValue(ctx, *root);
+    *root = value;
+    value = JS_UNDEFINED;
+    ret = 0;
+    goto fail;
+  }
+
+  switch(i) {
+    case DIFF_ADD:
+    case DIFF_MOVE: {
+      ret = deep_patch_insert(ctx, parent, key, value);
+      value = JS_UNDEFINED;
+      break;
+    }
+
+    case DIFF_REMOVE: {
+      value = deep_patch_remove(ctx, parent, key);
+      ret = JS_IsException(value) ? -1 : 0;
+      break;
+    }
+
+    case DIFF_REPLACE: {
+      ret = JS_SetProperty(ctx, parent, key, value) < 0 ? -1 : 0;
+      value = JS_UNDEFINED;
+      break;
+    }
+  }
+
+fail:
+  JS_FreeValue(ctx, value);
+  JS_FreeValue(ctx, parent);
+  JS_FreeAtom(ctx, key);
+  JS_FreeValue(ctx, op);
+  JS_FreeValue(ctx, path);
+  return ret;
+}
+
+/**
+ * deep.patch(target, changes) applies a list of changes from deep.diff()
+ * to 'target' in place.  Returns the target, or its replacement when a
+ * change has an empty path.
+ */
+static JSValue
+js_deep_patch(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSValue root = JS_DupValue(ctx, argv[0]);
+  int64_t i, len;
+
+  if((len = js_array_length(ctx, argv[1])) < 0) {
+    JS_FreeValue(ctx, root);
+    return JS_ThrowTypeError(ctx, "deep.patch: changes must be an array");
+  }
+
+  for(i = 0; i < len; i++) {
+    JSValue change = JS_GetPropertyUint32(ctx, argv[1], i);
+    int r = JS_IsException(change) ? -1 : deep_patch_apply(ctx, &root, change);
+
+    JS_FreeValue(ctx, change);
+
+    if(r < 0) {
+      JS_FreeValue(ctx, root);
+      return JS_EXCEPTION;
+    }
+  }
+
+  return root;
+}
+
+/*
+ * Path patterns for deep.find() and deep.select(), in the style of
+ * JSONPath:
+ *
+ *   $.store.book[0].title      names and indices
+ *   $.store.*  $.list[*]       wildcards
+ *   $..price                   recursive descent
+ *   $['a','b']  $[0,-1]        key sets, negative indices count from the end
+ *   $.list[1:10:2]             index ranges
+ *   $.book[?(@.price < 10)]    value filters (==, !=, <, <=, >, >= or existence)
+ *
+ * A pattern is compiled into a list of steps.  Names and indices are
+ * looked up directly, so only the branches a pattern can reach are
+ * visited, and paths are only built for the results.
+ */
+enum {
+  QUERY_NAMES = 0,
+  QUERY_WILDCARD,
+  QUERY_SLICE,
+  QUERY_FILTER,
+};
+
+enum {
+  FILTER_EXISTS = 0,
+  FILTER_EQ,
+  FILTER_NE,
+  FILTER_LT,
+  FILTER_LE,
+  FILTER_GT,
+  FILTER_GE,
+};
+
+typedef struct {
+  JSAtom atom; /* JS_ATOM_NULL for negative indices */
+  int64_t index;
+} DeepQueryKey;
+
+typedef struct {
+  int type;
+  BOOL descend; /* preceded by '..' */
+  DeepQueryKey* keys;
+  uint32_t nkeys;
+  int64_t start, end, step;
+  BOOL has_start, has_end;
+  Pointer* operand; /* relative to '@' */
+  int op;
+  JSValue literal;
+} DeepQueryStep;
+
+typedef struct {
+  JSValue value;
+  uint32_t step, depth;
+  int32_t node;
+} DeepQueryTask;
+
+/* the key which leads to a visited value, results walk these back to the root */
+typedef struct {
+  int32_t parent;
+  JSAtom atom;
+  JSObject* obj;
+} DeepQueryNode;
+
+typedef struct {
+  const char *s, *end, *start;
+} DeepQueryParser;
+
+static void
+deep_query_free(JSContext* ctx, Vector* steps) {
+  DeepQueryStep* step;
+  uint32_t i;
+
+  vector_foreach_t(steps, step) {
+    for(i = 0; i < step->nkeys; i++) JS_FreeAtom(ctx, step->keys[i].atom);
+
+    js_free(ctx, step->keys);
+
+    if(step->operand)
+      pointer_free(step->operand, ctx);
+
+    JS_FreeValue(ctx, step->literal);
+  }
+
+  vector_free(steps);
+}
+
+static int
+deep_query_error(JSContext* ctx, DeepQueryParser* p, const char* what) {
+  JS_ThrowSyntaxError(ctx, "deep: %s at offset %td of path pattern '%s'", what, p->s - p->start, p->start);
+  return -1;
+}
+
+static void
+deep_query_skip(DeepQueryParser* p) {
+  while(p->s < p->end && (*p->s == ' ' || *p->s == '\t')) p->s++;
+}
+
+static BOOL
+deep_query_accept(DeepQueryParser* p, char c) {
+  deep_query_skip(p);
+
+  if(p->s < p->end && *p->s == c) {
+    p->s++;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* 1 when there is an integer, 0 when there is none, -1 when it is out of the range of an array index */
+static int
+deep_query_integer(JSContext* ctx, DeepQueryParser* p, int64_t* out) {
+  const char* s;
+  BOOL neg = FALSE;
+  int64_t n = 0;
+
+  deep_query_skip(p);
+  s = p->s;
+
+  if(s < p->end && *s == '-') {
+    neg = TRUE;
+    s++;
+  }
+
+  if(s >= p->end || !is_digit_char(*s))
+    return 0;
+
+  while(s < p->end && is_digit_char(*s))
+    if((n = n * 10 + (*s++ - '0')) > UINT32_MAX)
+      return deep_query_error(ctx, p, "index out of range");
+
+  *out = neg ? -n : n;
+  p->s = s;
+  return 1;
+}
+
+/* a quoted string, with backslash escapes */
+static JSAtom
+deep_query_quoted(JSContext* ctx, DeepQueryParser* p) {
+  char quote = *p->s++;
+  DynBuf dbuf;
+  JSAtom atom = JS_ATOM_NULL;
+
+  js_dbuf_init(ctx, &dbuf);
+
+  while(p->s < p->end && *p->s != quote) {
+    char c = *p->s++;
+
+    if(c == '\\' && p->s < p->end) {
+      switch((c = *p->s++)) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+      }
+    }
+
+    dbuf_putc(&dbuf, c);
+  }
+
+  if(p->s < p->end) {
+    p->s++;
+    atom = JS_NewAtomLen(ctx, dbuf.buf ? (const char*)dbuf.buf : "", dbuf.size);
+  } else {
+    deep_query_error(ctx, p, "unterminated string");
+  }
+
+  dbuf_free(&dbuf);
+  return atom;
+}
+
+/* a name after '.' runs up to the next '.' or '[' */
+static JSAtom
+deep_query_name(JSContext* ctx, DeepQueryParser* p) {
+  const char* s = p->s;
+
+  while(p->s < p->end && *p->s != '.' && *p->s != '[') p->s++;
+
+  if(p->s == s) {
+    deep_query_error(ctx, p, "expected a name");
+    return JS_ATOM_NULL;
+  }
+
+  return JS_NewAtomLen(ctx, s, p->s - s);
+}
+
+static int
+deep_query_addkey(JSContext* ctx, DeepQueryStep* step, JSAtom atom, int64_t index) {
+  DeepQueryKey* keys;
+
+  if(!(keys = js_realloc(ctx, step->keys, sizeof(DeepQueryKey) * (step->nkeys + 1)))) {
+    JS_FreeAtom(ctx, atom);
+    return -1;
+  }
+
+  keys[step->nkeys++] = (DeepQueryKey){atom, index};
+  step->keys = keys;
+  return 0;
+}
+
+static int
+deep_query_index(JSContext* ctx, DeepQueryStep* step, int64_t index) {
+  JSAtom atom = index >= 0 ? JS_NewAtomUInt32(ctx, MIN_NUM(index, UINT32_MAX)) : JS_ATOM_NULL;
+
+  return deep_query_addkey(ctx, step, atom, index);
+}
+
+/* the literal a filter compares with */
+static int
+deep_query_literal(JSContext* ctx, DeepQueryParser* p, JSValue* out) {
+  static const char* const words[] = {"true", "false", "null"};
+  const JSValue values[] = {JS_TRUE, JS_FALSE, JS_NULL};
+  size_t i;
+
+  deep_query_skip(p);
+
+  if(p->s < p->end && (*p->s == '\'' || *p->s == '"')) {
+    JSAtom atom;
+
+    if((atom = deep_query_quoted(ctx, p)) == JS_ATOM_NULL)
+      return -1;
+
+    *out = JS_AtomToString(ctx, atom);
+    JS_FreeAtom(ctx, atom);
+    return 0;
+  }
+
+  for(i = 0; i < countof(words); i++) {
+    size_t len = strlen(words[i]);
+
+    if((size_t)(p->end - p->s) >= len && !strncmp(p->s, words[i], len)) {
+      p->s += len;
+      *out = values[i];
+      return 0;
+    }
+  }
+
+  {
+    char* end;
+    double d = strtod(p->s, &end);
+
+    if(end == p->s || end > p->end)
+      return deep_query_error(ctx, p, "expected a literal");
+
+    p->s = end;
+    *out = JS_NewFloat64(ctx, d);
+  }
+
+  return 0;
+}
+
+/* [?(@.key op literal)] */
+static int
+deep_query_filter(JSContext* ctx, DeepQueryParser* p, DeepQueryStep* step) {
+  static const struct {
+    const char* str;
+    int op;
+  } ops[] = {
+      {"==", FILTER_EQ},
+      {"!=", FILTER_NE},
+      {"<=", FILTER_LE},
+      {">=", FILTER_GE},
+      {"<", FILTER_LT},
+      {">", FILTER_GT},
+  };
+  size_t i;
+
+  step->type = QUERY_FILTER;
+
+  if(!deep_query_accept(p, '(') || !deep_query_accept(p, '@'))
+    return deep_query_error(ctx, p, "expected '(@'");
+
+  if(!(step->operand = pointer_new(ctx)))
+    return -1;
+
+  for(;;) {
+    JSAtom atom = JS_ATOM_NULL;
+    int64_t index;
+    int r;
+
+    if(p->s < p->end && *p->s == '.') {
+      const char* s = ++p->s;
+
+      while(p->s < p->end && *p->s && !strchr(".[)=!<> \t", *p->s)) p->s++;
+
+      if(p->s == s)
+        return deep_query_error(ctx, p, "expected a name");
+
+      pointer_pushatom(step->operand, ctx, JS_NewAtomLen(ctx, s, p->s - s));
+      continue;
+    }
+
+    if(p->s < p->end && *p->s == '[') {
+      p->s++;
+      deep_query_skip(p);
+
+      if(p->s < p->end && (*p->s == '\'' || *p->s == '"'))
+        atom = deep_query_quoted(ctx, p);
+      else if((r = deep_query_integer(ctx, p, &index)) < 0)
+        return -1;
+      else if(r && index >= 0)
+        atom = JS_NewAtomUInt32(ctx, index);
+
+      if(atom == JS_ATOM_NULL || !deep_query_accept(p, ']'))
+        return deep_query_error(ctx, p, "invalid filter key");
+
+      pointer_pushatom(step->operand, ctx, atom);
+      continue;
+    }
+
+    break;
+  }
+
+  step->op = FILTER_EXISTS;
+  deep_query_skip(p);
+
+  for(i = 0; i < countof(ops); i++) {
+    size_t len = strlen(ops[i].str);
+
+    if((size_t)(p->end - p->s) >= len && !strncmp(p->s, ops[i].str, len)) {
+      p->s += len;
+      step->op = ops[i].op;
+
+      if(deep_query_literal(ctx, p, &step->literal) < 0)
+        return -1;
+
+      break;
+    }
+  }
+
+  if(!deep_query_accept(p, ')'))
+    return deep_query_error(ctx, p, "expected ')'");
+
+  return 0;
+}
+
+/* everything between '[' and ']' */
+static int
+deep_query_bracket(JSContext* ctx, DeepQueryParser* p, DeepQueryStep* step) {
+  int64_t index;
+  int r;
+
+  if(deep_query_accept(p, '*')) {
+    step->type = QUERY_WILDCARD;
+  } else if(deep_query_accept(p, '?')) {
+    if(deep_query_filter(ctx, p, step) < 0)
+      return -1;
+  } else {
+    int has_index;
+
+    if((has_index = deep_query_integer(ctx, p, &index)) < 0)
+      return -1;
+
+    if(deep_query_accept(p, ':')) {
+      step->type = QUERY_SLICE;
+      step->step = 1;
+
+      if((step->has_start = has_index))
+        step->start = index;
+
+      if((step->has_end = deep_query_integer(ctx, p, &step->end)) < 0)
+        return -1;
+
+      if(deep_query_accept(p, ':')) {
+        if((r = deep_query_integer(ctx, p, &step->step)) < 0)
+          return -1;
+
+        if(r && step->step == 0)
+          return deep_query_error(ctx, p, "slice step can't be zero");
+      }
+
+    } else {
+      step->type = QUERY_NAMES;
+
+      for(;;) {
+        if(has_index) {
+          if(deep_query_index(ctx, step, index) < 0)
+            return -1;
+        } else if(p->s < p->end && (*p->s == '\'' || *p->s == '"')) {
+          JSAtom atom;
+
+          if((atom = deep_query_quoted(ctx, p)) == JS_ATOM_NULL || deep_query_addkey(ctx, step, atom, -1) < 0)
+            return -1;
+        } else {
+          return deep_query_error(ctx, p, "expected a key");
+        }
+
+        if(!deep_query_accept(p, ','))
+          break;
+
+        if((has_index = deep_query_integer(ctx, p, &index)) < 0)
+          return -1;
+
+        deep_query_skip(p);
+      }
+    }
+  }
+
+  if(!deep_query_accept(p, ']'))
+    return deep_query_error(ctx, p, "expected ']'");
+
+  return 0;
+}
+
+static int
+deep_query_compile(JSContext* ctx, const char* str, size_t len, Vector* steps) {
+  DeepQueryParser p = {str, str + len, str};
+
+  if(p.s < p.end && *p.s == '$')
+    p.s++;
+
+  while(p.s < p.end) {
+    DeepQueryStep* step;
+    BOOL bracket = FALSE;
+
+    if(!(step = vector_emplace(steps, sizeof(DeepQueryStep))))
+      return -1;
+
+    memset(step, 0, sizeof(DeepQueryStep));
+    step->literal = JS_UNDEFINED;
+
+    if(p.s + 1 < p.end && p.s[0] == '.' && p.s[1] == '.') {
+      step->descend = TRUE;
+      p.s += 2;
+    } else if(*p.s == '.') {
+      p.s++;
+    } else if(*p.s != '[' && p.s > p.start && p.s[-1] != '$') {
+      return deep_query_error(ctx, &p, "expected '.' or '['");
+    }
+
+    if(p.s < p.end && *p.s == '[') {
+      p.s++;
+      bracket = TRUE;
+    }
+
+    if(bracket) {
+      if(deep_query_bracket(ctx, &p, step) < 0)
+        return -1;
+    } else if(p.s < p.end && *p.s == '*') {
+      p.s++;
+      step->type = QUERY_WILDCARD;
+    } else {
+      JSAtom atom;
+
+      step->type = QUERY_NAMES;
+
+      if((atom = deep_query_name(ctx, &p)) == JS_ATOM_NULL || deep_query_addkey(ctx, step, atom, -1) < 0)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* the value at the filter operand of 'value', or JS_UNINITIALIZED when there is none */
+static JSValue
+deep_query_operand(JSContext* ctx, Pointer* operand, JSValueConst value) {
+  JSValue obj = JS_DupValue(ctx, value);
+  size_t i;
+  int r = 0;
+
+  for(i = 0; i < operand->n; i++) {
+    JSValue child;
+
+    if(!JS_IsObject(obj) || (r = JS_GetOwnProperty(ctx, 0, obj, operand->atoms[i])) <= 0) {
+      JS_FreeValue(ctx, obj);
+      return r < 0 ? JS_EXCEPTION : JS_UNINITIALIZED;
+    }
+
+    child = JS_GetProperty(ctx, obj, operand->atoms[i]);
+    JS_FreeValue(ctx, obj);
+    obj = child;
+  }
+
+  return obj;
+}
+
+static int
+deep_query_compare(JSContext* ctx, JSValueConst a, JSValueConst b) {
+  if(JS_IsNumber(a) && JS_IsNumber(b)) {
+    double x, y;
+
+    JS_ToFloat64(ctx, &x, a);
+    JS_ToFloat64(ctx, &y, b);
+    return x < y ? -1 : x > y ? 1 : x == y ? 0 : 2;
+  }
+
+  if(JS_IsString(a) && JS_IsString(b)) {
+    const char *x = JS_ToCString(ctx, a), *y = JS_ToCString(ctx, b);
+    int r = 2;
+
+    if(x && y)
+      r = strcmp(x, y) < 0 ? -1 : strcmp(x, y) > 0 ? 1 : 0;
+
+    JS_FreeCString(ctx, x);
+    JS_FreeCString(ctx, y);
+    return r;
+  }
+
+  return 2;
+}
+
+static int
+deep_query_match(JSContext* ctx, const DeepQueryStep* step, JSValueConst value) {
+  JSValue operand = deep_query_operand(ctx, step->operand, value);
+  int r = 0;
+
+  if(JS_IsException(operand))
+    return -1;
+
+  if(JS_VALUE_GET_TAG(operand) == JS_TAG_UNINITIALIZED)
+    return step->op == FILTER_NE;
+
+  switch(step->op) {
+    case FILTER_EXISTS: r = 1; break;
+    case FILTER_EQ:
+    case FILTER_NE: {
+      if((r = deep_diff_equals(ctx, operand, step->literal)) >= 0 && step->op == FILTER_NE)
+        r = !r;
+      break;
+    }
+    default: {
+      int cmp = deep_query_compare(ctx, operand, step->literal);
+
+      switch(step->op) {
+        case FILTER_LT: r = cmp == -1; break;
+        case FILTER_LE: r = cmp == -1 || cmp == 0; break;
+        case FILTER_GT: r = cmp == 1; break;
+        case FILTER_GE: r = cmp == 1 || cmp == 0; break;
+      }
+      break;
+    }
+  }
+
+  JS_FreeValue(ctx, operand);
+  return r;
+}
+
+typedef struct {
+  Vector steps, tasks, nodes, pending;
+  JSValue results;
+  uint32_t count, flags, max_depth;
+  BOOL first;
+} DeepQuery;
+
+/* queues 'value' for the step 'index', reached through 'atom' from the node 'parent' */
+static int
+deep_query_pending(JSContext* ctx, DeepQuery* q, JSValue value, uint32_t index, uint32_t depth, int32_t parent, JSAtom atom) {
+  DeepQueryNode* node;
+  DeepQueryTask* task;
+
+  if(!(node = vector_emplace(&q->nodes, sizeof(DeepQueryNode))) || !(task = vector_emplace(&q->pending, sizeof(DeepQueryTask)))) {
+    JS_FreeValue(ctx, value);
+    return -1;
+  }
+
+  node->parent = parent;
+  node->atom = JS_DupAtom(ctx, atom);
+  node->obj = JS_IsObject(value) ? JS_VALUE_GET_OBJ(value) : 0;
+
+  task->value = value;
+  task->step = index;
+  task->depth = depth;
+  task->node = vector_size(&q->nodes, sizeof(DeepQueryNode)) - 1;
+  return 0;
+}
+
+static inline DeepQueryNode*
+deep_query_node(DeepQuery* q, int32_t index) {
+  return vector_at(&q->nodes, sizeof(DeepQueryNode), index);
+}
+
+/* TRUE when 'obj' already is on the way from the root to 'node' */
+static BOOL
+deep_query_cycle(DeepQuery* q, int32_t node, JSObject* obj) {
+  for(; node >= 0; node = deep_query_node(q, node)->parent)
+    if(deep_query_node(q, node)->obj == obj)
+      return TRUE;
+
+  return FALSE;
+}
+
+/* the keys from the root to 'node', built only for results */
+static JSValue
+deep_query_path(JSContext* ctx, DeepQuery* q, int32_t node) {
+  uint32_t i, depth = 0;
+  int32_t n;
+  JSValue ret;
+
+  for(n = node; n >= 0; n = deep_query_node(q, n)->parent) depth++;
+
+  if(q->flags & PATH_AS_STRING) {
+    JSAtom* atoms;
+    DynBuf dbuf;
+
+    if(!(atoms = js_malloc(ctx, sizeof(JSAtom) * (depth + 1))))
+      return JS_EXCEPTION;
+
+    for(i = depth, n = node; n >= 0; n = deep_query_node(q, n)->parent) atoms[--i] = deep_query_node(q, n)->atom;
+
+    js_dbuf_init(ctx, &dbuf);
+
+    for(i = 0; i < depth; i++) {
+      const char* key = JS_AtomToCString(ctx, atoms[i]);
+
+      if(i > 0)
+        dbuf_putc(&dbuf, '.');
+
+      if(key)
+        dbuf_putstr(&dbuf, key);
+
+      JS_FreeCString(ctx, key);
+    }
+
+    js_free(ctx, atoms);
+    ret = JS_NewStringLen(ctx, dbuf.buf ? (const char*)dbuf.buf : "", dbuf.size);
+    dbuf_free(&dbuf);
+    return ret;
+  }
+
+  ret = JS_NewArray(ctx);
+
+  for(i = depth, n = node; n >= 0; n = deep_query_node(q, n)->parent) JS_SetPropertyUint32(ctx, ret, --i, js_atom_tovalue(ctx, deep_query_node(q, n)->atom));
+
+  JS_DefinePropertyValueStr(
+      ctx, ret, "toString", JS_NewCFunction(ctx, property_enumeration_path_tostring, "toString", 0), JS_PROP_CONFIGURABLE | JS_PROP_WRITABLE);
+  return ret;
+}
+
+/* [value, path], [path, value], the value or the path, as for predicates */
+static JSValue
+deep_query_result(JSContext* ctx, DeepQuery* q, const DeepQueryTask* task) {
+  JSValue ret, path;
+
+  switch(q->flags & RETURN_MASK) {
+    case RETURN_VALUE: return JS_DupValue(ctx, task->value);
+    case RETURN_PATH: return deep_query_path(ctx, q, task->node);
+  }
+
+  if(JS_IsException((path = deep_query_path(ctx, q, task->node))))
+    return path;
+
+  ret = JS_NewArray(ctx);
+  JS_SetPropertyUint32(ctx, ret, (q->flags & RETURN_MASK) == RETURN_VALUE_PATH ? 0 : 1, JS_DupValue(ctx, task->value));
+  JS_SetPropertyUint32(ctx, ret, (q->flags & RETURN_MASK) == RETURN_VALUE_PATH ? 1 : 0, path);
+  return ret;
+}
+
+/* queues the children of 'task' which pass the filter of 'step' for the step 'index' */
+static int
+deep_query_children(JSContext* ctx, DeepQuery* q, const DeepQueryTask* task, const DeepQueryStep* step, uint32_t index, BOOL descend) {
+  JSValueConst obj = task->value;
+  JSPropertyEnum* tab = 0;
+  uint32_t i, len;
+  BOOL is_array = JS_IsArray(ctx, obj);
+  int r = 0, ret = 0;
+
+  if(is_array)
+    len = js_array_length(ctx, obj);
+  else if(JS_GetOwnPropertyNames(ctx, &tab, &len, obj, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+    return -1;
+
+  for(i = 0; i < len; i++) {
+    JSAtom atom = is_array ? JS_NewAtomUInt32(ctx, i) : JS_DupAtom(ctx, tab[i].atom);
+    JSValue child = JS_GetProperty(ctx, obj, atom);
+
+    if(JS_IsException(child)) {
+      JS_FreeAtom(ctx, atom);
+      ret = -1;
+      break;
+    }
+
+    if(descend ? !JS_IsObject(child) || deep_query_cycle(q, task->node, JS_VALUE_GET_OBJ(child)) : step && (r = deep_query_match(ctx, step, child)) <= 0) {
+      JS_FreeValue(ctx, child);
+      JS_FreeAtom(ctx, atom);
+
+      if(!descend && step && r < 0) {
+        ret = -1;
+        break;
+      }
+
+      continue;
+    }
+
+    r = deep_query_pending(ctx, q, child, index, task->depth + 1, task->node, atom);
+    JS_FreeAtom(ctx, atom);
+
+    if(r < 0) {
+      ret = -1;
+      break;
+    }
+  }
+
+  if(tab) {
+    js_propertyenums_free(ctx, tab, len);
+    js_free(ctx, tab);
+  }
+
+  return ret;
+}
+
+static int
+deep_query_key(JSContext* ctx, DeepQuery* q, const DeepQueryTask* task, JSAtom atom) {
+  int r;
+
+  if((r = JS_GetOwnProperty(ctx, 0, task->value, atom)) <= 0)
+    return r;
+
+  return deep_query_pending(ctx, q, JS_GetProperty(ctx, task->value, atom), task->step + 1, task->depth + 1, task->node, atom);
+}
+
+/* queues whatever the next step of 'task' leads to, the subtrees it can't reach are skipped */
+static int
+deep_query_expand(JSContext* ctx, DeepQuery* q, const DeepQueryTask* task) {
+  const DeepQueryStep* step = vector_at(&q->steps, sizeof(DeepQueryStep), task->step);
+  BOOL is_array = JS_IsArray(ctx, task->value);
+  int64_t len = is_array ? js_array_length(ctx, task->value) : 0, i;
+  uint32_t k;
+
+  switch(step->type) {
+    case QUERY_NAMES: {
+      for(k = 0; k < step->nkeys; k++) {
+        JSAtom atom = step->keys[k].atom;
+        int r;
+
+        if(atom == JS_ATOM_NULL) {
+          if(!is_array || (i = len + step->keys[k].index) < 0)
+            continue;
+
+          atom = JS_NewAtomUInt32(ctx, i);
+          r = deep_query_key(ctx, q, task, atom);
+          JS_FreeAtom(ctx, atom);
+        } else {
+          r = deep_query_key(ctx, q, task, atom);
+        }
+
+        if(r < 0)
+          return -1;
+      }
+
+      break;
+    }
+
+    case QUERY_SLICE: {
+      int64_t start, end;
+
+      if(!is_array)
+        break;
+
+      start = step->has_start ? step->start : step->step > 0 ? 0 : len - 1;
+      end = step->has_end ? step->end : step->step > 0 ? len : -len - 1;
+
+      if(start < 0)
+        start += len;
+      if(end < 0)
+        end += len;
+
+      if(step->step > 0) {
+        start = MAX_NUM(start, 0);
+        end = MIN_NUM(end, len);
+      } else {
+        start = MIN_NUM(start, len - 1);
+        end = MAX_NUM(end, -1);
+      }
+
+      for(i = start; step->step > 0 ? i < end : i > end; i += step->step) {
+        JSAtom atom = JS_NewAtomUInt32(ctx, i);
+        int r = deep_query_key(ctx, q, task, atom);
+
+        JS_FreeAtom(ctx, atom);
+
+        if(r < 0)
+          return -1;
+      }
+
+      break;
+    }
+
+    case QUERY_WILDCARD:
+    case QUERY_FILTER: {
+      if(deep_query_children(ctx, q, task, step->type == QUERY_FILTER ? step : 0, task->step + 1, FALSE) < 0)
+        return -1;
+
+      break;
+    }
+  }
+
+  if(step->descend && task->depth < q->max_depth)
+    if(deep_query_children(ctx, q, task, 0, task->step, TRUE) < 0)
+      return -1;
+
+  return 0;
+}
+
+/**
+ * Runs the path pattern 'pattern' on 'root', returning all the results
+ * or, when 'first' is set, the first one.
+ */
+static JSValue
+deep_query(JSContext* ctx, JSValueConst root, JSValueConst pattern, uint32_t flags, BOOL first) {
+  DeepQuery q = {VECTOR(ctx), VECTOR(ctx), VECTOR(ctx), VECTOR(ctx), JS_UNDEFINED, 0, flags, flags & MAXDEPTH_MASK, first};
+  DeepQueryTask task, *ptr;
+  DeepQueryNode* node;
+  const char* str;
+  size_t len;
+  int ret = 0;
+
+  if(q.max_depth == 0)
+    q.max_depth = INT32_MAX;
+
+  if(!(str = JS_ToCStringLen(ctx, &len, pattern)))
+    return JS_EXCEPTION;
+
+  ret = deep_query_compile(ctx, str, len, &q.steps);
+  JS_FreeCString(ctx, str);
+
+  if(ret == 0 && !first && JS_IsException((q.results = JS_NewArray(ctx))))
+    ret = -1;
+
+  if(ret == 0) {
+    task = (DeepQueryTask){JS_DupValue(ctx, root), 0, 0, -1};
+
+    if(!vector_push(&q.tasks, task)) {
+      JS_FreeValue(ctx, task.value);
+      ret = -1;
+    }
+  }
+
+  while(ret == 0 && !vector_empty(&q.tasks)) {
+    task = *(DeepQueryTask*)vector_back(&q.tasks, sizeof(DeepQueryTask));
+    vector_pop(&q.tasks, sizeof(DeepQueryTask));
+
+    if(task.step == vector_size(&q.steps, sizeof(DeepQueryStep))) {
+      JSValue result = deep_query_result(ctx, &q, &task);
+
+      if(JS_IsException(result)) {
+        ret = -1;
+      } else if(first) {
+        q.results = result;
+        JS_FreeValue(ctx, task.value);
+        break;
+      } else {
+        JS_SetPropertyUint32(ctx, q.results, q.count++, result);
+      }
+    } else if(JS_IsObject(task.value)) {
+      ret = deep_query_expand(ctx, &q, &task);
+
+      /* in reverse, so that the results come in document order */
+      while(ret == 0 && !vector_empty(&q.pending)) {
+        if(!vector_push(&q.tasks, *(DeepQueryTask*)vector_back(&q.pending, sizeof(DeepQueryTask))))
+          ret = -1;
+        else
+          vector_pop(&q.pending, sizeof(DeepQueryTask));
+      }
+    }
+
+    JS_FreeValue(ctx, task.value);
+  }
+
+  vector_foreach_t(&q.tasks, ptr) JS_FreeValue(ctx, ptr->value);
+  vector_foreach_t(&q.pending, ptr) JS_FreeValue(ctx, ptr->value);
+  vector_foreach_t(&q.nodes, node) JS_FreeAtom(ctx, node->atom);
+  vector_free(&q.tasks);
+  vector_free(&q.pending);
+  vector_free(&q.nodes);
+  deep_query_free(ctx, &q.steps);
+
+  if(ret < 0) {
+    JS_FreeValue(ctx, q.results);
+    return JS_EXCEPTION;
+  }
+
+  return q.results;
+}
+
+JSValue
+js_deep_call(JSContext* ctx, JSValueConst func_obj, JSValueConst this_val, int argc, JSValueConst argv[], int flags) {
+
+  return JS_UNDEFINED;
+}
+
+static JSClassDef js_deep_iterator_class = {.class_name = "DeepIterator", .finalizer = js_deep_iterator_finalizer};
+
+static const JSCFunctionListEntry js_deep_funcs[] = {
+    JS_CFUNC_DEF("find", 2, js_deep_find),
+    JS_CFUNC_DEF("select", 2, js_deep_select),
+    JS_CFUNC_DEF("get", 2, js_deep_get),
+    JS_CFUNC_DEF("set", 3, js_deep_set),
+    JS_CFUNC_DEF("unset", 2, js_deep_unset),
+    JS_CFUNC_DEF("flatten", 1, js_deep_flatten),
+    JS_CFUNC_DEF("pathOf", 2, js_deep_pathof),
+    JS_CFUNC_DEF("equals", 2, js_deep_equals),
+    JS_CFUNC_DEF("hash", 1, js_deep_hash),
+    JS_CFUNC_DEF("iterate", 1, js_deep_iterate),
+    JS_CFUNC_DEF("forEach", 2, js_deep_foreach),
+    JS_CFUNC_DEF("clone", 1, js_deep_clone),
+    JS_CFUNC_DEF("diff", 2, js_deep_diff),
+    JS_CFUNC_DEF("patch", 2, js_deep_patch),
+    JS_PROP_INT32_DEF("TYPE_UNDEFINED", TYPE_UNDEFINED, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_NULL", TYPE_NULL, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_BOOL", TYPE_BOOL, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_INT", TYPE_INT, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_OBJECT", TYPE_OBJECT, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_STRING", TYPE_STRING, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_SYMBOL", TYPE_SYMBOL, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_BIG_FLOAT", TYPE_BIG_FLOAT, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_BIG_INT", TYPE_BIG_INT, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_BIG_DECIMAL", TYPE_BIG_DECIMAL, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_FLOAT64", TYPE_FLOAT64, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_NUMBER", TYPE_NUMBER, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_NAN", TYPE_NAN, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_ALL", TYPE_ALL, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_PRIMITIVE", TYPE_PRIMITIVE, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_ARRAY", TYPE_ARRAY, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TYPE_FUNCTION", TYPE_FUNCTION, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("RETURN_VALUE", RETURN_VALUE, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("RETURN_PATH", RETURN_PATH, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("RETURN_VALUE_PATH", RETURN_VALUE_PATH, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("RETURN_PATH_VALUE", RETURN_PATH_VALUE, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("PATH_AS_STRING", PATH_AS_STRING, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("NO_THROW", NO_THROW, JS_PROP_ENUMERABLE),
+};
+
+static const JSCFunctionListEntry js_deep_iterator_proto_funcs[] = {
+    JS_ITERATOR_NEXT_DEF("next", 0, js_deep_iterator_next, 0),
+    JS_CFUNC_DEF("toString", 0, js_deep_iterator_tostring),
+    JS_CFUNC_DEF("[Symbol.iterator]", 0, js_deep_iterator_iterator),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "Deep Iterator", JS_PROP_CONFIGURABLE),
+};
+
+static int
+js_deep_init(JSContext* ctx, JSModuleDef* m) {
+
+  /* deep.diff() returns Pointer paths */
+  if(!js_pointer_class_id || !JS_IsRegisteredClass(JS_GetRuntime(ctx), js_pointer_class_id))
+    js_pointer_init(ctx, 0);
 
   JS_NewClassID(&js_deep_iterator_class_id);
   JS_NewClass(JS_GetRuntime(ctx), js_deep_iterator_class_id, &js_deep_iterator_class);
@@ -84,6 +84,7 @@ enum token_getters {
   TOKEN_PROP_SEQ,
   TOKEN_PROP_TYPE,
   TOKEN_PROP_RULE,
+  TOKEN_PROP_INTERNED,
 };
 
 Token*
@@ -148,8 +149,11 @@ js_token_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueC
     } else if(JS_IsString(argv[0])) {
     }
   }
-  if(argc > 1)
+  if(argc > 1) {
     tok->lexeme = (uint8_t*)js_tostring(ctx, argv[1]);
+    tok->byte_length = strlen((const char*)tok->lexeme);
+    tok->char_length = utf8_strlen(tok->lexeme, tok->byte_length);
+  }
   if(argc > 2) {
     Location* loc;
 
@@ -168,12 +172,24 @@ fail:
   return JS_EXCEPTION;
 }
 
+/* short lexemes are interned, so tokens with the same text share a string */
+static JSValue
+js_token_lexeme(JSContext* ctx, Token* tok) {
+  if(tok->atom == JS_ATOM_NULL && tok->lexer && tok->byte_length <= tok->lexer->intern)
+    tok->atom = JS_NewAtomLen(ctx, (const char*)tok->lexeme, tok->byte_length);
+
+  if(tok->atom != JS_ATOM_NULL)
+    return JS_AtomToString(ctx, tok->atom);
+
+  return JS_NewStringLen(ctx, (const char*)tok->lexeme, tok->byte_length);
+}
+
 JSValue
 js_token_tostring(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   Token* tok;
   if(!(tok = js_token_data2(ctx, this_val)))
     return JS_EXCEPTION;
-  return JS_NewStringLen(ctx, (const char*)tok->lexeme, tok->byte_length);
+  return js_token_lexeme(ctx, tok);
 }
 
 JSValue
@@ -188,7 +204,7 @@ js_token_toprimitive(JSContext* ctx, JSValueConst this_val, int argc, JSValueCon
   if(hint && !strcmp(hint, "number"))
     ret = JS_NewInt32(ctx, tok->id);
   else
-    ret = JS_NewStringLen(ctx, (const char*)tok->lexeme, tok->byte_length);
+    ret = js_token_lexeme(ctx, tok);
 
   if(hint)
     js_cstring_free(ctx, hint);
@@ -199,6 +215,26 @@ static const JSCFunctionListEntry js_token_inspect_funcs[1] = {
     JS_PROP_STRING_DEF("[Symbol.toStringTag]", "Token", JS_PROP_CONFIGURABLE),
 };
 
+/* resolves the location of a token created by a lexer in lazy mode */
+static Location*
+js_token_location(JSContext* ctx, Token* tok) {
+  Lexer* lex;
+  Location* loc;
+
+  if(!tok->loc && (lex = tok->lexer) && lex->lines.generation == tok->generation) {
+    if((loc = location_new(ctx))) {
+      if(lexer_location_at(lex, tok->pos, loc)) {
+        loc->file = lex->loc.file >= 0 ? JS_DupAtom(ctx, lex->loc.file) : -1;
+        tok->loc = loc;
+      } else {
+        js_free(ctx, loc);
+      }
+    }
+  }
+
+  return tok->loc;
+}
+
 JSValue
 js_token_inspect(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   Token* tok;
@@ -221,9 +257,9 @@ js_token_inspect(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst a
   JS_DefinePropertyValueStr(ctx, obj, "seq", JS_NewUint32(ctx, tok->seq), JS_PROP_ENUMERABLE);
 
   JS_DefinePropertyValueStr(ctx, obj, "type", rule ? JS_NewString(ctx, rule->name) : JS_NULL, JS_PROP_ENUMERABLE);
-  JS_DefinePropertyValueStr(ctx, obj, "lexeme", JS_NewString(ctx, (const char*)tok->lexeme), JS_PROP_ENUMERABLE);
+  JS_DefinePropertyValueStr(ctx, obj, "lexeme", js_token_lexeme(ctx, tok), JS_PROP_ENUMERABLE);
 
-  if(tok->loc)
+  if(js_token_location(ctx, tok))
     JS_DefinePropertyValueStr(ctx, obj, "charOffset", JS_NewUint32(ctx, tok->loc->char_offset), JS_PROP_ENUMERABLE);
 
   JS_DefinePropertyValueStr(ctx, obj, "charLength", JS_NewUint32(ctx, tok->char_length), JS_PROP_ENUMERABLE);
@@ -267,25 +303,25 @@ js_token_get(JSContext* ctx, JSValueConst this_val, int magic) {
        */
     case TOKEN_PROP_BYTERANGE: {
       Location* loc;
-      if((loc = tok->loc))
+      if((loc = js_token_location(ctx, tok)))
         ret = offset_toarray(token_byte_range(tok), ctx);
       break;
     }
     case TOKEN_PROP_CHARRANGE: {
       Location* loc;
-      if((loc = tok->loc))
+      if((loc = js_token_location(ctx, tok)))
         ret = offset_toarray(token_char_range(tok), ctx);
       break;
     }
     case TOKEN_PROP_LEXEME: {
-      ret = JS_NewStringLen(ctx, (const char*)tok->lexeme, tok->byte_length);
+      ret = js_token_lexeme(ctx, tok);
       break;
     }
     case TOKEN_PROP_LOC: {
       Location* loc;
 
-      if((loc = location_dup(tok->loc)))
-        ret = js_location_wrap(ctx, loc);
+      if((loc = js_token_location(ctx, tok)))
+        ret = js_location_wrap(ctx, location_dup(loc));
 
       break;
     }
@@ -307,6 +343,10 @@ js_token_get(JSContext* ctx, JSValueConst this_val, int magic) {
       ret = rule ? JS_NewString(ctx, rule->name) : JS_NULL;
       break;
     }
+    case TOKEN_PROP_INTERNED: {
+      ret = JS_NewBool(ctx, tok->atom != JS_ATOM_NULL);
+      break;
+    }
   }
   return ret;
 }
@@ -340,6 +380,7 @@ static const JSCFunctionListEntry js_token_proto_funcs[] = {
     JS_CGETSET_MAGIC_DEF("type", js_token_get, NULL, TOKEN_PROP_TYPE),
     JS_CGETSET_MAGIC_DEF("rule", js_token_get, NULL, TOKEN_PROP_RULE),
     JS_CGETSET_MAGIC_DEF("lexeme", js_token_get, NULL, TOKEN_PROP_LEXEME),
+    JS_CGETSET_MAGIC_DEF("interned", js_token_get, NULL, TOKEN_PROP_INTERNED),
     JS_CGETSET_MAGIC_DEF("value", js_token_get, NULL, TOKEN_PROP_LEXEME),
     // JS_CFUNC_DEF("toString", 0, js_token_tostring),
     // JS_CFUNC_DEF("[Symbol.toPrimitive]", 1, js_token_toprimitive),
@@ -412,7 +453,7 @@ lexer_lex(Lexer* lex, JSContext* ctx, JSValueConst this_val, int argc, JSValueCo
 
       JSLexerRule* jsrule = rule->opaque;
       if((rule->mask & skip)) {
-        lexer_skip(lex);
+        lexer_skip_run(lex);
         continue;
       }
       if(jsrule) {
@@ -526,14 +567,31 @@ static Token*
 lexer_token(Lexer* lex, int32_t id, JSContext* ctx) {
   size_t len;
   const char* lexeme;
+  Location* loc = 0;
+  TokenSource* src;
   Token* tok;
 
   if(!(lexeme = lexer_lexeme(lex, &len)))
     return 0;
 
-  if(!(tok = token_create(id, location_clone(&lex->loc, ctx), lexeme, len, ctx)))
+  /* in lazy mode the location is resolved from the line index when read */
+  if(!lex->lazy || lex->stream != LEXER_STREAM_NONE)
+    loc = location_clone(lexer_location(lex), ctx);
+
+  /* a streamed buffer is compacted, so its lexemes have to be copied */
+  if((src = lexer_source(lex, ctx)))
+    tok = token_slice(id, loc, src, lexeme, len, ctx);
+  else
+    tok = token_create(id, loc, lexeme, len, ctx);
+
+  if(!tok)
     return 0;
 
+  if(!loc) {
+    tok->pos = lex->input.pos;
+    tok->generation = lex->lines.generation;
+  }
+
   tok->lexer = lexer_dup(lex);
   tok->seq = lex->seq;
 
@@ -671,6 +729,10 @@ enum {
   METHOD_PUSH_STATE,
   METHOD_POP_STATE,
   METHOD_TOP_STATE,
+  METHOD_FEED,
+  METHOD_END,
+  METHOD_SERIALIZE,
+  METHOD_DESERIALIZE,
 };
 
 JSValue
@@ -688,17 +750,29 @@ js_lexer_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
       Location loc = {0, 0, 0, -1, 0};
 
       if((other = JS_GetOpaque(argv[0], js_lexer_class_id))) {
-        input = input_buffer_clone(&other->input, ctx);
-        loc = other->loc;
+        input = input_buffer_clone(other->source ? &other->source->input : &other->input, ctx);
+        input.pos = other->input.pos;
+        loc = *lexer_location(other);
         // lex->start = other->start;
       } else {
         input = js_input_chars(ctx, argv[0]);
       }
 
       input_buffer_free(&lex->input, ctx);
+      lexer_source_drop(lex);
+
+      if(lex->stream) {
+        dbuf_free(&lex->buffer);
+        lex->stream = LEXER_STREAM_NONE;
+      }
+
       lex->input = input;
       location_release_rt(&lex->loc, JS_GetRuntime(ctx));
       lex->loc = loc;
+      lex->loc_pos = lex->input.pos;
+
+      if(lex->lazy)
+        lexer_lines_reset(lex);
 
       if(argc > 1 && JS_IsString(argv[1])) {
         if(lex->loc.file > -1)
@@ -722,7 +796,7 @@ js_lexer_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
         if((loc = js_location_data2(ctx, argv[i]))) {
           lexer_set_location(lex, loc, ctx);
           ret = JS_NewInt32(ctx, lexer_peek(lex, 1 << lex->state, 0, ctx));
-        } else if((tok = js_token_data(argv[i]))) {
+        } else if((tok = js_token_data(argv[i])) && js_token_location(ctx, tok)) {
           lexer_set_location(lex, tok->loc, ctx);
           lex->byte_length = tok->byte_length;
           lex->seq = tok->seq;
@@ -734,7 +808,7 @@ js_lexer_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
             Location diff;
             location_zero(&diff);
             location_count(&diff, (const uint8_t*)&lex->input.data[lex->input.pos - len], len);
-            location_sub(&lex->loc, &diff);
+            location_sub(lexer_location(lex), &diff);
             ret = JS_NewInt32(ctx, lexer_peek(lex, 1 << lex->state, 0, ctx));
           } else {
             char* buf = byte_escape((const char*)&lex->input.data[lex->input.pos - len], len);
@@ -861,7 +935,7 @@ js_lexer_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
 
     case METHOD_ERROR: {
       const char* message = JS_ToCString(ctx, argv[0]);
-      char* location = location_tostring(&lex->loc, ctx);
+      char* location = location_tostring(lexer_location(lex), ctx);
 
       ret = JS_ThrowSyntaxError(ctx, "%s at %s", message, location);
 
@@ -904,6 +978,43 @@ js_lexer_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
         ret = JS_NewString(ctx, lexer_state_name(lex, id));
       break;
     }
+
+    case METHOD_FEED: {
+      InputBuffer input = js_input_chars(ctx, argv[0]);
+
+      if(!lexer_feed(lex, input_buffer_data(&input), input_buffer_length(&input), ctx))
+        ret = JS_ThrowInternalError(ctx, lex->stream == LEXER_STREAM_END ? "Lexer.prototype.feed() after end()" : "Lexer.prototype.feed() out of memory");
+
+      input_buffer_free(&input, ctx);
+      break;
+    }
+
+    case METHOD_END: {
+      lexer_end(lex);
+      break;
+    }
+
+    case METHOD_SERIALIZE: {
+      DynBuf db;
+      js_dbuf_init(ctx, &db);
+
+      if(!lexer_serialize(lex, &db, ctx)) {
+        dbuf_free(&db);
+        ret = JS_EXCEPTION;
+        break;
+      }
+
+      ret = JS_NewArrayBuffer(ctx, db.buf, db.size, (JSFreeArrayBufferDataFunc*)&js_free_rt, db.buf, FALSE);
+      break;
+    }
+
+    case METHOD_DESERIALIZE: {
+      InputBuffer input = js_input_buffer(ctx, argv[0]);
+
+      ret = JS_NewBool(ctx, lexer_deserialize(lex, input_buffer_data(&input), input_buffer_length(&input), ctx));
+      input_buffer_free(&input, ctx);
+      break;
+    }
   }
   return ret;
 }
@@ -927,6 +1038,8 @@ enum {
   PROP_SOURCE,
   PROP_LEXEME,
   PROP_TOKEN,
+  PROP_LAZY,
+  PROP_INTERN,
 };
 
 JSValue
@@ -954,7 +1067,7 @@ js_lexer_get(JSContext* ctx, JSValueConst this_val, int magic) {
           }*/
 
     case PROP_EOF: {
-      ret = JS_NewBool(ctx, input_buffer_eof(&lex->input));
+      ret = JS_NewBool(ctx, lex->stream != LEXER_STREAM_OPEN && input_buffer_eof(&lex->input));
       break;
     }
 
@@ -967,7 +1080,7 @@ js_lexer_get(JSContext* ctx, JSValueConst this_val, int magic) {
       Location* loc;
 
       if((loc = location_new(ctx))) {
-        location_copy(loc, &lex->loc, ctx);
+        location_copy(loc, lexer_location(lex), ctx);
         ret = js_location_wrap(ctx, loc);
       }
       break;
@@ -1000,6 +1113,16 @@ js_lexer_get(JSContext* ctx, JSValueConst this_val, int magic) {
       break;
     }
 
+    case PROP_LAZY: {
+      ret = JS_NewBool(ctx, lex->lazy);
+      break;
+    }
+
+    case PROP_INTERN: {
+      ret = JS_NewUint32(ctx, lex->intern);
+      break;
+    }
+
     case PROP_SEQ: {
       ret = JS_NewInt64(ctx, lex->seq);
       break;
@@ -1081,11 +1204,12 @@ js_lexer_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, int magi
   switch(magic) {
     case PROP_POS: {
       Token* tok;
-      if((tok = js_token_data(value))) {
+      if((tok = js_token_data(value)) && js_token_location(ctx, tok)) {
         lex->input.pos = tok->loc->char_offset;
 
         location_release(&lex->loc, ctx);
         location_copy(&lex->loc, tok->loc, ctx);
+        lex->loc_pos = lex->input.pos;
         //        lex->loc = tok->loc;
       }
       break;
@@ -1114,6 +1238,15 @@ js_lexer_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, int magi
       lex->mode = m;
       break;
     }
+
+    case PROP_LAZY: {
+      lexer_set_lazy(lex, JS_ToBool(ctx, value));
+      break;
+    }
+    case PROP_INTERN: {
+      JS_ToUint32(ctx, &lex->intern, value);
+      break;
+    }
     case PROP_SEQ: {
       uint64_t s;
       JS_ToIndex(ctx, &s, value);
@@ -1217,6 +1350,31 @@ js_lexer_tostring(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst
   return ret;
 }
 
+static JSValue
+lexer_nomatch_error(Lexer* lex, JSContext* ctx) {
+  JSValue ret;
+  char* lexeme = lexer_lexeme_s(lex, ctx);
+  char* file = location_file(lexer_location(lex), ctx);
+
+  ret = JS_ThrowInternalError(ctx,
+                              "%s:%" PRIu32 ":%" PRIu32 ": No matching token (%d: %s) '%s'\n%.*s\n%*s",
+                              file,
+                              lex->loc.line + 1,
+                              lex->loc.column + 1,
+                              lexer_state_top(lex, 0),
+                              lexer_state_name(lex, lexer_state_top(lex, 0)),
+                              lexeme,
+                              (int)(byte_chr((const char*)&lex->input.data[lex->input.pos], lex->input.size - lex->input.pos, '\n') + lex->loc.column),
+                              &lex->input.data[lex->input.pos - lex->loc.column],
+                              lex->loc.column + 1,
+                              "^");
+  if(file)
+    js_free(ctx, file);
+  js_free(ctx, lexeme);
+
+  return ret;
+}
+
 JSValue
 js_lexer_lex(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   JSValue ret = JS_UNDEFINED;
@@ -1239,30 +1397,17 @@ js_lexer_lex(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[
 
   switch(id) {
     case LEXER_ERROR_NOMATCH: {
-      char* lexeme = lexer_lexeme_s(lex, ctx);
-      char* file = location_file(&lex->loc, ctx);
-
-      ret = JS_ThrowInternalError(ctx,
-                                  "%s:%" PRIu32 ":%" PRIu32 ": No matching token (%d: %s) '%s'\n%.*s\n%*s",
-                                  file,
-                                  lex->loc.line + 1,
-                                  lex->loc.column + 1,
-                                  lexer_state_top(lex, 0),
-                                  lexer_state_name(lex, lexer_state_top(lex, 0)),
-                                  lexeme,
-                                  (int)(byte_chr((const char*)&lex->input.data[lex->input.pos], lex->input.size - lex->input.pos, '\n') + lex->loc.column),
-                                  &lex->input.data[lex->input.pos - lex->loc.column],
-                                  lex->loc.column + 1,
-                                  "^");
-      if(file)
-        js_free(ctx, file);
-      js_free(ctx, lexeme);
+      ret = lexer_nomatch_error(lex, ctx);
       break;
     }
     case LEXER_EOF: {
       ret = JS_NULL;
       break;
     }
+    case LEXER_NEED_INPUT: {
+      ret = JS_UNDEFINED;
+      break;
+    }
     case LEXER_EXCEPTION: {
       ret = JS_EXCEPTION;
       break;
@@ -1276,6 +1421,354 @@ js_lexer_lex(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[
   return ret;
 }
 
+enum {
+  TOKEN_RECORD_ID = 0,
+  TOKEN_RECORD_OFFSET,
+  TOKEN_RECORD_LENGTH,
+  TOKEN_RECORD_LINE,
+  TOKEN_RECORD_COLUMN,
+  TOKEN_RECORD_STATE,
+  TOKEN_RECORD_FIELDS,
+};
+
+static inline void
+lexer_record(Lexer* lex, int id, int32_t state, uint32_t record[TOKEN_RECORD_FIELDS]) {
+  Location* loc = lexer_location(lex);
+
+  record[TOKEN_RECORD_ID] = id;
+  record[TOKEN_RECORD_OFFSET] = lex->input.pos;
+  record[TOKEN_RECORD_LENGTH] = lex->byte_length;
+  record[TOKEN_RECORD_LINE] = loc->line;
+  record[TOKEN_RECORD_COLUMN] = loc->column;
+  record[TOKEN_RECORD_STATE] = state;
+}
+
+static JSValue
+lexer_table_value(DynBuf* table, JSContext* ctx) {
+  JSValue buf, ret;
+
+  buf = JS_NewArrayBuffer(ctx, table->buf, table->size, (JSFreeArrayBufferDataFunc*)&js_free_rt, table->buf, FALSE);
+  ret = js_typedarray_new(ctx, 32, FALSE, FALSE, buf);
+  JS_FreeValue(ctx, buf);
+
+  return ret;
+}
+
+#ifdef HAVE_THREADS_H
+/* segments are large enough to amortize the runtime each thread creates */
+#define LEXER_SEGMENT_MIN 65536
+
+typedef struct {
+  Lexer lex;
+  size_t start, end;
+  DynBuf table;
+  int result;
+  thrd_t thread;
+  BOOL running;
+} LexerSegment;
+
+static BOOL
+lexer_parallel_ok(Lexer* lex, JSContext* ctx, JSValueConst this_val) {
+  static const char* const hooks[] = {"callback", "handler"};
+  LexerRule* rule;
+  size_t i;
+
+  if(lex->stream != LEXER_STREAM_NONE)
+    return FALSE;
+
+  vector_foreach_t(&lex->rules, rule) {
+    JSLexerRule* jsrule = rule->opaque;
+
+    if(jsrule && JS_IsFunction(ctx, jsrule->action))
+      return FALSE;
+  }
+
+  for(i = 0; i < countof(hooks); i++) {
+    JSValue fn = JS_GetPropertyStr(ctx, this_val, hooks[i]);
+    BOOL set = JS_IsFunction(ctx, fn);
+
+    JS_FreeValue(ctx, fn);
+
+    if(set)
+      return FALSE;
+  }
+
+  /* the worker threads must only read the compiled rules and tables */
+  if(!lexer_compile_rules(lex, ctx) ||
+     (lex->dispatch_rules != vector_size(&lex->rules, sizeof(LexerRule)) && !lexer_dispatch_build(lex, ctx))) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    lexer_dispatch_free(lex, JS_GetRuntime(ctx));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+lexer_segment_init(LexerSegment* seg, Lexer* lex, size_t start, size_t end) {
+  seg->lex = *lex;
+  seg->lex.input.pos = start;
+  seg->lex.byte_length = 0;
+  seg->lex.token_id = -1;
+  seg->lex.loc.file = -1;
+  seg->lex.loc.str = 0;
+  seg->lex.lazy = FALSE;
+  location_zero(&seg->lex.loc);
+  seg->start = start;
+  seg->end = end;
+  seg->result = 0;
+  seg->table.size = 0;
+}
+
+/* lexes a private copy of the lexer up to the segment end; the last token
+ * may extend past it */
+static int
+lexer_segment_lex(LexerSegment* seg, JSContext* ctx) {
+  Lexer* lex = &seg->lex;
+  int id, start_rule = 0;
+
+  while(lex->input.pos < seg->end) {
+    uint32_t record[TOKEN_RECORD_FIELDS];
+    JSLexerRule* jsrule;
+
+    if((id = lexer_peek(lex, 0, start_rule, ctx)) < 0)
+      return id;
+
+    if((jsrule = lexer_rule_at(lex, id)->opaque) && jsrule->skip) {
+      start_rule = id + 1;
+      continue;
+    }
+
+    lexer_record(lex, id, lex->state, record);
+
+    if(dbuf_put(&seg->table, (const uint8_t*)record, sizeof(record)))
+      return LEXER_EXCEPTION;
+
+    lexer_skip(lex);
+    start_rule = 0;
+  }
+
+  return 0;
+}
+
+static int
+lexer_segment_thread(void* arg) {
+  LexerSegment* seg = arg;
+  JSRuntime* rt;
+  JSContext* ctx = 0;
+
+  /* libregexp needs a context of its own for its backtracking stack.  A
+   * runtime is bound to the thread using it, so each call creates one per
+   * segment rather than keeping a pool of them between calls. */
+  if((rt = JS_NewRuntime()) && (ctx = JS_NewContextRaw(rt)))
+    seg->result = lexer_segment_lex(seg, ctx);
+  else
+    seg->result = LEXER_EXCEPTION;
+
+  if(ctx)
+    JS_FreeContext(ctx);
+  if(rt)
+    JS_FreeRuntime(rt);
+
+  return 0;
+}
+
+static void
+lexer_location_advance(Location* loc, const Location* delta) {
+  loc->column = delta->line ? delta->column : loc->column + delta->column;
+  loc->line += delta->line;
+  loc->char_offset += delta->char_offset;
+  loc->byte_offset += delta->byte_offset;
+}
+
+static JSValue
+lexer_tokenize_parallel(Lexer* lex, JSContext* ctx, uint32_t nthreads) {
+  LexerSegment* segs;
+  Location cur;
+  size_t size = lex->input.size, pos, chunk;
+  uint32_t i, n = 0;
+  uint64_t count = 0;
+  int error = 0;
+  DynBuf table;
+
+  if(lex->byte_length)
+    lexer_skip(lex);
+
+  cur = *lexer_location(lex);
+  pos = lex->input.pos;
+  nthreads = MIN_NUM(nthreads, (size - pos) / LEXER_SEGMENT_MIN + 1);
+  chunk = (size - pos) / nthreads;
+
+  if(!(segs = js_mallocz(ctx, sizeof(LexerSegment) * nthreads)))
+    return JS_EXCEPTION;
+
+  /* split after newlines, assuming each segment starts in the current state */
+  for(i = 0; i < nthreads && pos < size; i++) {
+    LexerSegment* seg = &segs[n++];
+    size_t end = size;
+    const uint8_t* nl;
+
+    if(i + 1 < nthreads && pos + chunk < size)
+      if((nl = memchr(&lex->input.data[pos + chunk], '\n', size - (pos + chunk))))
+        end = nl + 1 - lex->input.data;
+
+    dbuf_init(&seg->table);
+    lexer_segment_init(seg, lex, pos, end);
+    seg->running = thrd_create(&seg->thread, lexer_segment_thread, seg) == thrd_success;
+
+    if(!seg->running)
+      lexer_segment_thread(seg);
+
+    pos = end;
+  }
+
+  js_dbuf_init(ctx, &table);
+  pos = lex->input.pos;
+
+  for(i = 0; i < n; i++) {
+    LexerSegment* seg = &segs[i];
+    uint32_t* record;
+
+    if(seg->running) {
+      thrd_join(seg->thread, 0);
+      seg->running = FALSE;
+    }
+
+    if(error)
+      continue;
+
+    /* a token crossed the split point or the thread failed: re-lex the
+     * segment sequentially from where the previous one actually ended */
+    if(seg->start != pos || seg->result == LEXER_EXCEPTION) {
+      lexer_segment_init(seg, lex, pos, seg->end);
+      seg->result = lexer_segment_lex(seg, ctx);
+    }
+
+    for(record = (uint32_t*)seg->table.buf; record < (uint32_t*)(seg->table.buf + seg->table.size); record += TOKEN_RECORD_FIELDS) {
+      if(record[TOKEN_RECORD_LINE] == 0)
+        record[TOKEN_RECORD_COLUMN] += cur.column;
+      record[TOKEN_RECORD_LINE] += cur.line;
+    }
+
+    if(dbuf_put(&table, seg->table.buf, seg->table.size))
+      seg->result = LEXER_EXCEPTION;
+
+    count += seg->table.size / (sizeof(uint32_t) * TOKEN_RECORD_FIELDS);
+    lexer_location_advance(&cur, &seg->lex.loc);
+    pos = MAX_NUM(pos, seg->lex.input.pos);
+
+    if(seg->result < 0)
+      error = seg->result;
+  }
+
+  for(i = 0; i < n; i++) dbuf_free(&segs[i].table);
+  js_free(ctx, segs);
+
+  lex->input.pos = pos;
+  lex->loc.line = cur.line;
+  lex->loc.column = cur.column;
+  lex->loc.char_offset = cur.char_offset;
+  lex->loc.byte_offset = cur.byte_offset;
+  lex->loc_pos = pos;
+  lex->byte_length = 0;
+  lex->token_id = -1;
+  lex->seq += count;
+
+  if(error) {
+    dbuf_free(&table);
+    return error == LEXER_ERROR_NOMATCH ? lexer_nomatch_error(lex, ctx) : JS_ThrowOutOfMemory(ctx);
+  }
+
+  return lexer_table_value(&table, ctx);
+}
+#endif
+
+/**
+ * lexer.tokenize([input], [{ batch }])
+ *
+ * Lexes without creating Token objects and returns a Uint32Array of
+ * TOKEN_RECORD_FIELDS entries per token.  With a batch size, at most that
+ * many tokens are returned per call and null signals the end of input (or,
+ * after feed(), that more input is needed).
+ * Lexemes can be materialized lazily through lexer.getRange().
+ *
+ * With { threads } the remaining input is split after newlines and the
+ * segments are lexed concurrently, provided no rule has an action and no
+ * callback/handler is set; otherwise it lexes sequentially.  Each segment
+ * of at least 64KiB is lexed in a runtime created for it, and a segment
+ * that starts inside a token is lexed again sequentially.
+ */
+JSValue
+js_lexer_tokenize(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  Lexer* lex;
+  DynBuf table;
+  uint32_t batch = 0, count = 0, threads = 0;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(lex = js_lexer_data2(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  if(argc > 0 && !JS_IsUndefined(argv[0]) && !JS_IsNull(argv[0])) {
+    ret = js_lexer_method(ctx, this_val, 1, argv, METHOD_SET_INPUT);
+
+    if(JS_IsException(ret))
+      return ret;
+  }
+
+  if(argc > 1) {
+    if(JS_IsNumber(argv[1])) {
+      JS_ToUint32(ctx, &batch, argv[1]);
+    } else if(JS_IsObject(argv[1])) {
+      JSValue value = JS_GetPropertyStr(ctx, argv[1], "batch");
+      if(!JS_IsUndefined(value))
+        JS_ToUint32(ctx, &batch, value);
+      JS_FreeValue(ctx, value);
+
+      value = JS_GetPropertyStr(ctx, argv[1], "threads");
+      if(!JS_IsUndefined(value))
+        JS_ToUint32(ctx, &threads, value);
+      JS_FreeValue(ctx, value);
+    }
+  }
+
+#ifdef HAVE_THREADS_H
+  if(threads > 1 && batch == 0 && lexer_parallel_ok(lex, ctx, this_val))
+    return lexer_tokenize_parallel(lex, ctx, threads);
+#endif
+
+  js_dbuf_init(ctx, &table);
+
+  while(batch == 0 || count < batch) {
+    uint32_t record[TOKEN_RECORD_FIELDS];
+    int32_t state = lex->state;
+    int id = lexer_lex(lex, ctx, this_val, 0, 0);
+
+    if(id == LEXER_EOF || id == LEXER_NEED_INPUT)
+      break;
+
+    if(id < 0) {
+      dbuf_free(&table);
+      return id == LEXER_ERROR_NOMATCH ? lexer_nomatch_error(lex, ctx) : JS_EXCEPTION;
+    }
+
+    lexer_record(lex, id, state, record);
+
+    if(dbuf_put(&table, (const uint8_t*)record, sizeof(record))) {
+      dbuf_free(&table);
+      return JS_ThrowOutOfMemory(ctx);
+    }
+
+    ++count;
+  }
+
+  if(batch && count == 0) {
+    dbuf_free(&table);
+    return JS_NULL;
+  }
+
+  return lexer_table_value(&table, ctx);
+}
+
 enum {
   YIELD_ID = 0,
   YIELD_OBJ = 1,
@@ -1406,6 +1899,8 @@ static const JSCFunctionListEntry js_lexer_proto_funcs[] = {
     JS_CGETSET_MAGIC_DEF("eof", js_lexer_get, 0, PROP_EOF),
     JS_CGETSET_MAGIC_DEF("mode", js_lexer_get, js_lexer_set, PROP_MODE),
     JS_CGETSET_MAGIC_DEF("seq", js_lexer_get, js_lexer_set, PROP_SEQ),
+    JS_CGETSET_MAGIC_DEF("lazy", js_lexer_get, js_lexer_set, PROP_LAZY),
+    JS_CGETSET_MAGIC_DEF("intern", js_lexer_get, js_lexer_set, PROP_INTERN),
     JS_CGETSET_MAGIC_DEF("byteLength", js_lexer_get, 0, PROP_BYTE_LENGTH),
     JS_CGETSET_MAGIC_DEF("charLength", js_lexer_get, 0, PROP_CHAR_LENGTH),
     JS_CGETSET_MAGIC_DEF("state", js_lexer_get, 0, PROP_STATE),
@@ -1417,6 +1912,10 @@ static const JSCFunctionListEntry js_lexer_proto_funcs[] = {
     JS_CGETSET_MAGIC_DEF("token", js_lexer_get, 0, PROP_TOKEN),
     JS_CGETSET_MAGIC_DEF("fileName", js_lexer_get, js_lexer_set, PROP_FILENAME),
     JS_CFUNC_MAGIC_DEF("setInput", 1, js_lexer_method, METHOD_SET_INPUT),
+    JS_CFUNC_MAGIC_DEF("feed", 1, js_lexer_method, METHOD_FEED),
+    JS_CFUNC_MAGIC_DEF("end", 0, js_lexer_method, METHOD_END),
+    JS_CFUNC_MAGIC_DEF("serialize", 0, js_lexer_method, METHOD_SERIALIZE),
+    JS_CFUNC_MAGIC_DEF("deserialize", 1, js_lexer_method, METHOD_DESERIALIZE),
     JS_CFUNC_MAGIC_DEF("skip", 0, js_lexer_method, METHOD_SKIP),
     JS_CFUNC_MAGIC_DEF("skipUntil", 1, js_lexer_method, METHOD_SKIPUNTIL),
     JS_CFUNC_MAGIC_DEF("tokenClass", 1, js_lexer_method, METHOD_TOKEN_CLASS),
@@ -1432,6 +1931,7 @@ static const JSCFunctionListEntry js_lexer_proto_funcs[] = {
     JS_CGETSET_MAGIC_DEF("ruleNames", js_lexer_get, 0, PROP_RULENAMES),
     JS_CGETSET_MAGIC_DEF("rules", js_lexer_get, 0, PROP_RULES),
     JS_CFUNC_DEF("lex", 0, js_lexer_lex),
+    JS_CFUNC_DEF("tokenize", 0, js_lexer_tokenize),
     JS_CFUNC_DEF("inspect", 0, js_lexer_inspect),
     JS_CGETSET_DEF("tokens", js_lexer_tokens, 0),
     JS_CGETSET_DEF("states", js_lexer_states, 0),
@@ -1450,6 +1950,13 @@ static const JSCFunctionListEntry js_lexer_static_funcs[] = {
     JS_PROP_INT32_DEF("LAST", LEXER_LAST, JS_PROP_ENUMERABLE),
     JS_PROP_INT32_DEF("YIELD_ID", YIELD_ID, JS_PROP_ENUMERABLE),
     JS_PROP_INT32_DEF("YIELD_OBJ", YIELD_OBJ, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_ID", TOKEN_RECORD_ID, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_OFFSET", TOKEN_RECORD_OFFSET, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_LENGTH", TOKEN_RECORD_LENGTH, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_LINE", TOKEN_RECORD_LINE, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_COLUMN", TOKEN_RECORD_COLUMN, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_STATE", TOKEN_RECORD_STATE, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("TOKEN_FIELDS", TOKEN_RECORD_FIELDS, JS_PROP_ENUMERABLE),
 };
 
 int
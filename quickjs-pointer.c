@@ -474,11 +474,16 @@ static JSClassDef js_pointer_class = {
     .exotic = &js_pointer_exotic_methods,
 };
 
-static int
+VISIBLE int
 js_pointer_init(JSContext* ctx, JSModuleDef* m) {
-  JSAtom inspectAtom;
-  JS_NewClassID(&js_pointer_class_id);
-  JS_NewClass(JS_GetRuntime(ctx), js_pointer_class_id, &js_pointer_class);
+  JSRuntime* rt = JS_GetRuntime(ctx);
+
+  if(js_pointer_class_id == 0)
+    JS_NewClassID(&js_pointer_class_id);
+
+  /* once per runtime, the prototype and constructor once per context */
+  if(!JS_IsRegisteredClass(rt, js_pointer_class_id))
+    JS_NewClass(rt, js_pointer_class_id, &js_pointer_class);
 
   pointer_proto = JS_NewObject(ctx);
   JS_SetPropertyFunctionList(ctx, pointer_proto, js_pointer_proto_funcs, countof(js_pointer_proto_funcs));
@@ -498,9 +503,11 @@ js_pointer_init(JSContext* ctx, JSModuleDef* m) {
   JS_SetConstructor(ctx, pointer_ctor, pointer_proto);
   JS_SetPropertyFunctionList(ctx, pointer_ctor, js_pointer_static_funcs, countof(js_pointer_static_funcs));
 
-  if(m) {
+  if(m)
     JS_SetModuleExport(ctx, m, "Pointer", pointer_ctor);
-  }
+  else
+    /* still referenced by the prototype */
+    JS_FreeValue(ctx, pointer_ctor);
 
   return 0;
 }
@@ -23,6 +23,7 @@ js_pointer_data(JSValueConst value) {
 
 JSValue js_pointer_wrap(JSContext*, Pointer*);
 JSValue js_pointer_new(JSContext*, JSValueConst, JSValueConst);
+int js_pointer_init(JSContext*, JSModuleDef*);
 
 /**
  * @}
@@ -9,6 +9,10 @@
 #include "include/debug.h"
 
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
 
 char* js_inspect_tostring(JSContext* ctx, JSValueConst value);
 
@@ -29,6 +33,17 @@ char* js_inspect_tostring(JSContext* ctx, JSValueConst value);
 #define EXCLAM 0x400
 #define HYPHEN 0x400
 
+/* the WS class: XML whitespace is just these, unlike is_whitespace_char() */
+#define XML_SPACE " \t\r\n"
+
+#define xml_skipspace(s, n) byte_spn((s), (n), XML_SPACE, 4)
+
+thread_local VISIBLE JSClassID js_xml_parser_class_id = 0, js_xml_element_class_id = 0, js_xml_document_class_id = 0, js_xml_selector_class_id = 0, js_xml_writer_class_id = 0;
+thread_local JSValue xml_parser_proto = {{JS_TAG_UNDEFINED}}, xml_parser_ctor = {{JS_TAG_UNDEFINED}};
+thread_local JSValue xml_document_proto = {{JS_TAG_UNDEFINED}}, xml_document_ctor = {{JS_TAG_UNDEFINED}};
+thread_local JSValue xml_selector_proto = {{JS_TAG_UNDEFINED}}, xml_selector_ctor = {{JS_TAG_UNDEFINED}};
+thread_local JSValue xml_writer_proto = {{JS_TAG_UNDEFINED}}, xml_writer_ctor = {{JS_TAG_UNDEFINED}};
+
 static int chars[256] = {0};
 
 static const char* const default_self_closing_tags[] = {
@@ -54,10 +69,12 @@ typedef struct {
   JSValue obj;
   const uint8_t* name;
   size_t namelen;
+  JSValue element;             /* the element 'obj' is the children of */
+  uint32_t start, offset, prev; /* for its span: where it starts, relative start, end of the last element child */
 } OutputValue;
 
 typedef struct {
-  BOOL flat, tolerant;
+  BOOL flat, tolerant, lazy, spans, decode;
   const char* const* self_closing_tags;
 } ParseOptions;
 
@@ -88,8 +105,9 @@ character_classes_init(int c[256]) {
 #define yield_push() \
   do { \
     xml_debug("push  [%zu] %.*s\n", vector_size(&st, sizeof(OutputValue)), (int)namelen, name); \
-    out = vector_push(&st, ((OutputValue){0, JS_NewArray(ctx), name, namelen})); \
-    JS_SetPropertyStr(ctx, element, "children", out->obj); \
+    uint32_t pos = start - buf, offset = pos - out->prev; \
+    out = vector_push(&st, ((OutputValue){0, JS_NewArray(ctx), name, namelen, element, pos, offset, pos})); \
+    JS_DefinePropertyValue(ctx, element, names.children, out->obj, JS_PROP_C_W_E); \
   } while(0)
 
 #define yield_pop() \
@@ -135,7 +153,19 @@ character_classes_init(int c[256]) {
   } while(!done)
 
 #define parse_until(cond) parse_skip(!(cond))
-#define parse_skipspace() parse_skip(chars[c] & WS)
+#define parse_advance(n) \
+  do { \
+    size_t n_ = (n); \
+    if((ptr += n_) >= end) { \
+      done = TRUE; \
+      if(n_) \
+        c = ptr[-1]; \
+    } else { \
+      c = *ptr; \
+    } \
+  } while(0)
+#define parse_skipspace() parse_advance(ptr < end ? xml_skipspace(ptr, end - ptr) : 0)
+#define parse_find(ch) parse_advance(ptr < end ? byte_chr(ptr, end - ptr, (ch)) : 0)
 #define parse_is(c, classes) (chars[(c)] & (classes))
 #define parse_inside(tag) (strlen((tag)) == out->namelen && !strncmp((const char*)out->name, (const char*)(tag), out->namelen))
 #define parse_close() (ptr[0] == '<' && ptr[1] == '/' && !strncmp((const char*)&ptr[2], (const char*)out->name, out->namelen) && ptr[2 + out->namelen] == '>')
@@ -169,6 +199,219 @@ is_self_closing_tag(const char* name, size_t namelen, const ParseOptions* opts)
   return FALSE;
 }
 
+static void
+xml_parse_options(JSContext* ctx, JSValueConst obj, ParseOptions* opts) {
+  JSValue tags;
+
+  opts->flat = js_get_propertystr_bool(ctx, obj, "flat");
+  opts->tolerant = js_get_propertystr_bool(ctx, obj, "tolerant");
+  opts->lazy = js_get_propertystr_bool(ctx, obj, "lazy");
+  opts->spans = js_get_propertystr_bool(ctx, obj, "spans");
+  opts->decode = js_get_propertystr_bool(ctx, obj, "decode");
+  tags = JS_GetPropertyStr(ctx, obj, "selfClosingTags");
+
+  if(JS_IsArray(ctx, tags)) {
+    int ac = -1;
+    opts->self_closing_tags = (const char* const*)js_array_to_argv(ctx, &ac, tags);
+  }
+
+  JS_FreeValue(ctx, tags);
+}
+
+static void
+xml_parse_options_free(JSRuntime* rt, ParseOptions* opts) {
+  if(opts->self_closing_tags != default_self_closing_tags)
+    js_strv_free_rt(rt, (char**)opts->self_closing_tags);
+
+  opts->self_closing_tags = default_self_closing_tags;
+}
+
+/* the named entities of HTML 4 which are in common use, sorted by name, for xml.decode() */
+static const struct {
+  const char* name;
+  int32_t code;
+} xml_entities[] = {
+    {"AElig", 198}, {"Aacute", 193}, {"Acirc", 194}, {"Agrave", 192}, {"Aring", 197}, {"Atilde", 195}, {"Auml", 196},
+    {"Ccedil", 199}, {"Dagger", 8225}, {"ETH", 208}, {"Eacute", 201}, {"Ecirc", 202}, {"Egrave", 200}, {"Euml", 203},
+    {"Iacute", 205}, {"Icirc", 206}, {"Igrave", 204}, {"Iuml", 207}, {"Ntilde", 209}, {"OElig", 338}, {"Oacute", 211},
+    {"Ocirc", 212}, {"Ograve", 210}, {"Oslash", 216}, {"Otilde", 213}, {"Ouml", 214}, {"Prime", 8243}, {"Scaron", 352},
+    {"THORN", 222}, {"Uacute", 218}, {"Ucirc", 219}, {"Ugrave", 217}, {"Uuml", 220}, {"Yacute", 221}, {"Yuml", 376},
+    {"aacute", 225}, {"acirc", 226}, {"acute", 180}, {"aelig", 230}, {"agrave", 224}, {"amp", 38}, {"apos", 39},
+    {"aring", 229}, {"asymp", 8776}, {"atilde", 227}, {"auml", 228}, {"bdquo", 8222}, {"brvbar", 166}, {"bull", 8226},
+    {"ccedil", 231}, {"cedil", 184}, {"cent", 162}, {"circ", 710}, {"clubs", 9827}, {"copy", 169}, {"curren", 164},
+    {"dagger", 8224}, {"darr", 8595}, {"deg", 176}, {"diams", 9830}, {"divide", 247}, {"eacute", 233}, {"ecirc", 234},
+    {"egrave", 232}, {"emsp", 8195}, {"ensp", 8194}, {"eth", 240}, {"euml", 235}, {"euro", 8364}, {"fnof", 402},
+    {"frac12", 189}, {"frac14", 188}, {"frac34", 190}, {"ge", 8805}, {"gt", 62}, {"harr", 8596}, {"hearts", 9829},
+    {"hellip", 8230}, {"iacute", 237}, {"icirc", 238}, {"iexcl", 161}, {"igrave", 236}, {"infin", 8734},
+    {"iquest", 191}, {"iuml", 239}, {"laquo", 171}, {"larr", 8592}, {"ldquo", 8220}, {"le", 8804}, {"lrm", 8206},
+    {"lsaquo", 8249}, {"lsquo", 8216}, {"lt", 60}, {"macr", 175}, {"mdash", 8212}, {"micro", 181}, {"middot", 183},
+    {"minus", 8722}, {"nbsp", 160}, {"ndash", 8211}, {"ne", 8800}, {"not", 172}, {"ntilde", 241}, {"oacute", 243},
+    {"ocirc", 244}, {"oelig", 339}, {"ograve", 242}, {"ordf", 170}, {"ordm", 186}, {"oslash", 248}, {"otilde", 245},
+    {"ouml", 246}, {"para", 182}, {"permil", 8240}, {"plusmn", 177}, {"pound", 163}, {"prime", 8242}, {"quot", 34},
+    {"raquo", 187}, {"rarr", 8594}, {"rdquo", 8221}, {"reg", 174}, {"rlm", 8207}, {"rsaquo", 8250}, {"rsquo", 8217},
+    {"sbquo", 8218}, {"scaron", 353}, {"sect", 167}, {"shy", 173}, {"spades", 9824}, {"sup1", 185}, {"sup2", 178},
+    {"sup3", 179}, {"szlig", 223}, {"thinsp", 8201}, {"thorn", 254}, {"tilde", 732}, {"times", 215}, {"trade", 8482},
+    {"uacute", 250}, {"uarr", 8593}, {"ucirc", 251}, {"ugrave", 249}, {"uml", 168}, {"uuml", 252}, {"yacute", 253},
+    {"yen", 165}, {"yuml", 255}, {"zwj", 8205}, {"zwnj", 8204},
+};
+
+enum {
+  ESCAPE_TEXT = 1,
+  ESCAPE_ATTR = 2,
+};
+
+/* the characters xml_escape_buf() replaces, by context */
+static const uint8_t xml_escape_classes[256] = {
+    ['<'] = ESCAPE_TEXT | ESCAPE_ATTR,
+    ['>'] = ESCAPE_TEXT | ESCAPE_ATTR,
+    ['&'] = ESCAPE_TEXT | ESCAPE_ATTR,
+    ['"'] = ESCAPE_ATTR,
+};
+
+static const char* const xml_escape_entities[256] = {
+    ['<'] = "&lt;",
+    ['>'] = "&gt;",
+    ['&'] = "&amp;",
+    ['"'] = "&quot;",
+};
+
+/* returns the code point of the entity named by [s, s + n), without '&' and ';', or -1 */
+/* &amp; &lt; &gt; &quot; and &apos;, the only named entities XML has without a DTD */
+static inline BOOL
+xml_entity_predefined(int32_t code) {
+  return code == '&' || code == '<' || code == '>' || code == '"' || code == '\'';
+}
+
+static int32_t
+xml_entity(const uint8_t* s, size_t n, BOOL html) {
+  int32_t code = 0, lo = 0, hi = countof(xml_entities) - 1;
+  size_t i;
+
+  if(n >= 2 && s[0] == '#') {
+    BOOL hex = s[1] == 'x' || s[1] == 'X';
+
+    if(n == 1 + hex)
+      return -1;
+
+    for(i = 1 + hex; i < n; i++) {
+      uint8_t c = s[i] | 0x20;
+      int32_t digit = is_digit_char(s[i]) ? s[i] - '0' : hex && c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+
+      if(digit < 0 || (code = code * (hex ? 16 : 10) + digit) > 0x10ffff)
+        return -1;
+    }
+
+    /* surrogates aren't characters, UTF-8 can't encode them */
+    return code > 0 && (code < 0xd800 || code > 0xdfff) ? code : -1;
+  }
+
+  while(lo <= hi) {
+    int32_t mid = (lo + hi) / 2;
+    const char* name = xml_entities[mid].name;
+    size_t len = strlen(name);
+    int r = memcmp(s, name, MIN_NUM(n, len));
+
+    if(r == 0)
+      r = n < len ? -1 : n > len;
+
+    if(r == 0)
+      return html || xml_entity_predefined(xml_entities[mid].code) ? xml_entities[mid].code : -1;
+
+    if(r < 0)
+      hi = mid - 1;
+    else
+      lo = mid + 1;
+  }
+
+  return -1;
+}
+
+/* returns the offset of the first character in 's' which has to be escaped in the context 'mask', or 'len' */
+static size_t
+xml_escape_scan(const uint8_t* s, size_t len, uint8_t mask) {
+  size_t i = 0;
+
+  /* most text has nothing to escape, so test 4 characters at a time */
+  for(; i + 4 <= len; i += 4)
+    if((xml_escape_classes[s[i]] | xml_escape_classes[s[i + 1]] | xml_escape_classes[s[i + 2]] | xml_escape_classes[s[i + 3]]) & mask)
+      break;
+
+  for(; i < len; i++)
+    if(xml_escape_classes[s[i]] & mask)
+      break;
+
+  return i;
+}
+
+static void
+xml_escape_buf(DynBuf* db, const char* s, size_t len, BOOL attr) {
+  uint8_t mask = attr ? ESCAPE_ATTR : ESCAPE_TEXT;
+  size_t i;
+
+  while((i = xml_escape_scan((const uint8_t*)s, len, mask)) < len) {
+    dbuf_put(db, (const uint8_t*)s, i);
+    dbuf_putstr(db, xml_escape_entities[(uint8_t)s[i]]);
+    s += i + 1;
+    len -= i + 1;
+  }
+
+  dbuf_put(db, (const uint8_t*)s, len);
+}
+
+/*
+ * appends 's' to 'db', decoding numeric character references and the five
+ * predefined entities of XML, or all the HTML 4 entities of xml_entities[]
+ * when 'html' is set
+ */
+static void
+xml_decode_buf(DynBuf* db, const uint8_t* s, size_t len, BOOL html) {
+  size_t i = byte_chr(s, len, '&');
+
+  for(;;) {
+    size_t n, max;
+    int32_t code;
+
+    dbuf_put(db, s, i);
+    s += i;
+    len -= i;
+
+    if(len == 0)
+      break;
+
+    max = MIN_NUM(len, 12);
+
+    if((n = byte_chr(s, max, ';')) < max && (code = xml_entity(s + 1, n - 1, html)) != -1) {
+      uint8_t buf[UTF8_CHAR_LEN_MAX];
+
+      dbuf_put(db, buf, unicode_to_utf8(buf, code));
+      n++;
+    } else {
+      dbuf_putc(db, '&');
+      n = 1;
+    }
+
+    s += n;
+    len -= n;
+    i = byte_chr(s, len, '&');
+  }
+}
+
+static JSValue
+xml_decode(JSContext* ctx, const uint8_t* s, size_t len, BOOL html) {
+  DynBuf db;
+  JSValue ret;
+
+  if(byte_chr(s, len, '&') == len)
+    return JS_NewStringLen(ctx, (const char*)s, len);
+
+  js_dbuf_init(ctx, &db);
+  xml_decode_buf(&db, s, len, html);
+
+  ret = JS_NewStringLen(ctx, (const char*)db.buf, db.size);
+  dbuf_free(&db);
+  return ret;
+}
+
 static int32_t
 xml_num_children(JSContext* ctx, JSValueConst element) {
   int64_t num_children = -1;
@@ -189,12 +432,141 @@ xml_set_attr_value(JSContext* ctx, JSValueConst obj, const char* attr, size_t al
   JS_FreeAtom(ctx, prop);
 }
 
+static inline uint32_t
+xml_name_hash(const uint8_t* s, size_t len) {
+  uint32_t hash = 2166136261u;
+  size_t k;
+
+  for(k = 0; k < len; k++) hash = (hash ^ s[k]) * 16777619u;
+
+  return hash;
+}
+
+/* a tag or attribute name seen by js_xml_parse(), 'slash' marks the "/name" closing tags of flat mode */
+typedef struct {
+  const uint8_t* s;
+  uint32_t len, hash;
+  BOOL slash;
+  JSAtom atom;
+  JSValue str;
+} XmlParseName;
+
+/* per-parse name table, so repetitive documents create each name string/atom only once */
+typedef struct {
+  XmlParseName* map;
+  uint32_t size, count;
+  JSAtom tag_name, attributes, children;
+} XmlParseNames;
+
+static void
+xml_parse_names_init(XmlParseNames* names, JSContext* ctx) {
+  *names = (XmlParseNames){0, 0, 0, JS_NewAtom(ctx, "tagName"), JS_NewAtom(ctx, "attributes"), JS_NewAtom(ctx, "children")};
+}
+
 static void
-xml_set_attr_bytes(JSContext* ctx, JSValueConst obj, const char* attr, size_t alen, const uint8_t* str, size_t slen) {
-  JSValue value;
-  value = JS_NewStringLen(ctx, (const char*)str, slen);
-  xml_set_attr_value(ctx, obj, attr, alen, value);
-  // JS_FreeValue(ctx, value);
+xml_parse_names_free(XmlParseNames* names, JSContext* ctx) {
+  uint32_t i;
+
+  for(i = 0; i < names->size; i++) {
+    if(!names->map[i].s)
+      continue;
+
+    if(names->map[i].atom != JS_ATOM_NULL)
+      JS_FreeAtom(ctx, names->map[i].atom);
+
+    JS_FreeValue(ctx, names->map[i].str);
+  }
+
+  js_free(ctx, names->map);
+  JS_FreeAtom(ctx, names->tag_name);
+  JS_FreeAtom(ctx, names->attributes);
+  JS_FreeAtom(ctx, names->children);
+}
+
+static BOOL
+xml_parse_names_grow(XmlParseNames* names, JSContext* ctx) {
+  uint32_t i, j, size = names->size ? names->size * 2 : 64;
+  XmlParseName* map;
+
+  if(!(map = js_mallocz(ctx, sizeof(XmlParseName) * size)))
+    return FALSE;
+
+  for(i = 0; i < names->size; i++) {
+    if(!names->map[i].s)
+      continue;
+
+    for(j = names->map[i].hash & (size - 1); map[j].s; j = (j + 1) & (size - 1)) {}
+    map[j] = names->map[i];
+  }
+
+  js_free(ctx, names->map);
+  names->map = map;
+  names->size = size;
+  return TRUE;
+}
+
+/* returns the table entry for a name, adding it if it is new */
+static XmlParseName*
+xml_parse_name(XmlParseNames* names, JSContext* ctx, const uint8_t* s, size_t len, BOOL slash) {
+  uint32_t i, hash = xml_name_hash(s, len) + slash;
+  XmlParseName* name;
+
+  if((names->count + 1) * 2 > names->size && !xml_parse_names_grow(names, ctx))
+    return 0;
+
+  for(i = hash & (names->size - 1); (name = &names->map[i])->s; i = (i + 1) & (names->size - 1))
+    if(name->hash == hash && name->len == len && name->slash == slash && !memcmp(name->s, s, len))
+      return name;
+
+  *name = (XmlParseName){s, len, hash, slash, JS_ATOM_NULL, JS_UNDEFINED};
+  names->count++;
+  return name;
+}
+
+/* defines the tagName of an element, sharing the string value between all elements of that name */
+static int
+xml_parse_tag(XmlParseNames* names, JSContext* ctx, JSValueConst element, const uint8_t* s, size_t len, BOOL slash) {
+  XmlParseName* name;
+
+  if(!(name = xml_parse_name(names, ctx, s, len, slash)))
+    return -1;
+
+  if(JS_IsUndefined(name->str)) {
+    DynBuf db;
+    js_dbuf_init(ctx, &db);
+
+    if((slash && dbuf_putc(&db, '/')) || dbuf_put(&db, s, len)) {
+      dbuf_free(&db);
+      JS_ThrowOutOfMemory(ctx);
+      return -1;
+    }
+
+    name->str = JS_NewStringLen(ctx, (const char*)db.buf, db.size);
+    dbuf_free(&db);
+
+    if(JS_IsException(name->str)) {
+      name->str = JS_UNDEFINED;
+      return -1;
+    }
+  }
+
+  return JS_DefinePropertyValue(ctx, element, names->tag_name, JS_DupValue(ctx, name->str), JS_PROP_C_W_E) < 0 ? -1 : 0;
+}
+
+/* takes ownership of 'value' */
+static int
+xml_parse_attr(XmlParseNames* names, JSContext* ctx, JSValueConst attributes, const uint8_t* s, size_t len, JSValue value) {
+  XmlParseName* name;
+
+  if(JS_IsException(value))
+    return -1;
+
+  if(!(name = xml_parse_name(names, ctx, s, len, FALSE)) || (name->atom == JS_ATOM_NULL && (name->atom = JS_NewAtomLen(ctx, (const char*)s, len)) == JS_ATOM_NULL)) {
+    JS_FreeValue(ctx, value);
+    return -1;
+  }
+
+  return JS_DefinePropertyValue(ctx, attributes, name->atom, value, JS_PROP_C_W_E) < 0 ? -1 : 0;
 }
 
 static void
@@ -395,8 +767,65 @@ xml_enumeration_next(Vector* vec, JSContext* ctx, DynBuf* db, int32_t max_depth)
   return it;
 }
 
+/**
+ * With { spans: true } each element gets a non-enumerable [offset, length]
+ * array under Symbol.for('xml.span').  'offset' is relative to the end of the
+ * previous element sibling, or to the start of the parent for the first one,
+ * so that an edit only changes the spans of the edited element and its
+ * ancestors.
+ */
+static void
+xml_set_span(JSContext* ctx, JSValueConst element, JSAtom span, uint32_t offset, uint32_t length) {
+  JSValue arr = JS_NewArray(ctx);
+
+  JS_SetPropertyUint32(ctx, arr, 0, JS_NewUint32(ctx, offset));
+  JS_SetPropertyUint32(ctx, arr, 1, JS_NewUint32(ctx, length));
+  JS_DefinePropertyValue(ctx, element, span, arr, JS_PROP_CONFIGURABLE | JS_PROP_WRITABLE);
+}
+
+static BOOL
+xml_get_span(JSContext* ctx, JSValueConst element, JSAtom span, uint32_t* offset, uint32_t* length) {
+  JSValue arr = JS_GetProperty(ctx, element, span);
+  BOOL ret = FALSE;
+
+  if(JS_IsArray(ctx, arr)) {
+    JSValue v0 = JS_GetPropertyUint32(ctx, arr, 0), v1 = JS_GetPropertyUint32(ctx, arr, 1);
+
+    ret = JS_IsNumber(v0) && JS_IsNumber(v1) && !JS_ToUint32(ctx, offset, v0) && !JS_ToUint32(ctx, length, v1);
+
+    JS_FreeValue(ctx, v0);
+    JS_FreeValue(ctx, v1);
+  }
+
+  JS_FreeValue(ctx, arr);
+  return ret;
+}
+
+/* sets the span of an element without children, which ends at 'pos' */
+static void
+xml_parse_span(JSContext* ctx, OutputValue* out, JSValueConst element, JSAtom span, uint32_t start, uint32_t pos) {
+  xml_set_span(ctx, element, span, start - out->prev, pos - start);
+  out->prev = pos;
+}
+
+/* sets the spans of the open elements from the top of the stack down to 'index', which end at 'pos' */
+static void
+xml_parse_spans(JSContext* ctx, Vector* st, int32_t index, JSAtom span, uint32_t pos) {
+  int32_t i;
+
+  for(i = vector_size(st, sizeof(OutputValue)) - 1; i >= index && i > 0; i--) {
+    OutputValue* o = vector_at(st, sizeof(OutputValue), i);
+
+    xml_set_span(ctx, o->element, span, o->offset, pos - o->start);
+  }
+
+  if(index > 0)
+    ((OutputValue*)vector_at(st, sizeof(OutputValue), index - 1))->prev = pos;
+}
+
+/* 'open' receives the number of elements left open at the end of the input */
 static JSValue
-js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_name, ParseOptions opts) {
+js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_name, ParseOptions opts, uint32_t* open) {
   BOOL done = FALSE;
   const uint8_t *ptr, *end, *start;
   uint8_t c;
@@ -404,16 +833,18 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
   JSValue ret, element = JS_UNDEFINED;
   Vector st = VECTOR(ctx);
   Location loc = {0, JS_NewAtom(ctx, input_name)};
+  XmlParseNames names;
+  JSAtom span = opts.spans && !opts.flat ? js_symbol_for_atom(ctx, "xml.span") : JS_ATOM_NULL;
   ptr = buf;
   end = buf + len;
 
   xml_debug("js_xml_parse input_name: %s flat: %s\n", input_name, opts.flat ? "TRUE" : "FALSE");
 
   ret = JS_NewArray(ctx);
+  xml_parse_names_init(&names, ctx);
 
   out = vector_emplace(&st, sizeof(OutputValue));
-  out->obj = ret;
-  out->idx = 0;
+  *out = (OutputValue){0, ret, 0, 0, JS_UNDEFINED, 0, 0, 0};
 
   while(!done) {
     // parse_skipspace();
@@ -429,7 +860,7 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
       }
 
     } else {
-      parse_until(parse_is(c, START));
+      parse_find('<');
     }
 
     size_t leading_ws = scan_whitenskip((const char*)start, ptr - start);
@@ -453,7 +884,7 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
         while(len > 0 && is_whitespace_char(start[len - 1])) len--;
 
       if(len > 0) {
-        JSValue str = JS_NewStringLen(ctx, (const char*)start, len);
+        JSValue str = opts.decode && !inside_script ? xml_decode(ctx, start, len, FALSE) : JS_NewStringLen(ctx, (const char*)start, len);
         yield_add(str);
       }
 
@@ -495,7 +926,9 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
 
         if(opts.flat) {
           yield_next();
-          xml_set_attr_bytes(ctx, element, "tagName", 7, name - 1, namelen + 1);
+
+          if(xml_parse_tag(&names, ctx, element, name, namelen, TRUE) < 0)
+            goto fail;
 
         } else {
 
@@ -505,20 +938,22 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
 
             if(!opts.tolerant) {
               char* file;
-              JS_FreeValue(ctx, ret);
               location_count(&loc, buf, start - buf);
               file = location_file(&loc, ctx);
               xml_debug(
                   "mismatch </%.*s> at %s:%u:%u (byte %zu/char %zu)", (int)namelen, name, file, loc.line + 1, loc.column + 1, loc.byte_offset, loc.char_offset);
-              ret = JS_ThrowSyntaxError(ctx, "mismatch </%.*s> at %s:%u:%u", (int)namelen, name, file, loc.line + 1, loc.column + 1);
+              JS_ThrowSyntaxError(ctx, "mismatch </%.*s> at %s:%u:%u", (int)namelen, name, file, loc.line + 1, loc.column + 1);
               if(file)
                 js_free(ctx, file);
-              return ret;
+              goto fail;
             }
 
             continue;
           }
 
+          if(span != JS_ATOM_NULL)
+            xml_parse_spans(ctx, &st, index, span, ptr - buf);
+
           yield_return(index);
         }
       } else {
@@ -546,10 +981,18 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
           namelen = ptr - name;
         }
 
-        xml_set_attr_bytes(ctx, element, "tagName", 7, name, namelen);
+        /* comments and declarations are not worth interning */
+        if(namelen && parse_is(name[0], EXCLAM))
+          JS_DefinePropertyValue(ctx, element, names.tag_name, JS_NewStringLen(ctx, (const char*)name, namelen), JS_PROP_C_W_E);
+        else if(xml_parse_tag(&names, ctx, element, name, namelen, FALSE) < 0)
+          goto fail;
 
         if(namelen && parse_is(name[0], EXCLAM)) {
           parse_getc();
+
+          if(span != JS_ATOM_NULL)
+            xml_parse_span(ctx, out, element, span, start - buf, ptr - buf);
+
           continue;
         }
 
@@ -557,7 +1000,7 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
         const uint8_t *attr, *value;
         size_t alen, vlen, num_attrs = 0;
         JSValue attributes = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, element, "attributes", attributes);
+        JS_DefinePropertyValue(ctx, element, names.attributes, attributes, JS_PROP_C_W_E);
         while(!done) {
           parse_skipspace();
           if(parse_is(c, END))
@@ -567,7 +1010,8 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
           if((alen = ptr - attr) == 0)
             break;
           if(parse_is(c, WS | CLOSE | SLASH)) {
-            xml_set_attr_value(ctx, attributes, (const char*)attr, alen, JS_NewBool(ctx, TRUE));
+            if(xml_parse_attr(&names, ctx, attributes, attr, alen, JS_NewBool(ctx, TRUE)) < 0)
+              goto fail;
             num_attrs++;
             continue;
           }
@@ -581,14 +1025,15 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
             }
             value = ptr;
             if(quote)
-              parse_until(c == quote);
+              parse_find(quote);
             else
               parse_until(parse_is(c, (WS | CLOSE)));
 
             vlen = ptr - value;
             if(quote && parse_is(c, QUOTE))
               parse_getc();
-            xml_set_attr_bytes(ctx, attributes, (const char*)attr, alen, value, vlen);
+            if(xml_parse_attr(&names, ctx, attributes, attr, alen, opts.decode ? xml_decode(ctx, value, vlen, FALSE) : JS_NewStringLen(ctx, (const char*)value, vlen)) < 0)
+              goto fail;
             num_attrs++;
           }
         }
@@ -608,30 +1053,55 @@ js_xml_parse(JSContext* ctx, const uint8_t* buf, size_t len, const char* input_n
       }
 
       if(self_closing && opts.flat) {
-        char* tagName = js_mallocz(ctx, namelen + 2);
-        tagName[0] = '/';
-        str_copyn(&tagName[1], (const char*)name, namelen);
-
         yield_next();
-        xml_set_attr_bytes(ctx, element, "tagName", 7, (const uint8_t*)tagName, namelen + 1);
-        js_free(ctx, tagName);
+
+        if(xml_parse_tag(&names, ctx, element, name, namelen, TRUE) < 0)
+          goto fail;
       }
 
       parse_skipspace();
       if(parse_is(c, CLOSE))
         parse_getc();
+
+      if(span != JS_ATOM_NULL && !closing && self_closing)
+        xml_parse_span(ctx, out, element, span, start - buf, ptr - buf);
     }
   }
+
+  if(open)
+    *open = vector_size(&st, sizeof(OutputValue)) - 1;
+
+  /* elements left open end with the input */
+  if(span != JS_ATOM_NULL) {
+    xml_parse_spans(ctx, &st, 1, span, len);
+    JS_FreeAtom(ctx, span);
+  }
+
+  xml_parse_names_free(&names, ctx);
+  vector_free(&st);
   JS_FreeAtom(ctx, loc.file);
   return ret;
+
+fail:
+  JS_FreeValue(ctx, ret);
+
+  if(span != JS_ATOM_NULL)
+    JS_FreeAtom(ctx, span);
+
+  xml_parse_names_free(&names, ctx);
+  vector_free(&st);
+  JS_FreeAtom(ctx, loc.file);
+  return JS_EXCEPTION;
 }
 
+static JSValue xml_document_read(JSContext*, InputBuffer*, const char*, const ParseOptions*);
+
 static JSValue
 js_xml_read(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
   JSValue ret;
   InputBuffer input = js_input_chars(ctx, argv[0]);
   const char* input_name = 0;
-  ParseOptions opts = {.flat = FALSE, .tolerant = FALSE, .self_closing_tags = default_self_closing_tags};
+  ParseOptions opts = {.flat = FALSE, .tolerant = FALSE, .lazy = FALSE, .self_closing_tags = default_self_closing_tags};
 
   if(input.data == 0 || input.size == 0) {
     JS_ThrowReferenceError(ctx, "xml.read(): expecting buffer or string");
@@ -643,16 +1113,7 @@ js_xml_read(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]
 
   if(argc >= 3) {
     if(JS_IsObject(argv[2])) {
-      JSValue tags;
-      opts.flat = js_get_propertystr_bool(ctx, argv[2], "flat");
-      opts.tolerant = js_get_propertystr_bool(ctx, argv[2], "tolerant");
-      tags = JS_GetPropertyStr(ctx, argv[2], "selfClosingTags");
-      if(JS_IsArray(ctx, tags)) {
-        int ac = -1;
-        opts.self_closing_tags = (const char* const*)js_array_to_argv(ctx, &ac, tags);
-      }
-      JS_FreeValue(ctx, tags);
-
+      xml_parse_options(ctx, argv[2], &opts);
     } else {
       opts.flat = JS_ToBool(ctx, argv[2]);
 
@@ -661,149 +1122,4245 @@ js_xml_read(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]
     }
   }
 
-  ret = js_xml_parse(ctx, input.data, input.size, input_name ? input_name : "<input>", opts);
+  if(opts.lazy && !opts.flat) {
+    ret = xml_document_read(ctx, &input, input_name, &opts);
+  } else {
+    ret = js_xml_parse(ctx, input.data, input.size, input_name ? input_name : "<input>", opts, 0);
+    input_buffer_free(&input, ctx);
+  }
+
+  xml_parse_options_free(JS_GetRuntime(ctx), &opts);
 
   if(input_name)
     JS_FreeCString(ctx, input_name);
 
-  input_buffer_free(&input, ctx);
   return ret;
 }
 
-static JSValue
-js_xml_write_tree(JSContext* ctx, JSValueConst obj, int max_depth, DynBuf* output) {
-  Vector enumerations = VECTOR(ctx);
-  PropertyEnumeration* it;
-  JSValue str, value = JS_UNDEFINED;
+typedef struct {
+  JSValue children, element; /* the element is children[index] */
+  uint32_t index, offset, start, end;
+} XmlSpanPath;
 
-  it = property_enumeration_push(&enumerations, ctx, JS_DupValue(ctx, obj), PROPENUM_DEFAULT_FLAGS);
+/* collects the elements which contain [edit_start, edit_end) strictly, outermost first */
+static void
+xml_span_path(JSContext* ctx, JSValueConst tree, JSAtom span, uint32_t edit_start, uint32_t edit_end, Vector* path) {
+  JSValue children = JS_DupValue(ctx, tree);
+  uint32_t base = 0;
 
-  do {
-    int32_t depth = vector_size(&enumerations, sizeof(PropertyEnumeration)) - 1;
+  while(JS_IsArray(ctx, children)) {
+    int64_t i, n = js_array_length(ctx, children);
+    uint32_t prev = base, offset, length;
+    XmlSpanPath* p = 0;
 
-    depth = MAX_NUM(0, depth - 1);
+    for(i = 0; i < n; i++) {
+      JSValue child = JS_GetPropertyUint32(ctx, children, i);
 
-    value = property_enumeration_value(it, ctx);
+      if(!JS_IsObject(child)) {
+        JS_FreeValue(ctx, child);
+        continue;
+      }
 
-    if(JS_IsString(value)) {
-      xml_write_text(ctx, value, output, depth, it->tab_atom_len > 1);
-    } else if(JS_IsObject(value) && !JS_IsArray(ctx, value)) {
-      int32_t num_children = xml_num_children(ctx, value);
-      xml_write_element(ctx, value, output, depth, num_children == -1);
+      /* without its span the positions of the following siblings are unknown */
+      if(!xml_get_span(ctx, child, span, &offset, &length) || prev + offset >= edit_end) {
+        JS_FreeValue(ctx, child);
+        break;
+      }
+
+      if(prev + offset < edit_start && edit_end < prev + offset + length) {
+        if((p = vector_emplace(path, sizeof(XmlSpanPath))))
+          *p = (XmlSpanPath){JS_DupValue(ctx, children), child, i, offset, prev + offset, prev + offset + length};
+        else
+          JS_FreeValue(ctx, child);
+
+        break;
+      }
+
+      prev += offset + length;
+      JS_FreeValue(ctx, child);
     }
 
-    JS_FreeValue(ctx, value);
-  } while((it = xml_enumeration_next(&enumerations, ctx, output, max_depth)));
+    JS_FreeValue(ctx, children);
 
-  while(output->size > 0 && (output->buf[output->size - 1] == '\0' || byte_chr("\r\n\t ", 4, output->buf[output->size - 1]) < 4)) output->size--;
-  dbuf_putc(output, '\0');
+    if(!p)
+      return;
 
-  str = JS_NewString(ctx, (const char*)output->buf);
-  // str = JS_NewStringLen(ctx, output->buf, output->size);
+    base = p->start;
+    children = JS_GetPropertyStr(ctx, p->element, "children");
+  }
 
-  vector_foreach_t(&enumerations, it) { property_enumeration_reset(it, JS_GetRuntime(ctx)); }
-  vector_free(&enumerations);
-  return str;
+  JS_FreeValue(ctx, children);
 }
 
+/* parses [start, end) of the new input, returns the element if it is exactly one and closed at 'end' */
 static JSValue
-js_xml_write_list(JSContext* ctx, JSValueConst obj, size_t len, DynBuf* output) {
-  size_t i;
-  int32_t depth = 0;
-  BOOL single_line = FALSE;
-  const char *tagName = 0, *nextTag;
+xml_span_reparse(JSContext* ctx, const uint8_t* buf, uint32_t start, uint32_t end, const ParseOptions* opts, JSAtom span) {
+  JSValue nodes, ret = JS_UNDEFINED;
+  uint32_t offset, length, open = 0;
 
-  JSValue value = JS_UNDEFINED, next = JS_GetPropertyUint32(ctx, obj, 0);
-  nextTag = JS_IsObject(next) ? js_get_propertystr_cstring(ctx, next, "tagName") : 0;
+  nodes = js_xml_parse(ctx, buf + start, end - start, "<input>", *opts, &open);
 
-  for(i = 0; i < len; i++) {
-    JS_FreeValue(ctx, value);
-    value = next;
-    next = JS_GetPropertyUint32(ctx, obj, i + 1);
+  if(JS_IsException(nodes)) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return JS_UNDEFINED;
+  }
 
-    tagName = nextTag;
-    nextTag = JS_IsObject(next) ? js_get_propertystr_cstring(ctx, next, "tagName") : 0;
+  /* an element closed implicitly at the end would extend further in the whole input */
+  if(open == 0 && js_array_length(ctx, nodes) == 1) {
+    ret = JS_GetPropertyUint32(ctx, nodes, 0);
 
-    if(JS_IsString(value)) {
-      const char* s = JS_ToCString(ctx, value);
-      uint32_t newlines = str_count(s, '\n');
-      JS_FreeCString(ctx, s);
-      single_line = newlines == 0;
+    if(!JS_IsObject(ret) || !xml_get_span(ctx, ret, span, &offset, &length) || length != end - start) {
+      JS_FreeValue(ctx, ret);
+      ret = JS_UNDEFINED;
+    }
+  }
 
-      xml_write_text(ctx, value, output, depth, !single_line);
+  JS_FreeValue(ctx, nodes);
+  return ret;
+}
 
-    } else if(JS_IsObject(value) && !JS_IsArray(ctx, value)) {
-      const char* tagName = js_get_propertystr_cstring(ctx, value, "tagName");
-      BOOL self_closing = nextTag && nextTag[0] == '/' && !strcmp(tagName, &nextTag[1]);
+/**
+ * xml.reparse(tree, input, editStart, oldLength, newLength, [options])
+ *
+ * 'tree' is the result of xml.read(..., { spans: true }) for the input
+ * before 'oldLength' bytes at 'editStart' were replaced by 'newLength'
+ * bytes.  The innermost element which contains the edit is parsed again from
+ * the new input and replaced in the children of its parent, going outwards
+ * while that doesn't yield exactly that one element.  Only the spans of its
+ * ancestors are adjusted, all other nodes are kept.  When no element
+ * qualifies the whole input is parsed and the new tree returned.
+ */
+static JSValue
+js_xml_reparse(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  InputBuffer input = js_input_chars(ctx, argc > 1 ? argv[1] : JS_UNDEFINED);
+  ParseOptions opts = {.flat = FALSE, .tolerant = FALSE, .lazy = FALSE, .spans = TRUE, .self_closing_tags = default_self_closing_tags};
+  uint32_t edit_start = 0, old_len = 0, new_len = 0;
+  const uint8_t* buf = input_buffer_begin(&input);
+  size_t len = input_buffer_length(&input);
+  Vector path = VECTOR(ctx);
+  XmlSpanPath* p;
+  JSValue ret = JS_UNDEFINED;
+  JSAtom span;
+  int32_t i;
+
+  if(JS_IsException(input.value))
+    return JS_ThrowTypeError(ctx, "xml.reparse(): expecting buffer or string");
+
+  if(argc < 5 || JS_ToUint32(ctx, &edit_start, argv[2]) || JS_ToUint32(ctx, &old_len, argv[3]) || JS_ToUint32(ctx, &new_len, argv[4])) {
+    input_buffer_free(&input, ctx);
+    return argc < 5 ? JS_ThrowTypeError(ctx, "xml.reparse(): expecting tree, input, editStart, oldLength, newLength") : JS_EXCEPTION;
+  }
 
-      if(tagName[0] == '/')
-        depth--;
+  if(argc > 5 && JS_IsObject(argv[5]))
+    xml_parse_options(ctx, argv[5], &opts);
 
-      xml_write_element(ctx, value, output, single_line ? 0 : depth, self_closing);
+  opts.flat = opts.lazy = FALSE;
+  opts.spans = TRUE;
+  span = js_symbol_for_atom(ctx, "xml.span");
 
-      if(self_closing)
-        next = JS_GetPropertyUint32(ctx, obj, ++i + 1);
-      else if(tagName[0] != '/' && tagName[0] != '?' && tagName[0] != '!' && !strcasecmp(tagName, "dt"))
-        depth++;
+  xml_span_path(ctx, argv[0], span, edit_start, edit_start + old_len, &path);
 
-      //  JS_FreeCString(ctx, tagName);
-      single_line = FALSE;
-    }
-    if(tagName)
-      JS_FreeCString(ctx, tagName);
-  }
-  return JS_NewStringLen(ctx, (const char*)output->buf, output->size);
-}
+  for(i = vector_size(&path, sizeof(XmlSpanPath)) - 1; i >= 0; i--) {
+    int64_t end;
+    JSValue element;
 
-static JSValue
-js_xml_write(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
-  DynBuf output = {0};
-  JSValueConst obj = argc > 0 ? argv[0] : JS_UNDEFINED;
-  JSValue ret, last, children = JS_UNDEFINED, arr = JS_UNDEFINED;
-  int32_t max_depth = INT32_MAX;
-  size_t len;
-  BOOL flat = TRUE;
+    p = vector_at(&path, sizeof(XmlSpanPath), i);
+    end = (int64_t)p->end + new_len - old_len;
 
-  js_dbuf_init(ctx, &output);
+    if(end > (int64_t)len || end <= p->start)
+      continue;
 
-  if(argc >= 2)
-    JS_ToInt32(ctx, &max_depth, argv[1]);
+    element = xml_span_reparse(ctx, buf, p->start, end, &opts, span);
 
-  if(!JS_IsArray(ctx, obj)) {
-    arr = JS_NewArray(ctx);
-    JS_SetPropertyUint32(ctx, arr, 0, JS_DupValue(ctx, obj));
-    obj = arr;
-  }
+    if(JS_IsUndefined(element))
+      continue;
 
-  len = js_array_length(ctx, obj);
+    xml_set_span(ctx, element, span, p->offset, end - p->start);
+    JS_SetPropertyUint32(ctx, p->children, p->index, element);
 
-  last = JS_GetPropertyUint32(ctx, obj, len - 1);
+    /* the ancestors grow or shrink by the same amount */
+    while(--i >= 0) {
+      p = vector_at(&path, sizeof(XmlSpanPath), i);
+      xml_set_span(ctx, p->element, span, p->offset, (int64_t)p->end + new_len - old_len - p->start);
+    }
 
-  if(JS_IsObject(last)) {
-    children = JS_GetPropertyStr(ctx, last, "children");
+    ret = JS_DupValue(ctx, argv[0]);
+  }
 
-    if(JS_IsArray(ctx, children))
-      flat = FALSE;
+  if(JS_IsUndefined(ret))
+    ret = js_xml_parse(ctx, buf, len, "<input>", opts, 0);
+
+  vector_foreach_t(&path, p) {
+    JS_FreeValue(ctx, p->children);
+    JS_FreeValue(ctx, p->element);
   }
 
-  xml_debug("js_xml_write len=%zu, children=%s, flat=%d\n", len, JS_ToCString(ctx, children), flat);
+  vector_free(&path);
+  JS_FreeAtom(ctx, span);
+  xml_parse_options_free(JS_GetRuntime(ctx), &opts);
+  input_buffer_free(&input, ctx);
+  return ret;
+}
+
+enum {
+  XML_ENCODE,
+  XML_DECODE,
+};
+
+/*
+ * xml.encode(str, attr) and xml.decode(str) return 'str' itself when there
+ * is nothing to replace.  xml.decode() knows the HTML 4 entities, parsing
+ * only the ones predefined by XML.
+ */
+static JSValue
+js_xml_entities(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  const char* str;
+  size_t len, pos;
+  JSValue ret;
+  DynBuf db;
 
-  if(flat)
-    ret = js_xml_write_list(ctx, obj, len, &output);
+  if(!(str = JS_ToCStringLen(ctx, &len, argv[0])))
+    return JS_EXCEPTION;
+
+  if(magic == XML_ENCODE)
+    pos = xml_escape_scan((const uint8_t*)str, len, argc > 1 && JS_ToBool(ctx, argv[1]) ? ESCAPE_ATTR : ESCAPE_TEXT);
   else
-    ret = js_xml_write_tree(ctx, obj, max_depth, &output);
+    pos = byte_chr(str, len, '&');
 
-  dbuf_free(&output);
+  if(pos == len) {
+    ret = JS_IsString(argv[0]) ? JS_DupValue(ctx, argv[0]) : JS_NewStringLen(ctx, str, len);
+  } else {
+    js_dbuf_init(ctx, &db);
+    dbuf_put(&db, (const uint8_t*)str, pos);
 
-  if(!JS_IsUndefined(arr))
-    JS_FreeValue(ctx, arr);
+    if(magic == XML_ENCODE)
+      xml_escape_buf(&db, str + pos, len - pos, argc > 1 && JS_ToBool(ctx, argv[1]));
+    else
+      xml_decode_buf(&db, (const uint8_t*)str + pos, len - pos, TRUE);
+
+    ret = JS_NewStringLen(ctx, (const char*)db.buf, db.size);
+    dbuf_free(&db);
+  }
 
+  JS_FreeCString(ctx, str);
   return ret;
 }
 
-static const JSCFunctionListEntry js_xml_funcs[] = {
+/**
+ * Streaming writer: output is formatted into 'buf' and handed to the sink
+ * (a file descriptor, or a WritableStream / object with write()) in blocks
+ * of 'block_size' bytes. Trailing whitespace stays in the buffer, because
+ * xml_write_text() and xml_close_element() look back at it.
+ */
+typedef struct {
+  DynBuf buf;
+  size_t block_size;
+  int32_t fd;
+  JSValue writer, write_fn, last; /* sink, its write() and the promise of the last write */
+  Vector tree;                    /* enumerations of xml.write(), resumed when the sink is ready */
+  int32_t max_depth;
+  BOOL resume;
+  JSValue list; /* a flat list given to xml.write() instead of a tree */
+  uint32_t list_index, list_length;
+  int32_t list_depth;
+  BOOL single_line;
+  Vector open;  /* names of the elements started by startElement() */
+  BOOL pending; /* the last start tag hasn't been closed yet */
+} XmlWriter;
+
+enum {
+  XML_WRITER_START = 0,
+  XML_WRITER_TEXT,
+  XML_WRITER_END,
+  XML_WRITER_FLUSH,
+  XML_WRITER_CLOSE,
+};
+
+static void
+xml_writer_init(XmlWriter* w, JSContext* ctx) {
+  js_dbuf_init(ctx, &w->buf);
+  w->block_size = 65536;
+  w->fd = -1;
+  w->writer = w->write_fn = w->last = w->list = JS_UNDEFINED;
+  vector_init(&w->tree, ctx);
+  w->max_depth = INT32_MAX;
+  vector_init(&w->open, ctx);
+}
+
+static void
+xml_writer_free(XmlWriter* w, JSRuntime* rt) {
+  PropertyEnumeration* it;
+  char** name;
+
+  vector_foreach_t(&w->tree, it) property_enumeration_reset(it, rt);
+  vector_foreach_t(&w->open, name) js_free_rt(rt, *name);
+
+  vector_free(&w->tree);
+  vector_free(&w->open);
+  dbuf_free(&w->buf);
+  JS_FreeValueRT(rt, w->writer);
+  JS_FreeValueRT(rt, w->write_fn);
+  JS_FreeValueRT(rt, w->last);
+  JS_FreeValueRT(rt, w->list);
+}
+
+/* a file descriptor, a WritableStream, an object with write() or nothing to produce a string */
+static int
+xml_writer_target(XmlWriter* w, JSContext* ctx, JSValueConst target) {
+  JSValue fn;
+
+  if(JS_IsNumber(target))
+    return JS_ToInt32(ctx, &w->fd, target);
+
+  if(JS_IsUndefined(target) || JS_IsNull(target)) {
+    w->block_size = SIZE_MAX;
+    return 0;
+  }
+
+  if(!JS_IsObject(target)) {
+    JS_ThrowTypeError(ctx, "xml: expecting a file descriptor, a WritableStream or an object with write()");
+    return -1;
+  }
+
+  fn = JS_GetPropertyStr(ctx, target, "getWriter");
+  w->writer = JS_IsFunction(ctx, fn) ? JS_Call(ctx, fn, target, 0, 0) : JS_DupValue(ctx, target);
+  JS_FreeValue(ctx, fn);
+
+  if(JS_IsException(w->writer))
+    return -1;
+
+  w->write_fn = JS_GetPropertyStr(ctx, w->writer, "write");
+
+  if(!JS_IsFunction(ctx, w->write_fn)) {
+    JS_ThrowTypeError(ctx, "xml: expecting a file descriptor, a WritableStream or an object with write()");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+xml_writer_fd(XmlWriter* w, JSContext* ctx, const uint8_t* data, size_t len) {
+  while(len > 0) {
+    ssize_t r;
+
+    if((r = write(w->fd, data, len)) < 0) {
+      if(errno == EINTR)
+        continue;
+
+      /* a non-blocking descriptor, wait until it accepts more */
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = {w->fd, POLLOUT, 0};
+
+        poll(&pfd, 1, -1);
+        continue;
+      }
+
+      JS_ThrowInternalError(ctx, "xml.write(): write error: %s", strerror(errno));
+      return -1;
+    }
+
+    data += r;
+    len -= r;
+  }
+
+  return 0;
+}
+
+/* the promise to wait for before the sink takes more, or undefined */
+static JSValue
+xml_writer_wait(XmlWriter* w, JSContext* ctx) {
+  JSValue desired = JS_GetPropertyStr(ctx, w->writer, "desiredSize"), ret = JS_UNDEFINED;
+  double size;
+
+  /* a sink without a queue gets one write() at a time */
+  if(JS_IsUndefined(desired)) {
+    if(js_is_promise(ctx, w->last))
+      ret = JS_DupValue(ctx, w->last);
+  } else if(JS_IsNumber(desired) && !JS_ToFloat64(ctx, &size, desired) && size <= 0) {
+    ret = JS_GetPropertyStr(ctx, w->writer, "ready");
+  }
+
+  JS_FreeValue(ctx, desired);
+  return ret;
+}
+
+/* hands the buffer to the sink, except for its trailing whitespace unless 'all' */
+static JSValue
+xml_writer_flush(XmlWriter* w, JSContext* ctx, BOOL all) {
+  size_t n = w->buf.size;
+  JSValue ret = JS_UNDEFINED;
+
+  if(w->fd < 0 && !JS_IsObject(w->writer))
+    return ret;
+
+  if(!all)
+    while(n > 0 && is_whitespace_char(w->buf.buf[n - 1])) n--;
+
+  if(n == 0)
+    return ret;
+
+  if(w->fd >= 0) {
+    if(xml_writer_fd(w, ctx, w->buf.buf, n))
+      return JS_EXCEPTION;
+
+  } else {
+    JSValue chunk = JS_NewArrayBufferCopy(ctx, w->buf.buf, n);
+
+    ret = JS_Call(ctx, w->write_fn, w->writer, 1, &chunk);
+    JS_FreeValue(ctx, chunk);
+
+    if(JS_IsException(ret))
+      return ret;
+
+    JS_FreeValue(ctx, w->last);
+    w->last = ret;
+    ret = xml_writer_wait(w, ctx);
+  }
+
+  memmove(w->buf.buf, w->buf.buf + n, w->buf.size - n);
+  w->buf.size -= n;
+  return ret;
+}
+
+static inline JSValue
+xml_writer_check(XmlWriter* w, JSContext* ctx) {
+  return w->buf.size >= w->block_size ? xml_writer_flush(w, ctx, FALSE) : JS_UNDEFINED;
+}
+
+static JSValue
+xml_writer_unlock(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  JSValue fn = JS_GetPropertyStr(ctx, data[0], "releaseLock"), ret = JS_UNDEFINED;
+
+  if(JS_IsFunction(ctx, fn))
+    ret = JS_Call(ctx, fn, data[0], 0, 0);
+
+  JS_FreeValue(ctx, fn);
+  return ret;
+}
+
+/**
+ * Flushes all of the buffer. Returns the output as string when there is no
+ * sink, for a stream a promise which resolves when the last write is done,
+ * after which the stream's writer is released.
+ */
+static JSValue
+xml_writer_finish(XmlWriter* w, JSContext* ctx) {
+  JSValue ret, fn;
+
+  if(w->fd < 0 && !JS_IsObject(w->writer))
+    return JS_NewStringLen(ctx, (const char*)w->buf.buf, w->buf.size);
+
+  ret = xml_writer_flush(w, ctx, TRUE);
+
+  if(w->fd >= 0 || JS_IsException(ret))
+    return ret;
+
+  JS_FreeValue(ctx, ret);
+  fn = JS_NewCFunctionData(ctx, xml_writer_unlock, 0, 0, 1, &w->writer);
+  ret = js_promise_resolve_then(ctx, w->last, fn);
+  JS_FreeValue(ctx, fn);
+  return ret;
+}
+
+/* writes the tree until it is done or the sink asks to wait, returns the promise to wait for */
+static JSValue
+xml_writer_tree(XmlWriter* w, JSContext* ctx) {
+  PropertyEnumeration* it = w->resume ? xml_enumeration_next(&w->tree, ctx, &w->buf, w->max_depth) : vector_back(&w->tree, sizeof(PropertyEnumeration));
+  JSValue value, wait;
+
+  for(w->resume = TRUE; it; it = xml_enumeration_next(&w->tree, ctx, &w->buf, w->max_depth)) {
+    int32_t depth = vector_size(&w->tree, sizeof(PropertyEnumeration)) - 1;
+
+    depth = MAX_NUM(0, depth - 1);
+
+    value = property_enumeration_value(it, ctx);
+
+    if(JS_IsString(value)) {
+      xml_write_text(ctx, value, &w->buf, depth, it->tab_atom_len > 1);
+    } else if(JS_IsObject(value) && !JS_IsArray(ctx, value)) {
+      int32_t num_children = xml_num_children(ctx, value);
+      xml_write_element(ctx, value, &w->buf, depth, num_children == -1);
+    }
+
+    JS_FreeValue(ctx, value);
+    wait = xml_writer_check(w, ctx);
+
+    if(!JS_IsUndefined(wait))
+      return wait;
+  }
+
+  while(w->buf.size > 0 && (w->buf.buf[w->buf.size - 1] == '\0' || byte_chr("\r\n\t ", 4, w->buf.buf[w->buf.size - 1]) < 4)) w->buf.size--;
+
+  return JS_UNDEFINED;
+}
+
+/**
+ * Writes the items of a flat list, in which a closing tag follows right
+ * after the element when it is empty, until it is done or the sink asks to
+ * wait.  Returns the promise to wait for.
+ */
+static JSValue
+xml_writer_list(XmlWriter* w, JSContext* ctx) {
+  JSValue value, wait;
+
+  while(w->list_index < w->list_length) {
+    value = JS_GetPropertyUint32(ctx, w->list, w->list_index++);
+
+    if(JS_IsString(value)) {
+      const char* s = JS_ToCString(ctx, value);
+
+      w->single_line = str_count(s, '\n') == 0;
+      JS_FreeCString(ctx, s);
+
+      xml_write_text(ctx, value, &w->buf, w->list_depth, !w->single_line);
+
+    } else if(JS_IsObject(value) && !JS_IsArray(ctx, value)) {
+      const char *tagName = js_get_propertystr_cstring(ctx, value, "tagName"), *nextTag = 0;
+      JSValue next = JS_GetPropertyUint32(ctx, w->list, w->list_index);
+      BOOL self_closing;
+
+      if(JS_IsObject(next))
+        nextTag = js_get_propertystr_cstring(ctx, next, "tagName");
+
+      self_closing = tagName && nextTag && nextTag[0] == '/' && !strcmp(tagName, &nextTag[1]);
+
+      if(tagName && tagName[0] == '/')
+        w->list_depth--;
+
+      xml_write_element(ctx, value, &w->buf, w->single_line ? 0 : w->list_depth, self_closing);
+
+      if(self_closing)
+        w->list_index++;
+      else if(tagName && tagName[0] != '/' && tagName[0] != '?' && tagName[0] != '!' && !strcasecmp(tagName, "dt"))
+        w->list_depth++;
+
+      if(nextTag)
+        JS_FreeCString(ctx, nextTag);
+      if(tagName)
+        JS_FreeCString(ctx, tagName);
+
+      JS_FreeValue(ctx, next);
+      w->single_line = FALSE;
+    }
+
+    JS_FreeValue(ctx, value);
+    wait = xml_writer_check(w, ctx);
+
+    if(!JS_IsUndefined(wait))
+      return wait;
+  }
+
+  return JS_UNDEFINED;
+}
+
+/* data[0] = XmlWriter */
+static JSValue
+js_xml_writer_step(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  XmlWriter* w = JS_GetOpaque(data[0], js_xml_writer_class_id);
+  JSValue wait, fn, ret;
+
+  wait = JS_IsObject(w->list) ? xml_writer_list(w, ctx) : xml_writer_tree(w, ctx);
+
+  if(JS_IsException(wait))
+    return wait;
+
+  /* both only return without a promise when they are done */
+  if(JS_IsUndefined(wait))
+    return xml_writer_finish(w, ctx);
+
+  fn = JS_NewCFunctionData(ctx, js_xml_writer_step, 0, 0, 1, data);
+  ret = js_promise_resolve_then(ctx, wait, fn);
+
+  JS_FreeValue(ctx, fn);
+  JS_FreeValue(ctx, wait);
+  return ret;
+}
+
+/* completes the pending start tag */
+static void
+xml_writer_open(XmlWriter* w, BOOL empty) {
+  if(w->pending) {
+    dbuf_putstr(&w->buf, empty ? " />\n" : ">\n");
+    w->pending = FALSE;
+  }
+}
+
+static int
+xml_writer_attributes(XmlWriter* w, JSContext* ctx, JSValueConst attributes) {
+  JSPropertyEnum* props;
+  uint32_t i, len;
+
+  if(JS_GetOwnPropertyNames(ctx, &props, &len, attributes, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+    return -1;
+
+  for(i = 0; i < len; i++) {
+    JSValue value = JS_GetProperty(ctx, attributes, props[i].atom);
+    const char *key = JS_AtomToCString(ctx, props[i].atom), *str;
+    size_t n;
+
+    dbuf_putc(&w->buf, ' ');
+    dbuf_putstr(&w->buf, key);
+    JS_FreeCString(ctx, key);
+
+    if(!(JS_IsBool(value) && JS_ToBool(ctx, value)) && (str = JS_ToCStringLen(ctx, &n, value))) {
+      dbuf_putstr(&w->buf, "=\"");
+      xml_escape_buf(&w->buf, str, n, TRUE);
+      dbuf_putc(&w->buf, '"');
+      JS_FreeCString(ctx, str);
+    }
+
+    JS_FreeValue(ctx, value);
+  }
+
+  js_propertyenums_free(ctx, props, len);
+  return 0;
+}
+
+static int
+xml_writer_start(XmlWriter* w, JSContext* ctx, const char* name, size_t len, JSValueConst attributes) {
+  uint32_t depth = vector_size(&w->open, sizeof(char*));
+  char* s;
+
+  xml_writer_open(w, FALSE);
+  xml_write_indent(&w->buf, depth);
+  dbuf_putc(&w->buf, '<');
+  dbuf_put(&w->buf, (const uint8_t*)name, len);
+
+  if(JS_IsObject(attributes) && xml_writer_attributes(w, ctx, attributes))
+    return -1;
+
+  /* declarations and processing instructions have no content */
+  if(name[0] == '?') {
+    dbuf_putstr(&w->buf, "?>\n");
+    return 0;
+  }
+
+  if(!(s = js_strndup(ctx, name, len)) || !vector_push(&w->open, s)) {
+    js_free(ctx, s);
+    JS_ThrowOutOfMemory(ctx);
+    return -1;
+  }
+
+  w->pending = TRUE;
+  return 0;
+}
+
+static void
+xml_writer_text(XmlWriter* w, const char* text, size_t len) {
+  xml_writer_open(w, FALSE);
+  xml_write_indent(&w->buf, vector_size(&w->open, sizeof(char*)));
+  xml_escape_buf(&w->buf, text, len, FALSE);
+  dbuf_putc(&w->buf, '\n');
+}
+
+static int
+xml_writer_end(XmlWriter* w, JSContext* ctx, const char* name) {
+  char* open;
+
+  if(vector_empty(&w->open)) {
+    JS_ThrowSyntaxError(ctx, "XmlWriter: no open element to end");
+    return -1;
+  }
+
+  open = *(char**)vector_back(&w->open, sizeof(char*));
+
+  if(name && strcmp(name, open)) {
+    JS_ThrowSyntaxError(ctx, "XmlWriter: ending <%s> while <%s> is open", name, open);
+    return -1;
+  }
+
+  vector_pop(&w->open, sizeof(char*));
+
+  if(w->pending) {
+    xml_writer_open(w, TRUE);
+  } else {
+    xml_write_indent(&w->buf, vector_size(&w->open, sizeof(char*)));
+    dbuf_putstr(&w->buf, "</");
+    dbuf_putstr(&w->buf, open);
+    dbuf_putstr(&w->buf, ">\n");
+  }
+
+  js_free(ctx, open);
+  return 0;
+}
+
+static JSValue
+js_xml_writer_new(JSContext* ctx, JSValueConst proto, JSValueConst target, JSValueConst options) {
+  XmlWriter* w;
+  JSValue obj;
+
+  if(!(w = js_mallocz(ctx, sizeof(XmlWriter))))
+    return JS_EXCEPTION;
+
+  xml_writer_init(w, ctx);
+
+  obj = JS_NewObjectProtoClass(ctx, proto, js_xml_writer_class_id);
+
+  if(JS_IsException(obj)) {
+    xml_writer_free(w, JS_GetRuntime(ctx));
+    js_free(ctx, w);
+    return obj;
+  }
+
+  JS_SetOpaque(obj, w);
+
+  if(xml_writer_target(w, ctx, target)) {
+    JS_FreeValue(ctx, obj);
+    return JS_EXCEPTION;
+  }
+
+  if(JS_IsObject(options) && w->block_size != SIZE_MAX) {
+    JSValue value = JS_GetPropertyStr(ctx, options, "blockSize");
+    uint32_t size;
+
+    if(!JS_IsUndefined(value) && !JS_ToUint32(ctx, &size, value))
+      w->block_size = MAX_NUM(size, 1);
+
+    JS_FreeValue(ctx, value);
+  }
+
+  return obj;
+}
+
+/**
+ * new XmlWriter(target, { blockSize })
+ *
+ * 'target' is a file descriptor, a WritableStream or an object with a
+ * write() method, without one end() returns the output as string.
+ */
+static JSValue
+js_xml_writer_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  JSValue proto, obj;
+
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+
+  if(!JS_IsObject(proto)) {
+    JS_FreeValue(ctx, proto);
+    proto = JS_DupValue(ctx, xml_writer_proto);
+  }
+
+  obj = js_xml_writer_new(ctx, proto, argc > 0 ? argv[0] : JS_UNDEFINED, argc > 1 ? argv[1] : JS_UNDEFINED);
+  JS_FreeValue(ctx, proto);
+  return obj;
+}
+
+/**
+ * startElement(name, attributes), text(str), endElement([name]) return a
+ * promise when the sink wants the producer to wait, flush() hands all of
+ * the output over and end() also closes the open elements.
+ */
+static JSValue
+js_xml_writer_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  XmlWriter* w;
+  const char* str = 0;
+  size_t len;
+  int r = 0;
+
+  if(!(w = JS_GetOpaque2(ctx, this_val, js_xml_writer_class_id)))
+    return JS_EXCEPTION;
+
+  if(magic <= XML_WRITER_END && (magic != XML_WRITER_END || (argc > 0 && !JS_IsUndefined(argv[0]))))
+    if(!(str = JS_ToCStringLen(ctx, &len, argv[0])))
+      return JS_EXCEPTION;
+
+  switch(magic) {
+    case XML_WRITER_START: {
+      r = xml_writer_start(w, ctx, str, len, argc > 1 ? argv[1] : JS_UNDEFINED);
+      break;
+    }
+
+    case XML_WRITER_TEXT: {
+      xml_writer_text(w, str, len);
+      break;
+    }
+
+    case XML_WRITER_END: {
+      r = xml_writer_end(w, ctx, str);
+      break;
+    }
+
+    case XML_WRITER_FLUSH: {
+      return xml_writer_flush(w, ctx, TRUE);
+    }
+
+    case XML_WRITER_CLOSE: {
+      while(!vector_empty(&w->open))
+        if(xml_writer_end(w, ctx, 0))
+          return JS_EXCEPTION;
+
+      return xml_writer_finish(w, ctx);
+    }
+  }
+
+  if(str)
+    JS_FreeCString(ctx, str);
+
+  return r < 0 ? JS_EXCEPTION : xml_writer_check(w, ctx);
+}
+
+static JSValue
+js_xml_writer_depth(JSContext* ctx, JSValueConst this_val) {
+  XmlWriter* w;
+
+  if(!(w = JS_GetOpaque2(ctx, this_val, js_xml_writer_class_id)))
+    return JS_EXCEPTION;
+
+  return JS_NewUint32(ctx, vector_size(&w->open, sizeof(char*)));
+}
+
+static void
+js_xml_writer_finalizer(JSRuntime* rt, JSValue val) {
+  XmlWriter* w;
+
+  if((w = JS_GetOpaque(val, js_xml_writer_class_id))) {
+    xml_writer_free(w, rt);
+    js_free_rt(rt, w);
+  }
+}
+
+/**
+ * xml.write(tree, maxDepth, target)
+ *
+ * Returns the document as string, or writes it to 'target' like XmlWriter,
+ * in which case a stream gets a promise of the whole document being written.
+ */
+static JSValue
+js_xml_write(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSValueConst obj = argc > 0 ? argv[0] : JS_UNDEFINED;
+  JSValue ret, last, writer, children = JS_UNDEFINED, arr = JS_UNDEFINED;
+  int32_t max_depth = INT32_MAX;
+  XmlWriter* w;
+  size_t len;
+  BOOL flat = TRUE;
+
+  /* undefined or Infinity when only passing a target */
+  if(argc >= 2 && JS_IsNumber(argv[1])) {
+    double d;
+
+    if(!JS_ToFloat64(ctx, &d, argv[1]) && d < INT32_MAX)
+      max_depth = d;
+  }
+
+  writer = js_xml_writer_new(ctx, xml_writer_proto, argc > 2 ? argv[2] : JS_UNDEFINED, JS_UNDEFINED);
+
+  if(JS_IsException(writer))
+    return writer;
+
+  w = JS_GetOpaque(writer, js_xml_writer_class_id);
+
+  /* a compact document is written like the array of its top-level nodes */
+  if(JS_GetOpaque(obj, js_xml_document_class_id))
+    obj = arr = JS_GetPropertyStr(ctx, obj, "children");
+
+  if(!JS_IsArray(ctx, obj)) {
+    arr = JS_NewArray(ctx);
+    JS_SetPropertyUint32(ctx, arr, 0, JS_DupValue(ctx, obj));
+    obj = arr;
+  }
+
+  len = js_array_length(ctx, obj);
+
+  last = JS_GetPropertyUint32(ctx, obj, len - 1);
+
+  if(JS_IsObject(last)) {
+    children = JS_GetPropertyStr(ctx, last, "children");
+
+    if(JS_IsArray(ctx, children))
+      flat = FALSE;
+  }
+
+  xml_debug("js_xml_write len=%zu, children=%s, flat=%d\n", len, JS_ToCString(ctx, children), flat);
+
+  /* both are flushed block by block, like XmlWriter does */
+  if(flat) {
+    w->list = JS_DupValue(ctx, obj);
+    w->list_length = len;
+  } else {
+    w->max_depth = max_depth;
+    property_enumeration_push(&w->tree, ctx, JS_DupValue(ctx, obj), PROPENUM_DEFAULT_FLAGS);
+  }
+
+  ret = js_xml_writer_step(ctx, this_val, 0, 0, 0, &writer);
+
+  JS_FreeValue(ctx, children);
+  JS_FreeValue(ctx, last);
+  JS_FreeValue(ctx, writer);
+
+  if(!JS_IsUndefined(arr))
+    JS_FreeValue(ctx, arr);
+
+  return ret;
+}
+
+/**
+ * Event-driven parser: input is pushed in chunks and only the names of the
+ * open elements are kept between them.  Markup which is cut off at the end of
+ * a chunk is held back in 'tail' until the rest of it arrives.
+ */
+typedef struct xml_parser XmlParser;
+
+/* receives the events, either by calling the JS handlers or natively */
+typedef struct {
+  int (*start)(XmlParser*, JSContext*, const uint8_t* name, size_t namelen, const uint8_t* attr, const uint8_t* attr_end, BOOL self_closing);
+  int (*text)(XmlParser*, JSContext*, const uint8_t* start, const uint8_t* end);
+  int (*end)(XmlParser*, JSContext*, const uint8_t* name, size_t namelen);
+} XmlParserEvents;
+
+/* how far the construct at the start of the tail has already been scanned */
+typedef struct {
+  size_t pos;
+  uint8_t quote;
+} XmlScan;
+
+struct xml_parser {
+  DynBuf tail;
+  XmlScan scan;
+  Vector st;
+  JSValue handlers, on_start, on_text, on_end;
+  ParseOptions opts;
+  Location loc;
+  BOOL busy, ended;
+  const XmlParserEvents* events;
+  void* opaque;
+};
+
+
+enum {
+  XML_PARSER_WRITE,
+  XML_PARSER_END,
+};
+
+/**
+ * Scans the next attribute in the range [*pptr, end) with the syntax
+ * js_xml_parse() accepts.  'value' is 0 for attributes without one.
+ */
+static BOOL
+xml_attribute_next(const uint8_t** pptr, const uint8_t* end, const uint8_t** attr, size_t* alen, const uint8_t** value, size_t* vlen) {
+  const uint8_t* ptr = *pptr;
+
+  ptr += xml_skipspace(ptr, end - ptr);
+
+  for(*attr = ptr; ptr < end && !parse_is(*ptr, EQUAL | WS | SPECIAL | CLOSE); ptr++) {}
+
+  if((*alen = ptr - *attr) == 0)
+    return FALSE;
+
+  *value = 0;
+  *vlen = 0;
+
+  if(ptr < end && parse_is(*ptr, EQUAL)) {
+    uint8_t quote = 0;
+
+    if(++ptr < end && parse_is(*ptr, QUOTE))
+      quote = *ptr++;
+
+    *value = ptr;
+
+    if(quote)
+      ptr += byte_chr(ptr, end - ptr, quote);
+    else
+      while(ptr < end && !parse_is(*ptr, WS | CLOSE)) ptr++;
+
+    *vlen = ptr - *value;
+
+    if(quote && ptr < end)
+      ptr++;
+  }
+
+  *pptr = ptr;
+  return TRUE;
+}
+
+static JSValue
+xml_parse_attributes(JSContext* ctx, const uint8_t* ptr, const uint8_t* end, BOOL decode) {
+  JSValue attributes = JS_NewObject(ctx);
+  const uint8_t *attr, *value;
+  size_t alen, vlen;
+
+  while(xml_attribute_next(&ptr, end, &attr, &alen, &value, &vlen)) {
+    JSValue v = !value ? JS_NewBool(ctx, TRUE) : decode ? xml_decode(ctx, value, vlen, FALSE) : JS_NewStringLen(ctx, (const char*)value, vlen);
+
+    xml_set_attr_value(ctx, attributes, (const char*)attr, alen, v);
+  }
+
+  return attributes;
+}
+
+/* like location_count(), but counts columns in bytes */
+static void
+xml_location_advance(Location* loc, const uint8_t* buf, size_t n) {
+  const uint8_t *p = buf, *end = buf + n, *nl;
+
+  while((nl = memchr(p, '\n', end - p))) {
+    loc->line++;
+    loc->column = 0;
+    p = nl + 1;
+  }
+
+  loc->column += end - p;
+  loc->byte_offset += n;
+}
+
+/* returns a pointer to the last character of 'needle' or 0 */
+static const uint8_t*
+xml_search(const uint8_t* p, const uint8_t* end, const char* needle, size_t len) {
+  while((size_t)(end - p) >= len) {
+    p += byte_chr(p, end - p, needle[0]);
+
+    if((size_t)(end - p) < len)
+      break;
+
+    if(!memcmp(p, needle, len))
+      return p + len - 1;
+
+    p++;
+  }
+
+  return 0;
+}
+
+/* searches the terminator of a comment or CDATA section from 'scan->pos' */
+static const uint8_t*
+xml_markup_search(const uint8_t* ptr, const uint8_t* end, size_t start, const char* needle, XmlScan* scan) {
+  const uint8_t* p;
+
+  if(!(p = xml_search(ptr + MAX_NUM(start, scan->pos), end, needle, 3)))
+    scan->pos = MAX_NUM(start, (size_t)(end - ptr) - 2);
+
+  return p;
+}
+
+/**
+ * Returns the '>' which ends the markup at 'ptr', or 0 if it is incomplete.
+ * In the latter case 'scan' records how far the markup has been scanned, so
+ * that the next call with more input picks up from there.
+ */
+static const uint8_t*
+xml_markup_end(const uint8_t* ptr, const uint8_t* end, XmlScan* scan) {
+  const uint8_t* p;
+  size_t n = end - ptr;
+
+  if(n >= 2 && ptr[1] == '!') {
+    if(n < 4)
+      return 0;
+
+    if(ptr[2] == '-' && ptr[3] == '-')
+      return xml_markup_search(ptr, end, 4, "-->", scan);
+
+    if(!memcmp(ptr, "<![CDATA[", MIN_NUM(n, 9)))
+      return n < 9 ? 0 : xml_markup_search(ptr, end, 9, "]]>", scan);
+
+    if(!(p = memchr(ptr + scan->pos, '>', n - scan->pos)))
+      scan->pos = n;
+
+    return p;
+  }
+
+  for(p = ptr + MAX_NUM(scan->pos, 1); p < end; p++) {
+    if(scan->quote) {
+      if((p += byte_chr(p, end - p, scan->quote)) == end)
+        break;
+
+      scan->quote = 0;
+    } else {
+      if((p += byte_chrs(p, end - p, "\"'>", 3)) == end)
+        break;
+
+      if(*p == '>')
+        return p;
+
+      scan->quote = *p;
+    }
+  }
+
+  scan->pos = n;
+  return 0;
+}
+
+static void
+xml_parser_throw(XmlParser* xp, JSContext* ctx, const uint8_t* buf, const uint8_t* ptr, const char* what, const uint8_t* name, size_t namelen) {
+  Location loc = xp->loc;
+  char* file;
+
+  xml_location_advance(&loc, buf, ptr - buf);
+  file = location_file(&loc, ctx);
+  JS_ThrowSyntaxError(ctx, what, (int)namelen, name, file, loc.line + 1, loc.column + 1);
+
+  if(file)
+    js_free(ctx, file);
+}
+
+static int
+xml_parser_call(XmlParser* xp, JSContext* ctx, JSValueConst fn, int argc, JSValue argv[]) {
+  JSValue ret = JS_Call(ctx, fn, xp->handlers, argc, argv);
+  int i;
+
+  for(i = 0; i < argc; i++) JS_FreeValue(ctx, argv[i]);
+
+  if(JS_IsException(ret))
+    return -1;
+
+  JS_FreeValue(ctx, ret);
+  return 0;
+}
+
+static int
+xml_handler_text(XmlParser* xp, JSContext* ctx, const uint8_t* start, const uint8_t* end) {
+  const char* top;
+  BOOL decode;
+
+  if(!JS_IsFunction(ctx, xp->on_text))
+    return 0;
+
+  /* the content of <script> is passed as is, like js_xml_parse() does */
+  top = vector_empty(&xp->st) ? 0 : *(char**)vector_back(&xp->st, sizeof(char*));
+  decode = xp->opts.decode && !(top && !strcmp(top, "script"));
+
+  return xml_parser_call(xp, ctx, xp->on_text, 1, (JSValue[]){decode ? xml_decode(ctx, start, end - start, FALSE) : JS_NewStringLen(ctx, (const char*)start, end - start)});
+}
+
+static int
+xml_handler_start(XmlParser* xp, JSContext* ctx, const uint8_t* name, size_t namelen, const uint8_t* attr, const uint8_t* end, BOOL self_closing) {
+  if(!JS_IsFunction(ctx, xp->on_start))
+    return 0;
+
+  return xml_parser_call(xp,
+                         ctx,
+                         xp->on_start,
+                         2,
+                         (JSValue[]){
+                             JS_NewStringLen(ctx, (const char*)name, namelen),
+                             attr ? xml_parse_attributes(ctx, attr, end, xp->opts.decode) : JS_NewObject(ctx),
+                         });
+}
+
+static int
+xml_handler_end(XmlParser* xp, JSContext* ctx, const uint8_t* name, size_t namelen) {
+  if(!JS_IsFunction(ctx, xp->on_end))
+    return 0;
+
+  return xml_parser_call(xp, ctx, xp->on_end, 1, (JSValue[]){JS_NewStringLen(ctx, (const char*)name, namelen)});
+}
+
+static const XmlParserEvents xml_handler_events = {
+    xml_handler_start,
+    xml_handler_text,
+    xml_handler_end,
+};
+
+static int
+xml_parser_text(XmlParser* xp, JSContext* ctx, const uint8_t* start, const uint8_t* end, BOOL trim) {
+  start += xml_skipspace(start, end - start);
+
+  if(trim)
+    while(end > start && parse_is(end[-1], WS)) end--;
+
+  return start < end ? xp->events->text(xp, ctx, start, end) : 0;
+}
+
+static int32_t
+xml_parser_find(XmlParser* xp, const uint8_t* name, size_t namelen) {
+  int32_t index = vector_size(&xp->st, sizeof(char*));
+
+  while(--index >= 0) {
+    const char* s = *(char**)vector_at(&xp->st, sizeof(char*), index);
+
+    if(!strncmp(s, (const char*)name, namelen) && s[namelen] == '\0')
+      return index;
+  }
+
+  return -1;
+}
+
+/* closes the open elements down to 'index' */
+static int
+xml_parser_pop(XmlParser* xp, JSContext* ctx, uint32_t index) {
+  while(vector_size(&xp->st, sizeof(char*)) > index) {
+    char* name = *(char**)vector_back(&xp->st, sizeof(char*));
+    int ret;
+
+    vector_pop(&xp->st, sizeof(char*));
+    ret = xp->events->end(xp, ctx, (const uint8_t*)name, strlen(name));
+    js_free(ctx, name);
+
+    if(ret < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Emits the events for the complete constructs in 'buf' and returns the
+ * number of bytes consumed.  Unless 'final' is set, text is only emitted
+ * when the markup following it has been seen, so that it can be trimmed
+ * like js_xml_parse() does.
+ */
+static ssize_t
+xml_parser_scan(XmlParser* xp, JSContext* ctx, const uint8_t* buf, size_t len, BOOL final) {
+  const uint8_t *ptr = buf, *end = buf + len, *next, *name, *gt;
+  size_t namelen;
+  XmlScan scan = xp->scan;
+
+  xp->scan = (XmlScan){0, 0};
+
+  /* 'scan' only applies to the construct at the start of 'buf' */
+  for(; ptr < end; scan = (XmlScan){0, 0}) {
+    const char* top = vector_empty(&xp->st) ? 0 : *(char**)vector_back(&xp->st, sizeof(char*));
+
+    if(top && !strcmp(top, "script")) {
+      for(next = ptr + scan.pos; (next += byte_chr(next, end - next, '<')) < end; next++)
+        if(end - next < 9 || !memcmp(next, "</script>", 9))
+          break;
+
+      if(end - next < 9) {
+        if(!final) {
+          xp->scan.pos = next - ptr;
+          break;
+        }
+
+        next = end;
+      }
+
+      if(xml_parser_text(xp, ctx, ptr, next, FALSE) < 0)
+        return -1;
+
+    } else {
+      /* a tail which starts with '<' holds markup, the scan state is about that */
+      if(*ptr == '<')
+        scan.pos = 0;
+
+      if((next = ptr + scan.pos + byte_chr(ptr + scan.pos, end - ptr - scan.pos, '<')) == end && !final) {
+        xp->scan.pos = next - ptr;
+        break;
+      }
+
+      if(xml_parser_text(xp, ctx, ptr, next, TRUE) < 0)
+        return -1;
+    }
+
+    if(next != ptr)
+      scan = (XmlScan){0, 0};
+
+    if((ptr = next) == end)
+      break;
+
+    if(!(gt = xml_markup_end(ptr, end, &scan))) {
+      if(!final) {
+        xp->scan = scan;
+        break;
+      }
+
+      if(!xp->opts.tolerant) {
+        xml_parser_throw(xp, ctx, buf, ptr, "unterminated <%.*s at %s:%u:%u", ptr + 1, MIN_NUM(byte_chr(ptr + 1, end - ptr - 1, '\n'), 32));
+        return -1;
+      }
+
+      ptr = end;
+      break;
+    }
+
+    name = ptr + 1;
+
+    if(*name == '/') {
+      int32_t index;
+
+      for(next = ++name; next < gt && !parse_is(*next, WS | END); next++) {}
+      namelen = next - name;
+
+      if((index = xml_parser_find(xp, name, namelen)) >= 0) {
+        if(xml_parser_pop(xp, ctx, index) < 0)
+          return -1;
+
+      } else if(!xp->opts.tolerant) {
+        xml_parser_throw(xp, ctx, buf, ptr, "mismatch </%.*s> at %s:%u:%u", name, namelen);
+        return -1;
+      }
+
+    } else if(*name == '!') {
+      /* comments, CDATA and declarations are reported as one element */
+      namelen = gt - name;
+
+      if(xp->events->start(xp, ctx, name, namelen, 0, 0, TRUE) < 0 || xp->events->end(xp, ctx, name, namelen) < 0)
+        return -1;
+
+    } else {
+      const uint8_t* attr_end = gt;
+      BOOL self_closing;
+
+      for(next = name; next < gt && !parse_is(*next, WS | END); next++) {}
+
+      if((namelen = next - name)) {
+        /* processing instructions never have content */
+        self_closing = *name == '?' || gt[-1] == '/' || is_self_closing_tag((const char*)name, namelen, &xp->opts);
+
+        if(gt[-1] == (*name == '?' ? '?' : '/'))
+          attr_end = MAX_NUM(next, gt - 1);
+
+        if(xp->events->start(xp, ctx, name, namelen, next, attr_end, self_closing) < 0)
+          return -1;
+
+        if(self_closing) {
+          if(xp->events->end(xp, ctx, name, namelen) < 0)
+            return -1;
+
+        } else {
+          char* s;
+
+          if(!(s = js_strndup(ctx, (const char*)name, namelen)))
+            return -1;
+
+          vector_push(&xp->st, s);
+        }
+      }
+    }
+
+    ptr = gt + 1;
+  }
+
+  return ptr - buf;
+}
+
+static int
+xml_parser_write(XmlParser* xp, JSContext* ctx, const uint8_t* data, size_t len, BOOL final) {
+  ssize_t n;
+  int ret = 0;
+
+  if(xp->busy || xp->ended) {
+    JS_ThrowInternalError(ctx, "XML parser %s", xp->busy ? "is busy" : "has ended");
+    return -1;
+  }
+
+  if(xp->tail.size) {
+    if(len && dbuf_put(&xp->tail, data, len)) {
+      JS_ThrowOutOfMemory(ctx);
+      return -1;
+    }
+
+    data = xp->tail.buf;
+    len = xp->tail.size;
+  }
+
+  xp->busy = TRUE;
+
+  if((n = xml_parser_scan(xp, ctx, data, len, final)) < 0) {
+    ret = -1;
+  } else {
+    xml_location_advance(&xp->loc, data, n);
+
+    if(data == xp->tail.buf) {
+      if(n > 0)
+        memmove(xp->tail.buf, xp->tail.buf + n, len - n);
+
+      xp->tail.size = len - n;
+    } else if((size_t)n < len && dbuf_put(&xp->tail, data + n, len - n)) {
+      JS_ThrowOutOfMemory(ctx);
+      ret = -1;
+    }
+
+    /* elements left open at the end of input are closed implicitly */
+    if(final)
+      ret = xml_parser_pop(xp, ctx, 0);
+  }
+
+  xp->busy = FALSE;
+
+  if(final || ret < 0)
+    xp->ended = TRUE;
+
+  return ret;
+}
+
+static int
+xml_parser_put(XmlParser* xp, JSContext* ctx, JSValueConst chunk) {
+  InputBuffer input = js_input_chars(ctx, chunk);
+  int ret;
+
+  if(JS_IsException(input.value)) {
+    JS_ThrowTypeError(ctx, "XML parser: expecting buffer or string");
+    return -1;
+  }
+
+  ret = xml_parser_write(xp, ctx, input_buffer_begin(&input), input_buffer_length(&input), FALSE);
+
+  input_buffer_free(&input, ctx);
+  return ret;
+}
+
+static void
+xml_parser_init(XmlParser* xp, JSContext* ctx, const XmlParserEvents* events, const char* input_name) {
+  js_dbuf_init_rt(JS_GetRuntime(ctx), &xp->tail);
+  vector_init_rt(&xp->st, JS_GetRuntime(ctx));
+  location_init(&xp->loc);
+
+  xp->loc.file = JS_NewAtom(ctx, input_name ? input_name : "<input>");
+  xp->handlers = xp->on_start = xp->on_text = xp->on_end = JS_UNDEFINED;
+  xp->opts = (ParseOptions){.flat = FALSE, .tolerant = FALSE, .self_closing_tags = default_self_closing_tags};
+  xp->events = events;
+  xp->opaque = 0;
+  xp->scan = (XmlScan){0, 0};
+  xp->busy = xp->ended = FALSE;
+}
+
+/* frees everything but the options */
+static void
+xml_parser_free(XmlParser* xp, JSRuntime* rt) {
+  char** ptr;
+
+  vector_foreach_t(&xp->st, ptr) js_free_rt(rt, *ptr);
+  vector_free(&xp->st);
+  dbuf_free(&xp->tail);
+
+  JS_FreeValueRT(rt, xp->handlers);
+  JS_FreeValueRT(rt, xp->on_start);
+  JS_FreeValueRT(rt, xp->on_text);
+  JS_FreeValueRT(rt, xp->on_end);
+  JS_FreeAtomRT(rt, xp->loc.file);
+}
+
+static JSValue
+js_xml_parser_new(JSContext* ctx, JSValueConst proto, JSValueConst handlers, JSValueConst options) {
+  XmlParser* xp;
+  JSValue obj;
+  const char* name = 0;
+
+  if(!(xp = js_mallocz(ctx, sizeof(XmlParser))))
+    return JS_EXCEPTION;
+
+  obj = JS_NewObjectProtoClass(ctx, proto, js_xml_parser_class_id);
+
+  if(JS_IsException(obj)) {
+    js_free(ctx, xp);
+    return JS_EXCEPTION;
+  }
+
+  if(JS_IsObject(options))
+    name = js_get_propertystr_cstring(ctx, options, "name");
+
+  xml_parser_init(xp, ctx, &xml_handler_events, name);
+
+  if(name)
+    JS_FreeCString(ctx, name);
+
+  if(JS_IsObject(options))
+    xml_parse_options(ctx, options, &xp->opts);
+
+  if(JS_IsObject(handlers)) {
+    xp->handlers = JS_DupValue(ctx, handlers);
+    xp->on_start = JS_GetPropertyStr(ctx, handlers, "onStart");
+    xp->on_text = JS_GetPropertyStr(ctx, handlers, "onText");
+    xp->on_end = JS_GetPropertyStr(ctx, handlers, "onEnd");
+  }
+
+  JS_SetOpaque(obj, xp);
+  return obj;
+}
+
+static JSValue
+js_xml_parser_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  JSValue proto, obj;
+
+  /* using new_target to get the prototype is necessary when the class is extended. */
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+  if(JS_IsException(proto))
+    return JS_EXCEPTION;
+
+  obj = js_xml_parser_new(ctx, proto, argc > 0 ? argv[0] : JS_UNDEFINED, argc > 1 ? argv[1] : JS_UNDEFINED);
+  JS_FreeValue(ctx, proto);
+  return obj;
+}
+
+static JSValue
+js_xml_parser_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  XmlParser* xp;
+
+  if(!(xp = JS_GetOpaque2(ctx, this_val, js_xml_parser_class_id)))
+    return JS_EXCEPTION;
+
+  if(argc > 0 && !JS_IsUndefined(argv[0]))
+    if(xml_parser_put(xp, ctx, argv[0]) < 0)
+      return JS_EXCEPTION;
+
+  if(magic == XML_PARSER_END)
+    if(xml_parser_write(xp, ctx, 0, 0, TRUE) < 0)
+      return JS_EXCEPTION;
+
+  return JS_UNDEFINED;
+}
+
+static JSValue
+js_xml_parser_depth(JSContext* ctx, JSValueConst this_val) {
+  XmlParser* xp;
+
+  if(!(xp = JS_GetOpaque2(ctx, this_val, js_xml_parser_class_id)))
+    return JS_EXCEPTION;
+
+  return JS_NewUint32(ctx, vector_size(&xp->st, sizeof(char*)));
+}
+
+static void
+js_xml_parser_finalizer(JSRuntime* rt, JSValue val) {
+  XmlParser* xp;
+
+  if((xp = JS_GetOpaque(val, js_xml_parser_class_id))) {
+    xml_parser_free(xp, rt);
+    xml_parse_options_free(rt, &xp->opts);
+    js_free_rt(rt, xp);
+  }
+}
+
+/**
+ * Compact document built by xml.parseCompact() and xml.read(input, name,
+ * { lazy: true }).
+ *
+ * The input stays referenced (an mmap'd ArrayBuffer is never copied) and
+ * the parser only fills three arenas: nodes, attributes and a pool of the
+ * distinct tag and attribute names.  Text and values are kept as byte spans
+ * into the input.  Element objects are created when the 'children' of their
+ * parent are first read, and each of their properties when it is first
+ * read; entities are decoded at that point.
+ */
+enum {
+  XML_NODE_TEXT = 1,
+  XML_NODE_ATTRIBUTES = 2,
+  XML_NODE_CHILDREN = 4,
+};
+
+#define XML_NONE UINT32_MAX
+
+typedef struct {
+  uint32_t flags;
+  uint32_t name;             /* index into 'names', XML_NONE for text, comments and declarations */
+  uint32_t offset, length;   /* span of the tag name or the text */
+  uint32_t attr, attr_count; /* range of 'attrs' */
+  int32_t parent, first_child, last_child, next_sibling;
+} XmlNode;
+
+typedef struct {
+  uint32_t name;
+  uint32_t offset, length; /* span of the value, offset is XML_NONE when it has none */
+} XmlAttr;
+
+typedef struct {
+  JSAtom atom;
+  uint32_t hash, offset, length;
+} XmlName;
+
+typedef struct {
+  uint32_t child;       /* index in the parent's children */
+  uint32_t pos, rpos;   /* 1-based among the element siblings, from the start and from the end */
+  uint32_t tpos, trpos; /* the same among the siblings with the same name */
+  int32_t prev;         /* previous element sibling */
+} XmlPosition;
+
+/* built on demand by the selectors */
+typedef struct {
+  uint32_t *by_name, *name_start; /* elements grouped by tag name, in document order */
+  uint32_t *by_attr, *attr_start; /* elements grouped by attribute name */
+  XmlPosition* positions;         /* filled in for all children of a parent at once */
+  uint32_t *scratch, scratch_size;
+} XmlIndex;
+
+typedef struct {
+  int ref_count;
+  JSRuntime* rt;
+  InputBuffer input;
+  Vector nodes, attrs, names;
+  uint32_t *name_map, name_map_size; /* open addressing, index + 1 into 'names' */
+  int32_t current;
+  XmlIndex index;
+} XmlDocument;
+
+typedef struct {
+  XmlDocument* doc;
+  int32_t index;
+} XmlElement;
+
+enum {
+  ELEMENT_TAGNAME,
+  ELEMENT_ATTRIBUTES,
+  ELEMENT_CHILDREN,
+};
+
+enum {
+  DOCUMENT_NODES,
+  DOCUMENT_ATTRS,
+  DOCUMENT_NAMES,
+  DOCUMENT_LENGTH,
+};
+
+static const char* const xml_element_props[] = {"tagName", "attributes", "children"};
+
+thread_local JSValue xml_element_getters[3], xml_element_setters[3];
+
+static inline XmlNode*
+xml_document_at(XmlDocument* doc, int32_t index) {
+  return vector_at(&doc->nodes, sizeof(XmlNode), index);
+}
+
+static inline const uint8_t*
+xml_document_begin(XmlDocument* doc) {
+  return input_buffer_begin(&doc->input);
+}
+
+/* takes ownership of 'input', which must be freeable without a context */
+static XmlDocument*
+xml_document_new(JSContext* ctx, InputBuffer* input) {
+  XmlDocument* doc;
+  XmlNode* root;
+
+  if(!(doc = js_mallocz(ctx, sizeof(XmlDocument)))) {
+    input_buffer_free(input, ctx);
+    return 0;
+  }
+
+  doc->ref_count = 1;
+  doc->rt = JS_GetRuntime(ctx);
+  doc->input = *input;
+  vector_init_rt(&doc->nodes, doc->rt);
+  vector_init_rt(&doc->attrs, doc->rt);
+  vector_init_rt(&doc->names, doc->rt);
+
+  if((root = vector_emplace(&doc->nodes, sizeof(XmlNode))))
+    *root = (XmlNode){XML_NODE_CHILDREN, XML_NONE, 0, 0, 0, 0, -1, -1, -1, -1};
+
+  return doc;
+}
+
+static void
+xml_index_free(JSRuntime* rt, XmlIndex* ix) {
+  js_free_rt(rt, ix->by_name);
+  js_free_rt(rt, ix->name_start);
+  js_free_rt(rt, ix->by_attr);
+  js_free_rt(rt, ix->attr_start);
+  js_free_rt(rt, ix->positions);
+  js_free_rt(rt, ix->scratch);
+}
+
+static inline XmlDocument*
+xml_document_dup(XmlDocument* doc) {
+  ++doc->ref_count;
+  return doc;
+}
+
+static void
+xml_document_release(XmlDocument* doc) {
+  JSRuntime* rt = doc->rt;
+  XmlName* name;
+
+  if(--doc->ref_count)
+    return;
+
+  vector_foreach_t(&doc->names, name) JS_FreeAtomRT(rt, name->atom);
+
+  xml_index_free(rt, &doc->index);
+  input_buffer_free_rt(&doc->input, rt);
+  vector_free(&doc->nodes);
+  vector_free(&doc->attrs);
+  vector_free(&doc->names);
+  js_free_rt(rt, doc->name_map);
+  js_free_rt(rt, doc);
+}
+
+static BOOL
+xml_document_rehash(XmlDocument* doc, JSContext* ctx) {
+  uint32_t i, j, size = doc->name_map_size ? doc->name_map_size * 2 : 64, *map;
+  XmlName* name;
+
+  if(!(map = js_mallocz(ctx, size * sizeof(uint32_t))))
+    return FALSE;
+
+  for(i = 0; i < vector_size(&doc->names, sizeof(XmlName)); i++) {
+    name = vector_at(&doc->names, sizeof(XmlName), i);
+
+    for(j = name->hash & (size - 1); map[j]; j = (j + 1) & (size - 1)) {}
+    map[j] = i + 1;
+  }
+
+  js_free(ctx, doc->name_map);
+  doc->name_map = map;
+  doc->name_map_size = size;
+  return TRUE;
+}
+
+/* returns the index of the name in the pool or XML_NONE, '*slot' is where it belongs in 'name_map' */
+static uint32_t
+xml_document_lookup(XmlDocument* doc, const uint8_t* s, size_t len, uint32_t hash, uint32_t* slot) {
+  const uint8_t* base = xml_document_begin(doc);
+  uint32_t i, index;
+  XmlName* name;
+
+  if(doc->name_map_size == 0)
+    return XML_NONE;
+
+  for(i = hash & (doc->name_map_size - 1); (index = doc->name_map[i]); i = (i + 1) & (doc->name_map_size - 1)) {
+    name = vector_at(&doc->names, sizeof(XmlName), index - 1);
+
+    if(name->hash == hash && name->length == len && !memcmp(base + name->offset, s, len))
+      return index - 1;
+  }
+
+  if(slot)
+    *slot = i;
+
+  return XML_NONE;
+}
+
+/* returns the index of the name in the pool, adding it if it is new */
+static uint32_t
+xml_document_intern(XmlDocument* doc, JSContext* ctx, const uint8_t* s, size_t len) {
+  const uint8_t* base = xml_document_begin(doc);
+  uint32_t i, index, hash = xml_name_hash(s, len), count = vector_size(&doc->names, sizeof(XmlName));
+  XmlName* name;
+
+  if((count + 1) * 2 > doc->name_map_size && !xml_document_rehash(doc, ctx))
+    return XML_NONE;
+
+  if((index = xml_document_lookup(doc, s, len, hash, &i)) != XML_NONE)
+    return index;
+
+  if(!(name = vector_emplace(&doc->names, sizeof(XmlName))))
+    return XML_NONE;
+
+  *name = (XmlName){JS_NewAtomLen(ctx, (const char*)s, len), hash, s - base, len};
+  doc->name_map[i] = count + 1;
+  return count;
+}
+
+/* appends a node to the current element */
+static int32_t
+xml_document_node(XmlDocument* doc, uint32_t flags, const uint8_t* s, size_t len) {
+  int32_t index = vector_size(&doc->nodes, sizeof(XmlNode));
+  XmlNode *node, *parent;
+
+  if(!(node = vector_emplace(&doc->nodes, sizeof(XmlNode))))
+    return -1;
+
+  *node = (XmlNode){flags, XML_NONE, s - xml_document_begin(doc), len, 0, 0, doc->current, -1, -1, -1};
+  parent = xml_document_at(doc, doc->current);
+
+  if(parent->last_child == -1)
+    parent->first_child = index;
+  else
+    xml_document_at(doc, parent->last_child)->next_sibling = index;
+
+  parent->last_child = index;
+  return index;
+}
+
+static int
+xml_document_start(XmlParser* xp, JSContext* ctx, const uint8_t* name, size_t namelen, const uint8_t* attr, const uint8_t* attr_end, BOOL self_closing) {
+  XmlDocument* doc = xp->opaque;
+  const uint8_t *base = xml_document_begin(doc), *aname, *value;
+  uint32_t id = XML_NONE, count = 0, first = vector_size(&doc->attrs, sizeof(XmlAttr));
+  size_t alen, vlen;
+  int32_t index;
+  XmlNode* node;
+
+  /* comments, CDATA and declarations would only bloat the pool */
+  if(*name != '!' && (id = xml_document_intern(doc, ctx, name, namelen)) == XML_NONE)
+    goto fail;
+
+  if(attr)
+    while(xml_attribute_next(&attr, attr_end, &aname, &alen, &value, &vlen)) {
+      XmlAttr* a;
+
+      if(!(a = vector_emplace(&doc->attrs, sizeof(XmlAttr))))
+        goto fail;
+
+      *a = (XmlAttr){XML_NONE, value ? value - base : XML_NONE, vlen};
+
+      if((a->name = xml_document_intern(doc, ctx, aname, alen)) == XML_NONE)
+        goto fail;
+
+      count++;
+    }
+
+  if((index = xml_document_node(doc, (attr_end ? XML_NODE_ATTRIBUTES : 0) | (self_closing ? 0 : XML_NODE_CHILDREN), name, namelen)) == -1)
+    goto fail;
+
+  node = xml_document_at(doc, index);
+  node->name = id;
+  node->attr = first;
+  node->attr_count = count;
+
+  doc->current = index;
+  return 0;
+
+fail:
+  JS_ThrowOutOfMemory(ctx);
+  return -1;
+}
+
+static int
+xml_document_text(XmlParser* xp, JSContext* ctx, const uint8_t* start, const uint8_t* end) {
+  if(xml_document_node(xp->opaque, XML_NODE_TEXT, start, end - start) == -1) {
+    JS_ThrowOutOfMemory(ctx);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+xml_document_end(XmlParser* xp, JSContext* ctx, const uint8_t* name, size_t namelen) {
+  XmlDocument* doc = xp->opaque;
+
+  doc->current = xml_document_at(doc, doc->current)->parent;
+  return 0;
+}
+
+static const XmlParserEvents xml_document_events = {
+    xml_document_start,
+    xml_document_text,
+    xml_document_end,
+};
+
+/* throws if the input has been detached (e.g. by munmap()) since parsing */
+static const uint8_t*
+xml_document_base(JSContext* ctx, XmlDocument* doc) {
+  size_t size;
+
+  if(JS_IsObject(doc->input.value) && !JS_GetArrayBuffer(ctx, &size, doc->input.value))
+    return 0;
+
+  return xml_document_begin(doc);
+}
+
+/* parses 'input', of which the document takes ownership */
+static XmlDocument*
+xml_document_parse(JSContext* ctx, InputBuffer* input, const char* input_name, const ParseOptions* opts) {
+  XmlDocument* doc;
+  XmlParser xp;
+
+  if(input_buffer_length(input) >= XML_NONE) {
+    input_buffer_free(input, ctx);
+    JS_ThrowRangeError(ctx, "xml: input too large for a compact document");
+    return 0;
+  }
+
+  if(!(doc = xml_document_new(ctx, input)))
+    return 0;
+
+  xml_parser_init(&xp, ctx, &xml_document_events, input_name);
+  xp.opts = *opts;
+  xp.opaque = doc;
+
+  if(xml_parser_write(&xp, ctx, xml_document_begin(doc), input_buffer_length(&doc->input), TRUE)) {
+    xml_document_release(doc);
+    doc = 0;
+  }
+
+  xml_parser_free(&xp, JS_GetRuntime(ctx));
+  return doc;
+}
+
+static JSValue
+xml_element_wrap(JSContext* ctx, JSClassID class_id, XmlDocument* doc, int32_t index) {
+  XmlNode* node = xml_document_at(doc, index);
+  XmlElement* el;
+  JSValue obj;
+  int i;
+
+  if(!(el = js_malloc(ctx, sizeof(XmlElement))))
+    return JS_EXCEPTION;
+
+  obj = JS_NewObjectClass(ctx, class_id);
+
+  if(JS_IsException(obj)) {
+    js_free(ctx, el);
+    return obj;
+  }
+
+  el->doc = xml_document_dup(doc);
+  el->index = index;
+  JS_SetOpaque(obj, el);
+
+  for(i = index ? ELEMENT_TAGNAME : ELEMENT_CHILDREN; i <= ELEMENT_CHILDREN; i++) {
+    JSAtom prop;
+
+    if((i == ELEMENT_ATTRIBUTES && !(node->flags & XML_NODE_ATTRIBUTES)) || (i == ELEMENT_CHILDREN && !(node->flags & XML_NODE_CHILDREN)))
+      continue;
+
+    prop = JS_NewAtom(ctx, xml_element_props[i]);
+    JS_DefinePropertyGetSet(ctx, obj, prop, JS_DupValue(ctx, xml_element_getters[i]), JS_DupValue(ctx, xml_element_setters[i]), JS_PROP_CONFIGURABLE | JS_PROP_ENUMERABLE);
+    JS_FreeAtom(ctx, prop);
+  }
+
+  return obj;
+}
+
+/* a text node is returned as string, an element as XmlElement */
+static JSValue
+xml_document_value(JSContext* ctx, XmlDocument* doc, int32_t index) {
+  const uint8_t* base;
+  XmlNode* node;
+
+  if(!(base = xml_document_base(ctx, doc)))
+    return JS_EXCEPTION;
+
+  node = xml_document_at(doc, index);
+
+  if(node->flags & XML_NODE_TEXT)
+    return xml_decode(ctx, base + node->offset, node->length, FALSE);
+
+  return xml_element_wrap(ctx, js_xml_element_class_id, doc, index);
+}
+
+static JSValue
+xml_document_children(JSContext* ctx, XmlDocument* doc, int32_t index) {
+  JSValue ret = JS_NewArray(ctx);
+  uint32_t i = 0;
+
+  for(index = xml_document_at(doc, index)->first_child; index != -1; index = xml_document_at(doc, index)->next_sibling) {
+    JSValue value = xml_document_value(ctx, doc, index);
+
+    if(JS_IsException(value)) {
+      JS_FreeValue(ctx, ret);
+      return value;
+    }
+
+    JS_SetPropertyUint32(ctx, ret, i++, value);
+  }
+
+  return ret;
+}
+
+static JSValue
+xml_document_attributes(JSContext* ctx, XmlDocument* doc, int32_t index) {
+  XmlNode* node = xml_document_at(doc, index);
+  const uint8_t* base;
+  JSValue ret;
+  uint32_t i;
+
+  if(!(base = xml_document_base(ctx, doc)))
+    return JS_EXCEPTION;
+
+  ret = JS_NewObject(ctx);
+
+  for(i = node->attr; i < node->attr + node->attr_count; i++) {
+    XmlAttr* a = vector_at(&doc->attrs, sizeof(XmlAttr), i);
+    XmlName* name = vector_at(&doc->names, sizeof(XmlName), a->name);
+
+    JS_DefinePropertyValue(ctx, ret, name->atom, a->offset == XML_NONE ? JS_NewBool(ctx, TRUE) : xml_decode(ctx, base + a->offset, a->length, FALSE), JS_PROP_C_W_E);
+  }
+
+  return ret;
+}
+
+static JSValue
+xml_document_tagname(JSContext* ctx, XmlDocument* doc, int32_t index) {
+  XmlNode* node = xml_document_at(doc, index);
+  const uint8_t* base;
+
+  if(node->name != XML_NONE)
+    return JS_AtomToString(ctx, ((XmlName*)vector_at(&doc->names, sizeof(XmlName), node->name))->atom);
+
+  if(!(base = xml_document_base(ctx, doc)))
+    return JS_EXCEPTION;
+
+  return JS_NewStringLen(ctx, (const char*)base + node->offset, node->length);
+}
+
+/* a typed array over a copy of one of the arenas, which the document keeps
+ * indexing into without bounds checks */
+static JSValue
+xml_document_array(JSContext* ctx, Vector* vec) {
+  JSValue buffer, ret;
+
+  buffer = JS_NewArrayBufferCopy(ctx, vector_begin(vec), vec->size);
+
+  if(JS_IsException(buffer))
+    return buffer;
+
+  ret = js_typedarray_new(ctx, 32, FALSE, FALSE, buffer);
+  JS_FreeValue(ctx, buffer);
+  return ret;
+}
+
+static JSValue
+xml_document_read(JSContext* ctx, InputBuffer* input, const char* input_name, const ParseOptions* opts) {
+  XmlDocument* doc;
+  JSValue ret;
+
+  if(!(doc = xml_document_parse(ctx, input, input_name, opts)))
+    return JS_EXCEPTION;
+
+  ret = xml_document_children(ctx, doc, 0);
+  xml_document_release(doc);
+  return ret;
+}
+
+#ifdef HAVE_THREADS_H
+/* appends the top-level nodes of 'part', parsed from the same input, to the current element */
+static BOOL
+xml_document_append(XmlDocument* doc, JSContext* ctx, XmlDocument* part) {
+  uint32_t i, *names, num_names = vector_size(&part->names, sizeof(XmlName));
+  uint32_t first_attr = vector_size(&doc->attrs, sizeof(XmlAttr)), num_attrs = vector_size(&part->attrs, sizeof(XmlAttr));
+  int32_t first = vector_size(&doc->nodes, sizeof(XmlNode)), num_nodes = vector_size(&part->nodes, sizeof(XmlNode)) - 1, parent = doc->current;
+  XmlNode *node, *top = xml_document_at(part, 0);
+  BOOL ret = FALSE;
+
+  if(!(names = js_malloc(ctx, sizeof(uint32_t) * (num_names + 1))))
+    return FALSE;
+
+  for(i = 0; i < num_names; i++) {
+    XmlName* name = vector_at(&part->names, sizeof(XmlName), i);
+
+    if((names[i] = xml_document_intern(doc, ctx, xml_document_begin(part) + name->offset, name->length)) == XML_NONE)
+      goto fail;
+  }
+
+  if((num_attrs && !vector_put(&doc->attrs, vector_begin(&part->attrs), num_attrs * sizeof(XmlAttr))) ||
+     (num_nodes && !vector_put(&doc->nodes, xml_document_at(part, 1), num_nodes * sizeof(XmlNode))))
+    goto fail;
+
+  for(i = 0; i < num_attrs; i++) {
+    XmlAttr* a = vector_at(&doc->attrs, sizeof(XmlAttr), first_attr + i);
+
+    a->name = names[a->name];
+  }
+
+  /* node k of 'part' becomes node first + k - 1 */
+  for(i = 0; i < (uint32_t)num_nodes; i++) {
+    node = xml_document_at(doc, first + i);
+
+    if(node->name != XML_NONE)
+      node->name = names[node->name];
+
+    node->attr += first_attr;
+    node->parent = node->parent == 0 ? parent : node->parent + first - 1;
+
+    if(node->first_child != -1)
+      node->first_child += first - 1;
+    if(node->last_child != -1)
+      node->last_child += first - 1;
+    if(node->next_sibling != -1)
+      node->next_sibling += first - 1;
+  }
+
+  if(top->first_child != -1) {
+    node = xml_document_at(doc, parent);
+
+    if(node->last_child == -1)
+      node->first_child = top->first_child + first - 1;
+    else
+      xml_document_at(doc, node->last_child)->next_sibling = top->first_child + first - 1;
+
+    node->last_child = top->last_child + first - 1;
+  }
+
+  ret = TRUE;
+
+fail:
+  js_free(ctx, names);
+  return ret;
+}
+
+/* returns the offset of the next '<name' start tag in [pos, len), or len */
+static size_t
+xml_records_find(const uint8_t* buf, size_t pos, size_t len, const char* name, size_t namelen) {
+  while((pos += byte_chr(buf + pos, len - pos, '<')) < len) {
+    if(pos + namelen + 1 < len && !memcmp(buf + pos + 1, name, namelen) && parse_is(buf[pos + namelen + 1], WS | END))
+      return pos;
+
+    pos++;
+  }
+
+  return len;
+}
+
+/* returns the offset after the last record, that is after the last '</name>' or the last self-closing '<name/>' */
+static size_t
+xml_records_end(const uint8_t* buf, size_t len, const char* name, size_t namelen) {
+  size_t pos = len, lt, gt;
+
+  for(; pos > 0 && (lt = byte_rchr(buf, pos, '<')) < pos; pos = lt) {
+    const uint8_t* s = buf + lt + 1;
+    BOOL closing = *s == '/';
+
+    if(lt + namelen + 1 + closing < len && !memcmp(s + closing, name, namelen) && parse_is(s[closing + namelen], WS | END)) {
+      if((gt = lt + byte_chr(s, len - lt - 1, '>') + 1) >= len)
+        break;
+
+      if(closing || buf[gt - 1] == '/')
+        return gt + 1;
+    }
+  }
+
+  return len;
+}
+
+#define XML_RECORDS_MIN 65536
+
+typedef struct {
+  InputBuffer input;
+  const ParseOptions* opts;
+  size_t start, end;
+  JSRuntime* rt;
+  XmlDocument* doc;
+  int result;
+  thrd_t thread;
+  BOOL running;
+} XmlRecordSegment;
+
+/* parses a run of records into a document of a private runtime, it fails
+ * unless all of the elements are closed within the segment */
+static int
+xml_records_thread(void* arg) {
+  XmlRecordSegment* seg = arg;
+  JSContext* ctx = 0;
+  XmlParser xp;
+
+  seg->result = -1;
+
+  if(!(seg->rt = JS_NewRuntime()) || !(ctx = JS_NewContextRaw(seg->rt)))
+    return 0;
+
+  JS_AddIntrinsicBaseObjects(ctx);
+
+  if((seg->doc = xml_document_new(ctx, &seg->input))) {
+    xml_parser_init(&xp, ctx, &xml_document_events, 0);
+    xp.opts = *seg->opts;
+    xp.opaque = seg->doc;
+
+    if(xml_parser_write(&xp, ctx, (const uint8_t*)input_buffer_begin(&seg->input) + seg->start, seg->end - seg->start, FALSE) == 0 && vector_empty(&xp.st) &&
+       xml_skipspace(xp.tail.buf, xp.tail.size) == xp.tail.size)
+      seg->result = 0;
+    else
+      JS_FreeValue(ctx, JS_GetException(ctx));
+
+    xml_parser_free(&xp, seg->rt);
+  }
+
+  JS_FreeContext(ctx);
+  return 0;
+}
+
+static void
+xml_records_release(XmlRecordSegment* seg) {
+  if(seg->doc)
+    xml_document_release(seg->doc);
+
+  if(seg->rt)
+    JS_FreeRuntime(seg->rt);
+
+  seg->doc = 0;
+  seg->rt = 0;
+}
+
+/**
+ * Splits the records between the first '<name' and the end of the last one
+ * into segments which are parsed concurrently.  The markup before and after
+ * them is parsed on the calling thread and the segments are spliced into the
+ * element which is open at that point.  Returns 0 without an exception when
+ * the input doesn't split cleanly.
+ */
+static XmlDocument*
+xml_records_parallel(JSContext* ctx, InputBuffer* input, const char* name, size_t namelen, const char* input_name, const ParseOptions* opts, uint32_t nthreads) {
+  const uint8_t* buf = input_buffer_begin(input);
+  size_t len = input_buffer_length(input), pos, records_end, chunk;
+  InputBuffer view = *input;
+  XmlRecordSegment* segs;
+  XmlDocument* doc;
+  XmlParser xp;
+  uint32_t i, n = 0;
+  BOOL ok;
+
+  if((pos = xml_records_find(buf, 0, len, name, namelen)) == len || (records_end = xml_records_end(buf, len, name, namelen)) <= pos)
+    return 0;
+
+  nthreads = MIN_NUM(nthreads, (records_end - pos) / XML_RECORDS_MIN + 1);
+
+  if(nthreads < 2 || !(segs = js_mallocz(ctx, sizeof(XmlRecordSegment) * nthreads)))
+    return 0;
+
+  /* without a value the default free function leaves the data alone */
+  view.free = &input_buffer_free_default;
+  view.value = JS_UNDEFINED;
+  chunk = (records_end - pos) / nthreads;
+
+  for(i = 0; i < nthreads && pos < records_end; i++) {
+    XmlRecordSegment* seg = &segs[n++];
+    size_t end = records_end;
+
+    if(i + 1 < nthreads && pos + chunk < records_end)
+      end = xml_records_find(buf, pos + chunk, records_end, name, namelen);
+
+    seg->input = view;
+    seg->opts = opts;
+    seg->start = pos;
+    seg->end = end;
+    seg->running = thrd_create(&seg->thread, xml_records_thread, seg) == thrd_success;
+
+    if(!seg->running)
+      xml_records_thread(seg);
+
+    pos = end;
+  }
+
+  doc = xml_document_new(ctx, &view);
+
+  xml_parser_init(&xp, ctx, &xml_document_events, input_name);
+  xp.opts = *opts;
+  xp.opaque = doc;
+
+  /* the prologue must end with complete markup, it is the segments that hold the text */
+  ok = doc && xml_parser_write(&xp, ctx, buf, segs[0].start, FALSE) == 0 && xml_skipspace(xp.tail.buf, xp.tail.size) == xp.tail.size;
+  xp.tail.size = 0;
+  xp.scan = (XmlScan){0, 0};
+
+  for(i = 0; i < n; i++) {
+    XmlRecordSegment* seg = &segs[i];
+
+    if(seg->running)
+      thrd_join(seg->thread, 0);
+
+    if(ok && (seg->result < 0 || !xml_document_append(doc, ctx, seg->doc)))
+      ok = FALSE;
+
+    xml_records_release(seg);
+  }
+
+  ok = ok && xml_parser_write(&xp, ctx, buf + records_end, len - records_end, TRUE) == 0;
+
+  xml_parser_free(&xp, JS_GetRuntime(ctx));
+  js_free(ctx, segs);
+
+  if(!ok) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+
+    if(doc)
+      xml_document_release(doc);
+
+    return 0;
+  }
+
+  /* the document takes ownership of the input from here on */
+  doc->input = *input;
+  return doc;
+}
+#endif
+
+/* returns the elements named 'name' which are not inside another of them, in document order */
+static JSValue
+xml_document_records(JSContext* ctx, XmlDocument* doc, const char* name, size_t namelen) {
+  uint32_t id = xml_document_lookup(doc, (const uint8_t*)name, namelen, xml_name_hash((const uint8_t*)name, namelen), 0), i = 0;
+  int32_t index = 1, count = vector_size(&doc->nodes, sizeof(XmlNode));
+  JSValue ret = JS_NewArray(ctx);
+
+  while(id != XML_NONE && index < count) {
+    XmlNode* node = xml_document_at(doc, index);
+    JSValue value;
+
+    if(node->name != id) {
+      ++index;
+      continue;
+    }
+
+    if(JS_IsException((value = xml_element_wrap(ctx, js_xml_element_class_id, doc, index)))) {
+      JS_FreeValue(ctx, ret);
+      return value;
+    }
+
+    JS_SetPropertyUint32(ctx, ret, i++, value);
+
+    /* continue after the subtree */
+    while(index > 0 && xml_document_at(doc, index)->next_sibling == -1) index = xml_document_at(doc, index)->parent;
+
+    index = index > 0 ? xml_document_at(doc, index)->next_sibling : count;
+  }
+
+  return ret;
+}
+
+static XmlElement*
+js_xml_element_data(JSContext* ctx, JSValueConst value) {
+  XmlElement* el;
+
+  if((el = JS_GetOpaque(value, js_xml_element_class_id)))
+    return el;
+
+  return JS_GetOpaque2(ctx, value, js_xml_document_class_id);
+}
+
+/* replaces the accessor with the value on first access */
+static JSValue
+js_xml_element_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  XmlElement* el;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(el = js_xml_element_data(ctx, this_val)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case ELEMENT_TAGNAME: {
+      ret = xml_document_tagname(ctx, el->doc, el->index);
+      break;
+    }
+
+    case ELEMENT_ATTRIBUTES: {
+      ret = xml_document_attributes(ctx, el->doc, el->index);
+      break;
+    }
+
+    case ELEMENT_CHILDREN: {
+      ret = xml_document_children(ctx, el->doc, el->index);
+      break;
+    }
+  }
+
+  if(!JS_IsException(ret))
+    JS_DefinePropertyValueStr(ctx, this_val, xml_element_props[magic], JS_DupValue(ctx, ret), JS_PROP_C_W_E);
+
+  return ret;
+}
+
+static JSValue
+js_xml_element_set(JSContext* ctx, JSValueConst this_val, JSValueConst value, int magic) {
+  if(JS_DefinePropertyValueStr(ctx, this_val, xml_element_props[magic], JS_DupValue(ctx, value), JS_PROP_C_W_E) < 0)
+    return JS_EXCEPTION;
+
+  return JS_UNDEFINED;
+}
+
+static void
+js_xml_element_finalizer(JSRuntime* rt, JSValue val) {
+  XmlElement* el;
+
+  if((el = JS_GetOpaque(val, js_xml_element_class_id)) || (el = JS_GetOpaque(val, js_xml_document_class_id))) {
+    xml_document_release(el->doc);
+    js_free_rt(rt, el);
+  }
+}
+
+/**
+ * new XmlDocument(input, name, options), also xml.parseCompact()
+ *
+ * Its 'children' are the top-level nodes in the form xml.read() returns.
+ */
+static JSValue
+js_xml_document_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  InputBuffer input = js_input_chars(ctx, argc > 0 ? argv[0] : JS_UNDEFINED);
+  ParseOptions opts = {.flat = FALSE, .tolerant = FALSE, .lazy = TRUE, .self_closing_tags = default_self_closing_tags};
+  const char* input_name = 0;
+  XmlDocument* doc;
+  JSValue ret = JS_EXCEPTION;
+
+  if(JS_IsException(input.value))
+    return JS_ThrowTypeError(ctx, "XmlDocument: expecting buffer or string");
+
+  if(argc > 1 && !JS_IsUndefined(argv[1]))
+    input_name = JS_ToCString(ctx, argv[1]);
+
+  if(argc > 2 && JS_IsObject(argv[2]))
+    xml_parse_options(ctx, argv[2], &opts);
+
+  if((doc = xml_document_parse(ctx, &input, input_name, &opts))) {
+    ret = xml_element_wrap(ctx, js_xml_document_class_id, doc, 0);
+    xml_document_release(doc);
+  }
+
+  xml_parse_options_free(JS_GetRuntime(ctx), &opts);
+
+  if(input_name)
+    JS_FreeCString(ctx, input_name);
+
+  return ret;
+}
+
+static JSValue
+js_xml_document_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  XmlElement* el;
+  XmlDocument* doc;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(el = JS_GetOpaque2(ctx, this_val, js_xml_document_class_id)))
+    return JS_EXCEPTION;
+
+  doc = el->doc;
+
+  switch(magic) {
+    case DOCUMENT_NODES: {
+      ret = xml_document_array(ctx, &doc->nodes);
+      break;
+    }
+
+    case DOCUMENT_ATTRS: {
+      ret = xml_document_array(ctx, &doc->attrs);
+      break;
+    }
+
+    case DOCUMENT_NAMES: {
+      XmlName* name;
+      uint32_t i = 0;
+
+      ret = JS_NewArray(ctx);
+      vector_foreach_t(&doc->names, name) JS_SetPropertyUint32(ctx, ret, i++, JS_AtomToString(ctx, name->atom));
+      break;
+    }
+
+    case DOCUMENT_LENGTH: {
+      ret = JS_NewUint32(ctx, vector_size(&doc->nodes, sizeof(XmlNode)));
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static JSValue
+js_xml_document_node(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  XmlElement* el;
+  uint32_t index;
+
+  if(!(el = JS_GetOpaque2(ctx, this_val, js_xml_document_class_id)))
+    return JS_EXCEPTION;
+
+  if(JS_ToUint32(ctx, &index, argv[0]))
+    return JS_EXCEPTION;
+
+  if(index == 0 || index >= vector_size(&el->doc->nodes, sizeof(XmlNode)))
+    return JS_ThrowRangeError(ctx, "XmlDocument.node(): index %" PRIu32 " out of range", index);
+
+  return xml_document_value(ctx, el->doc, index);
+}
+
+static JSValue
+js_xml_parse_compact(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  return js_xml_document_constructor(ctx, xml_document_ctor, argc, argv);
+}
+
+/**
+ * xml.parseRecords(input, recordTag, { threads, name, ...options })
+ *
+ * Parses a document which consists of many sibling records into a compact
+ * document and returns the <recordTag> elements as XmlElement objects, in
+ * document order.  With { threads } the records are parsed concurrently;
+ * input which doesn't split cleanly at the record boundaries is parsed
+ * sequentially.
+ */
+static JSValue
+js_xml_parse_records(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  InputBuffer input = js_input_chars(ctx, argc > 0 ? argv[0] : JS_UNDEFINED);
+  ParseOptions opts = {.flat = FALSE, .tolerant = FALSE, .lazy = TRUE, .self_closing_tags = default_self_closing_tags};
+  const char *name, *input_name = 0;
+  size_t namelen;
+  uint32_t threads = 0;
+  XmlDocument* doc = 0;
+  JSValue ret = JS_EXCEPTION;
+
+  if(JS_IsException(input.value))
+    return JS_ThrowTypeError(ctx, "xml.parseRecords(): expecting buffer or string");
+
+  if(!(name = JS_ToCStringLen(ctx, &namelen, argc > 1 ? argv[1] : JS_UNDEFINED))) {
+    input_buffer_free(&input, ctx);
+    return JS_EXCEPTION;
+  }
+
+  if(argc > 2 && JS_IsObject(argv[2])) {
+    JSValue value = JS_GetPropertyStr(ctx, argv[2], "threads");
+
+    if(!JS_IsUndefined(value))
+      JS_ToUint32(ctx, &threads, value);
+
+    JS_FreeValue(ctx, value);
+
+    input_name = js_get_propertystr_cstring(ctx, argv[2], "name");
+    xml_parse_options(ctx, argv[2], &opts);
+  }
+
+#ifdef HAVE_THREADS_H
+  if(threads > 1 && !opts.tolerant && input_buffer_length(&input) < XML_NONE)
+    doc = xml_records_parallel(ctx, &input, name, namelen, input_name, &opts, threads);
+#endif
+
+  if(doc || (doc = xml_document_parse(ctx, &input, input_name, &opts))) {
+    ret = xml_document_records(ctx, doc, name, namelen);
+    xml_document_release(doc);
+  }
+
+  xml_parse_options_free(JS_GetRuntime(ctx), &opts);
+  JS_FreeCString(ctx, name);
+
+  if(input_name)
+    JS_FreeCString(ctx, input_name);
+
+  return ret;
+}
+
+/**
+ * Selectors
+ *
+ * CSS selectors and a subset of XPath compile to the same program: a list
+ * of alternatives, each a sequence of compound selectors (tests which must
+ * all hold for one element) joined by combinators. An element is matched
+ * right to left, starting from the candidates of the last compound, which
+ * for a compact document come from the tag and attribute name groups of
+ * its XmlIndex, built on the first query. A plain tree is flattened into
+ * XmlNodes for each query.
+ */
+enum {
+  XML_TEST_NAME = 0,
+  XML_TEST_ATTR,
+  XML_TEST_EQUAL,
+  XML_TEST_NOT_EQUAL,
+  XML_TEST_INCLUDES,
+  XML_TEST_DASH,
+  XML_TEST_PREFIX,
+  XML_TEST_SUFFIX,
+  XML_TEST_SUBSTRING,
+  XML_TEST_NTH_CHILD,
+  XML_TEST_NTH_LAST_CHILD,
+  XML_TEST_NTH_OF_TYPE,
+  XML_TEST_NTH_LAST_OF_TYPE,
+};
+
+enum {
+  XML_DESCENDANT = 0,
+  XML_CHILD,
+  XML_ADJACENT,
+  XML_SIBLING,
+};
+
+enum {
+  SELECT_RETURN_PATH = 1 << 24,
+  SELECT_RETURN_VALUE = 2 << 24,
+  SELECT_RETURN_MASK = 7 << 24,
+};
+
+enum {
+  SELECTOR_SELECT = 0,
+  SELECTOR_SELECT_FIRST,
+};
+
+enum {
+  SELECTOR_SOURCE = 0,
+  SELECTOR_TYPE,
+};
+
+typedef struct {
+  uint32_t op;
+  char *name, *value;
+  size_t name_len, value_len;
+  JSAtom atom; /* 'name', for plain trees */
+  int32_t a, b; /* a * n + b of the positional tests */
+} XmlTest;
+
+typedef struct {
+  uint32_t combinator; /* relation to the previous compound, of the first one to the root */
+  uint32_t test, num_tests;
+} XmlCompound;
+
+typedef struct {
+  uint32_t compound, num_compounds;
+} XmlAlternative;
+
+typedef struct {
+  Vector tests, compounds, alternatives;
+  char* source;
+  BOOL xpath;
+} XmlSelector;
+
+typedef struct {
+  JSContext* ctx;
+  XmlSelector* sel;
+  const char *start, *ptr, *end;
+} XmlSelectorParser;
+
+typedef struct {
+  JSContext* ctx;
+  XmlDocument* doc; /* 0 for a plain tree */
+  const uint8_t* base;
+  XmlNode* nodes;
+  uint32_t count, num_names;
+  XmlIndex* index;
+  int32_t scope;
+  BOOL array;    /* the root is a list of nodes rather than an element */
+  BOOL lazy;     /* the plain tree is flattened while it is searched */
+  uint32_t* ids; /* names of the tests in this document */
+  DynBuf buf;
+  /* plain tree */
+  Vector tree, values, atoms, frames;
+  uint32_t *atom_map, atom_map_size;
+  XmlIndex tree_index;
+} XmlQuery;
+
+typedef struct {
+  JSValue list;
+  uint32_t index, length;
+  int32_t parent;
+} XmlFrame;
+
+static const struct {
+  const char* name;
+  uint32_t op;
+  BOOL arg, only;
+} xml_pseudo_classes[] = {
+    {"first-child", XML_TEST_NTH_CHILD, FALSE, FALSE},
+    {"last-child", XML_TEST_NTH_LAST_CHILD, FALSE, FALSE},
+    {"only-child", XML_TEST_NTH_CHILD, FALSE, TRUE},
+    {"nth-child", XML_TEST_NTH_CHILD, TRUE, FALSE},
+    {"nth-last-child", XML_TEST_NTH_LAST_CHILD, TRUE, FALSE},
+    {"first-of-type", XML_TEST_NTH_OF_TYPE, FALSE, FALSE},
+    {"last-of-type", XML_TEST_NTH_LAST_OF_TYPE, FALSE, FALSE},
+    {"only-of-type", XML_TEST_NTH_OF_TYPE, FALSE, TRUE},
+    {"nth-of-type", XML_TEST_NTH_OF_TYPE, TRUE, FALSE},
+    {"nth-last-of-type", XML_TEST_NTH_LAST_OF_TYPE, TRUE, FALSE},
+};
+
+static void
+xml_selector_free(JSRuntime* rt, XmlSelector* sel) {
+  XmlTest* t;
+
+  vector_foreach_t(&sel->tests, t) {
+    js_free_rt(rt, t->name);
+    js_free_rt(rt, t->value);
+
+    if(t->atom != JS_ATOM_NULL)
+      JS_FreeAtomRT(rt, t->atom);
+  }
+
+  vector_free(&sel->tests);
+  vector_free(&sel->compounds);
+  vector_free(&sel->alternatives);
+  js_free_rt(rt, sel->source);
+  js_free_rt(rt, sel);
+}
+
+static size_t
+selector_skipws(XmlSelectorParser* sp) {
+  const char* start = sp->ptr;
+
+  while(is_whitespace_char(*sp->ptr)) sp->ptr++;
+
+  return sp->ptr - start;
+}
+
+static BOOL
+selector_accept(XmlSelectorParser* sp, const char* s) {
+  size_t n = strlen(s);
+
+  if(strncmp(sp->ptr, s, n))
+    return FALSE;
+
+  sp->ptr += n;
+  return TRUE;
+}
+
+static inline BOOL
+selector_name_char(int c, BOOL xpath) {
+  return (uint8_t)c >= 0x80 || is_alphanumeric_char(c) || is_digit_char(c) || c == '-' || c == '_' || (xpath && (c == ':' || c == '.'));
+}
+
+/* reads a name, with backslash escapes in CSS */
+static char*
+selector_name(XmlSelectorParser* sp, size_t* lenp) {
+  DynBuf db;
+  char* ret = 0;
+
+  js_dbuf_init(sp->ctx, &db);
+
+  for(;;) {
+    if(*sp->ptr == '\\' && !sp->sel->xpath && sp->ptr[1]) {
+      dbuf_putc(&db, sp->ptr[1]);
+      sp->ptr += 2;
+    } else if(selector_name_char(*sp->ptr, sp->sel->xpath)) {
+      dbuf_putc(&db, *sp->ptr++);
+    } else {
+      break;
+    }
+  }
+
+  if(db.size) {
+    ret = js_strndup(sp->ctx, (const char*)db.buf, db.size);
+    *lenp = db.size;
+  }
+
+  dbuf_free(&db);
+  return ret;
+}
+
+/* reads a quoted string, in CSS also a name */
+static char*
+selector_string(XmlSelectorParser* sp, size_t* lenp) {
+  const char* start;
+  char quote;
+
+  if(*sp->ptr != '"' && *sp->ptr != '\'')
+    return sp->sel->xpath ? 0 : selector_name(sp, lenp);
+
+  quote = *sp->ptr++;
+  start = sp->ptr;
+
+  while(*sp->ptr && *sp->ptr != quote) sp->ptr++;
+
+  if(*sp->ptr != quote)
+    return 0;
+
+  *lenp = sp->ptr++ - start;
+  return js_strndup(sp->ctx, start, *lenp);
+}
+
+/* takes ownership of 'name' and 'value' */
+static XmlTest*
+selector_test(XmlSelectorParser* sp, uint32_t op, char* name, size_t name_len, char* value, size_t value_len) {
+  XmlTest* t;
+
+  if(!(t = vector_emplace(&sp->sel->tests, sizeof(XmlTest)))) {
+    js_free(sp->ctx, name);
+    js_free(sp->ctx, value);
+    return 0;
+  }
+
+  *t = (XmlTest){op, name, value, name_len, value_len, name ? JS_NewAtomLen(sp->ctx, name, name_len) : JS_ATOM_NULL, 0, 1};
+  return t;
+}
+
+static BOOL
+selector_compound(XmlSelectorParser* sp, uint32_t combinator, uint32_t first) {
+  XmlCompound* c;
+
+  if(!(c = vector_emplace(&sp->sel->compounds, sizeof(XmlCompound))))
+    return FALSE;
+
+  *c = (XmlCompound){combinator, first, vector_size(&sp->sel->tests, sizeof(XmlTest)) - first};
+  return TRUE;
+}
+
+static BOOL
+selector_alternative(XmlSelectorParser* sp, uint32_t first) {
+  XmlAlternative* alt;
+
+  if(!(alt = vector_emplace(&sp->sel->alternatives, sizeof(XmlAlternative))))
+    return FALSE;
+
+  *alt = (XmlAlternative){first, vector_size(&sp->sel->compounds, sizeof(XmlCompound)) - first};
+  return TRUE;
+}
+
+/* an+b, odd or even */
+static BOOL
+selector_nth(XmlSelectorParser* sp, int32_t* a, int32_t* b) {
+  BOOL neg = FALSE, digits = FALSE;
+  long n = 1;
+  char* end;
+
+  selector_skipws(sp);
+
+  if(selector_accept(sp, "odd")) {
+    *a = 2;
+    *b = 1;
+  } else if(selector_accept(sp, "even")) {
+    *a = 2;
+    *b = 0;
+  } else {
+    if(*sp->ptr == '+' || *sp->ptr == '-')
+      neg = *sp->ptr++ == '-';
+
+    if(is_digit_char(*sp->ptr)) {
+      n = strtol(sp->ptr, &end, 10);
+      sp->ptr = end;
+      digits = TRUE;
+    }
+
+    if(*sp->ptr == 'n' || *sp->ptr == 'N') {
+      *a = neg ? -n : n;
+      *b = 0;
+      sp->ptr++;
+      selector_skipws(sp);
+
+      if(*sp->ptr == '+' || *sp->ptr == '-') {
+        neg = *sp->ptr++ == '-';
+        selector_skipws(sp);
+
+        if(!is_digit_char(*sp->ptr))
+          return FALSE;
+
+        n = strtol(sp->ptr, &end, 10);
+        sp->ptr = end;
+        *b = neg ? -n : n;
+      }
+    } else if(digits) {
+      *a = 0;
+      *b = neg ? -n : n;
+    } else {
+      return FALSE;
+    }
+  }
+
+  selector_skipws(sp);
+  return TRUE;
+}
+
+static BOOL
+selector_pseudo_class(XmlSelectorParser* sp) {
+  XmlTest* t;
+  char* name;
+  size_t i, len;
+  int32_t a = 0, b = 1;
+
+  if(!(name = selector_name(sp, &len)))
+    return FALSE;
+
+  for(i = 0; i < countof(xml_pseudo_classes); i++)
+    if(!strcmp(xml_pseudo_classes[i].name, name))
+      break;
+
+  js_free(sp->ctx, name);
+
+  if(i == countof(xml_pseudo_classes))
+    return FALSE;
+
+  if(xml_pseudo_classes[i].arg && !(*sp->ptr++ == '(' && selector_nth(sp, &a, &b) && *sp->ptr++ == ')'))
+    return FALSE;
+
+  if(!(t = selector_test(sp, xml_pseudo_classes[i].op, 0, 0, 0, 0)))
+    return FALSE;
+
+  t->a = a;
+  t->b = b;
+
+  /* only-child is first-child and last-child */
+  if(xml_pseudo_classes[i].only && !selector_test(sp, xml_pseudo_classes[i].op + 1, 0, 0, 0, 0))
+    return FALSE;
+
+  return TRUE;
+}
+
+static BOOL
+selector_css_compound(XmlSelectorParser* sp, uint32_t combinator) {
+  uint32_t first = vector_size(&sp->sel->tests, sizeof(XmlTest));
+  BOOL any = FALSE;
+  char *name, *value;
+  size_t len, vlen;
+
+  if(*sp->ptr == '*') {
+    sp->ptr++;
+    any = TRUE;
+  } else if((name = selector_name(sp, &len))) {
+    if(!selector_test(sp, XML_TEST_NAME, name, len, 0, 0))
+      return FALSE;
+  }
+
+  for(;;) {
+    char c = *sp->ptr;
+
+    if(c == '#' || c == '.') {
+      sp->ptr++;
+
+      if(!(value = selector_name(sp, &vlen)))
+        return FALSE;
+
+      if(!selector_test(sp, c == '#' ? XML_TEST_EQUAL : XML_TEST_INCLUDES, js_strdup(sp->ctx, c == '#' ? "id" : "class"), c == '#' ? 2 : 5, value, vlen))
+        return FALSE;
+
+    } else if(c == '[') {
+      uint32_t op = XML_TEST_ATTR;
+
+      sp->ptr++;
+      selector_skipws(sp);
+
+      if(!(name = selector_name(sp, &len)))
+        return FALSE;
+
+      selector_skipws(sp);
+      value = 0;
+      vlen = 0;
+
+      if(selector_accept(sp, "="))
+        op = XML_TEST_EQUAL;
+      else if(selector_accept(sp, "~="))
+        op = XML_TEST_INCLUDES;
+      else if(selector_accept(sp, "|="))
+        op = XML_TEST_DASH;
+      else if(selector_accept(sp, "^="))
+        op = XML_TEST_PREFIX;
+      else if(selector_accept(sp, "$="))
+        op = XML_TEST_SUFFIX;
+      else if(selector_accept(sp, "*="))
+        op = XML_TEST_SUBSTRING;
+
+      if(op != XML_TEST_ATTR) {
+        selector_skipws(sp);
+        value = selector_string(sp, &vlen);
+        selector_skipws(sp);
+      }
+
+      if((op != XML_TEST_ATTR && !value) || *sp->ptr != ']') {
+        js_free(sp->ctx, name);
+        js_free(sp->ctx, value);
+        return FALSE;
+      }
+
+      sp->ptr++;
+
+      if(!selector_test(sp, op, name, len, value, vlen))
+        return FALSE;
+
+    } else if(c == ':') {
+      sp->ptr++;
+
+      if(!selector_pseudo_class(sp))
+        return FALSE;
+
+    } else {
+      break;
+    }
+  }
+
+  if(!any && vector_size(&sp->sel->tests, sizeof(XmlTest)) == first)
+    return FALSE;
+
+  return selector_compound(sp, combinator, first);
+}
+
+/* a, b > c, d + e ~ f:nth-child(2n+1), g#id.class[attr^=value] */
+static BOOL
+selector_css(XmlSelectorParser* sp) {
+  for(;;) {
+    uint32_t first = vector_size(&sp->sel->compounds, sizeof(XmlCompound)), combinator = XML_DESCENDANT;
+    size_t ws;
+
+    selector_skipws(sp);
+
+    /* relative to the root */
+    if(selector_accept(sp, ">")) {
+      combinator = XML_CHILD;
+      selector_skipws(sp);
+    }
+
+    for(;;) {
+      if(!selector_css_compound(sp, combinator))
+        return FALSE;
+
+      ws = selector_skipws(sp);
+
+      if(selector_accept(sp, ">"))
+        combinator = XML_CHILD;
+      else if(selector_accept(sp, "+"))
+        combinator = XML_ADJACENT;
+      else if(selector_accept(sp, "~"))
+        combinator = XML_SIBLING;
+      else if(ws && *sp->ptr && *sp->ptr != ',')
+        combinator = XML_DESCENDANT;
+      else
+        break;
+
+      selector_skipws(sp);
+    }
+
+    if(!selector_alternative(sp, first))
+      return FALSE;
+
+    if(!selector_accept(sp, ","))
+      break;
+  }
+
+  return sp->ptr == sp->end;
+}
+
+/* [n], [last()], [@attr], [@attr='value'], [@attr!='value'], [contains(@attr, 'value')], [starts-with(@attr, 'value')] */
+static BOOL
+selector_xpath_predicate(XmlSelectorParser* sp, BOOL any) {
+  uint32_t op = XML_TEST_ATTR;
+  char *name, *value = 0;
+  size_t len, vlen = 0;
+  XmlTest* t;
+
+  if(is_digit_char(*sp->ptr)) {
+    char* end;
+    long n = strtol(sp->ptr, &end, 10);
+
+    sp->ptr = end;
+
+    if(n <= 0 || !(t = selector_test(sp, any ? XML_TEST_NTH_CHILD : XML_TEST_NTH_OF_TYPE, 0, 0, 0, 0)))
+      return FALSE;
+
+    t->b = n;
+    return TRUE;
+  }
+
+  if(selector_accept(sp, "last()"))
+    return selector_test(sp, any ? XML_TEST_NTH_LAST_CHILD : XML_TEST_NTH_LAST_OF_TYPE, 0, 0, 0, 0) != 0;
+
+  if(selector_accept(sp, "contains("))
+    op = XML_TEST_SUBSTRING;
+  else if(selector_accept(sp, "starts-with("))
+    op = XML_TEST_PREFIX;
+
+  selector_skipws(sp);
+
+  if(!selector_accept(sp, "@") || !(name = selector_name(sp, &len)))
+    return FALSE;
+
+  selector_skipws(sp);
+
+  if(op != XML_TEST_ATTR) {
+    if(selector_accept(sp, ",")) {
+      selector_skipws(sp);
+      value = selector_string(sp, &vlen);
+      selector_skipws(sp);
+    }
+
+    if(!value || !selector_accept(sp, ")"))
+      goto fail;
+
+  } else {
+    if(selector_accept(sp, "="))
+      op = XML_TEST_EQUAL;
+    else if(selector_accept(sp, "!="))
+      op = XML_TEST_NOT_EQUAL;
+
+    if(op != XML_TEST_ATTR) {
+      selector_skipws(sp);
+
+      if(!(value = selector_string(sp, &vlen)))
+        goto fail;
+    }
+  }
+
+  return selector_test(sp, op, name, len, value, vlen) != 0;
+
+fail:
+  js_free(sp->ctx, name);
+  js_free(sp->ctx, value);
+  return FALSE;
+}
+
+static BOOL
+selector_xpath_step(XmlSelectorParser* sp, uint32_t combinator) {
+  uint32_t first = vector_size(&sp->sel->tests, sizeof(XmlTest));
+  BOOL any = FALSE;
+  char* name;
+  size_t len;
+
+  if(selector_accept(sp, "*"))
+    any = TRUE;
+  else if(!(name = selector_name(sp, &len)) || !selector_test(sp, XML_TEST_NAME, name, len, 0, 0))
+    return FALSE;
+
+  while(selector_accept(sp, "[")) {
+    do {
+      selector_skipws(sp);
+
+      if(!selector_xpath_predicate(sp, any))
+        return FALSE;
+
+      selector_skipws(sp);
+    } while(selector_accept(sp, "and "));
+
+    if(!selector_accept(sp, "]"))
+      return FALSE;
+  }
+
+  return selector_compound(sp, combinator, first);
+}
+
+/* /a/b[2], //a[@attr='value']/b, a//b | c, relative paths start at the root */
+static BOOL
+selector_xpath(XmlSelectorParser* sp) {
+  for(;;) {
+    uint32_t first = vector_size(&sp->sel->compounds, sizeof(XmlCompound)), combinator;
+
+    selector_skipws(sp);
+
+    if(sp->ptr[0] == '.' && sp->ptr[1] == '/')
+      sp->ptr++;
+
+    combinator = selector_accept(sp, "//") ? XML_DESCENDANT : (selector_accept(sp, "/"), XML_CHILD);
+
+    for(;;) {
+      if(!selector_xpath_step(sp, combinator))
+        return FALSE;
+
+      if(selector_accept(sp, "//"))
+        combinator = XML_DESCENDANT;
+      else if(selector_accept(sp, "/"))
+        combinator = XML_CHILD;
+      else
+        break;
+    }
+
+    selector_skipws(sp);
+
+    if(!selector_alternative(sp, first))
+      return FALSE;
+
+    if(!selector_accept(sp, "|"))
+      break;
+  }
+
+  return sp->ptr == sp->end;
+}
+
+/* 'xpath' < 0 means XPath when the source starts with '/' */
+static XmlSelector*
+xml_selector_compile(JSContext* ctx, const char* source, size_t len, int xpath) {
+  XmlSelectorParser sp;
+  XmlSelector* sel;
+
+  if(!(sel = js_mallocz(ctx, sizeof(XmlSelector))))
+    return 0;
+
+  vector_init(&sel->tests, ctx);
+  vector_init(&sel->compounds, ctx);
+  vector_init(&sel->alternatives, ctx);
+
+  sel->source = js_strndup(ctx, source, len);
+  sel->xpath = xpath < 0 ? source[scan_whitenskip(source, len)] == '/' : xpath;
+
+  sp = (XmlSelectorParser){ctx, sel, source, source, source + len};
+
+  if(!(sel->xpath ? selector_xpath(&sp) : selector_css(&sp))) {
+    JS_ThrowSyntaxError(ctx, "xml: invalid %s selector '%s' at offset %zu", sel->xpath ? "XPath" : "CSS", source, (size_t)(sp.ptr - source));
+    xml_selector_free(JS_GetRuntime(ctx), sel);
+    return 0;
+  }
+
+  return sel;
+}
+
+static inline BOOL
+xml_query_element(XmlQuery* q, int32_t index) {
+  XmlNode* node = &q->nodes[index];
+
+  /* processing instructions are in the pool of a compact document */
+  return node->name != XML_NONE && !(q->doc && q->base[node->offset] == '?');
+}
+
+/* maps a tag name of a plain tree to an index into 'atoms' */
+static uint32_t
+xml_query_atom(XmlQuery* q, JSAtom atom, BOOL insert) {
+  uint32_t i, index, count = vector_size(&q->atoms, sizeof(JSAtom)), hash = atom * 2654435761u;
+
+  if(insert && (count + 1) * 2 > q->atom_map_size) {
+    uint32_t j, size = q->atom_map_size ? q->atom_map_size * 2 : 64, *map;
+
+    if(!(map = js_mallocz(q->ctx, size * sizeof(uint32_t))))
+      return XML_NONE;
+
+    for(i = 0; i < count; i++) {
+      for(j = (*(JSAtom*)vector_at(&q->atoms, sizeof(JSAtom), i) * 2654435761u) & (size - 1); map[j]; j = (j + 1) & (size - 1)) {}
+      map[j] = i + 1;
+    }
+
+    js_free(q->ctx, q->atom_map);
+    q->atom_map = map;
+    q->atom_map_size = size;
+  }
+
+  if(q->atom_map_size == 0)
+    return XML_NONE;
+
+  for(i = hash & (q->atom_map_size - 1); (index = q->atom_map[i]); i = (i + 1) & (q->atom_map_size - 1))
+    if(*(JSAtom*)vector_at(&q->atoms, sizeof(JSAtom), index - 1) == atom)
+      return index - 1;
+
+  if(!insert)
+    return XML_NONE;
+
+  atom = JS_DupAtom(q->ctx, atom);
+
+  if(!vector_push(&q->atoms, atom)) {
+    JS_FreeAtom(q->ctx, atom);
+    return XML_NONE;
+  }
+
+  q->atom_map[i] = count + 1;
+  return count;
+}
+
+static int32_t
+xml_query_append(XmlQuery* q, int32_t parent, uint32_t flags, uint32_t name, JSValue value) {
+  int32_t index = vector_size(&q->tree, sizeof(XmlNode));
+  XmlNode *node, *p;
+
+  if(!(node = vector_emplace(&q->tree, sizeof(XmlNode))) || !vector_push(&q->values, value)) {
+    JS_FreeValue(q->ctx, value);
+    return -1;
+  }
+
+  *node = (XmlNode){flags, name, 0, 0, 0, 0, parent, -1, -1, -1};
+
+  if(parent != -1) {
+    p = vector_at(&q->tree, sizeof(XmlNode), parent);
+
+    if(p->last_child == -1)
+      p->first_child = index;
+    else
+      ((XmlNode*)vector_at(&q->tree, sizeof(XmlNode), p->last_child))->next_sibling = index;
+
+    p->last_child = index;
+  }
+
+  return index;
+}
+
+static BOOL
+xml_query_frame(XmlQuery* q, Vector* frames, JSValue list, int32_t parent) {
+  XmlFrame frame = {list, 0, 0, parent};
+  int64_t len;
+
+  if(!JS_IsArray(q->ctx, list) || (len = js_array_length(q->ctx, list)) <= 0) {
+    JS_FreeValue(q->ctx, list);
+    return TRUE;
+  }
+
+  frame.length = len;
+
+  if(!vector_push(frames, frame)) {
+    JS_FreeValue(q->ctx, list);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* starts to flatten a plain tree, node 0 stands for 'root' */
+static int
+xml_query_flatten_start(XmlQuery* q, JSValueConst root) {
+  JSContext* ctx = q->ctx;
+
+  if(xml_query_append(q, -1, XML_NODE_CHILDREN, XML_NONE, JS_DupValue(ctx, root)) == -1 ||
+     !xml_query_frame(q, &q->frames, q->array ? JS_DupValue(ctx, root) : JS_GetPropertyStr(ctx, root, "children"), 0)) {
+    JS_ThrowOutOfMemory(ctx);
+    return -1;
+  }
+
+  q->nodes = vector_begin(&q->tree);
+  q->count = 1;
+  return 0;
+}
+
+/* appends the next node in document order, returns its index or 0 at the end */
+static int32_t
+xml_query_flatten_next(XmlQuery* q) {
+  JSContext* ctx = q->ctx;
+  XmlFrame* frame;
+
+  while(!vector_empty(&q->frames)) {
+    JSValue item, children = JS_UNDEFINED;
+    uint32_t name = XML_NONE, flags = XML_NODE_TEXT;
+    int32_t parent, index;
+
+    frame = vector_back(&q->frames, sizeof(XmlFrame));
+
+    if(frame->index == frame->length) {
+      JS_FreeValue(ctx, frame->list);
+      vector_pop(&q->frames, sizeof(XmlFrame));
+      continue;
+    }
+
+    item = JS_GetPropertyUint32(ctx, frame->list, frame->index++);
+    parent = frame->parent;
+
+    if(JS_IsObject(item)) {
+      JSValue tag = JS_GetPropertyStr(ctx, item, "tagName");
+      const char* str;
+
+      if((str = JS_ToCString(ctx, tag))) {
+        if(*str != '!' && *str != '?') {
+          JSAtom atom = JS_NewAtom(ctx, str);
+
+          name = xml_query_atom(q, atom, TRUE);
+          JS_FreeAtom(ctx, atom);
+        }
+
+        JS_FreeCString(ctx, str);
+      }
+
+      JS_FreeValue(ctx, tag);
+      children = JS_GetPropertyStr(ctx, item, "children");
+      flags = JS_IsArray(ctx, children) ? XML_NODE_CHILDREN : 0;
+    }
+
+    if((index = xml_query_append(q, parent, flags, name, item)) == -1 || !xml_query_frame(q, &q->frames, children, index)) {
+      JS_ThrowOutOfMemory(ctx);
+      return -1;
+    }
+
+    q->nodes = vector_begin(&q->tree);
+    q->count = index + 1;
+    return index;
+  }
+
+  return 0;
+}
+
+/* flattens the rest of a plain tree */
+static int
+xml_query_flatten(XmlQuery* q) {
+  int32_t index;
+
+  while((index = xml_query_flatten_next(q)) > 0) {}
+
+  return index;
+}
+
+/* the first match on a plain tree can be found before it is flattened
+ * completely, unless a test needs the siblings of an element */
+static BOOL
+xml_selector_forward(XmlSelector* sel) {
+  XmlCompound* c;
+  XmlTest* t;
+
+  vector_foreach_t(&sel->tests, t) if(t->op >= XML_TEST_NTH_CHILD) return FALSE;
+  vector_foreach_t(&sel->compounds, c) if(c->combinator == XML_ADJACENT || c->combinator == XML_SIBLING) return FALSE;
+
+  return TRUE;
+}
+
+/* groups the elements by tag name, range of name i is [start[i], start[i + 1]) */
+static BOOL
+xml_index_names(XmlQuery* q) {
+  XmlIndex* ix = q->index;
+  uint32_t i, n = q->num_names, *start, *list;
+
+  if(ix->by_name)
+    return TRUE;
+
+  if(!(start = js_mallocz(q->ctx, (n + 2) * sizeof(uint32_t))))
+    return FALSE;
+
+  for(i = 1; i < q->count; i++)
+    if(xml_query_element(q, i))
+      start[q->nodes[i].name + 2]++;
+
+  for(i = 1; i <= n + 1; i++) start[i] += start[i - 1];
+
+  if(!(list = js_malloc(q->ctx, (start[n + 1] + 1) * sizeof(uint32_t)))) {
+    js_free(q->ctx, start);
+    return FALSE;
+  }
+
+  for(i = 1; i < q->count; i++)
+    if(xml_query_element(q, i))
+      list[start[q->nodes[i].name + 1]++] = i;
+
+  ix->by_name = list;
+  ix->name_start = start;
+  return TRUE;
+}
+
+/* groups the elements by attribute name, compact documents only */
+static BOOL
+xml_index_attrs(XmlQuery* q) {
+  XmlIndex* ix = q->index;
+  XmlAttr* attrs = vector_begin(&q->doc->attrs);
+  uint32_t i, j, k, n = q->num_names, *start, *list;
+  int pass;
+
+  if(ix->by_attr)
+    return TRUE;
+
+  if(!(start = js_mallocz(q->ctx, (n + 2) * sizeof(uint32_t))))
+    return FALSE;
+
+  list = 0;
+
+  for(pass = 0; pass < 2; pass++) {
+    for(i = 1; i < q->count; i++) {
+      XmlNode* node = &q->nodes[i];
+
+      for(j = node->attr; j < node->attr + node->attr_count; j++) {
+        /* counted once per element */
+        for(k = node->attr; k < j; k++)
+          if(attrs[k].name == attrs[j].name)
+            break;
+
+        if(k < j)
+          continue;
+
+        if(pass == 0)
+          start[attrs[j].name + 2]++;
+        else
+          list[start[attrs[j].name + 1]++] = i;
+      }
+    }
+
+    if(pass == 0) {
+      for(i = 1; i <= n + 1; i++) start[i] += start[i - 1];
+
+      if(!(list = js_malloc(q->ctx, (start[n + 1] + 1) * sizeof(uint32_t)))) {
+        js_free(q->ctx, start);
+        return FALSE;
+      }
+    }
+  }
+
+  ix->by_attr = list;
+  ix->attr_start = start;
+  return TRUE;
+}
+
+static inline uint32_t*
+xml_query_slot(uint32_t* map, uint32_t size, uint32_t name) {
+  uint32_t i;
+
+  for(i = (name * 2654435761u) & (size - 1); map[i * 2] != XML_NONE && map[i * 2] != name; i = (i + 1) & (size - 1)) {}
+
+  return &map[i * 2];
+}
+
+/* numbers the children of 'parent' */
+static BOOL
+xml_query_number(XmlQuery* q, int32_t parent) {
+  XmlIndex* ix = q->index;
+  uint32_t n = 0, size, child = 0, pos = 0, *map, *slot;
+  int32_t i, prev = -1;
+
+  for(i = q->nodes[parent].first_child; i != -1; i = q->nodes[i].next_sibling) n += xml_query_element(q, i);
+
+  for(size = 8; size < n * 2; size <<= 1) {}
+
+  if(size * 2 > ix->scratch_size) {
+    if(!(map = js_realloc(q->ctx, ix->scratch, size * 2 * sizeof(uint32_t))))
+      return FALSE;
+
+    ix->scratch = map;
+    ix->scratch_size = size * 2;
+  }
+
+  /* name -> count, open addressing */
+  map = ix->scratch;
+  memset(map, 0xff, size * 2 * sizeof(uint32_t));
+
+  for(i = q->nodes[parent].first_child; i != -1; i = q->nodes[i].next_sibling, child++) {
+    XmlPosition* p = &ix->positions[i];
+
+    p->child = child;
+
+    if(!xml_query_element(q, i))
+      continue;
+
+    slot = xml_query_slot(map, size, q->nodes[i].name);
+
+    if(slot[0] == XML_NONE) {
+      slot[0] = q->nodes[i].name;
+      slot[1] = 0;
+    }
+
+    p->pos = ++pos;
+    p->tpos = ++slot[1];
+    p->prev = prev;
+    prev = i;
+  }
+
+  for(i = q->nodes[parent].first_child; i != -1; i = q->nodes[i].next_sibling) {
+    XmlPosition* p = &ix->positions[i];
+
+    if(!xml_query_element(q, i))
+      continue;
+
+    slot = xml_query_slot(map, size, q->nodes[i].name);
+
+    p->rpos = n - p->pos + 1;
+    p->trpos = slot[1] - p->tpos + 1;
+  }
+
+  return TRUE;
+}
+
+static XmlPosition*
+xml_query_position(XmlQuery* q, int32_t index) {
+  XmlIndex* ix = q->index;
+
+  if(!ix->positions && !(ix->positions = js_mallocz(q->ctx, q->count * sizeof(XmlPosition))))
+    return 0;
+
+  if(ix->positions[index].pos == 0 && !xml_query_number(q, q->nodes[index].parent))
+    return 0;
+
+  return &ix->positions[index];
+}
+
+/* looks up the attribute of test 't', FALSE when the element has none */
+static BOOL
+xml_query_attr(XmlQuery* q, const XmlTest* t, uint32_t id, int32_t index, const uint8_t** s, size_t* n) {
+  JSContext* ctx = q->ctx;
+  BOOL ret = FALSE;
+
+  q->buf.size = 0;
+
+  if(q->doc) {
+    XmlNode* node = &q->nodes[index];
+    XmlAttr* a = vector_at(&q->doc->attrs, sizeof(XmlAttr), node->attr);
+    uint32_t i;
+
+    for(i = 0; i < node->attr_count; i++, a++) {
+      if(a->name != id)
+        continue;
+
+      if(a->offset == XML_NONE) {
+        *s = (const uint8_t*)"";
+        *n = 0;
+      } else if(byte_chr(q->base + a->offset, a->length, '&') < a->length) {
+        xml_decode_buf(&q->buf, q->base + a->offset, a->length, FALSE);
+        *s = q->buf.buf;
+        *n = q->buf.size;
+      } else {
+        *s = q->base + a->offset;
+        *n = a->length;
+      }
+
+      return TRUE;
+    }
+
+  } else {
+    JSValue attributes = JS_GetPropertyStr(ctx, *(JSValue*)vector_at(&q->values, sizeof(JSValue), index), "attributes");
+    JSValue value = JS_IsObject(attributes) ? JS_GetProperty(ctx, attributes, t->atom) : JS_UNDEFINED;
+    const char* str;
+    size_t len;
+
+    if(JS_IsBool(value)) {
+      ret = JS_ToBool(ctx, value);
+    } else if(!JS_IsUndefined(value) && !JS_IsNull(value) && (str = JS_ToCStringLen(ctx, &len, value))) {
+      dbuf_put(&q->buf, (const uint8_t*)str, len);
+      JS_FreeCString(ctx, str);
+      ret = TRUE;
+    }
+
+    JS_FreeValue(ctx, value);
+    JS_FreeValue(ctx, attributes);
+
+    *s = q->buf.size ? q->buf.buf : (const uint8_t*)"";
+    *n = q->buf.size;
+  }
+
+  return ret;
+}
+
+static BOOL
+xml_test_value(uint32_t op, const uint8_t* s, size_t n, const char* v, size_t vlen) {
+  switch(op) {
+    case XML_TEST_ATTR: return TRUE;
+    case XML_TEST_EQUAL: return n == vlen && !memcmp(s, v, n);
+    case XML_TEST_NOT_EQUAL: return !(n == vlen && !memcmp(s, v, n));
+    case XML_TEST_DASH: return n >= vlen && !memcmp(s, v, vlen) && (n == vlen || s[vlen] == '-');
+    case XML_TEST_PREFIX: return vlen && n >= vlen && !memcmp(s, v, vlen);
+    case XML_TEST_SUFFIX: return vlen && n >= vlen && !memcmp(s + n - vlen, v, vlen);
+    case XML_TEST_SUBSTRING: return vlen && xml_search(s, s + n, v, vlen) != 0;
+
+    case XML_TEST_INCLUDES: {
+      size_t i = 0, len;
+
+      while(vlen && i < n) {
+        i += scan_whitenskip((const char*)s + i, n - i);
+        len = scan_nonwhitenskip((const char*)s + i, n - i);
+
+        if(len == vlen && !memcmp(s + i, v, vlen))
+          return TRUE;
+
+        i += len;
+      }
+
+      return FALSE;
+    }
+  }
+
+  return FALSE;
+}
+
+static inline BOOL
+xml_test_nth(const XmlTest* t, uint32_t pos) {
+  int64_t d = (int64_t)pos - t->b;
+
+  if(t->a == 0)
+    return d == 0;
+
+  return d % t->a == 0 && d / t->a >= 0;
+}
+
+static BOOL
+xml_query_test(XmlQuery* q, const XmlTest* t, uint32_t id, int32_t index) {
+  const uint8_t* s;
+  XmlPosition* p;
+  size_t n;
+
+  switch(t->op) {
+    case XML_TEST_NAME: return q->nodes[index].name == id;
+    case XML_TEST_NTH_CHILD: return (p = xml_query_position(q, index)) && xml_test_nth(t, p->pos);
+    case XML_TEST_NTH_LAST_CHILD: return (p = xml_query_position(q, index)) && xml_test_nth(t, p->rpos);
+    case XML_TEST_NTH_OF_TYPE: return (p = xml_query_position(q, index)) && xml_test_nth(t, p->tpos);
+    case XML_TEST_NTH_LAST_OF_TYPE: return (p = xml_query_position(q, index)) && xml_test_nth(t, p->trpos);
+  }
+
+  return xml_query_attr(q, t, id, index, &s, &n) && xml_test_value(t->op, s, n, t->value, t->value_len);
+}
+
+static BOOL
+xml_query_compound(XmlQuery* q, XmlSelector* sel, const XmlCompound* c, int32_t index) {
+  uint32_t i;
+
+  if(!xml_query_element(q, index))
+    return FALSE;
+
+  for(i = c->test; i < c->test + c->num_tests; i++)
+    if(!xml_query_test(q, vector_at(&sel->tests, sizeof(XmlTest), i), q->ids[i], index))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* 'index' matches compound 'c', matches the ones before it */
+static BOOL
+xml_query_match(XmlQuery* q, XmlSelector* sel, const XmlCompound* first, const XmlCompound* c, int32_t index) {
+  const XmlCompound* prev = c - 1;
+  XmlPosition* p;
+  int32_t i;
+
+  if(c == first)
+    return c->combinator != XML_CHILD || q->nodes[index].parent == q->scope;
+
+  switch(c->combinator) {
+    case XML_CHILD: {
+      i = q->nodes[index].parent;
+      return i != q->scope && xml_query_compound(q, sel, prev, i) && xml_query_match(q, sel, first, prev, i);
+    }
+
+    case XML_DESCENDANT: {
+      for(i = q->nodes[index].parent; i != q->scope; i = q->nodes[i].parent)
+        if(xml_query_compound(q, sel, prev, i) && xml_query_match(q, sel, first, prev, i))
+          return TRUE;
+
+      break;
+    }
+
+    case XML_ADJACENT:
+    case XML_SIBLING: {
+      for(i = index; (p = xml_query_position(q, i)) && (i = p->prev) != -1;) {
+        if(xml_query_compound(q, sel, prev, i) && xml_query_match(q, sel, first, prev, i))
+          return TRUE;
+
+        if(c->combinator == XML_ADJACENT)
+          break;
+      }
+
+      break;
+    }
+  }
+
+  return FALSE;
+}
+
+/* resolves the names of the tests, XML_NONE for those which don't occur */
+static BOOL
+xml_query_resolve(XmlQuery* q, XmlSelector* sel) {
+  uint32_t i, n = vector_size(&sel->tests, sizeof(XmlTest));
+
+  if(!(q->ids = js_malloc(q->ctx, (n + 1) * sizeof(uint32_t))))
+    return FALSE;
+
+  for(i = 0; i < n; i++) {
+    XmlTest* t = vector_at(&sel->tests, sizeof(XmlTest), i);
+
+    if(t->op >= XML_TEST_NTH_CHILD || (!q->doc && t->op != XML_TEST_NAME))
+      q->ids[i] = 0;
+    else if(q->doc)
+      q->ids[i] = xml_document_lookup(q->doc, (const uint8_t*)t->name, t->name_len, xml_name_hash((const uint8_t*)t->name, t->name_len), 0);
+    else if((q->ids[i] = xml_query_atom(q, t->atom, q->lazy)) == XML_NONE && q->lazy)
+      return FALSE; /* the names of the part not flattened yet are unknown */
+  }
+
+  return TRUE;
+}
+
+static JSValue
+xml_query_path(XmlQuery* q, int32_t index) {
+  JSContext* ctx = q->ctx;
+  XmlPosition* p;
+  JSValue ret;
+  uint32_t *path, i, n = 0, k = 0;
+
+  q->buf.size = 0;
+
+  for(; index != q->scope; index = q->nodes[index].parent) {
+    if(!(p = xml_query_position(q, index)) || dbuf_put(&q->buf, (const uint8_t*)&p->child, sizeof(uint32_t)))
+      return JS_ThrowOutOfMemory(ctx);
+
+    n++;
+  }
+
+  path = (uint32_t*)q->buf.buf;
+  ret = JS_NewArray(ctx);
+
+  for(i = n; i > 0; i--) {
+    if(!(q->array && i == n))
+      JS_SetPropertyUint32(ctx, ret, k++, JS_NewString(ctx, "children"));
+
+    JS_SetPropertyUint32(ctx, ret, k++, JS_NewUint32(ctx, path[i - 1]));
+  }
+
+  return ret;
+}
+
+static JSValue
+xml_query_result(XmlQuery* q, int32_t index, int32_t flags) {
+  if((flags & SELECT_RETURN_MASK) == SELECT_RETURN_PATH)
+    return xml_query_path(q, index);
+
+  if(q->doc)
+    return xml_document_value(q->ctx, q->doc, index);
+
+  return JS_DupValue(q->ctx, *(JSValue*)vector_at(&q->values, sizeof(JSValue), index));
+}
+
+/* appends the result for 'index' to 'ret', or sets it when 'first' */
+static BOOL
+xml_query_emit(XmlQuery* q, JSValue* ret, uint32_t* count, int32_t index, int32_t flags, BOOL first) {
+  JSValue value = xml_query_result(q, index, flags);
+
+  if(JS_IsException(value))
+    return FALSE;
+
+  if(first) {
+    *ret = value;
+    return TRUE;
+  }
+
+  return JS_SetPropertyUint32(q->ctx, *ret, (*count)++, value) >= 0;
+}
+
+/* first index of 'list' which is >= 'index' */
+static uint32_t
+xml_query_bound(const uint32_t* list, uint32_t n, uint32_t index) {
+  uint32_t lo = 0, hi = n;
+
+  while(lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+
+    if(list[mid] < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void
+xml_query_free(XmlQuery* q) {
+  JSContext* ctx = q->ctx;
+  XmlFrame* frame;
+  JSValue* value;
+  JSAtom* atom;
+
+  vector_foreach_t(&q->values, value) JS_FreeValue(ctx, *value);
+  vector_foreach_t(&q->atoms, atom) JS_FreeAtom(ctx, *atom);
+  vector_foreach_t(&q->frames, frame) JS_FreeValue(ctx, frame->list);
+
+  vector_free(&q->frames);
+  vector_free(&q->tree);
+  vector_free(&q->values);
+  vector_free(&q->atoms);
+  js_free(ctx, q->atom_map);
+  xml_index_free(JS_GetRuntime(ctx), &q->tree_index);
+  js_free(ctx, q->ids);
+  dbuf_free(&q->buf);
+}
+
+/**
+ * Evaluates 'sel' below 'root', which is a compact document or one of its
+ * elements, or a plain tree: an element or a list of nodes as xml.read()
+ * returns them. Returns the elements in document order, or the first one.
+ */
+static JSValue
+xml_selector_select(JSContext* ctx, XmlSelector* sel, JSValueConst root, int32_t flags, BOOL first) {
+  XmlQuery q = {.ctx = ctx};
+  XmlElement* el;
+  uint8_t* hits = 0;
+  uint32_t a, lo, hi, num_alternatives = vector_size(&sel->alternatives, sizeof(XmlAlternative)), count = 0;
+  JSValue ret = JS_EXCEPTION;
+
+  js_dbuf_init(ctx, &q.buf);
+  vector_init(&q.tree, ctx);
+  vector_init(&q.values, ctx);
+  vector_init(&q.atoms, ctx);
+  vector_init(&q.frames, ctx);
+
+  if((el = JS_GetOpaque(root, js_xml_element_class_id)) || (el = JS_GetOpaque(root, js_xml_document_class_id))) {
+    q.doc = el->doc;
+    q.scope = el->index;
+
+    if(!(q.base = xml_document_base(ctx, q.doc))) {
+      JS_ThrowTypeError(ctx, "xml: the document's buffer has been detached");
+      goto fail;
+    }
+
+    q.nodes = vector_begin(&q.doc->nodes);
+    q.count = vector_size(&q.doc->nodes, sizeof(XmlNode));
+    q.num_names = vector_size(&q.doc->names, sizeof(XmlName));
+    q.index = &q.doc->index;
+
+  } else if(JS_IsObject(root)) {
+    q.array = JS_IsArray(ctx, root);
+    q.lazy = first && xml_selector_forward(sel);
+
+    if(xml_query_flatten_start(&q, root) || (!q.lazy && xml_query_flatten(&q)))
+      goto fail;
+
+    q.num_names = vector_size(&q.atoms, sizeof(JSAtom));
+    q.index = &q.tree_index;
+
+  } else {
+    JS_ThrowTypeError(ctx, "xml: expecting a document, an element or a list of nodes");
+    goto fail;
+  }
+
+  if(!xml_query_resolve(&q, sel) || (!q.lazy && num_alternatives > 1 && !(hits = js_mallocz(ctx, q.count))))
+    goto oom;
+
+  /* each node is tried against the alternatives when it is appended */
+  if(q.lazy) {
+    int32_t index;
+
+    ret = JS_NULL;
+
+    while((index = xml_query_flatten_next(&q)) > 0) {
+      for(a = 0; a < num_alternatives; a++) {
+        XmlAlternative* alt = vector_at(&sel->alternatives, sizeof(XmlAlternative), a);
+        XmlCompound *c0 = vector_at(&sel->compounds, sizeof(XmlCompound), alt->compound), *c = c0 + alt->num_compounds - 1;
+
+        if(xml_query_compound(&q, sel, c, index) && xml_query_match(&q, sel, c0, c, index)) {
+          if(!xml_query_emit(&q, &ret, &count, index, flags, first))
+            goto fail;
+
+          goto done;
+        }
+      }
+    }
+
+    if(index < 0)
+      goto fail;
+
+    goto done;
+  }
+
+  /* the descendants of the scope follow it in the arena */
+  lo = q.scope + 1;
+  hi = q.count;
+
+  for(a = q.scope; a > 0; a = q.nodes[a].parent)
+    if(q.nodes[a].next_sibling != -1) {
+      hi = q.nodes[a].next_sibling;
+      break;
+    }
+
+  ret = first ? JS_NULL : JS_NewArray(ctx);
+
+  for(a = 0; a < num_alternatives; a++) {
+    XmlAlternative* alt = vector_at(&sel->alternatives, sizeof(XmlAlternative), a);
+    XmlCompound *c0 = vector_at(&sel->compounds, sizeof(XmlCompound), alt->compound), *c = c0 + alt->num_compounds - 1;
+    const uint32_t* list = 0;
+    uint32_t i, k, end = hi;
+
+    /* a name which doesn't occur in the document can't match */
+    for(i = c0->test; i < c->test + c->num_tests; i++)
+      if(q.ids[i] == XML_NONE)
+        break;
+
+    if(i < c->test + c->num_tests)
+      continue;
+
+    /* candidates from the index, by tag name or else by attribute name */
+    for(i = c->test; i < c->test + c->num_tests && q.doc; i++) {
+      XmlTest* t = vector_at(&sel->tests, sizeof(XmlTest), i);
+
+      if(t->op == XML_TEST_NAME) {
+        if(!xml_index_names(&q))
+          goto oom;
+
+        list = q.index->by_name + q.index->name_start[q.ids[i]];
+        end = q.index->name_start[q.ids[i] + 1] - q.index->name_start[q.ids[i]];
+        break;
+      }
+    }
+
+    for(i = c->test; i < c->test + c->num_tests && q.doc && !list; i++) {
+      XmlTest* t = vector_at(&sel->tests, sizeof(XmlTest), i);
+
+      if(t->op < XML_TEST_NTH_CHILD) {
+        if(!xml_index_attrs(&q))
+          goto oom;
+
+        list = q.index->by_attr + q.index->attr_start[q.ids[i]];
+        end = q.index->attr_start[q.ids[i] + 1] - q.index->attr_start[q.ids[i]];
+      }
+    }
+
+    for(k = list ? xml_query_bound(list, end, lo) : lo; k < end; k++) {
+      int32_t index = list ? list[k] : k;
+
+      if((uint32_t)index >= hi)
+        break;
+
+      if((hits && hits[index]) || !xml_query_compound(&q, sel, c, index) || !xml_query_match(&q, sel, c0, c, index))
+        continue;
+
+      if(hits) {
+        hits[index] = 1;
+        continue;
+      }
+
+      if(!xml_query_emit(&q, &ret, &count, index, flags, first))
+        goto fail;
+
+      if(first)
+        goto done;
+    }
+  }
+
+  /* the union of the alternatives in document order */
+  if(hits)
+    for(a = lo; a < hi; a++) {
+      if(!hits[a])
+        continue;
+
+      if(!xml_query_emit(&q, &ret, &count, a, flags, first))
+        goto fail;
+
+      if(first)
+        goto done;
+    }
+
+  goto done;
+
+oom:
+  JS_ThrowOutOfMemory(ctx);
+fail:
+  JS_FreeValue(ctx, ret);
+  ret = JS_EXCEPTION;
+done:
+  js_free(ctx, hits);
+  xml_query_free(&q);
+  return ret;
+}
+
+static XmlSelector*
+js_xml_selector_compile(JSContext* ctx, JSValueConst expr, JSValueConst type) {
+  XmlSelector* sel;
+  const char *source, *str;
+  size_t len;
+  int xpath = -1;
+
+  if(!JS_IsUndefined(type) && (str = JS_ToCString(ctx, type))) {
+    xpath = !strcasecmp(str, "xpath");
+    JS_FreeCString(ctx, str);
+  }
+
+  if(!(source = JS_ToCStringLen(ctx, &len, expr)))
+    return 0;
+
+  sel = xml_selector_compile(ctx, source, len, xpath);
+  JS_FreeCString(ctx, source);
+  return sel;
+}
+
+/**
+ * new XmlSelector(expression, type)
+ *
+ * 'type' is 'css' or 'xpath', by default expressions starting with '/' are
+ * XPath.
+ */
+static JSValue
+js_xml_selector_constructor(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst argv[]) {
+  XmlSelector* sel;
+  JSValue proto, obj;
+
+  if(!(sel = js_xml_selector_compile(ctx, argv[0], argc > 1 ? argv[1] : JS_UNDEFINED)))
+    return JS_EXCEPTION;
+
+  proto = JS_GetPropertyStr(ctx, new_target, "prototype");
+
+  if(!JS_IsObject(proto)) {
+    JS_FreeValue(ctx, proto);
+    proto = JS_DupValue(ctx, xml_selector_proto);
+  }
+
+  obj = JS_NewObjectProtoClass(ctx, proto, js_xml_selector_class_id);
+  JS_FreeValue(ctx, proto);
+
+  if(JS_IsException(obj)) {
+    xml_selector_free(JS_GetRuntime(ctx), sel);
+    return obj;
+  }
+
+  JS_SetOpaque(obj, sel);
+  return obj;
+}
+
+static JSValue
+js_xml_selector_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  XmlSelector* sel;
+  int32_t flags = 0;
+
+  if(!(sel = JS_GetOpaque2(ctx, this_val, js_xml_selector_class_id)))
+    return JS_EXCEPTION;
+
+  if(argc > 1 && JS_ToInt32(ctx, &flags, argv[1]))
+    return JS_EXCEPTION;
+
+  return xml_selector_select(ctx, sel, argv[0], flags, magic == SELECTOR_SELECT_FIRST);
+}
+
+static JSValue
+js_xml_selector_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  XmlSelector* sel;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(sel = JS_GetOpaque2(ctx, this_val, js_xml_selector_class_id)))
+    return JS_EXCEPTION;
+
+  switch(magic) {
+    case SELECTOR_SOURCE: {
+      ret = JS_NewString(ctx, sel->source);
+      break;
+    }
+
+    case SELECTOR_TYPE: {
+      ret = JS_NewString(ctx, sel->xpath ? "xpath" : "css");
+      break;
+    }
+  }
+
+  return ret;
+}
+
+static void
+js_xml_selector_finalizer(JSRuntime* rt, JSValue val) {
+  XmlSelector* sel;
+
+  if((sel = JS_GetOpaque(val, js_xml_selector_class_id)))
+    xml_selector_free(rt, sel);
+}
+
+/**
+ * xml.select(root, expression, flags), xml.selectFirst(root, expression, flags)
+ *
+ * Compiles 'expression' like new XmlSelector() and evaluates it once.
+ */
+static JSValue
+js_xml_select(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic) {
+  XmlSelector* sel;
+  int32_t flags = 0;
+  JSValue ret;
+
+  if(argc > 2 && JS_ToInt32(ctx, &flags, argv[2]))
+    return JS_EXCEPTION;
+
+  if(!(sel = js_xml_selector_compile(ctx, argc > 1 ? argv[1] : JS_UNDEFINED, JS_UNDEFINED)))
+    return JS_EXCEPTION;
+
+  ret = xml_selector_select(ctx, sel, argv[0], flags, magic == SELECTOR_SELECT_FIRST);
+  xml_selector_free(JS_GetRuntime(ctx), sel);
+  return ret;
+}
+
+/**
+ * Feeds one result of reader.read() / iterator.next() to the parser and
+ * requests the next one.
+ *
+ * data[0] = parser, data[1] = reader or iterator, data[2] = read/next method
+ */
+static JSValue
+js_xml_parse_step(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[], int magic, JSValue data[]) {
+  XmlParser* xp = JS_GetOpaque(data[0], js_xml_parser_class_id);
+  JSValue result, fn, ret;
+
+  if(argc > 0) {
+    if(js_get_propertystr_bool(ctx, argv[0], "done"))
+      return xml_parser_write(xp, ctx, 0, 0, TRUE) < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+
+    result = JS_GetPropertyStr(ctx, argv[0], "value");
+    ret = xml_parser_put(xp, ctx, result) < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+    JS_FreeValue(ctx, result);
+
+    if(JS_IsException(ret))
+      return ret;
+  }
+
+  result = JS_Call(ctx, data[2], data[1], 0, 0);
+
+  if(JS_IsException(result))
+    return result;
+
+  fn = JS_NewCFunctionData(ctx, js_xml_parse_step, 1, 0, 3, data);
+  ret = js_promise_resolve_then(ctx, result, fn);
+
+  JS_FreeValue(ctx, fn);
+  JS_FreeValue(ctx, result);
+  return ret;
+}
+
+static JSValue
+js_xml_parse_fd(JSContext* ctx, XmlParser* xp, int fd) {
+  const size_t size = 65536;
+  uint8_t* buf;
+  ssize_t r;
+  JSValue ret = JS_UNDEFINED;
+
+  if(!(buf = js_malloc(ctx, size)))
+    return JS_EXCEPTION;
+
+  do {
+    if((r = read(fd, buf, size)) < 0) {
+      if(errno == EINTR)
+        continue;
+
+      ret = JS_ThrowInternalError(ctx, "xml.parse(): read error: %s", strerror(errno));
+      break;
+    }
+
+    if(xml_parser_write(xp, ctx, buf, r, r == 0) < 0) {
+      ret = JS_EXCEPTION;
+      break;
+    }
+  } while(r != 0);
+
+  js_free(ctx, buf);
+  return ret;
+}
+
+/**
+ * xml.parse(source, { onStart(name, attributes), onText(text), onEnd(name) }, options)
+ *
+ * 'source' is a string or buffer (e.g. from mmap) which is parsed in place,
+ * a file descriptor which is read in chunks, or a ReadableStream / (async)
+ * iterable of chunks, in which case a Promise is returned.
+ */
+static JSValue
+js_xml_parse_events(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst argv[]) {
+  JSValueConst source = argc > 0 ? argv[0] : JS_UNDEFINED;
+  JSValue obj, ret = JS_UNDEFINED;
+  XmlParser* xp;
+
+  obj = js_xml_parser_new(ctx, xml_parser_proto, argc > 1 ? argv[1] : JS_UNDEFINED, argc > 2 ? argv[2] : JS_UNDEFINED);
+
+  if(JS_IsException(obj))
+    return obj;
+
+  xp = JS_GetOpaque(obj, js_xml_parser_class_id);
+
+  if(JS_IsNumber(source)) {
+    int32_t fd = -1;
+
+    JS_ToInt32(ctx, &fd, source);
+    ret = js_xml_parse_fd(ctx, xp, fd);
+
+  } else if(JS_IsObject(source) && !js_is_arraybuffer(ctx, source) && !js_is_typedarray(source)) {
+    JSValue data[3] = {obj, JS_UNDEFINED, JS_UNDEFINED};
+    JSValue fn = JS_GetPropertyStr(ctx, source, "getReader");
+
+    if(JS_IsFunction(ctx, fn))
+      data[1] = JS_Call(ctx, fn, source, 0, 0);
+    else if(js_is_iterable(ctx, source))
+      data[1] = js_iterator_new(ctx, source);
+
+    if(JS_IsObject(data[1]))
+      data[2] = JS_GetPropertyStr(ctx, data[1], JS_IsFunction(ctx, fn) ? "read" : "next");
+
+    if(JS_IsFunction(ctx, data[2]))
+      ret = js_xml_parse_step(ctx, this_val, 0, 0, 0, data);
+    else if(!JS_IsException(data[1]))
+      ret = JS_ThrowTypeError(ctx, "xml.parse(): expecting a ReadableStream or an iterable");
+    else
+      ret = JS_EXCEPTION;
+
+    JS_FreeValue(ctx, data[2]);
+    JS_FreeValue(ctx, data[1]);
+    JS_FreeValue(ctx, fn);
+
+  } else if(xml_parser_put(xp, ctx, source) < 0 || xml_parser_write(xp, ctx, 0, 0, TRUE) < 0) {
+    ret = JS_EXCEPTION;
+  }
+
+  JS_FreeValue(ctx, obj);
+  return ret;
+}
+
+static const JSCFunctionListEntry js_xml_parser_funcs[] = {
+    JS_CFUNC_MAGIC_DEF("write", 1, js_xml_parser_method, XML_PARSER_WRITE),
+    JS_CFUNC_MAGIC_DEF("end", 0, js_xml_parser_method, XML_PARSER_END),
+    JS_CGETSET_DEF("depth", js_xml_parser_depth, 0),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "XmlParser", JS_PROP_CONFIGURABLE),
+};
+
+static JSClassDef js_xml_parser_class = {
+    .class_name = "XmlParser",
+    .finalizer = js_xml_parser_finalizer,
+};
+
+static JSClassDef js_xml_element_class = {
+    .class_name = "XmlElement",
+    .finalizer = js_xml_element_finalizer,
+};
+
+static JSClassDef js_xml_document_class = {
+    .class_name = "XmlDocument",
+    .finalizer = js_xml_element_finalizer,
+};
+
+static const JSCFunctionListEntry js_xml_document_funcs[] = {
+    JS_CGETSET_MAGIC_DEF("nodes", js_xml_document_get, 0, DOCUMENT_NODES),
+    JS_CGETSET_MAGIC_DEF("attrs", js_xml_document_get, 0, DOCUMENT_ATTRS),
+    JS_CGETSET_MAGIC_DEF("names", js_xml_document_get, 0, DOCUMENT_NAMES),
+    JS_CGETSET_MAGIC_DEF("length", js_xml_document_get, 0, DOCUMENT_LENGTH),
+    JS_CFUNC_DEF("node", 1, js_xml_document_node),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "XmlDocument", JS_PROP_CONFIGURABLE),
+};
+
+static const JSCFunctionListEntry js_xml_document_static[] = {
+    JS_PROP_INT32_DEF("NODE_FIELDS", sizeof(XmlNode) / sizeof(uint32_t), JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("ATTR_FIELDS", sizeof(XmlAttr) / sizeof(uint32_t), JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("NODE_TEXT", XML_NODE_TEXT, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("NODE_ATTRIBUTES", XML_NODE_ATTRIBUTES, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("NODE_CHILDREN", XML_NODE_CHILDREN, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("NONE", -1, JS_PROP_ENUMERABLE),
+};
+
+static JSClassDef js_xml_writer_class = {
+    .class_name = "XmlWriter",
+    .finalizer = js_xml_writer_finalizer,
+};
+
+static const JSCFunctionListEntry js_xml_writer_funcs[] = {
+    JS_CFUNC_MAGIC_DEF("startElement", 2, js_xml_writer_method, XML_WRITER_START),
+    JS_CFUNC_MAGIC_DEF("text", 1, js_xml_writer_method, XML_WRITER_TEXT),
+    JS_CFUNC_MAGIC_DEF("endElement", 0, js_xml_writer_method, XML_WRITER_END),
+    JS_CFUNC_MAGIC_DEF("flush", 0, js_xml_writer_method, XML_WRITER_FLUSH),
+    JS_CFUNC_MAGIC_DEF("end", 0, js_xml_writer_method, XML_WRITER_CLOSE),
+    JS_CGETSET_DEF("depth", js_xml_writer_depth, 0),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "XmlWriter", JS_PROP_CONFIGURABLE),
+};
+
+static JSClassDef js_xml_selector_class = {
+    .class_name = "XmlSelector",
+    .finalizer = js_xml_selector_finalizer,
+};
+
+static const JSCFunctionListEntry js_xml_selector_funcs[] = {
+    JS_CFUNC_MAGIC_DEF("select", 1, js_xml_selector_method, SELECTOR_SELECT),
+    JS_CFUNC_MAGIC_DEF("selectFirst", 1, js_xml_selector_method, SELECTOR_SELECT_FIRST),
+    JS_CGETSET_MAGIC_DEF("source", js_xml_selector_get, 0, SELECTOR_SOURCE),
+    JS_CGETSET_MAGIC_DEF("type", js_xml_selector_get, 0, SELECTOR_TYPE),
+    JS_PROP_STRING_DEF("[Symbol.toStringTag]", "XmlSelector", JS_PROP_CONFIGURABLE),
+};
+
+static const JSCFunctionListEntry js_xml_funcs[] = {
     JS_CFUNC_DEF("read", 1, js_xml_read),
     JS_CFUNC_DEF("write", 2, js_xml_write),
+    JS_CFUNC_DEF("parse", 2, js_xml_parse_events),
+    JS_CFUNC_DEF("parseCompact", 1, js_xml_parse_compact),
+    JS_CFUNC_DEF("parseRecords", 2, js_xml_parse_records),
+    JS_CFUNC_DEF("reparse", 5, js_xml_reparse),
+    JS_CFUNC_MAGIC_DEF("encode", 1, js_xml_entities, XML_ENCODE),
+    JS_CFUNC_MAGIC_DEF("decode", 1, js_xml_entities, XML_DECODE),
+    JS_CFUNC_MAGIC_DEF("select", 2, js_xml_select, SELECTOR_SELECT),
+    JS_CFUNC_MAGIC_DEF("selectFirst", 2, js_xml_select, SELECTOR_SELECT_FIRST),
+    JS_PROP_INT32_DEF("RETURN_PATH", SELECT_RETURN_PATH, JS_PROP_ENUMERABLE),
+    JS_PROP_INT32_DEF("RETURN_VALUE", SELECT_RETURN_VALUE, JS_PROP_ENUMERABLE),
 };
 
 static int
@@ -811,11 +5368,89 @@ js_xml_init(JSContext* ctx, JSModuleDef* m) {
 
   character_classes_init(chars);
 
+  if(js_xml_parser_class_id == 0) {
+    JS_NewClassID(&js_xml_parser_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_xml_parser_class_id, &js_xml_parser_class);
+
+    xml_parser_ctor = JS_NewCFunction2(ctx, js_xml_parser_constructor, "XmlParser", 2, JS_CFUNC_constructor, 0);
+    xml_parser_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, xml_parser_proto, js_xml_parser_funcs, countof(js_xml_parser_funcs));
+    JS_SetClassProto(ctx, js_xml_parser_class_id, xml_parser_proto);
+    JS_SetConstructor(ctx, xml_parser_ctor, xml_parser_proto);
+  }
+
+  if(js_xml_element_class_id == 0) {
+    int i;
+
+    JS_NewClassID(&js_xml_element_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_xml_element_class_id, &js_xml_element_class);
+    JS_SetClassProto(ctx, js_xml_element_class_id, JS_NewObject(ctx));
+
+    for(i = ELEMENT_TAGNAME; i <= ELEMENT_CHILDREN; i++) {
+      xml_element_getters[i] = JS_NewCFunction2(ctx, (JSCFunction*)&js_xml_element_get, xml_element_props[i], 0, JS_CFUNC_getter_magic, i);
+      xml_element_setters[i] = JS_NewCFunction2(ctx, (JSCFunction*)&js_xml_element_set, xml_element_props[i], 1, JS_CFUNC_setter_magic, i);
+    }
+
+    JS_NewClassID(&js_xml_document_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_xml_document_class_id, &js_xml_document_class);
+
+    xml_document_ctor = JS_NewCFunction2(ctx, js_xml_document_constructor, "XmlDocument", 3, JS_CFUNC_constructor, 0);
+    xml_document_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, xml_document_proto, js_xml_document_funcs, countof(js_xml_document_funcs));
+    JS_SetPropertyFunctionList(ctx, xml_document_ctor, js_xml_document_static, countof(js_xml_document_static));
+    JS_SetClassProto(ctx, js_xml_document_class_id, xml_document_proto);
+    JS_SetConstructor(ctx, xml_document_ctor, xml_document_proto);
+  }
+
+  if(js_xml_writer_class_id == 0) {
+    JS_NewClassID(&js_xml_writer_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_xml_writer_class_id, &js_xml_writer_class);
+
+    xml_writer_ctor = JS_NewCFunction2(ctx, js_xml_writer_constructor, "XmlWriter", 2, JS_CFUNC_constructor, 0);
+    xml_writer_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, xml_writer_proto, js_xml_writer_funcs, countof(js_xml_writer_funcs));
+    JS_SetClassProto(ctx, js_xml_writer_class_id, xml_writer_proto);
+    JS_SetConstructor(ctx, xml_writer_ctor, xml_writer_proto);
+  }
+
+  if(js_xml_selector_class_id == 0) {
+    JS_NewClassID(&js_xml_selector_class_id);
+    JS_NewClass(JS_GetRuntime(ctx), js_xml_selector_class_id, &js_xml_selector_class);
+
+    xml_selector_ctor = JS_NewCFunction2(ctx, js_xml_selector_constructor, "XmlSelector", 2, JS_CFUNC_constructor, 0);
+    xml_selector_proto = JS_NewObject(ctx);
+
+    JS_SetPropertyFunctionList(ctx, xml_selector_proto, js_xml_selector_funcs, countof(js_xml_selector_funcs));
+    JS_SetClassProto(ctx, js_xml_selector_class_id, xml_selector_proto);
+    JS_SetConstructor(ctx, xml_selector_ctor, xml_selector_proto);
+  }
+
   JS_SetModuleExportList(ctx, m, js_xml_funcs, countof(js_xml_funcs));
+  JS_SetModuleExport(ctx, m, "XmlParser", JS_DupValue(ctx, xml_parser_ctor));
+  JS_SetModuleExport(ctx, m, "XmlDocument", JS_DupValue(ctx, xml_document_ctor));
+  JS_SetModuleExport(ctx, m, "XmlSelector", JS_DupValue(ctx, xml_selector_ctor));
+  JS_SetModuleExport(ctx, m, "XmlWriter", JS_DupValue(ctx, xml_writer_ctor));
 
   JSValue defaultObj = JS_NewObject(ctx);
   JS_SetPropertyStr(ctx, defaultObj, "read", JS_NewCFunction(ctx, js_xml_read, "read", 1));
   JS_SetPropertyStr(ctx, defaultObj, "write", JS_NewCFunction(ctx, js_xml_write, "write", 2));
+  JS_SetPropertyStr(ctx, defaultObj, "parse", JS_NewCFunction(ctx, js_xml_parse_events, "parse", 2));
+  JS_SetPropertyStr(ctx, defaultObj, "parseCompact", JS_NewCFunction(ctx, js_xml_parse_compact, "parseCompact", 1));
+  JS_SetPropertyStr(ctx, defaultObj, "parseRecords", JS_NewCFunction(ctx, js_xml_parse_records, "parseRecords", 2));
+  JS_SetPropertyStr(ctx, defaultObj, "reparse", JS_NewCFunction(ctx, js_xml_reparse, "reparse", 5));
+  JS_SetPropertyStr(ctx, defaultObj, "encode", JS_NewCFunctionMagic(ctx, js_xml_entities, "encode", 1, JS_CFUNC_generic_magic, XML_ENCODE));
+  JS_SetPropertyStr(ctx, defaultObj, "decode", JS_NewCFunctionMagic(ctx, js_xml_entities, "decode", 1, JS_CFUNC_generic_magic, XML_DECODE));
+  JS_SetPropertyStr(ctx, defaultObj, "XmlParser", JS_DupValue(ctx, xml_parser_ctor));
+  JS_SetPropertyStr(ctx, defaultObj, "select", JS_NewCFunctionMagic(ctx, js_xml_select, "select", 2, JS_CFUNC_generic_magic, SELECTOR_SELECT));
+  JS_SetPropertyStr(ctx, defaultObj, "selectFirst", JS_NewCFunctionMagic(ctx, js_xml_select, "selectFirst", 2, JS_CFUNC_generic_magic, SELECTOR_SELECT_FIRST));
+  JS_SetPropertyStr(ctx, defaultObj, "RETURN_PATH", JS_NewInt32(ctx, SELECT_RETURN_PATH));
+  JS_SetPropertyStr(ctx, defaultObj, "RETURN_VALUE", JS_NewInt32(ctx, SELECT_RETURN_VALUE));
+  JS_SetPropertyStr(ctx, defaultObj, "XmlDocument", JS_DupValue(ctx, xml_document_ctor));
+  JS_SetPropertyStr(ctx, defaultObj, "XmlSelector", JS_DupValue(ctx, xml_selector_ctor));
+  JS_SetPropertyStr(ctx, defaultObj, "XmlWriter", JS_DupValue(ctx, xml_writer_ctor));
   JS_SetModuleExport(ctx, m, "default", defaultObj);
 
   return 0;
@@ -834,6 +5469,10 @@ JS_INIT_MODULE(JSContext* ctx, const char* module_name) {
   if(!m)
     return NULL;
   JS_AddModuleExportList(ctx, m, js_xml_funcs, countof(js_xml_funcs));
+  JS_AddModuleExport(ctx, m, "XmlParser");
+  JS_AddModuleExport(ctx, m, "XmlDocument");
+  JS_AddModuleExport(ctx, m, "XmlSelector");
+  JS_AddModuleExport(ctx, m, "XmlWriter");
   JS_AddModuleExport(ctx, m, "default");
   return m;
 }
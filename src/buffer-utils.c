@@ -534,6 +534,15 @@ input_buffer_dump(const InputBuffer* in, DynBuf* db) {
   dbuf_printf(db, "(InputBuffer){ .data = %p, .size = %zu, .pos = %zu, .free = %p }", in->data, in->size, in->pos, in->free);
 }
 
+void
+input_buffer_free_default(JSContext* ctx, const char* str, JSValue val) {
+  if(JS_IsString(val))
+    JS_FreeCString(ctx, str);
+
+  if(!JS_IsUndefined(val))
+    JS_FreeValue(ctx, val);
+}
+
 void
 input_buffer_free(InputBuffer* in, JSContext* ctx) {
   if(in->data) {
@@ -545,6 +554,26 @@ input_buffer_free(InputBuffer* in, JSContext* ctx) {
   }
 }
 
+/**
+ * Frees an input owned by input_buffer_free_default() when there is no
+ * context at hand, e.g. in a finalizer.
+ */
+void
+input_buffer_free_rt(InputBuffer* in, JSRuntime* rt) {
+  if(in->data) {
+    if(JS_IsString(in->value))
+      js_cstring_free_rt(rt, (const char*)in->data);
+
+    if(!JS_IsUndefined(in->value))
+      JS_FreeValueRT(rt, in->value);
+
+    in->data = 0;
+    in->size = 0;
+    in->pos = 0;
+    in->value = JS_UNDEFINED;
+  }
+}
+
 const uint8_t*
 input_buffer_peek(InputBuffer* in, size_t* lenp) {
   input_buffer_peekc(in, lenp);
@@ -1,6 +1,12 @@
 #include "char-utils.h"
 #include "libutf/include/libutf.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /**
  * \addtogroup char-utils
  * @{
@@ -141,22 +147,87 @@ scan_xlonglong(const char* src, uint64_t* dest) {
   return tmp - src;
 }
 
+#define BYTE_SCAN_VECTOR 8
+
+/**
+ * Returns the offset of the first byte that is (stop_in_set) or is not
+ * (!stop_in_set) one of set[0..n-1].  Small sets are compared 16 or 32
+ * bytes at a time when SSE2/AVX2 is available.
+ */
+static size_t
+byte_scan(const void* str, size_t len, const char set[], size_t n, BOOL stop_in_set) {
+  const uint8_t* s = str;
+  size_t i = 0, k;
+
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+  if(n <= BYTE_SCAN_VECTOR) {
+#if defined(__AVX2__)
+    __m256i v[BYTE_SCAN_VECTOR];
+
+    for(k = 0; k < n; k++) v[k] = _mm256_set1_epi8(set[k]);
+
+    for(; i + 32 <= len; i += 32) {
+      __m256i chunk = _mm256_loadu_si256((const __m256i*)(s + i)), m = _mm256_setzero_si256();
+      uint32_t bits;
+
+      for(k = 0; k < n; k++) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(chunk, v[k]));
+
+      if((bits = _mm256_movemask_epi8(m) ^ (stop_in_set ? 0 : 0xffffffffu)))
+        return i + __builtin_ctz(bits);
+    }
+#else
+    __m128i v[BYTE_SCAN_VECTOR];
+
+    for(k = 0; k < n; k++) v[k] = _mm_set1_epi8(set[k]);
+
+    for(; i + 16 <= len; i += 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i*)(s + i)), m = _mm_setzero_si128();
+      uint32_t bits;
+
+      for(k = 0; k < n; k++) m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, v[k]));
+
+      if((bits = _mm_movemask_epi8(m) ^ (stop_in_set ? 0 : 0xffff)))
+        return i + __builtin_ctz(bits);
+    }
+#endif
+  }
+#endif
+
+  if(n <= BYTE_SCAN_VECTOR) {
+    for(; i < len; i++)
+      if((byte_chr(set, n, s[i]) < n) == stop_in_set)
+        break;
+  } else {
+    uint8_t table[256] = {0};
+
+    for(k = 0; k < n; k++) table[(uint8_t)set[k]] = 1;
+
+    for(; i < len; i++)
+      if(table[s[i]] == stop_in_set)
+        break;
+  }
+
+  return i;
+}
+
+size_t
+byte_chrs(const void* str, size_t len, const char needle[], size_t nl) {
+  return byte_scan(str, len, needle, nl, TRUE);
+}
+
+size_t
+byte_spn(const void* str, size_t len, const char accept[], size_t na) {
+  return byte_scan(str, len, accept, na, FALSE);
+}
+
 size_t
 scan_whitenskip(const char* s, size_t limit) {
-  const char *t, *u;
-  for(t = s, u = t + limit; t < u; ++t)
-    if(!is_whitespace_char(*t))
-      break;
-  return (size_t)(t - s);
+  return byte_spn(s, limit, " \t\v\n\r", 5);
 }
 
 size_t
 scan_nonwhitenskip(const char* s, size_t limit) {
-  const char *t, *u;
-  for(t = s, u = t + limit; t < u; ++t)
-    if(is_whitespace_char(*t))
-      break;
-  return (size_t)(t - s);
+  return byte_chrs(s, limit, " \t\v\n\r", 5);
 }
 
 size_t
@@ -4,6 +4,7 @@
 #include <libregexp.h>
 #include <ctype.h>
 #include "buffer-utils.h"
+#include "token.h"
 
 /**
  * \addtogroup lexer
@@ -146,171 +147,1640 @@ lexer_rule_expand(Lexer* lex, char* p, DynBuf* db) {
   return TRUE;
 }
 
+static inline void
+byteset_add(uint32_t set[8], unsigned int c) {
+  set[(c >> 5) & 7] |= 1u << (c & 31);
+}
+
+static inline BOOL
+byteset_has(const uint32_t set[8], unsigned int c) {
+  return !!(set[(c >> 5) & 7] & (1u << (c & 31)));
+}
+
+static inline void
+byteset_range(uint32_t set[8], unsigned int lo, unsigned int hi) {
+  if(hi > 0xff)
+    hi = 0xff;
+  for(; lo <= hi; lo++) byteset_add(set, lo);
+}
+
+static inline void
+byteset_union(uint32_t set[8], const uint32_t other[8]) {
+  int i;
+  for(i = 0; i < 8; i++) set[i] |= other[i];
+}
+
+static inline void
+byteset_invert(uint32_t set[8]) {
+  int i;
+  for(i = 0; i < 8; i++) set[i] = ~set[i];
+}
+
+static inline void
+byteset_fill(uint32_t set[8]) {
+  memset(set, 0xff, sizeof(uint32_t) * 8);
+}
+
+/* Regexes are executed on 8-bit input (see lexer_rule_match()), so every
+ * character class is a set of bytes. */
+static void
+regex_first_class_escape(int c, uint32_t set[8]) {
+  uint32_t tmp[8] = {0};
+
+  switch(c) {
+    case 'd':
+    case 'D': byteset_range(tmp, '0', '9'); break;
+    case 'w':
+    case 'W':
+      byteset_range(tmp, '0', '9');
+      byteset_range(tmp, 'A', 'Z');
+      byteset_range(tmp, 'a', 'z');
+      byteset_add(tmp, '_');
+      break;
+    case 's':
+    case 'S':
+      byteset_range(tmp, '\t', '\r');
+      byteset_add(tmp, ' ');
+      byteset_add(tmp, 0xa0);
+      break;
+  }
+
+  if(c == 'D' || c == 'W' || c == 'S')
+    byteset_invert(tmp);
+
+  byteset_union(set, tmp);
+}
+
+static int
+regex_first_hex(const char* p, int n) {
+  int i, d, c = 0;
+
+  for(i = 0; i < n; i++) {
+    if((d = scan_fromhex(p[i])) == -1)
+      return -1;
+    c = (c << 4) | d;
+  }
+  return c;
+}
+
+/* parses an escape sequence after the backslash, returns the character code
+ * or -1 when the escape is a character class, which is added to 'set' */
+static int
+regex_first_escape(const char** pp, uint32_t set[8], BOOL in_class) {
+  const char* p = *pp;
+  int c = (unsigned char)*p++;
+
+  switch(c) {
+    case 'd':
+    case 'D':
+    case 'w':
+    case 'W':
+    case 's':
+    case 'S': regex_first_class_escape(c, set); c = -1; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case 'f': c = '\f'; break;
+    case 'b': c = in_class ? '\b' : c; break;
+    case 'x': {
+      int x;
+      if((x = regex_first_hex(p, 2)) != -1) {
+        c = x;
+        p += 2;
+      }
+      break;
+    }
+    case 'u': {
+      int x;
+      if((x = regex_first_hex(p, 4)) != -1) {
+        c = x;
+        p += 4;
+      }
+      break;
+    }
+    case 'c': {
+      if(is_alphanumeric_char(*p))
+        c = *p++ & 0x1f;
+      else
+        c = '\\', p--;
+      break;
+    }
+    case '\0': p--; break;
+  }
+
+  *pp = p;
+  return c;
+}
+
+static BOOL regex_first_disjunction(const char**, uint32_t set[8], BOOL* nullable);
+
 static BOOL
-lexer_rule_compile(Lexer* lex, LexerRule* rule, JSContext* ctx) {
-  DynBuf dbuf;
-  BOOL ret;
+regex_first_class(const char** pp, uint32_t set[8]) {
+  const char* p = *pp;
+  uint32_t tmp[8] = {0};
+  BOOL invert = FALSE, unknown = FALSE, high;
+
+  if(*p == '^') {
+    invert = TRUE;
+    p++;
+  }
 
-  if(rule->bytecode)
-    return TRUE;
+  while(*p && *p != ']') {
+    int lo, hi;
+
+    if(*p == '\\' && is_digit_char(p[1])) {
+      /* octal escapes */
+      unknown = TRUE;
+      p += 2;
+      lo = -1;
+    } else if(*p == '\\') {
+      ++p;
+      lo = regex_first_escape(&p, tmp, TRUE);
+    } else {
+      lo = (unsigned char)*p++;
+    }
 
-  js_dbuf_init(ctx, &dbuf);
+    if(*p == '-' && p[1] && p[1] != ']' && lo >= 0) {
+      ++p;
 
-  if(lexer_rule_expand(lex, lexer_rule_regex(rule), &dbuf)) {
-    rule->expansion = js_strndup(ctx, (const char*)dbuf.buf, dbuf.size);
-    rule->bytecode = regexp_compile(regexp_from_dbuf(&dbuf, LRE_FLAG_GLOBAL | LRE_FLAG_MULTILINE | LRE_FLAG_STICKY), ctx);
-    ret = rule->bytecode != 0;
+      if(*p == '\\') {
+        ++p;
+        hi = regex_first_escape(&p, tmp, TRUE);
+      } else {
+        hi = (unsigned char)*p++;
+      }
+
+      if(hi < 0) {
+        byteset_add(tmp, lo);
+        byteset_add(tmp, '-');
+      } else if(lo <= 0xff) {
+        byteset_range(tmp, lo, hi);
+      }
+    } else if(lo >= 0 && lo <= 0xff) {
+      byteset_add(tmp, lo);
+    }
+  }
+
+  if(*p != ']')
+    return FALSE;
+
+  high = !!(tmp[4] | tmp[5] | tmp[6] | tmp[7]);
+
+  if(invert)
+    byteset_invert(tmp);
+
+  /* non-ASCII source characters are UTF-8 encoded, be conservative */
+  if(high)
+    byteset_range(tmp, 0x80, 0xff);
+
+  if(unknown)
+    byteset_fill(tmp);
+
+  byteset_union(set, tmp);
+  *pp = p + 1;
+  return TRUE;
+}
+
+static BOOL
+regex_first_quantifier(const char** pp, BOOL* nullable) {
+  const char* p = *pp;
+
+  switch(*p) {
+    case '*':
+    case '?': *nullable = TRUE; /* fallthrough */
+    case '+': p++; break;
+    case '{': {
+      unsigned long min = 0;
+
+      if(!is_digit_char(p[1]))
+        return FALSE;
+
+      for(++p; is_digit_char(*p); p++) min = min * 10 + (*p - '0');
+
+      if(*p == ',')
+        for(++p; is_digit_char(*p); p++) {}
+
+      if(*p != '}')
+        return FALSE;
+
+      ++p;
+
+      if(min == 0)
+        *nullable = TRUE;
+      break;
+    }
+    default: return FALSE;
+  }
+
+  if(*p == '?')
+    p++;
+
+  *pp = p;
+  return TRUE;
+}
+
+static BOOL
+regex_first_term(const char** pp, uint32_t set[8], BOOL* nullable) {
+  const char* p = *pp;
+  BOOL assertion = FALSE;
+
+  *nullable = FALSE;
+
+  switch(*p) {
+    case '^':
+    case '$': {
+      p++;
+      assertion = TRUE;
+      break;
+    }
+    case '.': {
+      uint32_t tmp[8] = {0};
+      byteset_add(tmp, '\n');
+      byteset_add(tmp, '\r');
+      byteset_invert(tmp);
+      byteset_union(set, tmp);
+      p++;
+      break;
+    }
+    case '(': {
+      uint32_t tmp[8] = {0};
+      BOOL lookaround = FALSE;
+
+      if(*++p == '?') {
+        if(p[1] == ':') {
+          p += 2;
+        } else if(p[1] == '=' || p[1] == '!') {
+          p += 2;
+          lookaround = TRUE;
+        } else if(p[1] == '<' && (p[2] == '=' || p[2] == '!')) {
+          p += 3;
+          lookaround = TRUE;
+        } else if(p[1] == '<') {
+          p += str_chr(p, '>');
+          if(*p++ != '>')
+            return FALSE;
+        } else {
+          return FALSE;
+        }
+      }
+
+      if(!regex_first_disjunction(&p, tmp, nullable) || *p != ')')
+        return FALSE;
+
+      p++;
+
+      if(lookaround)
+        assertion = TRUE;
+      else
+        byteset_union(set, tmp);
+      break;
+    }
+    case '[': {
+      p++;
+      if(!regex_first_class(&p, set))
+        return FALSE;
+      break;
+    }
+    case '\\': {
+      int c;
+      p++;
+
+      if(*p == 'b' || *p == 'B') {
+        p++;
+        assertion = TRUE;
+      } else if(is_digit_char(*p) || *p == 'k') {
+        /* back-references may match anything, or nothing */
+        byteset_fill(set);
+        *nullable = TRUE;
+        p++;
+      } else if((c = regex_first_escape(&p, set, FALSE)) >= 0) {
+        if(c <= 0xff)
+          byteset_add(set, c);
+        if(c >= 0x80)
+          byteset_range(set, 0x80, 0xff);
+      }
+      break;
+    }
+    case '*':
+    case '+':
+    case '?':
+    case ')':
+    case '|':
+    case '\0': return FALSE;
+    default: {
+      if((unsigned char)*p >= 0x80)
+        byteset_range(set, 0x80, 0xff);
+      else
+        byteset_add(set, (unsigned char)*p);
+      p++;
+      break;
+    }
+  }
+
+  if(assertion)
+    *nullable = TRUE;
+
+  regex_first_quantifier(&p, nullable);
+
+  *pp = p;
+  return TRUE;
+}
+
+static BOOL
+regex_first_alternative(const char** pp, uint32_t set[8], BOOL* nullable) {
+  const char* p = *pp;
+
+  *nullable = TRUE;
+
+  while(*p && *p != '|' && *p != ')') {
+    uint32_t tmp[8] = {0};
+    BOOL term_nullable;
+
+    if(!regex_first_term(&p, tmp, &term_nullable))
+      return FALSE;
+
+    if(*nullable)
+      byteset_union(set, tmp);
+
+    if(!term_nullable)
+      *nullable = FALSE;
+  }
+
+  *pp = p;
+  return TRUE;
+}
+
+static BOOL
+regex_first_disjunction(const char** pp, uint32_t set[8], BOOL* nullable) {
+  const char* p = *pp;
+
+  *nullable = FALSE;
+
+  for(;;) {
+    BOOL alt_nullable;
+
+    if(!regex_first_alternative(&p, set, &alt_nullable))
+      return FALSE;
+
+    if(alt_nullable)
+      *nullable = TRUE;
+
+    if(*p != '|')
+      break;
 
+    p++;
+  }
+
+  *pp = p;
+  return TRUE;
+}
+
+/**
+ * Computes the set of bytes a non-empty match of the regex can start with.
+ * When the expression can't be analyzed, all bytes are included.
+ */
+void
+lexer_rule_first(const char* regex, uint32_t set[8]) {
+  BOOL nullable;
+
+  memset(set, 0, sizeof(uint32_t) * 8);
+
+  if(!regex_first_disjunction(&regex, set, &nullable) || *regex != '\0')
+    byteset_fill(set);
+}
+
+/**
+ * Decodes a regex which only matches a fixed string, e.g. a keyword or a
+ * punctuator.  Returns FALSE when the expression isn't a plain literal.
+ */
+BOOL
+lexer_rule_literal(const char* regex, DynBuf* db) {
+  const char* p;
+
+  dbuf_zero(db);
+
+  for(p = regex; *p; p++) {
+    int c = (unsigned char)*p;
+
+    switch(c) {
+      case '^':
+      case '$':
+      case '.':
+      case '*':
+      case '+':
+      case '?':
+      case '(':
+      case ')':
+      case '[':
+      case ']':
+      case '|': return FALSE;
+      case '{': {
+        if(is_digit_char(p[1]))
+          return FALSE;
+        break;
+      }
+      case '\\': {
+        c = (unsigned char)*++p;
+
+        switch(c) {
+          case 'n': c = '\n'; break;
+          case 'r': c = '\r'; break;
+          case 't': c = '\t'; break;
+          case 'v': c = '\v'; break;
+          case 'f': c = '\f'; break;
+          case 'x': {
+            if((c = regex_first_hex(p + 1, 2)) == -1)
+              return FALSE;
+            p += 2;
+            break;
+          }
+          default: {
+            if(c == '\0' || c >= 0x80 || is_alphanumeric_char(c) || is_digit_char(c) || c == '_')
+              return FALSE;
+            break;
+          }
+        }
+        break;
+      }
+      default: {
+        /* the pattern is UTF-8, but the input is matched byte-wise */
+        if(c >= 0x80)
+          return FALSE;
+        break;
+      }
+    }
+
+    dbuf_putc(db, c);
+  }
+
+  return db->size > 0;
+}
+
+/* whether the expression is a single character class, optionally repeated
+ * with '+', so that it matches any run of the bytes in its first set */
+static BOOL
+lexer_rule_isrun(const char* re, const uint32_t first[8]) {
+  const char* p = re;
+  int i;
+
+  if(*p == '[') {
+    for(++p; *p && *p != ']'; p++)
+      if(*p == '\\' && p[1])
+        p++;
+
+    if(*p++ != ']')
+      return FALSE;
+  } else if(*p == '\\' && p[1] && strchr("sSdDwW", p[1])) {
+    p += 2;
   } else {
-    JS_ThrowInternalError(ctx, "Error expanding rule '%s'", rule->name);
-    ret = FALSE;
+    return FALSE;
+  }
+
+  if(*p == '+')
+    p++;
+
+  if(*p)
+    return FALSE;
+
+  /* a filled set means the class could not be analyzed */
+  for(i = 0; i < 8; i++)
+    if(first[i] != 0xffffffff)
+      return TRUE;
+
+  return FALSE;
+}
+
+static void
+lexer_rule_setliteral(LexerRule* rule, JSContext* ctx) {
+  DynBuf dbuf;
+
+  if(rule->literal)
+    js_free(ctx, rule->literal);
+
+  rule->literal = 0;
+  rule->literal_length = 0;
+
+  js_dbuf_init(ctx, &dbuf);
+
+  if(lexer_rule_literal(rule->expansion, &dbuf)) {
+    if((rule->literal = js_malloc(ctx, dbuf.size))) {
+      memcpy(rule->literal, dbuf.buf, dbuf.size);
+      rule->literal_length = dbuf.size;
+    }
   }
 
   dbuf_free(&dbuf);
-  return ret;
 }
 
-static int
-lexer_rule_match(Lexer* lex, LexerRule* rule, uint8_t** capture, JSContext* ctx) {
+/* A byte automaton for a rule which follows the backtracking order of the
+ * regex, used while a stream is open to tell whether the match could still
+ * change with more input.  Where the bytes don't tell the whole story
+ * (assertions, lookarounds, back-references, counted repetitions and
+ * non-ASCII bytes) paths are tainted and can't settle the match. */
+enum {
+  PREFIX_BYTES = 0,
+  PREFIX_SPLIT,
+  PREFIX_JMP,
+  PREFIX_TAINT,
+  PREFIX_MATCH,
+};
+
+/* larger automatons aren't built, their rules always wait for more input */
+#define LEXER_PREFIX_MAX 2048
+
+typedef struct lexical_prefix_op {
+  uint8_t op;
+  int32_t x, y;
+  uint32_t set[8];
+} LexerPrefixOp;
+
+struct lexical_prefix {
+  uint32_t length;
+  LexerPrefixOp ops[];
+};
+
+#define prefix_op(ops, pc) ((LexerPrefixOp*)vector_at((ops), sizeof(LexerPrefixOp), (pc)))
+
+static int32_t
+regex_prefix_emit(Vector* ops, uint8_t op, int32_t x, int32_t y) {
+  int32_t pc = vector_size(ops, sizeof(LexerPrefixOp));
+  LexerPrefixOp* o;
+
+  if(!(o = vector_emplace(ops, sizeof(LexerPrefixOp))))
+    return -1;
 
-  if(rule->bytecode == 0) {
-    if(!lexer_rule_compile(lex, rule, ctx))
-      return LEXER_ERROR_COMPILE;
+  memset(o, 0, sizeof(LexerPrefixOp));
+  o->op = op;
+  o->x = x;
+  o->y = y;
+  return pc;
+}
+
+static int32_t
+regex_prefix_bytes(Vector* ops, const uint32_t set[8]) {
+  int32_t pc;
+
+  if((pc = regex_prefix_emit(ops, PREFIX_BYTES, 0, 0)) != -1)
+    memcpy(prefix_op(ops, pc)->set, set, sizeof(uint32_t) * 8);
+
+  return pc;
+}
+
+static BOOL regex_prefix_disjunction(const char**, Vector* ops);
+
+static BOOL
+regex_prefix_term(const char** pp, Vector* ops) {
+  const char* p = *pp;
+  uint32_t set[8] = {0};
+  int32_t start, end;
+  BOOL nullable = FALSE, repeat, lazy, counted;
+  const char* q;
+
+  /* placeholder for the split of an optional term */
+  if((start = regex_prefix_emit(ops, PREFIX_JMP, vector_size(ops, sizeof(LexerPrefixOp)) + 1, 0)) == -1)
+    return FALSE;
+
+  switch(*p) {
+    case '^':
+    case '$': {
+      p++;
+      if(regex_prefix_emit(ops, PREFIX_TAINT, 0, 0) == -1)
+        return FALSE;
+      break;
+    }
+    case '.': {
+      byteset_add(set, '\n');
+      byteset_add(set, '\r');
+      byteset_invert(set);
+      p++;
+      if(regex_prefix_bytes(ops, set) == -1)
+        return FALSE;
+      break;
+    }
+    case '(': {
+      BOOL lookaround = FALSE;
+
+      if(*++p == '?') {
+        if(p[1] == ':') {
+          p += 2;
+        } else if(p[1] == '=' || p[1] == '!') {
+          p += 2;
+          lookaround = TRUE;
+        } else if(p[1] == '<' && (p[2] == '=' || p[2] == '!')) {
+          p += 3;
+          lookaround = TRUE;
+        } else if(p[1] == '<') {
+          p += str_chr(p, '>');
+          if(*p++ != '>')
+            return FALSE;
+        } else {
+          return FALSE;
+        }
+      }
+
+      if(!regex_prefix_disjunction(&p, ops) || *p != ')')
+        return FALSE;
+
+      p++;
+
+      /* only the position is tested, which the bytes don't tell */
+      if(lookaround) {
+        vector_shrink(ops, sizeof(LexerPrefixOp), start + 1);
+
+        if(regex_prefix_emit(ops, PREFIX_TAINT, 0, 0) == -1)
+          return FALSE;
+      }
+      break;
+    }
+    case '[': {
+      const char* r;
+      BOOL octal = FALSE;
+
+      for(r = ++p; *r && *r != ']'; r++)
+        if(*r == '\\' && *++r && is_digit_char(*r))
+          octal = TRUE;
+
+      if(!regex_first_class(&p, set))
+        return FALSE;
+
+      if(octal && regex_prefix_emit(ops, PREFIX_TAINT, 0, 0) == -1)
+        return FALSE;
+
+      if(regex_prefix_bytes(ops, set) == -1)
+        return FALSE;
+      break;
+    }
+    case '\\': {
+      int c;
+      p++;
+
+      if(*p == 'b' || *p == 'B') {
+        p++;
+        if(regex_prefix_emit(ops, PREFIX_TAINT, 0, 0) == -1)
+          return FALSE;
+      } else if(is_digit_char(*p) || *p == 'k') {
+        int32_t loop = vector_size(ops, sizeof(LexerPrefixOp));
+
+        /* back-references match any string */
+        if(*p++ == 'k' && *p == '<') {
+          p += str_chr(p, '>');
+          if(*p++ != '>')
+            return FALSE;
+        }
+
+        while(is_digit_char(*p)) p++;
+
+        byteset_fill(set);
+
+        if(regex_prefix_emit(ops, PREFIX_TAINT, 0, 0) == -1 || regex_prefix_emit(ops, PREFIX_SPLIT, loop + 2, loop + 4) == -1 ||
+           regex_prefix_bytes(ops, set) == -1 || regex_prefix_emit(ops, PREFIX_JMP, loop + 1, 0) == -1)
+          return FALSE;
+      } else {
+        if((c = regex_first_escape(&p, set, FALSE)) >= 0) {
+          if(c <= 0xff)
+            byteset_add(set, c);
+          if(c >= 0x80)
+            byteset_range(set, 0x80, 0xff);
+        }
+
+        if(regex_prefix_bytes(ops, set) == -1)
+          return FALSE;
+      }
+      break;
+    }
+    case '*':
+    case '+':
+    case '?':
+    case ')':
+    case '|':
+    case '\0': return FALSE;
+    default: {
+      /* a UTF-8 encoded character matches a single byte, if any */
+      if((unsigned char)*p >= 0x80) {
+        byteset_range(set, 0x80, 0xff);
+        for(p++; ((unsigned char)*p & 0xc0) == 0x80; p++) {}
+      } else {
+        byteset_add(set, (unsigned char)*p++);
+      }
+
+      if(regex_prefix_bytes(ops, set) == -1)
+        return FALSE;
+      break;
+    }
   }
 
-  // fprintf(stderr, "lexer_rule_match %s %s %s\n", rule->name, rule->expr, rule->expansion);
+  q = p;
 
-  return lre_exec(capture, rule->bytecode, (uint8_t*)lex->input.data, lex->input.pos, lex->input.size, 0, ctx);
+  if(regex_first_quantifier(&p, &nullable)) {
+    repeat = *q != '?';
+    lazy = p - q > 1 && p[-1] == '?';
+    counted = *q == '{' && strncmp(q, "{0,}", 4) && strncmp(q, "{1,}", 4);
+
+    end = vector_size(ops, sizeof(LexerPrefixOp));
+
+    /* a counted repetition is approximated by an unbounded one */
+    if(repeat && regex_prefix_emit(ops, PREFIX_SPLIT, lazy ? end + 1 : start + 1, lazy ? start + 1 : end + 1) == -1)
+      return FALSE;
+
+    if(counted && regex_prefix_emit(ops, PREFIX_TAINT, 0, 0) == -1)
+      return FALSE;
+
+    if(nullable) {
+      LexerPrefixOp* o = prefix_op(ops, start);
+
+      end = vector_size(ops, sizeof(LexerPrefixOp));
+      o->op = PREFIX_SPLIT;
+      o->x = lazy ? end : start + 1;
+      o->y = lazy ? start + 1 : end;
+    }
+  }
+
+  *pp = p;
+  return TRUE;
 }
 
-int
-lexer_rule_add(Lexer* lex, char* name, char* expr) {
-  LexerRule rule = {name, expr, 1, 0, 0, 0}, *previous;
-  int ret;
+static BOOL
+regex_prefix_alternative(const char** pp, Vector* ops) {
+  const char* p = *pp;
+
+  while(*p && *p != '|' && *p != ')')
+    if(!regex_prefix_term(&p, ops))
+      return FALSE;
+
+  *pp = p;
+  return TRUE;
+}
+
+static BOOL
+regex_prefix_disjunction(const char** pp, Vector* ops) {
+  const char* p = *pp;
+  int32_t split, jmp, jmps = -1, end;
+
+  for(;;) {
+    if((split = regex_prefix_emit(ops, PREFIX_SPLIT, vector_size(ops, sizeof(LexerPrefixOp)) + 1, 0)) == -1)
+      return FALSE;
+
+    if(!regex_prefix_alternative(&p, ops))
+      return FALSE;
+
+    if(*p != '|')
+      break;
+
+    /* the jumps to the end are chained through their targets */
+    if((jmp = regex_prefix_emit(ops, PREFIX_JMP, jmps, 0)) == -1)
+      return FALSE;
+
+    jmps = jmp;
+    prefix_op(ops, split)->y = vector_size(ops, sizeof(LexerPrefixOp));
+    p++;
+  }
+
+  prefix_op(ops, split)->op = PREFIX_JMP;
+  end = vector_size(ops, sizeof(LexerPrefixOp));
+
+  for(; jmps != -1; jmps = jmp) {
+    jmp = prefix_op(ops, jmps)->x;
+    prefix_op(ops, jmps)->x = end;
+  }
+
+  *pp = p;
+  return TRUE;
+}
+
+static void
+lexer_rule_setprefix(LexerRule* rule, JSContext* ctx) {
+  Vector ops = VECTOR(ctx);
+  const char* p = rule->expansion;
+  uint32_t n;
+
+  if(rule->prefix)
+    js_free(ctx, rule->prefix);
+
+  rule->prefix = 0;
+
+  if(p && regex_prefix_disjunction(&p, &ops) && *p == '\0' && regex_prefix_emit(&ops, PREFIX_MATCH, 0, 0) != -1) {
+    if((n = vector_size(&ops, sizeof(LexerPrefixOp))) <= LEXER_PREFIX_MAX &&
+       (rule->prefix = js_malloc(ctx, sizeof(struct lexical_prefix) + sizeof(LexerPrefixOp) * n))) {
+      rule->prefix->length = n;
+      memcpy(rule->prefix->ops, vector_begin(&ops), sizeof(LexerPrefixOp) * n);
+    }
+  }
+
+  vector_free(&ops);
+}
+
+/* adds the thread at 'pc' and the ones reachable without input, in the
+ * order the regex engine would try them; the high bit marks a taint */
+static void
+lexer_prefix_add(const struct lexical_prefix* prefix, uint32_t* list, uint32_t* n, uint32_t* mark, uint32_t gen, int32_t pc, uint32_t taint) {
+  const LexerPrefixOp* o = &prefix->ops[pc];
+
+  if(mark[pc] == gen)
+    return;
+
+  mark[pc] = gen;
+
+  switch(o->op) {
+    case PREFIX_JMP: lexer_prefix_add(prefix, list, n, mark, gen, o->x, taint); break;
+    case PREFIX_SPLIT:
+      lexer_prefix_add(prefix, list, n, mark, gen, o->x, taint);
+      lexer_prefix_add(prefix, list, n, mark, gen, o->y, taint);
+      break;
+    case PREFIX_TAINT: lexer_prefix_add(prefix, list, n, mark, gen, pc + 1, 1u << 31); break;
+    default: list[(*n)++] = pc | taint; break;
+  }
+}
+
+/**
+ * Whether the result of matching the rule on 'data' could change when more
+ * input follows 'len' bytes: some path the regex engine would prefer over
+ * the match found so far (or over failing) still reads on at the end.
+ */
+static BOOL
+lexer_rule_extends(LexerRule* rule, const uint8_t* data, size_t len) {
+  const struct lexical_prefix* prefix = rule->prefix;
+  uint32_t *clist, *nlist, *mark, *tmp, cn = 0, nn, i, gen = 1;
+  size_t pos;
+
+  if(rule->literal)
+    return len < rule->literal_length && !memcmp(data, rule->literal, len);
+
+  if(!byteset_has(rule->first, data[0]))
+    return FALSE;
+
+  if(!prefix)
+    return TRUE;
+
+  clist = alloca(sizeof(uint32_t) * prefix->length * 3);
+  nlist = clist + prefix->length;
+  mark = nlist + prefix->length;
+  memset(mark, 0, sizeof(uint32_t) * prefix->length);
+
+  lexer_prefix_add(prefix, clist, &cn, mark, gen, 0, 0);
+
+  for(pos = 0; pos < len && cn; pos++) {
+    ++gen;
+
+    for(i = 0, nn = 0; i < cn; i++) {
+      const LexerPrefixOp* o = &prefix->ops[clist[i] & ~(1u << 31)];
+
+      /* a certain match cuts off the paths tried after it */
+      if(o->op == PREFIX_MATCH) {
+        if(!(clist[i] >> 31))
+          break;
+      } else if(byteset_has(o->set, data[pos])) {
+        lexer_prefix_add(prefix, nlist, &nn, mark, gen, (clist[i] & ~(1u << 31)) + 1, data[pos] >= 0x80 ? 1u << 31 : clist[i] & (1u << 31));
+      }
+    }
+
+    tmp = clist, clist = nlist, nlist = tmp;
+    cn = nn;
+  }
+
+  /* a tainted match at the end may depend on what follows, too */
+  return cn > 0 && (prefix->ops[clist[0] & ~(1u << 31)].op != PREFIX_MATCH || (clist[0] >> 31));
+}
+
+static BOOL
+lexer_rule_compile(Lexer* lex, LexerRule* rule, JSContext* ctx) {
+  DynBuf dbuf;
+  BOOL ret;
+
+  if(rule->bytecode)
+    return TRUE;
+
+  js_dbuf_init(ctx, &dbuf);
+
+  if(lexer_rule_expand(lex, lexer_rule_regex(rule), &dbuf)) {
+    if(rule->expansion)
+      js_free(ctx, rule->expansion);
+    rule->expansion = js_strndup(ctx, (const char*)dbuf.buf, dbuf.size);
+    lexer_rule_first(rule->expansion, rule->first);
+    lexer_rule_setliteral(rule, ctx);
+    lexer_rule_setprefix(rule, ctx);
+    rule->run = lexer_rule_isrun(rule->expansion, rule->first);
+    rule->bytecode = regexp_compile_len(regexp_from_dbuf(&dbuf, LRE_FLAG_GLOBAL | LRE_FLAG_MULTILINE | LRE_FLAG_STICKY), &rule->bytecode_length, ctx);
+    ret = rule->bytecode != 0;
+
+  } else {
+    JS_ThrowInternalError(ctx, "Error expanding rule '%s'", rule->name);
+    ret = FALSE;
+  }
+
+  dbuf_free(&dbuf);
+  return ret;
+}
+
+static int
+lexer_rule_match(Lexer* lex, LexerRule* rule, uint8_t** capture, JSContext* ctx) {
+
+  if(rule->bytecode == 0) {
+    if(!lexer_rule_compile(lex, rule, ctx))
+      return LEXER_ERROR_COMPILE;
+  }
+
+  // fprintf(stderr, "lexer_rule_match %s %s %s\n", rule->name, rule->expr, rule->expansion);
+
+  if(rule->literal) {
+    if(lex->input.size - lex->input.pos < rule->literal_length ||
+       memcmp(&lex->input.data[lex->input.pos], rule->literal, rule->literal_length))
+      return 0;
+
+    capture[0] = &lex->input.data[lex->input.pos];
+    capture[1] = capture[0] + rule->literal_length;
+    return 1;
+  }
+
+  return lre_exec(capture, rule->bytecode, (uint8_t*)lex->input.data, lex->input.pos, lex->input.size, 0, ctx);
+}
+
+int
+lexer_rule_add(Lexer* lex, char* name, char* expr) {
+  LexerRule rule = {name, expr, 1, 0, 0, 0}, *previous;
+  int ret;
+
+  if((previous = lexer_rule_find(lex, name))) {
+    return -1;
+  }
+
+  if(rule.expr[0] == '<') {
+    char* s;
+    int32_t flags = 0;
+
+    for(s = &rule.expr[1]; *s && *s != '>';) {
+      size_t len = str_chrs(s, ",>", 2);
+      int index;
+
+      if(s[len] == '\0')
+        break;
+
+      if((index = lexer_state_findb(lex, s, len)) == -1)
+        index = lexer_state_new(lex, s, len);
+
+      assert(index != -1);
+      flags |= 1 << index;
+
+      if(*(s += len) == ',')
+        s++;
+    }
+
+    if(*s == '>')
+      rule.mask = flags;
+  }
+
+  // fprintf(stderr, "lexer_rule_add %s %s %08x\n", rule.name, rule.expr, rule.mask);
+  ret = vector_size(&lex->rules, sizeof(LexerRule));
+  vector_push(&lex->rules, rule);
+  return ret;
+}
+
+LexerRule*
+lexer_rule_find(Lexer* lex, const char* name) {
+  LexerRule* rule;
+  assert(name);
+  vector_foreach_t(&lex->rules, rule) {
+    assert(rule->name);
+    if(!strcmp(rule->name, name))
+      return rule;
+  }
+  return 0;
+}
+
+void
+lexer_rule_free(LexerRule* rule, JSContext* ctx) {
+  if(rule->name)
+    js_free(ctx, rule->name);
+  js_free(ctx, rule->expr);
+
+  if(rule->bytecode)
+    js_free(ctx, rule->bytecode);
+
+  if(rule->literal)
+    js_free(ctx, rule->literal);
+
+  if(rule->prefix)
+    js_free(ctx, rule->prefix);
+}
+
+void
+lexer_rule_free_rt(LexerRule* rule, JSRuntime* rt) {
+  if(rule->name)
+    js_free_rt(rt, rule->name);
+  js_free_rt(rt, rule->expr);
+
+  if(rule->bytecode)
+    orig_js_free_rt(rt, rule->bytecode);
+
+  if(rule->literal)
+    js_free_rt(rt, rule->literal);
+
+  if(rule->prefix)
+    js_free_rt(rt, rule->prefix);
+}
+
+void
+lexer_rule_dump(Lexer* lex, LexerRule* rule, DynBuf* dbuf) {
+  /*  if(rule->mask != 0) {
+      dbuf_putc(dbuf, '<');
+      lexer_states_dump(lex, rule->mask, dbuf);
+      dbuf_putc(dbuf, '>');
+    }*/
+  lexer_rule_expand(lex, rule->expr, dbuf);
+}
+
+void
+lexer_init(Lexer* lex, enum lexer_mode mode, JSContext* ctx) {
+  char* initial = js_strdup(ctx, "INITIAL");
+
+  memset(lex, 0, sizeof(Lexer));
+
+  lex->ref_count = 1;
+  lex->mode = mode;
+  lex->state = 0;
+  lex->seq = 0;
+
+  location_init(&lex->loc);
+
+  vector_init(&lex->defines, ctx);
+  vector_init(&lex->rules, ctx);
+  vector_init(&lex->states, ctx);
+  vector_push(&lex->states, initial);
+  vector_init(&lex->state_stack, ctx);
+  vector_init(&lex->lines.index, ctx);
+
+  lex->intern = LEXER_INTERN_MAX;
+}
+
+void
+lexer_define(Lexer* lex, char* name, char* expr) {
+  LexerRule definition = {name, expr, MASK_ALL, 0, 0, 0};
+  vector_size(&lex->defines, sizeof(LexerRule));
+  vector_push(&lex->defines, definition);
+}
+
+LexerRule*
+lexer_find_definition(Lexer* lex, const char* name, size_t namelen) {
+  LexerRule* definition;
+  vector_foreach_t(&lex->defines, definition) {
+    if(!strncmp(definition->name, name, namelen) && definition->name[namelen] == '\0')
+      return definition;
+  }
+  return 0;
+}
+
+BOOL
+lexer_compile_rules(Lexer* lex, JSContext* ctx) {
+  LexerRule* rule;
+
+  vector_foreach_t(&lex->rules, rule) {
+    if(!lexer_rule_compile(lex, rule, ctx))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+#define LEXER_CACHE_MAGIC 0x4358454c /* "LEXC" */
+#define LEXER_CACHE_VERSION 3
+#define LEXER_CACHE_HEADER 8
+
+#ifndef CONFIG_VERSION
+#define CONFIG_VERSION ""
+#endif
+
+static uint32_t
+lexer_hash_bytes(uint32_t h, const void* data, size_t len) {
+  const uint8_t* p = data;
+
+  while(len--) h = (h ^ *p++) * 16777619;
+
+  return h;
+}
+
+static uint32_t
+lexer_hash_str(uint32_t h, const char* s) {
+  return lexer_hash_bytes(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+/**
+ * FNV-1a hash of everything the compiled rules depend on: states,
+ * definitions and the rules with their masks.
+ */
+uint32_t
+lexer_hash(Lexer* lex) {
+  uint32_t h = 2166136261;
+  LexerRule* rule;
+  char** state;
+
+  vector_foreach_t(&lex->states, state) { h = lexer_hash_str(h, *state); }
+
+  vector_foreach_t(&lex->defines, rule) {
+    h = lexer_hash_str(h, rule->name);
+    h = lexer_hash_str(h, rule->expr);
+  }
+
+  vector_foreach_t(&lex->rules, rule) {
+    h = lexer_hash_str(h, rule->name);
+    h = lexer_hash_str(h, rule->expr);
+    h = lexer_hash_bytes(h, &rule->mask, sizeof(rule->mask));
+  }
+
+  return h;
+}
+
+/* the regex bytecode is stored in host byte order and word sizes */
+static uint32_t
+lexer_cache_abi(void) {
+  const uint16_t order = 0x0102;
+
+  return (uint32_t)*(const uint8_t*)&order << 24 | sizeof(void*) << 16 | sizeof(size_t) << 8 | sizeof(int);
+}
+
+/*
+ * the QuickJS release and the bytecode libregexp emits for a probe
+ * expression, which differs whenever its format does
+ */
+static BOOL
+lexer_cache_format(JSContext* ctx, uint32_t* release, uint32_t* format) {
+  static const char probe[] = "(?<w>[a-z_]+|\\d{2,}?)\\s*(?=[^\\n]|$)\\k<w>?\\b";
+  uint8_t* bytecode;
+  size_t len;
+
+  if(!(bytecode = regexp_compile_len(regexp_from_string((char*)probe, LRE_FLAG_GLOBAL | LRE_FLAG_MULTILINE | LRE_FLAG_STICKY), &len, ctx)))
+    return FALSE;
+
+  *release = lexer_hash_str(2166136261, CONFIG_VERSION);
+  *format = lexer_hash_bytes(2166136261, bytecode, len);
+  js_free(ctx, bytecode);
+  return TRUE;
+}
+
+static void
+lexer_cache_put(DynBuf* db, const void* data, uint32_t len) {
+  dbuf_put_u32(db, len);
+  dbuf_put(db, data, len);
+}
+
+/**
+ * Writes the expanded expression, bytecode, first-byte set and literal of
+ * every rule, compiling them first.
+ */
+BOOL
+lexer_serialize(Lexer* lex, DynBuf* db, JSContext* ctx) {
+  LexerRule* rule;
+  size_t start;
+  uint32_t checksum, release, format;
+
+  if(!lexer_compile_rules(lex, ctx) || !lexer_cache_format(ctx, &release, &format))
+    return FALSE;
+
+  dbuf_put_u32(db, LEXER_CACHE_MAGIC);
+  dbuf_put_u32(db, LEXER_CACHE_VERSION);
+  dbuf_put_u32(db, lexer_cache_abi());
+  dbuf_put_u32(db, release);
+  dbuf_put_u32(db, format);
+  dbuf_put_u32(db, lexer_hash(lex));
+  dbuf_put_u32(db, vector_size(&lex->rules, sizeof(LexerRule)));
+  start = db->size;
+  dbuf_put_u32(db, 0);
+
+  vector_foreach_t(&lex->rules, rule) {
+    lexer_cache_put(db, rule->expansion, strlen(rule->expansion));
+    lexer_cache_put(db, rule->bytecode, rule->bytecode_length);
+    dbuf_put(db, (const uint8_t*)rule->first, sizeof(rule->first));
+
+    if(rule->literal)
+      lexer_cache_put(db, rule->literal, rule->literal_length);
+    else
+      dbuf_put_u32(db, UINT32_MAX);
+  }
+
+  if(dbuf_error(db)) {
+    JS_ThrowOutOfMemory(ctx);
+    return FALSE;
+  }
+
+  /* checksum of the payload following the header */
+  checksum = lexer_hash_bytes(2166136261, db->buf + start + sizeof(uint32_t), db->size - start - sizeof(uint32_t));
+  memcpy(db->buf + start, &checksum, sizeof(uint32_t));
+  return TRUE;
+}
+
+static BOOL
+lexer_cache_get(const uint8_t** p, const uint8_t* end, void* out, size_t len) {
+  if((size_t)(end - *p) < len)
+    return FALSE;
+
+  memcpy(out, *p, len);
+  *p += len;
+  return TRUE;
+}
+
+static BOOL
+lexer_cache_u32(const uint8_t** p, const uint8_t* end, uint32_t* out) {
+  return lexer_cache_get(p, end, out, sizeof(uint32_t));
+}
+
+static BOOL
+lexer_cache_skip(const uint8_t** p, const uint8_t* end, BOOL optional) {
+  uint32_t len;
+
+  if(!lexer_cache_u32(p, end, &len))
+    return FALSE;
+  if(len == UINT32_MAX)
+    return optional;
+  if((size_t)(end - *p) < len)
+    return FALSE;
+
+  *p += len;
+  return TRUE;
+}
+
+/**
+ * Restores compiled rules written by lexer_serialize().  Returns FALSE and
+ * leaves the lexer untouched if the data is truncated or corrupt, or was
+ * produced by another version, on another platform, by another QuickJS
+ * release or regex bytecode format, or for a different rule set.
+ *
+ * Cache files are trusted input: the bytecode is run by lre_exec()
+ * unchecked, and the FNV checksum only catches accidental damage, not a
+ * crafted file.
+ */
+BOOL
+lexer_deserialize(Lexer* lex, const uint8_t* data, size_t size, JSContext* ctx) {
+  const uint8_t *p = data, *end = data + size;
+  uint32_t i, magic, version, abi, release, format, host_release, host_format, hash, count, checksum, len;
+  LexerRule* rule;
+
+  if(!lexer_cache_u32(&p, end, &magic) || magic != LEXER_CACHE_MAGIC)
+    return FALSE;
+  if(!lexer_cache_u32(&p, end, &version) || version != LEXER_CACHE_VERSION)
+    return FALSE;
+  if(!lexer_cache_u32(&p, end, &abi) || abi != lexer_cache_abi())
+    return FALSE;
+  if(!lexer_cache_u32(&p, end, &release) || !lexer_cache_u32(&p, end, &format))
+    return FALSE;
+  if(!lexer_cache_format(ctx, &host_release, &host_format) || release != host_release || format != host_format)
+    return FALSE;
+  if(!lexer_cache_u32(&p, end, &hash) || hash != lexer_hash(lex))
+    return FALSE;
+  if(!lexer_cache_u32(&p, end, &count) || count != vector_size(&lex->rules, sizeof(LexerRule)))
+    return FALSE;
+  if(!lexer_cache_u32(&p, end, &checksum) || checksum != lexer_hash_bytes(2166136261, p, end - p))
+    return FALSE;
+
+  /* validate before modifying any rule */
+  for(i = 0; i < count; i++) {
+    if(!lexer_cache_skip(&p, end, FALSE) || !lexer_cache_skip(&p, end, FALSE))
+      return FALSE;
+
+    if((size_t)(end - p) < sizeof(rule->first))
+      return FALSE;
+    p += sizeof(rule->first);
+
+    if(!lexer_cache_skip(&p, end, TRUE))
+      return FALSE;
+  }
+
+  if(p != end)
+    return FALSE;
+
+  p = data + LEXER_CACHE_HEADER * sizeof(uint32_t);
+
+  vector_foreach_t(&lex->rules, rule) {
+    lexer_cache_u32(&p, end, &len);
+
+    if(rule->expansion)
+      js_free(ctx, rule->expansion);
+    rule->expansion = js_strndup(ctx, (const char*)p, len);
+    lexer_rule_setprefix(rule, ctx);
+    p += len;
+
+    lexer_cache_u32(&p, end, &len);
+
+    if(rule->bytecode)
+      js_free(ctx, rule->bytecode);
+    if((rule->bytecode = orig_js_malloc(ctx, len)))
+      memcpy(rule->bytecode, p, len);
+    rule->bytecode_length = len;
+    p += len;
+
+    lexer_cache_get(&p, end, rule->first, sizeof(rule->first));
+    rule->run = lexer_rule_isrun(rule->expansion, rule->first);
+
+    lexer_cache_u32(&p, end, &len);
+
+    if(rule->literal)
+      js_free(ctx, rule->literal);
+    rule->literal = 0;
+    rule->literal_length = 0;
+
+    if(len != UINT32_MAX) {
+      if((rule->literal = js_malloc(ctx, len ? len : 1))) {
+        memcpy(rule->literal, p, len);
+        rule->literal_length = len;
+      }
+      p += len;
+    }
+  }
+
+  /* the dispatch tables are rebuilt from the restored rules */
+  lex->dispatch_rules = 0;
+  return TRUE;
+}
+
+void
+lexer_dispatch_free(Lexer* lex, JSRuntime* rt) {
+  uint32_t i;
+
+  if(lex->dispatch) {
+    for(i = 0; i < lex->dispatch_states; i++) {
+      LexerDispatch* table = &lex->dispatch[i];
+
+      if(table->rules)
+        js_free_rt(rt, table->rules);
+      if(table->chain)
+        js_free_rt(rt, table->chain);
+
+      vector_free(&table->trie);
+      vector_free(&table->runs);
+    }
+
+    js_free_rt(rt, lex->dispatch);
+  }
+
+  lex->dispatch = 0;
+  lex->dispatch_states = 0;
+  lex->dispatch_rules = 0;
+}
+
+static LexerTrie*
+lexer_trie_at(LexerDispatch* table, int32_t node) {
+  return vector_at(&table->trie, sizeof(LexerTrie), node);
+}
+
+static BOOL
+lexer_trie_insert(LexerDispatch* table, LexerRule* rule, int32_t id) {
+  int32_t node = 0, child;
+  size_t i;
+
+  for(i = 0; i < rule->literal_length; i++) {
+    uint8_t c = rule->literal[i];
+
+    for(child = lexer_trie_at(table, node)->child; child != -1; child = lexer_trie_at(table, child)->next)
+      if(lexer_trie_at(table, child)->byte == c)
+        break;
+
+    if(child == -1) {
+      LexerTrie leaf = {-1, lexer_trie_at(table, node)->child, -1, c};
+
+      child = vector_size(&table->trie, sizeof(LexerTrie));
+
+      if(!vector_push(&table->trie, leaf))
+        return FALSE;
+
+      lexer_trie_at(table, node)->child = child;
+    }
+
+    node = child;
+  }
+
+  /* rules are inserted in ascending order, append to the chain */
+  if(lexer_trie_at(table, node)->rule == -1) {
+    lexer_trie_at(table, node)->rule = id;
+  } else {
+    int32_t prev = lexer_trie_at(table, node)->rule;
+
+    while(table->chain[prev] != -1) prev = table->chain[prev];
+
+    table->chain[prev] = id;
+  }
+
+  return TRUE;
+}
+
+/* collects the bytes for which a run rule is the only candidate */
+static BOOL
+lexer_dispatch_runs(Lexer* lex, LexerDispatch* table, uint32_t state) {
+  uint32_t literal[8] = {0}, c;
+  int32_t child;
+  LexerRule* rule;
+
+  for(child = lexer_trie_at(table, 0)->child; child != -1; child = lexer_trie_at(table, child)->next)
+    byteset_add(literal, lexer_trie_at(table, child)->byte);
+
+  vector_foreach_t(&lex->rules, rule) {
+    LexerRun run = {rule - (LexerRule*)vector_begin(&lex->rules), 0};
+
+    if((rule->mask & (1 << state)) == 0 || !rule->run)
+      continue;
+
+    /* the first set of a class with non-ASCII characters includes all
+     * bytes >= 0x80 whether or not they match, so runs are ASCII only */
+    for(c = 0; c < 0x80; c++)
+      if(table->index[c + 1] - table->index[c] == 1 && table->rules[table->index[c]] == run.rule && !byteset_has(literal, c))
+        run.bytes[run.length++] = c;
+
+    if(run.length && !vector_push(&table->runs, run))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * Builds a table for each state which maps the first input byte to the regex
+ * rules that could match there, and a trie of the literal rules.  Rules which
+ * fail to compile are added for every byte, so the error is raised by
+ * lexer_peek() as soon as they're tried.
+ */
+BOOL
+lexer_dispatch_build(Lexer* lex, JSContext* ctx) {
+  LexerRule* rule;
+  uint32_t i, c, nstates = MIN_NUM(lexer_num_states(lex), 32), nrules = vector_size(&lex->rules, sizeof(LexerRule));
+
+  lexer_dispatch_free(lex, JS_GetRuntime(ctx));
+
+  vector_foreach_t(&lex->rules, rule) {
+    if(!rule->bytecode && !lexer_rule_compile(lex, rule, ctx)) {
+      JS_FreeValue(ctx, JS_GetException(ctx));
+      byteset_fill(rule->first);
+    }
+  }
+
+  if(!(lex->dispatch = js_mallocz(ctx, sizeof(LexerDispatch) * nstates)))
+    return FALSE;
+
+  lex->dispatch_states = nstates;
+  lex->dispatch_rules = nrules;
+
+  for(i = 0; i < nstates; i++) {
+    LexerDispatch* table = &lex->dispatch[i];
+    LexerTrie root = {-1, -1, -1, 0};
+    uint32_t count[256] = {0};
+
+    vector_init(&table->trie, ctx);
+
+    if(!vector_push(&table->trie, root))
+      return FALSE;
+
+    if(nrules && !(table->chain = js_malloc(ctx, sizeof(int32_t) * nrules)))
+      return FALSE;
+
+    memset(table->chain, 0xff, sizeof(int32_t) * nrules);
+
+    vector_foreach_t(&lex->rules, rule) {
+      if((rule->mask & (1 << i)) == 0)
+        continue;
+
+      if(rule->literal) {
+        if(!lexer_trie_insert(table, rule, rule - (LexerRule*)vector_begin(&lex->rules)))
+          return FALSE;
+        continue;
+      }
+
+      for(c = 0; c < 256; c++)
+        if(byteset_has(rule->first, c))
+          count[c]++;
+    }
+
+    for(c = 0; c < 256; c++) table->index[c + 1] = table->index[c] + count[c];
 
-  if((previous = lexer_rule_find(lex, name))) {
-    return -1;
-  }
+    vector_init(&table->runs, ctx);
 
-  if(rule.expr[0] == '<') {
-    char* s;
-    int32_t flags = 0;
+    if(table->index[256] == 0)
+      continue;
 
-    for(s = &rule.expr[1]; *s && *s != '>';) {
-      size_t len = str_chrs(s, ",>", 2);
-      int index;
+    if(!(table->rules = js_malloc(ctx, sizeof(int32_t) * table->index[256])))
+      return FALSE;
 
-      if(s[len] == '\0')
-        break;
+    memset(count, 0, sizeof(count));
 
-      if((index = lexer_state_findb(lex, s, len)) == -1)
-        index = lexer_state_new(lex, s, len);
+    vector_foreach_t(&lex->rules, rule) {
+      int32_t id = rule - (LexerRule*)vector_begin(&lex->rules);
 
-      assert(index != -1);
-      flags |= 1 << index;
+      if((rule->mask & (1 << i)) == 0 || rule->literal)
+        continue;
 
-      if(*(s += len) == ',')
-        s++;
+      for(c = 0; c < 256; c++)
+        if(byteset_has(rule->first, c))
+          table->rules[table->index[c] + count[c]++] = id;
     }
 
-    if(*s == '>')
-      rule.mask = flags;
+    if(!lexer_dispatch_runs(lex, table, i))
+      return FALSE;
   }
 
-  // fprintf(stderr, "lexer_rule_add %s %s %08x\n", rule.name, rule.expr, rule.mask);
-  ret = vector_size(&lex->rules, sizeof(LexerRule));
-  vector_push(&lex->rules, rule);
-  return ret;
-}
-
-LexerRule*
-lexer_rule_find(Lexer* lex, const char* name) {
-  LexerRule* rule;
-  assert(name);
-  vector_foreach_t(&lex->rules, rule) {
-    assert(rule->name);
-    if(!strcmp(rule->name, name))
-      return rule;
-  }
-  return 0;
+  return TRUE;
 }
 
-void
-lexer_rule_free(LexerRule* rule, JSContext* ctx) {
-  if(rule->name)
-    js_free(ctx, rule->name);
-  js_free(ctx, rule->expr);
+/**
+ * Walks the literal trie along the input in a single pass and selects the
+ * literal rule the lexer mode prefers: the lowest id (LEXER_FIRST), the
+ * highest id (LEXER_LAST) or the longest literal (LEXER_LONGEST).
+ */
+static int
+lexer_trie_match(Lexer* lex, LexerDispatch* table, int start_rule, size_t* lenp) {
+  const uint8_t *p = &lex->input.data[lex->input.pos], *end = &lex->input.data[lex->input.size];
+  int32_t node = lexer_trie_at(table, 0)->child, id, ret = -1;
+  size_t depth = 0;
 
-  if(rule->bytecode)
-    js_free(ctx, rule->bytecode);
-}
+  while(node != -1 && p < end) {
+    LexerTrie* trie;
 
-void
-lexer_rule_free_rt(LexerRule* rule, JSRuntime* rt) {
-  if(rule->name)
-    js_free_rt(rt, rule->name);
-  js_free_rt(rt, rule->expr);
+    while(node != -1 && (trie = lexer_trie_at(table, node))->byte != *p) node = trie->next;
 
-  if(rule->bytecode)
-    orig_js_free_rt(rt, rule->bytecode);
-}
+    if(node == -1)
+      break;
 
-void
-lexer_rule_dump(Lexer* lex, LexerRule* rule, DynBuf* dbuf) {
-  /*  if(rule->mask != 0) {
-      dbuf_putc(dbuf, '<');
-      lexer_states_dump(lex, rule->mask, dbuf);
-      dbuf_putc(dbuf, '>');
-    }*/
-  lexer_rule_expand(lex, rule->expr, dbuf);
-}
+    ++depth;
+    ++p;
 
-void
-lexer_init(Lexer* lex, enum lexer_mode mode, JSContext* ctx) {
-  char* initial = js_strdup(ctx, "INITIAL");
+    for(id = trie->rule; id != -1; id = table->chain[id]) {
+      if(id < start_rule)
+        continue;
 
-  memset(lex, 0, sizeof(Lexer));
+      if(ret == -1 || (lex->mode & LEXER_LONGEST) || (lex->mode == LEXER_FIRST ? id < ret : id > ret)) {
+        ret = id;
+        *lenp = depth;
+      }
 
-  lex->ref_count = 1;
-  lex->mode = mode;
-  lex->state = 0;
-  lex->seq = 0;
+      if(lex->mode != LEXER_LAST)
+        break;
+    }
 
-  location_init(&lex->loc);
+    node = trie->child;
+  }
 
-  vector_init(&lex->defines, ctx);
-  vector_init(&lex->rules, ctx);
-  vector_init(&lex->states, ctx);
-  vector_push(&lex->states, initial);
-  vector_init(&lex->state_stack, ctx);
+  return ret;
 }
 
-void
-lexer_define(Lexer* lex, char* name, char* expr) {
-  LexerRule definition = {name, expr, MASK_ALL, 0, 0, 0};
-  vector_size(&lex->defines, sizeof(LexerRule));
-  vector_push(&lex->defines, definition);
-}
+/* returns TRUE when no further rules need to be tried */
+static BOOL
+lexer_peek_rule(Lexer* lex, int id, LexerRule* rule, uint8_t** capture, int* ret, size_t* len, JSContext* ctx) {
+  int result = lexer_rule_match(lex, rule, capture, ctx);
 
-LexerRule*
-lexer_find_definition(Lexer* lex, const char* name, size_t namelen) {
-  LexerRule* definition;
-  vector_foreach_t(&lex->defines, definition) {
-    if(!strncmp(definition->name, name, namelen) && definition->name[namelen] == '\0')
-      return definition;
+  if(result == LEXER_ERROR_COMPILE) {
+    *ret = result;
+    return TRUE;
+  } else if(result < 0) {
+    JS_ThrowInternalError(ctx, "Error matching regex /%s/", rule->expr);
+    *ret = LEXER_ERROR_EXEC;
+    return TRUE;
+  } else if(result > 0 && (capture[1] - capture[0]) > 0) {
+    /*printf("%s:%" PRIu32 ":%" PRIu32 " #%i %-20s - /%s/ [%zu] %.*s\n",
+           lex->loc.file,
+           lex->loc.line + 1,
+           lex->loc.column + 1,
+           id,
+           rule->name,
+           rule->expr,
+           capture[1] - capture[0],
+           capture[1] - capture[0],
+           capture[0]); */
+    if((lex->mode & LEXER_LONGEST) == 0 || *ret < 0 || (size_t)(capture[1] - capture[0]) > *len) {
+      *ret = id;
+      *len = capture[1] - capture[0];
+      if(lex->mode == LEXER_FIRST)
+        return TRUE;
+    }
   }
-  return 0;
+
+  return FALSE;
 }
 
-BOOL
-lexer_compile_rules(Lexer* lex, JSContext* ctx) {
+/**
+ * Whether the rules which would take precedence over rule 'id' could match
+ * differently when the buffered input is continued.
+ */
+static BOOL
+lexer_peek_extends(Lexer* lex, int start_rule, int id, JSContext* ctx) {
+  const uint8_t* data = &lex->input.data[lex->input.pos];
+  size_t len = lex->input.size - lex->input.pos;
   LexerRule* rule;
+  int i = -1;
 
   vector_foreach_t(&lex->rules, rule) {
-    if(!lexer_rule_compile(lex, rule, ctx))
-      return FALSE;
+    if(++i < start_rule || (rule->mask & (1 << lex->state)) == 0)
+      continue;
+
+    if(!(lex->mode & LEXER_LONGEST)) {
+      if(lex->mode == LEXER_FIRST && i > id)
+        break;
+      if(lex->mode == LEXER_LAST && i < id)
+        continue;
+    }
+
+    if(!rule->bytecode && !lexer_rule_compile(lex, rule, ctx)) {
+      JS_FreeValue(ctx, JS_GetException(ctx));
+      return TRUE;
+    }
+
+    if(lexer_rule_extends(rule, data, len))
+      return TRUE;
   }
-  return TRUE;
+
+  return FALSE;
 }
 
 int
@@ -321,45 +1791,66 @@ lexer_peek(Lexer* lex, uint64_t state, int start_rule, JSContext* ctx) {
   size_t len = 0;
 
   if(input_buffer_eof(&lex->input))
-    return LEXER_EOF;
+    return lex->stream == LEXER_STREAM_OPEN ? LEXER_NEED_INPUT : LEXER_EOF;
 
   //  lex->start = lex->input.pos;
 
-  vector_foreach_t(&lex->rules, rule) {
-    int result;
-    if(++i < start_rule)
-      continue;
+  if(lex->dispatch_rules != vector_size(&lex->rules, sizeof(LexerRule)))
+    if(!lexer_dispatch_build(lex, ctx))
+      lexer_dispatch_free(lex, JS_GetRuntime(ctx));
+
+  if(lex->state >= 0 && (uint32_t)lex->state < lex->dispatch_states) {
+    LexerDispatch* table = &lex->dispatch[lex->state];
+    uint8_t c = lex->input.data[lex->input.pos];
+    uint32_t k;
+    size_t literal_len = 0;
+    int literal = lexer_trie_match(lex, table, start_rule, &literal_len);
+
+    if(lex->mode == LEXER_LAST) {
+      /* only rules after the literal match can take precedence */
+      for(k = table->index[c + 1]; k > table->index[c]; k--) {
+        if((i = table->rules[k - 1]) < start_rule || i < literal)
+          break;
 
-    if((rule->mask & (1 << lex->state)) == 0)
-      continue;
+        if(lexer_peek_rule(lex, i, lexer_rule_at(lex, i), capture, &ret, &len, ctx) || ret >= 0)
+          break;
+      }
+    } else {
+      for(k = table->index[c]; k < table->index[c + 1]; k++) {
+        if((i = table->rules[k]) < start_rule)
+          continue;
 
-    result = lexer_rule_match(lex, rule, capture, ctx);
-    if(result == LEXER_ERROR_COMPILE) {
-      ret = result;
-      break;
-    } else if(result < 0) {
-      JS_ThrowInternalError(ctx, "Error matching regex /%s/", rule->expr);
-      ret = LEXER_ERROR_EXEC;
-      break;
-    } else if(result > 0 && (capture[1] - capture[0]) > 0) {
-      /*printf("%s:%" PRIu32 ":%" PRIu32 " #%i %-20s - /%s/ [%zu] %.*s\n",
-             lex->loc.file,
-             lex->loc.line + 1,
-             lex->loc.column + 1,
-             i,
-             rule->name,
-             rule->expr,
-             capture[1] - capture[0],
-             capture[1] - capture[0],
-             capture[0]); */
-      if((lex->mode & LEXER_LONGEST) == 0 || ret < 0 || (size_t)(capture[1] - capture[0]) > len) {
-        ret = i;
-        len = capture[1] - capture[0];
-        if(lex->mode == LEXER_FIRST)
+        if(lex->mode == LEXER_FIRST && literal >= 0 && i > literal)
+          break;
+
+        if(lexer_peek_rule(lex, i, lexer_rule_at(lex, i), capture, &ret, &len, ctx))
           break;
       }
     }
+
+    if(literal >= 0 && (ret == LEXER_ERROR_NOMATCH || ((lex->mode & LEXER_LONGEST) && ret >= 0 && (literal_len > len || (literal_len == len && literal < ret))))) {
+      ret = literal;
+      len = literal_len;
+    }
+  } else {
+    vector_foreach_t(&lex->rules, rule) {
+      if(++i < start_rule)
+        continue;
+
+      if((rule->mask & (1 << lex->state)) == 0)
+        continue;
+
+      if(lexer_peek_rule(lex, i, rule, capture, &ret, &len, ctx))
+        break;
+    }
   }
+
+  /* a token reaching the end of the buffered input may continue in the next
+   * chunk, and a rule preferred over it may match once more input is there */
+  if(lex->stream == LEXER_STREAM_OPEN)
+    if(ret == LEXER_ERROR_NOMATCH || (ret >= 0 && (lex->input.pos + len == lex->input.size || lexer_peek_extends(lex, start_rule, ret, ctx))))
+      return LEXER_NEED_INPUT;
+
   if(ret >= 0) {
     lex->byte_length = len;
     lex->token_id = ret;
@@ -386,13 +1877,19 @@ input_skip(InputBuffer* input, size_t end, Location* loc) {
   return n;
 }
 
+/**
+ * Advances past the current token and returns its length in characters,
+ * or 0 when locations are tracked lazily.
+ */
 size_t
 lexer_skip(Lexer* lex) {
-  size_t len;
+  size_t len = 0;
   assert(lex->byte_length);
   assert(lex->token_id != -1);
 
-  len = location_count(&lex->loc, &lex->input.data[lex->input.pos], lex->byte_length);
+  if(!lex->lazy)
+    len = location_count(&lex->loc, &lex->input.data[lex->input.pos], lex->byte_length);
+
   lex->input.pos += lex->byte_length;
 
   // len = input_skip(&lex->input, lex->input.pos + lex->byte_length, &lex->loc);
@@ -403,6 +1900,40 @@ lexer_skip(Lexer* lex) {
   return len;
 }
 
+/**
+ * Skips the current token and, if its rule matches a single character class
+ * and is the only candidate for those bytes, the rest of the run.
+ */
+size_t
+lexer_skip_run(Lexer* lex) {
+  int32_t id = lex->token_id;
+  size_t len = lexer_skip(lex), n;
+  LexerDispatch* table;
+  LexerRun* run;
+
+  if(lex->dispatch_rules != vector_size(&lex->rules, sizeof(LexerRule)))
+    return len;
+
+  if(lex->state < 0 || (uint32_t)lex->state >= lex->dispatch_states)
+    return len;
+
+  table = &lex->dispatch[lex->state];
+
+  vector_foreach_t(&table->runs, run) {
+    if(run->rule != id)
+      continue;
+
+    if((n = byte_spn(&lex->input.data[lex->input.pos], lex->input.size - lex->input.pos, run->bytes, run->length))) {
+      lex->byte_length = n;
+      lex->token_id = id;
+      len += lexer_skip(lex);
+    }
+    break;
+  }
+
+  return len;
+}
+
 size_t
 lexer_charlen(Lexer* lex) {
   if(lex->byte_length == 0)
@@ -436,6 +1967,88 @@ lexer_set_input(Lexer* lex, InputBuffer input, int32_t file_atom) {
   lex->loc.file = file_atom;
 }
 
+static void
+lexer_buffer_nofree(JSContext* ctx, const char* data, JSValue value) {
+}
+
+/* the matcher sees all of the buffered input, lexer_peek() holds back the
+ * tokens which could still change while the stream is open */
+static void
+lexer_stream_window(Lexer* lex) {
+  lex->input.data = lex->buffer.buf;
+  lex->input.size = lex->buffer.size;
+}
+
+BOOL
+lexer_feed(Lexer* lex, const uint8_t* data, size_t len, JSContext* ctx) {
+  size_t start;
+
+  if(lex->stream == LEXER_STREAM_END)
+    return FALSE;
+
+  if(lex->stream == LEXER_STREAM_NONE) {
+    lexer_location(lex);
+    input_buffer_free(&lex->input, ctx);
+    lexer_source_drop(lex);
+    js_dbuf_init(ctx, &lex->buffer);
+    offset_init(&lex->input.range);
+    lex->input.free = &lexer_buffer_nofree;
+    lex->input.value = JS_UNDEFINED;
+    lex->stream = LEXER_STREAM_OPEN;
+    lex->loc_pos = 0;
+
+    if(lex->lazy)
+      lexer_lines_reset(lex);
+  }
+
+  /* release consumed input, only the pending token is kept */
+  if((start = lex->input.pos) > 0) {
+    lexer_location(lex);
+    memmove(lex->buffer.buf, lex->buffer.buf + start, lex->buffer.size - start);
+    lex->buffer.size -= start;
+    lex->input.pos -= start;
+
+    if(lex->lazy)
+      lexer_lines_reset(lex);
+  }
+
+  if(dbuf_put(&lex->buffer, data, len))
+    return FALSE;
+
+  lexer_stream_window(lex);
+  return TRUE;
+}
+
+void
+lexer_end(Lexer* lex) {
+  if(lex->stream == LEXER_STREAM_OPEN) {
+    lex->stream = LEXER_STREAM_END;
+    lexer_stream_window(lex);
+  }
+}
+
+/**
+ * Returns the input shared with tokens, handing the ownership of the input
+ * buffer over to it on first use.
+ */
+TokenSource*
+lexer_source(Lexer* lex, JSContext* ctx) {
+  if(!lex->source && lex->input.data && lex->stream == LEXER_STREAM_NONE)
+    if((lex->source = token_source_new(&lex->input, ctx)))
+      lex->input.free = &lexer_buffer_nofree;
+
+  return lex->source;
+}
+
+/* the input is going away, tokens keep it alive as long as they need it */
+void
+lexer_source_drop(Lexer* lex) {
+  if(lex->source) {
+    token_source_release(lex->source);
+    lex->source = 0;
+  }
+}
+
 void
 lexer_set_location(Lexer* lex, const Location* loc, JSContext* ctx) {
   // lex->start = loc->char_offset;
@@ -443,6 +2056,177 @@ lexer_set_location(Lexer* lex, const Location* loc, JSContext* ctx) {
   lex->input.pos = loc->char_offset;
   location_release(&lex->loc, ctx);
   location_copy(&lex->loc, loc, ctx);
+  lex->loc_pos = lex->input.pos;
+}
+
+/* number of UTF-8 characters, counting all bytes but continuation bytes */
+static size_t
+lexer_chars(const uint8_t* x, size_t n) {
+  size_t i, count = 0;
+
+  for(i = 0; i < n; i++) count += (x[i] & 0xc0) != 0x80;
+
+  return count;
+}
+
+void
+lexer_set_lazy(Lexer* lex, BOOL lazy) {
+  lexer_location(lex);
+  lex->lazy = lazy;
+
+  if(lazy)
+    lexer_lines_reset(lex);
+}
+
+/**
+ * Starts a new line index at the current input position, invalidating the
+ * positions of lazily located tokens.
+ */
+void
+lexer_lines_reset(Lexer* lex) {
+  LexerLines* lines = &lex->lines;
+
+  lines->start = lines->end = lex->loc_pos = lex->input.pos;
+  lines->line = lex->loc.line;
+  lines->column = lex->loc.column;
+  lines->char_offset = lex->loc.char_offset;
+  lines->byte_offset = lex->loc.byte_offset;
+  lines->generation++;
+  vector_clear(&lines->index);
+}
+
+static void
+lexer_lines_extend(Lexer* lex, size_t pos) {
+  LexerLines* lines = &lex->lines;
+  const uint8_t *x = lex->input.data, *nl;
+  size_t start = lines->end;
+  int64_t char_offset = lines->char_offset;
+  LexerLine* last;
+
+  if(pos <= lines->end)
+    return;
+
+  if((last = vector_empty(&lines->index) ? 0 : vector_back(&lines->index, sizeof(LexerLine))))
+    char_offset = last->char_offset, start = last->pos;
+  else
+    start = lines->start;
+
+  while((nl = memchr(&x[lines->end], '\n', pos - lines->end))) {
+    LexerLine line = {nl + 1 - x, 0};
+
+    line.char_offset = char_offset + lexer_chars(&x[start], line.pos - start);
+    char_offset = line.char_offset;
+    start = lines->end = line.pos;
+
+    vector_push(&lines->index, line);
+  }
+
+  lines->end = pos;
+}
+
+/* restarts the line index at an earlier position, counting the lines back
+ * from its current start */
+static void
+lexer_lines_rewind(Lexer* lex, size_t pos) {
+  LexerLines* lines = &lex->lines;
+  const uint8_t *x = lex->input.data, *nl, *line;
+  size_t n = lines->start - pos, chars = lexer_chars(&x[pos], n);
+  uint32_t count = 0;
+
+  for(nl = &x[pos]; (nl = memchr(nl, '\n', &x[lines->start] - nl)); nl++) count++;
+
+  if(count) {
+    /* the input is assumed to start a line */
+    for(line = &x[pos]; line > x && line[-1] != '\n'; line--) {}
+
+    lines->line -= count;
+    lines->column = lexer_chars(line, &x[pos] - line);
+  } else {
+    lines->column -= chars;
+  }
+
+  lines->char_offset -= chars;
+  lines->byte_offset -= n;
+  lines->start = lines->end = pos;
+  vector_clear(&lines->index);
+}
+
+/**
+ * Resolves a byte position of the input to line, column and offsets using
+ * the line index, which is rebuilt from further back when the position
+ * precedes it.  Returns FALSE if the position is past the input.
+ */
+BOOL
+lexer_location_at(Lexer* lex, size_t pos, Location* loc) {
+  LexerLines* lines = &lex->lines;
+  LexerLine* index;
+  size_t lo = 0, hi;
+
+  if(pos > lex->input.size)
+    return FALSE;
+
+  if(pos < lines->start)
+    lexer_lines_rewind(lex, pos);
+
+  lexer_lines_extend(lex, pos);
+
+  index = vector_begin(&lines->index);
+  hi = vector_size(&lines->index, sizeof(LexerLine));
+
+  /* find the number of line starts <= pos */
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+
+    if(index[mid].pos <= pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if(lo == 0) {
+    loc->line = lines->line;
+    loc->column = lines->column + lexer_chars(&lex->input.data[lines->start], pos - lines->start);
+    loc->char_offset = lines->char_offset + (loc->column - lines->column);
+  } else {
+    loc->line = lines->line + lo;
+    loc->column = lexer_chars(&lex->input.data[index[lo - 1].pos], pos - index[lo - 1].pos);
+    loc->char_offset = index[lo - 1].char_offset + loc->column;
+  }
+
+  loc->byte_offset = lines->byte_offset + (pos - lines->start);
+  return TRUE;
+}
+
+/**
+ * Returns the location of the current input position, bringing it up to
+ * date first when locations are tracked lazily.
+ */
+Location*
+lexer_location(Lexer* lex) {
+  size_t pos = lex->input.pos;
+
+  if(lex->lazy && lex->loc_pos != pos) {
+    if(pos > lex->loc_pos) {
+      const uint8_t *x = lex->input.data, *nl, *line = 0;
+      size_t n = pos - lex->loc_pos;
+
+      for(nl = &x[lex->loc_pos]; (nl = memchr(nl, '\n', &x[pos] - nl)); line = ++nl) lex->loc.line++;
+
+      if(line)
+        lex->loc.column = lexer_chars(line, &x[pos] - line);
+      else
+        lex->loc.column += lexer_chars(&x[lex->loc_pos], n);
+
+      lex->loc.char_offset += lexer_chars(&x[lex->loc_pos], n);
+      lex->loc.byte_offset += n;
+    } else {
+      lexer_location_at(lex, pos, &lex->loc);
+    }
+
+    lex->loc_pos = pos;
+  }
+
+  return &lex->loc;
 }
 
 void
@@ -455,6 +2239,12 @@ lexer_release(Lexer* lex, JSContext* ctx) {
       ctx = lex->rules.opaque;
 
     input_buffer_free(&lex->input, ctx);
+    lexer_source_drop(lex);
+
+    if(lex->stream)
+      dbuf_free(&lex->buffer);
+
+    vector_free(&lex->lines.index);
 
     vector_foreach_t(&lex->defines, rule) { lexer_rule_free(rule, ctx); }
     vector_foreach_t(&lex->rules, rule) { lexer_rule_free(rule, ctx); }
@@ -464,6 +2254,8 @@ lexer_release(Lexer* lex, JSContext* ctx) {
     vector_free(&lex->rules);
     vector_free(&lex->states);
     vector_free(&lex->state_stack);
+
+    lexer_dispatch_free(lex, JS_GetRuntime(ctx));
   }
 }
 
@@ -486,6 +2278,12 @@ lexer_release_rt(Lexer* lex, JSRuntime* rt) {
     vector_foreach_t(&lex->defines, rule) { lexer_rule_free_rt(rule, rt); }
     vector_free(&lex->defines);
     vector_free(&lex->state_stack);
+    lexer_dispatch_free(lex, rt);
+    vector_free(&lex->lines.index);
+    lexer_source_drop(lex);
+
+    if(lex->stream)
+      dbuf_free(&lex->buffer);
   }
 }
 void
@@ -870,8 +870,12 @@ jsm_context_new(JSRuntime* rt) {
 
 struct trace_malloc_data {
   uint8_t* base;
+  BOOL quiet;
+  uint64_t allocs;
 };
 
+static struct trace_malloc_data trace_data = {0};
+
 static void
 dump_vector(const Vector* vec, size_t start) {
   size_t i, len = vector_size(vec, sizeof(char*));
@@ -918,6 +922,9 @@ static void
   va_list ap;
   int c;
 
+  if(((struct trace_malloc_data*)s->opaque)->quiet)
+    return;
+
   va_start(ap, fmt);
   while((c = *fmt++) != '\0') {
     if(c == '%') {
@@ -961,6 +968,7 @@ jsm_trace_malloc(JSMallocState* s, size_t size) {
   ptr = malloc(size);
   jsm_trace_malloc_printf(s, "A %zd -> %p\n", size, ptr);
   if(ptr) {
+    ((struct trace_malloc_data*)s->opaque)->allocs++;
     s->malloc_count++;
     s->malloc_size += jsm_trace_malloc_usable_size(ptr) + MALLOC_OVERHEAD;
   }
@@ -1003,6 +1011,7 @@ jsm_trace_realloc(JSMallocState* s, void* ptr, size_t size) {
   ptr = realloc(ptr, size);
   jsm_trace_malloc_printf(s, " -> %p\n", ptr);
   if(ptr) {
+    ((struct trace_malloc_data*)s->opaque)->allocs++;
     s->malloc_size += jsm_trace_malloc_usable_size(ptr) - old_size;
   }
   return ptr;
@@ -1046,6 +1055,7 @@ jsm_help(void) {
          "qjscalc)\n"
 #endif
          "-T  --trace        trace memory allocation\n"
+         "-A  --allocs       count memory allocations (globalThis.mallocCount)\n"
          "-d  --dump         dump the memory usage stats\n"
          "    --memory-limit n       limit the memory usage to 'n' bytes\n"
          "    --stack-size n         limit the stack size to 'n' bytes\n"
@@ -1227,6 +1237,15 @@ jsm_module_func(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst ar
   return val;
 }
 
+/* number of allocations so far, when started with --trace or --allocs */
+static JSValue
+jsm_trace_get(JSContext* ctx, JSValueConst this_val, int magic) {
+  if(!trace_data.base)
+    return JS_UNDEFINED;
+
+  return JS_NewInt64(ctx, trace_data.allocs);
+}
+
 static const JSCFunctionListEntry jsm_global_funcs[] = {
     JS_CFUNC_MAGIC_DEF("evalFile", 1, jsm_eval_script, 0),
     JS_CFUNC_MAGIC_DEF("evalScript", 1, jsm_eval_script, 1),
@@ -1238,6 +1257,7 @@ static const JSCFunctionListEntry jsm_global_funcs[] = {
     JS_CGETSET_MAGIC_DEF("scriptDir", jsm_stack_get, 0, SCRIPT_DIRNAME),
     JS_CGETSET_MAGIC_DEF("__filename", jsm_stack_get, 0, SCRIPT_FILENAME),
     JS_CGETSET_MAGIC_DEF("__dirname", jsm_stack_get, 0, SCRIPT_DIRNAME),
+    JS_CGETSET_MAGIC_DEF("mallocCount", jsm_trace_get, 0, 0),
     JS_CFUNC_MAGIC_DEF("findModule", 1, jsm_module_func, FIND_MODULE),
     JS_CFUNC_MAGIC_DEF("loadModule", 1, jsm_module_func, LOAD_MODULE),
     JS_CFUNC_MAGIC_DEF("resolveModule", 1, jsm_module_func, RESOLVE_MODULE),
@@ -1285,7 +1305,6 @@ int
 main(int argc, char** argv) {
   JSRuntime* rt;
   JSContext* ctx;
-  struct trace_malloc_data trace_data = {0};
   int optind;
   char* expr = 0;
   int interactive = 0;
@@ -1401,6 +1420,11 @@ main(int argc, char** argv) {
         trace_memory++;
         break;
       }
+      if(opt == 'A' || !strcmp(longopt, "allocs")) {
+        trace_data.quiet = TRUE;
+        trace_memory++;
+        break;
+      }
       if(!strcmp(longopt, "std")) {
         load_std = 1;
         break;
@@ -2,6 +2,56 @@
 #include "debug.h"
 #include "token.h"
 
+/**
+ * Takes over the input, which is freed when the last token pointing into it
+ * has been released.  Only the runtime is kept, tokens can outlive the
+ * context.  Strings, ArrayBuffers and views on them (mmap() buffers
+ * included) are held by reference; only an input with a free function of
+ * its own, which may need a context, is copied.
+ */
+TokenSource*
+token_source_new(InputBuffer* input, JSContext* ctx) {
+  TokenSource* src;
+
+  if(!(src = js_malloc(ctx, sizeof(TokenSource))))
+    return 0;
+
+  if(input->free != &input_buffer_free_default) {
+    uint8_t* data;
+
+    if(!(data = js_malloc(ctx, input->size + 1))) {
+      js_free(ctx, src);
+      return 0;
+    }
+
+    memcpy(data, input->data, input->size);
+    data[input->size] = '\0';
+    input->free(ctx, (const char*)input->data, input->value);
+    input->data = data;
+    input->value = JS_UNDEFINED;
+    input->free = 0;
+  }
+
+  src->ref_count = 1;
+  src->input = *input;
+  src->rt = JS_GetRuntime(ctx);
+  return src;
+}
+
+void
+token_source_release(TokenSource* src) {
+  if(--src->ref_count == 0) {
+    JSRuntime* rt = src->rt;
+
+    if(src->input.free)
+      input_buffer_free_rt(&src->input, rt);
+    else
+      js_free_rt(rt, src->input.data);
+
+    js_free_rt(rt, src);
+  }
+}
+
 Token*
 token_new(JSContext* ctx) {
   Token* tok;
@@ -16,8 +66,17 @@ token_new(JSContext* ctx) {
 BOOL
 token_release_rt(Token* tok, JSRuntime* rt) {
   if(--tok->ref_count == 0) {
-    location_release_rt(tok->loc, rt);
-    js_free_rt(rt, tok->lexeme);
+    if(tok->loc)
+      location_release_rt(tok->loc, rt);
+
+    if(tok->atom != JS_ATOM_NULL)
+      JS_FreeAtomRT(rt, tok->atom);
+
+    if(tok->source)
+      token_source_release(tok->source);
+    else
+      js_free_rt(rt, tok->lexeme);
+
     tok->lexeme = 0;
     return TRUE;
   }
@@ -48,3 +107,25 @@ token_create(int id, Location* loc, const char* lexeme, size_t len, JSContext* c
 
   return tok;
 }
+
+/**
+ * Creates a token whose lexeme points into the input of 'src' instead of
+ * being copied.
+ */
+Token*
+token_slice(int id, Location* loc, TokenSource* src, const char* lexeme, size_t len, JSContext* ctx) {
+  Token* tok;
+
+  if((tok = token_new(ctx))) {
+    tok->id = id;
+    tok->loc = loc;
+    tok->source = token_source_dup(src);
+
+    tok->byte_length = len;
+
+    tok->lexeme = (uint8_t*)lexeme;
+    tok->char_length = utf8_strlen(lexeme, len);
+  }
+
+  return tok;
+}
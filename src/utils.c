@@ -139,6 +139,11 @@ regexp_from_dbuf(DynBuf* dbuf, int flags) {
 
 uint8_t*
 regexp_compile(RegExp re, JSContext* ctx) {
+  return regexp_compile_len(re, 0, ctx);
+}
+
+uint8_t*
+regexp_compile_len(RegExp re, size_t* lenp, JSContext* ctx) {
   char error_msg[64];
   int len = 0;
   uint8_t* bytecode;
@@ -146,6 +151,9 @@ regexp_compile(RegExp re, JSContext* ctx) {
   if(!(bytecode = lre_compile(&len, error_msg, sizeof(error_msg), re.source, re.len, re.flags, ctx)))
     JS_ThrowInternalError(ctx, "Error compiling regex /%.*s/: %s", (int)re.len, re.source, error_msg);
 
+  if(lenp)
+    *lenp = bytecode ? len : 0;
+
   return bytecode;
 }
 
@@ -0,0 +1,268 @@
+/**
+ * Native lexer throughput driver.
+ *
+ * Reads the rules of a grammar as written by `qjsm tests/bench_lexer.js
+ * --rules <grammar>` (one "name<TAB>expression" per line), lexes the given
+ * files and prints one JSON record per input with tokens/s, MB/s and the
+ * number of allocations per token.
+ */
+#include "lexer.h"
+#include "utils.h"
+#include <quickjs.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+typedef struct {
+  uint64_t allocs;
+} BenchMalloc;
+
+static void*
+bench_malloc(JSMallocState* s, size_t size) {
+  void* ptr;
+
+  if(s->malloc_size + size > s->malloc_limit)
+    return 0;
+
+  if((ptr = malloc(size))) {
+    ((BenchMalloc*)s->opaque)->allocs++;
+    s->malloc_count++;
+    s->malloc_size += malloc_usable_size(ptr);
+  }
+
+  return ptr;
+}
+
+static void
+bench_free(JSMallocState* s, void* ptr) {
+  if(!ptr)
+    return;
+
+  s->malloc_count--;
+  s->malloc_size -= malloc_usable_size(ptr);
+  free(ptr);
+}
+
+static void*
+bench_realloc(JSMallocState* s, void* ptr, size_t size) {
+  size_t old_size;
+
+  if(!ptr)
+    return size ? bench_malloc(s, size) : 0;
+
+  old_size = malloc_usable_size(ptr);
+
+  if(size == 0) {
+    bench_free(s, ptr);
+    return 0;
+  }
+
+  if((ptr = realloc(ptr, size))) {
+    ((BenchMalloc*)s->opaque)->allocs++;
+    s->malloc_size += malloc_usable_size(ptr) - old_size;
+  }
+
+  return ptr;
+}
+
+static const JSMallocFunctions bench_mf = {
+    bench_malloc,
+    bench_free,
+    bench_realloc,
+    (size_t(*)(const void*))malloc_usable_size,
+};
+
+static void
+bench_nofree(JSContext* ctx, const char* data, JSValue value) {
+}
+
+static char*
+bench_load(const char* file, size_t* lenp) {
+  FILE* fp;
+  char* buf = 0;
+  long len;
+
+  if(!(fp = fopen(file, "rb")))
+    return 0;
+
+  if(fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+    if((buf = malloc(len + 1)))
+      buf[*lenp = fread(buf, 1, len, fp)] = '\0';
+
+  fclose(fp);
+  return buf;
+}
+
+/* repeats the input until it is at least 'size' bytes long */
+static char*
+bench_synthesize(char* buf, size_t* lenp, size_t size) {
+  size_t len = *lenp, n;
+  char* out;
+
+  if(size <= len || len == 0 || !(out = malloc(size + len + 1)))
+    return buf;
+
+  for(n = 0; n < size; n += len) memcpy(&out[n], buf, len);
+
+  out[*lenp = n] = '\0';
+  free(buf);
+  return out;
+}
+
+static BOOL
+bench_rules(Lexer* lex, const char* file, JSContext* ctx) {
+  char *buf, *line, *next, *tab;
+  size_t len;
+
+  if(!(buf = bench_load(file, &len)))
+    return FALSE;
+
+  for(line = buf; *line; line = next) {
+    if((next = strchr(line, '\n')))
+      *next++ = '\0';
+    else
+      next = line + strlen(line);
+
+    if(!(tab = strchr(line, '\t')))
+      continue;
+
+    *tab++ = '\0';
+    lexer_rule_add(lex, js_strdup(ctx, line), js_strdup(ctx, tab));
+  }
+
+  free(buf);
+  return TRUE;
+}
+
+static void
+usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [options] <rules> <files...>\n"
+          "  -m MODE   lexer mode (0 = first, 1 = last, 2 = longest)\n"
+          "  -k NAME   rule whose tokens are skipped in runs (default whitespace)\n"
+          "  -s MB     repeat each input up to MB megabytes\n"
+          "  -r N      repeat each measurement N times and report the best\n"
+          "  -g NAME   grammar name for the report\n",
+          prog);
+  exit(2);
+}
+
+int
+main(int argc, char* argv[]) {
+  BenchMalloc data = {0};
+  JSRuntime* rt;
+  JSContext* ctx;
+  const char *grammar = "", *skip_name = "whitespace", *rules;
+  int i, mode = LEXER_FIRST, repeat = 3, ret = 0;
+  size_t size = 0;
+
+  for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if(i + 1 >= argc)
+      usage(argv[0]);
+
+    switch(argv[i][1]) {
+      case 'm': mode = atoi(argv[++i]); break;
+      case 'k': skip_name = argv[++i]; break;
+      case 's': size = strtoul(argv[++i], 0, 10) << 20; break;
+      case 'r': repeat = MAX_NUM(1, atoi(argv[++i])); break;
+      case 'g': grammar = argv[++i]; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if(argc - i < 2)
+    usage(argv[0]);
+
+  rt = JS_NewRuntime2(&bench_mf, &data);
+  ctx = JS_NewContextRaw(rt);
+  JS_AddIntrinsicBaseObjects(ctx);
+  JS_AddIntrinsicRegExpCompiler(ctx);
+
+  for(rules = argv[i++]; i < argc; i++) {
+    InputBuffer input = {{{0, 0}}, 0, &bench_nofree, JS_UNDEFINED};
+    Lexer lex;
+    char* buf;
+    size_t len, tokens = 0;
+    uint64_t best = UINT64_MAX, allocs = 0, t;
+    int r, id, skip = -1;
+
+    if(!(buf = bench_load(argv[i], &len))) {
+      fprintf(stderr, "%s: cannot read '%s'\n", argv[0], argv[i]);
+      ret = 1;
+      continue;
+    }
+
+    buf = bench_synthesize(buf, &len, size);
+    input.data = (uint8_t*)buf;
+    input.size = len;
+    offset_init(&input.range);
+
+    for(r = 0; r < repeat; r++) {
+      lexer_init(&lex, mode, ctx);
+
+      if(!bench_rules(&lex, rules, ctx)) {
+        fprintf(stderr, "%s: cannot read rules '%s'\n", argv[0], rules);
+        exit(1);
+      }
+
+      if(!lexer_compile_rules(&lex, ctx) || !lexer_dispatch_build(&lex, ctx)) {
+        fprintf(stderr, "%s: cannot compile rules '%s'\n", argv[0], rules);
+        exit(1);
+      }
+
+      for(id = 0; id < (int)vector_size(&lex.rules, sizeof(LexerRule)); id++)
+        if(!strcmp(lexer_rule_at(&lex, id)->name, skip_name))
+          skip = id;
+
+      lexer_set_input(&lex, input, -1);
+      lexer_set_lazy(&lex, TRUE);
+
+      tokens = 0;
+      allocs = data.allocs;
+      t = time_us();
+
+      while((id = lexer_peek(&lex, 0, 0, ctx)) >= 0) {
+        if(id == skip) {
+          lexer_skip_run(&lex);
+        } else {
+          lexer_skip(&lex);
+          tokens++;
+        }
+      }
+
+      t = time_us() - t;
+      allocs = data.allocs - allocs;
+
+      if(id != LEXER_EOF) {
+        Location* loc = lexer_location(&lex);
+        fprintf(stderr, "%s: %s:%" PRIu32 ":%" PRIu32 ": no match\n", argv[0], argv[i], loc->line + 1, loc->column + 1);
+        ret = 1;
+      }
+
+      lexer_release(&lex, ctx);
+
+      if(t < best)
+        best = MAX_NUM(t, 1);
+    }
+
+    printf("{\"driver\":\"native\",\"grammar\":\"%s\",\"input\":\"%s\",\"bytes\":%zu,\"tokens\":%zu,"
+           "\"seconds\":%.6f,\"tokensPerSecond\":%.0f,\"mbPerSecond\":%.3f,\"allocs\":%" PRIu64 ",\"allocsPerToken\":%.4f}\n",
+           grammar,
+           argv[i],
+           len,
+           tokens,
+           best / 1e6,
+           tokens * 1e6 / best,
+           len * 1e6 / best / 1048576.0,
+           allocs,
+           tokens ? (double)allocs / tokens : 0.0);
+
+    free(buf);
+  }
+
+  JS_FreeContext(ctx);
+  JS_FreeRuntime(rt);
+  return ret;
+}
@@ -0,0 +1,168 @@
+import * as std from 'std';
+import * as path from 'path';
+import { Lexer } from 'lexer';
+import { getPerformanceCounter } from 'misc';
+import ECMAScriptLexer from '../lib/lexer/ecmascript.js';
+import CLexer from '../lib/lexer/c.js';
+import BNFLexer from '../lib/lexer/bnf.js';
+import CSVLexer from '../lib/lexer/csv.js';
+import { getOpt } from 'util';
+
+/*
+ * Lexer throughput benchmark, one JSON record per line on stdout:
+ *
+ *   qjsm --allocs tests/bench_lexer.js [-g grammar] [-m mode] [-s MB] [files...]
+ *
+ * 'allocs' is only reported when qjsm runs with --allocs (or --trace).
+ */
+
+const RelativePath = file => path.join(path.dirname(process.argv[1]), '..', file);
+
+const Grammars = {
+  c: {
+    create: (input, file) => new CLexer(input, file),
+    corpora: ['src/lexer.c', 'quickjs-lexer.c', 'quickjs-xml.c']
+  },
+  ecmascript: {
+    create: (input, file) => new ECMAScriptLexer(input, file),
+    corpora: ['lib/util.js', 'lib/lexer/ecmascript.js', 'tests/test_lexer.js']
+  },
+  bnf: {
+    create: (input, file) => new BNFLexer(input, file),
+    corpora: ['tests/ANSI-C-grammar-2011.y', 'tests/Shell-Grammar.y', 'tests/Shell-Grammar.l']
+  },
+  csv: {
+    create: (input, file) => new CSVLexer(input, file),
+    corpora: [() => SyntheticCSV(4096)]
+  }
+};
+
+const Modes = {
+  /* rule ids only */
+  lex(lexer) {
+    let n = 0;
+    while(lexer.next() !== undefined) ++n;
+    return n;
+  },
+  /* Token objects, as consumed by lib/parser.js */
+  token(lexer) {
+    let n = 0;
+    while(lexer.nextToken() !== undefined) ++n;
+    return n;
+  },
+  /* packed token table */
+  tokenize(lexer) {
+    return lexer.tokenize(null).length / Lexer.TOKEN_FIELDS;
+  },
+  /* packed token table, lexed in parallel segments */
+  threads(lexer) {
+    return lexer.tokenize(null, { threads: 4 }).length / Lexer.TOKEN_FIELDS;
+  }
+};
+
+function SyntheticCSV(rows) {
+  let out = '';
+  for(let i = 0; i < rows; i++) out += `${i},"name ${i}",${(i * 0.5).toFixed(1)},"a ""quoted"" field",${i % 7}\n`;
+  return out;
+}
+
+function Synthesize(str, size) {
+  if(!size || str.length >= size) return str;
+  return str.repeat(Math.ceil(size / str.length));
+}
+
+function Measure(grammar, mode, input, file, repeat) {
+  let best = Infinity,
+    tokens = 0,
+    bytes = 0,
+    allocs;
+
+  for(let i = 0; i < repeat; i++) {
+    const lexer = Grammars[grammar].create(input, file);
+    const start = getPerformanceCounter();
+    const count = globalThis.mallocCount;
+
+    tokens = Modes[mode](lexer);
+
+    const elapsed = getPerformanceCounter() - start;
+
+    if(count !== undefined) allocs = globalThis.mallocCount - count;
+    if(elapsed < best) best = elapsed;
+
+    bytes = lexer.size;
+  }
+
+  const seconds = Math.max(best, 1e-3) / 1000;
+
+  return {
+    driver: 'js',
+    grammar,
+    mode,
+    input: file,
+    bytes,
+    tokens,
+    seconds,
+    tokensPerSecond: Math.round(tokens / seconds),
+    mbPerSecond: +(bytes / seconds / 1048576).toFixed(3),
+    allocs: allocs ?? null,
+    allocsPerToken: allocs !== undefined && tokens ? +(allocs / tokens).toFixed(4) : null
+  };
+}
+
+/* writes the rules in the format read by tests/bench_lexer.c */
+function DumpRules(grammar) {
+  const lexer = Grammars[grammar].create('', grammar);
+
+  for(let name of lexer.ruleNames) {
+    const [, expr, states] = lexer.getRule(name);
+    const prefix = states.length && states.join(',') != 'INITIAL' ? `<${states.join(',')}>` : '';
+    std.puts(`${name}\t${prefix}${expr}\n`);
+  }
+}
+
+function main(...args) {
+  const params = getOpt(
+    {
+      grammar: [true, null, 'g'],
+      mode: [true, null, 'm'],
+      size: [true, null, 's'],
+      repeat: [true, null, 'r'],
+      rules: [true, null, 'R'],
+      '@': 'files'
+    },
+    args
+  );
+
+  if(params.rules) return DumpRules(params.rules);
+
+  const grammars = params.grammar ? [params.grammar] : Object.keys(Grammars);
+  const modes = params.mode ? [params.mode] : Object.keys(Modes);
+  const size = (+params.size || 0) * 1048576;
+  const repeat = +params.repeat || 3;
+
+  for(let grammar of grammars) {
+    if(!(grammar in Grammars)) throw new Error(`No such grammar '${grammar}'`);
+
+    const corpora = params['@'].length ? params['@'] : Grammars[grammar].corpora.map(c => (typeof c == 'string' ? RelativePath(c) : c));
+
+    for(let corpus of corpora) {
+      const file = typeof corpus == 'function' ? `synthetic.${grammar}` : corpus;
+      const data = typeof corpus == 'function' ? corpus() : std.loadFile(corpus, 'utf-8');
+
+      if(data == null) throw new Error(`Cannot read '${corpus}'`);
+
+      const input = Synthesize(data, size);
+
+      for(let mode of modes) std.puts(JSON.stringify(Measure(grammar, mode, input, file, repeat)) + '\n');
+
+      std.gc();
+    }
+  }
+}
+
+try {
+  main(...scriptArgs.slice(1));
+} catch(error) {
+  std.err.puts(`FAIL: ${error.message}\n${error.stack}\n`);
+  std.exit(1);
+}
@@ -0,0 +1,182 @@
+import * as std from 'std';
+import { read, parse, write, parseRecords } from 'xml';
+import { getPerformanceCounter } from 'misc';
+import { getOpt } from 'util';
+
+/*
+ * XML parse/serialize throughput benchmark, one JSON record per line on stdout:
+ *
+ *   qjsm --allocs tests/bench_xml.js [-d document] [-m mode] [-s MB] [-r N] [-t threads]
+ *
+ * 'allocs' is only reported when qjsm runs with --allocs (or --trace), 'peakRSS'
+ * (in KiB) only where /proc/self/status is available.
+ */
+
+const Documents = {
+  /* many flat sibling records */
+  wide: {
+    record: 'item',
+    generate: i => `<item id="${i}" type="t${i % 5}">value ${i}</item>\n`
+  },
+  /* a chain of nested elements per record */
+  deep: {
+    record: 'd0',
+    generate(i) {
+      let out = '';
+      for(let d = 0; d < 32; d++) out += `<d${d} n="${d}">`;
+      out += `leaf ${i}`;
+      for(let d = 31; d >= 0; d--) out += `</d${d}>`;
+      return out + '\n';
+    }
+  },
+  /* self-closing elements with many attributes */
+  attributes: {
+    record: 'node',
+    generate(i) {
+      let out = '<node';
+      for(let a = 0; a < 16; a++) out += ` k${a}="${(i * 31 + a) % 1000}"`;
+      return out + ' visible/>\n';
+    }
+  },
+  /* long text content with entities */
+  text: {
+    record: 'p',
+    generate: i =>
+      `<p>Paragraph ${i}: Lorem ipsum dolor sit amet, consectetur adipiscing elit &amp; sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation &lt;ullamco&gt; laboris nisi ut aliquip ex ea commodo consequat.</p>\n`
+  }
+};
+
+const Modes = {
+  /* tree of plain objects */
+  read: input => read(input, 'bench.xml'),
+  /* flat list of elements and text */
+  flat: input => read(input, 'bench.xml', { flat: true }),
+  /* compact document, elements created on access */
+  lazy: input => read(input, 'bench.xml', { lazy: true }),
+  /* events only */
+  parse: input => parse(input, { onStart() {}, onText() {}, onEnd() {} }),
+  /* records parsed on several threads */
+  records: (input, doc, threads) => parseRecords(input, doc.record, { threads }),
+  /* serialization of a tree parsed beforehand */
+  write: (input, doc, threads, tree) => write(tree)
+};
+
+function Generate(generate, size) {
+  const parts = ['<?xml version="1.0"?>\n<root>\n'];
+  for(let i = 0, n = 0; n < size; i++) n += parts[parts.push(generate(i)) - 1].length;
+  parts.push('</root>\n');
+  return parts.join('');
+}
+
+/* elements and text nodes as seen by the tree modes */
+function CountNodes(input) {
+  let nodes = 0;
+  parse(input, {
+    onStart: () => nodes++,
+    onText: () => nodes++
+  });
+  return nodes;
+}
+
+/* resets the peak resident set size, where the kernel supports it */
+function ResetPeakRSS() {
+  const f = std.open('/proc/self/clear_refs', 'w');
+  if(f) {
+    f.puts('5');
+    f.close();
+  }
+}
+
+function PeakRSS() {
+  const status = std.loadFile('/proc/self/status');
+  const match = status && /VmHWM:\s*(\d+)/.exec(status);
+  return match ? +match[1] : null;
+}
+
+function Measure(document, mode, input, repeat, threads) {
+  const doc = Documents[document];
+  const tree = mode == 'write' ? read(input, 'bench.xml') : undefined;
+  const nodes = CountNodes(input);
+  let best = Infinity,
+    bytes = input.length,
+    allocs,
+    peakRSS;
+
+  std.gc();
+  ResetPeakRSS();
+
+  for(let i = 0; i < repeat; i++) {
+    const count = globalThis.mallocCount;
+    const start = getPerformanceCounter();
+
+    let result = Modes[mode](input, doc, threads, tree);
+
+    const elapsed = getPerformanceCounter() - start;
+
+    if(count !== undefined) allocs = globalThis.mallocCount - count;
+    if(elapsed < best) best = elapsed;
+    if(mode == 'write') bytes = result.length;
+
+    result = null;
+    std.gc();
+  }
+
+  peakRSS = PeakRSS();
+
+  const seconds = Math.max(best, 1e-3) / 1000;
+
+  return {
+    driver: 'js',
+    bench: 'xml',
+    document,
+    mode,
+    bytes,
+    nodes,
+    seconds,
+    nodesPerSecond: Math.round(nodes / seconds),
+    mbPerSecond: +(bytes / seconds / 1048576).toFixed(3),
+    allocs: allocs ?? null,
+    allocsPerNode: allocs !== undefined && nodes ? +(allocs / nodes).toFixed(4) : null,
+    peakRSS
+  };
+}
+
+function main(...args) {
+  const params = getOpt(
+    {
+      document: [true, null, 'd'],
+      mode: [true, null, 'm'],
+      size: [true, null, 's'],
+      repeat: [true, null, 'r'],
+      threads: [true, null, 't']
+    },
+    args
+  );
+
+  const documents = params.document ? [params.document] : Object.keys(Documents);
+  const modes = params.mode ? [params.mode] : Object.keys(Modes);
+  const size = (+params.size || 1) * 1048576;
+  const repeat = +params.repeat || 3;
+  const threads = +params.threads || 4;
+
+  for(let document of documents) {
+    if(!(document in Documents)) throw new Error(`No such document '${document}'`);
+
+    const input = Generate(Documents[document].generate, size);
+
+    for(let mode of modes) {
+      if(!(mode in Modes)) throw new Error(`No such mode '${mode}'`);
+
+      std.puts(JSON.stringify(Measure(document, mode, input, repeat, threads)) + '\n');
+    }
+
+    std.gc();
+  }
+}
+
+try {
+  main(...scriptArgs.slice(1));
+} catch(error) {
+  std.err.puts(`FAIL: ${error.message}\n${error.stack}\n`);
+  std.exit(1);
+}
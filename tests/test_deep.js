@@ -120,6 +120,146 @@ function main(...args) {
     'select()3:',
     deep.select(obj3, () => true, deep.RETURN_VALUE_PATH)
   );
+
+  const cyclic = () => {
+    const o = { list: [1, 'two', 3.5], bytes: new Uint16Array([1, 2, 3]), map: new Map([['k', { v: 1 }]]), set: new Set([1, { s: 2 }]) };
+    o.self = o;
+    return o;
+  };
+
+  if(!deep.equals(cyclic(), cyclic())) throw new Error(`deep.equals() of cyclic structures failed`);
+  if(deep.equals(obj1, { ...obj1, f: 5 })) throw new Error(`deep.equals() ignored an extra key`);
+  if(deep.equals([1, 2], { 0: 1, 1: 2 })) throw new Error(`deep.equals() ignored the class`);
+  if(deep.equals(Object.assign([1], { x: 1 }), [1]) || deep.equals([1], Object.assign([1], { x: 1 }))) throw new Error(`deep.equals() ignored a named array property`);
+  if(!deep.equals(Object.assign([1], { x: { y: 2 } }), Object.assign([1], { x: { y: 2 } })) || deep.equals(Object.assign([1], { x: 1 }), Object.assign([1], { x: 2 }))) throw new Error(`deep.equals() compared named array properties wrong`);
+  if(deep.equals(new Uint8Array([1, 2]), new Uint8Array([1, 3]))) throw new Error(`deep.equals() ignored typed array contents`);
+  if(deep.equals(new Map([['k', 1]]), new Map([['k', 2]]))) throw new Error(`deep.equals() ignored Map values`);
+
+  const shared = { x: 1 };
+  if(deep.equals(new Set([{ x: 1 }, { x: 1 }]), new Set([{ x: 1 }, { y: 2 }]))) throw new Error(`deep.equals() matched a Set member twice`);
+  if(deep.equals(new Set([shared, { y: 2 }]), new Set([shared, { x: 1 }]))) throw new Error(`deep.equals() matched a member taken by identity`);
+  if(deep.equals(new Map([[{ k: 1 }, 1], [{ k: 1 }, 1]]), new Map([[{ k: 1 }, 1], [{ k: 2 }, 1]]))) throw new Error(`deep.equals() matched a Map key twice`);
+  if(!deep.equals(new Set([{ x: 1 }, { x: 1 }, shared]), new Set([shared, { x: 1 }, { x: 1 }]))) throw new Error(`deep.equals() of Sets with duplicate members failed`);
+  if(!deep.equals(new Map([[{ k: 1 }, 1], [{ k: 1 }, 2]]), new Map([[{ k: 1 }, 2], [{ k: 1 }, 1]]))) throw new Error(`deep.equals() of Maps with duplicate keys failed`);
+
+  if(deep.hash(cyclic()) != deep.hash(cyclic())) throw new Error(`deep.hash() of equal structures differs`);
+  if(deep.hash({ a: 1, b: 2 }) == deep.hash({ b: 2, a: 1 })) throw new Error(`deep.hash() ignored the key order`);
+  if(deep.hash({ a: 1, b: 2 }, { unordered: true }) != deep.hash({ b: 2, a: 1 }, { unordered: true })) throw new Error(`deep.hash({ unordered }) depends on the key order`);
+  if(deep.hash({ a: 1, t: 1 }, { ignoreKeys: ['t'] }) != deep.hash({ a: 1, t: 2 }, { ignoreKeys: ['t'] })) throw new Error(`deep.hash({ ignoreKeys }) hashed an ignored key`);
+  if(deep.hash(obj1, { algorithm: 'fnv1a128' }).length != 32) throw new Error(`deep.hash({ algorithm: 'fnv1a128' }) isn't 128 bits`);
+
+  const cache = new WeakMap();
+  if(deep.hash(obj3, { cache }) != deep.hash(obj3) || !cache.has(obj3.x) || deep.hash(obj3, { cache }) != deep.hash(obj3)) throw new Error(`deep.hash({ cache }) differs`);
+
+  /* cached subtrees are used as they are, until the caller drops their entries */
+  const tree = { a: { b: [1, 2] }, t: 1 },
+    treeHash = deep.hash(tree),
+    treeCache = new WeakMap();
+  if(deep.hash(tree, { cache: treeCache }) != treeHash || !treeCache.has(tree.a)) throw new Error(`deep.hash({ cache }) didn't fill the cache`);
+  tree.a.b.push(3);
+  if(deep.hash(tree, { cache: treeCache }) != treeHash) throw new Error(`deep.hash({ cache }) didn't use the cached hash`);
+  treeCache.delete(tree);
+  treeCache.delete(tree.a);
+  if(deep.hash(tree, { cache: treeCache }) != deep.hash(tree) || deep.hash(tree) == treeHash) throw new Error(`deep.hash({ cache }) kept a dropped entry`);
+
+  for(let options of [{ ignoreKeys: ['t'] }, { unordered: true }, { algorithm: 'fnv1a128' }])
+    if(deep.hash(tree, { ...options, cache: treeCache }) != deep.hash(tree, options)) throw new Error(`deep.hash(${JSON.stringify(options)}) used a hash cached under other options`);
+  if(deep.hash(tree, { cache: treeCache }) != deep.hash(tree)) throw new Error(`deep.hash({ cache }) used a hash cached under other options`);
+
+  if(deep.hash(new Uint8Array([1, 2])) != deep.hash(new Uint8Array([1, 2])) || deep.hash(new Uint8Array([1, 2])) == deep.hash(new Uint8Array([1, 3]))) throw new Error(`deep.hash() ignored typed array contents`);
+  if(deep.hash(new Uint8Array([1, 2])) == deep.hash(new Int8Array([1, 2]))) throw new Error(`deep.hash() ignored the typed array class`);
+  if(deep.hash(new Map([['a', 1], ['b', { c: 2 }]])) != deep.hash(new Map([['b', { c: 2 }], ['a', 1]]))) throw new Error(`deep.hash() of a Map depends on the insertion order`);
+  if(deep.hash(new Set([1, 'x', { y: 2 }])) != deep.hash(new Set([{ y: 2 }, 'x', 1])) || deep.hash(new Set([1, 2])) == deep.hash(new Set([1, 3]))) throw new Error(`deep.hash() of Sets failed`);
+
+  const original = cyclic();
+  original.shared = [original.list, original.list];
+  original.view = new Uint8Array(original.bytes.buffer, 2, 2);
+
+  const copy = deep.clone(original);
+  if(!deep.equals(copy, original) || copy === original || copy.list === original.list) throw new Error(`deep.clone() didn't copy`);
+  if(copy.self !== copy || copy.shared[0] !== copy.shared[1] || copy.view.buffer !== copy.bytes.buffer) throw new Error(`deep.clone() didn't keep shared references`);
+
+  class Point {
+    constructor(x, y) {
+      Object.assign(this, { x, y });
+    }
+  }
+  if(!(deep.clone(new Point(1, 2), { prototypes: true }) instanceof Point)) throw new Error(`deep.clone({ prototypes }) lost the prototype`);
+
+  class Dict extends Map {}
+  const dict = deep.clone(new Dict([['a', 1]]), { prototypes: true });
+  if(!(dict instanceof Dict) || dict.get('a') !== 1) throw new Error(`deep.clone({ prototypes }) lost the prototype of a Map`);
+
+  const source = { bytes: new Uint8Array([1, 2, 3]) };
+  const moved = deep.clone(source, { transfer: true });
+  if(moved.bytes.length != 3 || moved.bytes[2] != 3) throw new Error(`deep.clone({ transfer }) lost the data`);
+  if(source.bytes.buffer.byteLength != 0) throw new Error(`deep.clone({ transfer }) did not detach the source`);
+
+  const buffer = new ArrayBuffer(8);
+  const views = deep.clone({ a: new Uint8Array(buffer, 0, 4), b: new DataView(buffer, 2) });
+  if(views.a.buffer !== views.b.buffer || views.a.buffer === buffer) throw new Error(`deep.clone() did not share the cloned buffer`);
+  views.b.setUint8(0, 7);
+  if(views.a[2] !== 7 || new Uint8Array(buffer)[2] !== 0) throw new Error(`deep.clone() views do not write to one buffer`);
+
+  const before = { name: 'a', list: [1, 2, 3, 4, 5], rows: [{ id: 1 }, { id: 2 }, { id: 3 }], gone: true };
+  const after = { name: 'b', list: [1, 2, 9, 3, 4, 5], rows: [{ id: 3 }, { id: 1 }, { id: 2, x: 1 }], added: [null] };
+  const changes = deep.diff(before, after);
+  const patched = deep.patch(deep.clone(before), changes);
+  if(!deep.equals(patched, after)) throw new Error(`deep.patch(deep.diff()) differs: ${JSON.stringify(patched)}`);
+  if(patched.added === after.added) throw new Error(`deep.patch() shares objects with the changes`);
+  if(changes.filter(c => /^\/?list/.test(c.path + '')).length != 1) throw new Error(`deep.diff() didn't find the single insertion`);
+  if(!changes.some(c => c.op == 'move')) throw new Error(`deep.diff() didn't find the move`);
+  if(deep.diff(before, deep.clone(before)).length != 0) throw new Error(`deep.diff() of equal values isn't empty`);
+  if(deep.patch(1, deep.diff(1, [2])).length != 1) throw new Error(`deep.patch() didn't replace the root`);
+  if(!changes.every(c => c.path.constructor.name == 'Pointer')) throw new Error(`deep.diff() paths aren't Pointer objects`);
+  if(deep.diff(cyclic(), cyclic()).length != 0) throw new Error(`deep.diff() of cyclic structures isn't empty`);
+
+  const from = { v: 1 }, to = { v: 2 };
+  const aliased = deep.diff({ p: from, q: from }, { p: to, q: to });
+  if(aliased.length != 2 || !deep.equals(deep.patch({ p: { v: 1 }, q: { v: 1 } }, aliased), { p: to, q: to })) throw new Error(`deep.diff() dropped the changes of a shared subtree: ${aliased.map(c => c.path)}`);
+
+  const throwsType = fn => {
+    try {
+      fn();
+    } catch(e) {
+      return e instanceof TypeError;
+    }
+    return false;
+  };
+  if(!throwsType(() => deep.patch({ a: 1 }, [{ op: 'replace', value: 2 }]))) throw new Error(`deep.patch() accepted a missing path`);
+  if(!throwsType(() => deep.patch({ a: 1 }, [{ op: 'replace', path: 5, value: 2 }]))) throw new Error(`deep.patch() accepted an invalid path`);
+  if(deep.patch({ a: 1 }, [{ op: 'replace', path: '', value: 2 }]) !== 2) throw new Error(`deep.patch() didn't replace the root for an empty path`);
+
+  const store = {
+    book: [
+      { title: 'A', price: 8, tags: ['x'] },
+      { title: 'B', price: 12 },
+      { title: 'C', price: 5, isbn: '1' }
+    ],
+    bicycle: { price: 20 }
+  };
+  const titles = q => deep.select(store, q, deep.RETURN_VALUE).join(',');
+  if(titles('$.book[*].title') != 'A,B,C') throw new Error(`deep.select('[*]') failed`);
+  if(titles('$.book[?(@.price < 10)].title') != 'A,C') throw new Error(`deep.select('[?()]') failed`);
+  if(titles('$.book[?(@.isbn)].title') != 'C') throw new Error(`deep.select() existence filter failed`);
+  if(titles("$.book[?(@.title == 'B')].price") != '12') throw new Error(`deep.select() equality filter failed`);
+  if(titles('$.book[-1:0:-1].title') != 'C,B' || titles('book[0,-1].title') != 'A,C') throw new Error(`deep.select() index ranges failed`);
+  if(titles('$..price') != '8,12,5,20') throw new Error(`deep.select('..') failed`);
+  if(titles("$['bicycle','nothing'].price") != '20') throw new Error(`deep.select() key sets failed`);
+  if(deep.find(store, '$..tags[0]', deep.RETURN_PATH | deep.PATH_AS_STRING) != 'book.0.tags.0') throw new Error(`deep.find() with a path pattern failed`);
+  if(deep.find(store, '$.book[7]') !== undefined) throw new Error(`deep.find() found a missing index`);
+  if(deep.select(cyclic(), '$..missing').length != 0) throw new Error(`deep.select('..') on a cycle failed`);
+
+  const throwsSyntax = fn => {
+    try {
+      fn();
+    } catch(e) {
+      return e instanceof SyntaxError;
+    }
+    return false;
+  };
+  for(let pattern of ['$.a[', '$[?(@.x <)]', '$[99999999999999999999]', '$[1:2:99999999999999999999]'])
+    if(!throwsSyntax(() => deep.select(store, pattern))) throw new Error(`deep.select() accepted '${pattern}'`);
   return;
 
   for(let o of [obj1, obj2]) {
@@ -78,6 +78,357 @@ function WriteFile(file, tok) {
   console.log('Wrote "' + file + '": ' + tok.length + ' bytes');
 }
 
+/* the [id, offset, length] records of a token table, as strings */
+function TokenRecords(table) {
+  const records = [];
+  for(let i = 0; i < table.length; i += Lexer.TOKEN_FIELDS) records.push(`${table[i + Lexer.TOKEN_ID]}:${table[i + Lexer.TOKEN_OFFSET]}:${table[i + Lexer.TOKEN_LENGTH]}`);
+  return records;
+}
+
+function NativeRecords(lexer) {
+  const records = [];
+  try {
+    for(let table; (table = lexer.tokenize(null, { batch: 1024 })); ) records.push(...TokenRecords(table));
+  } catch(error) {
+    records.push(`nomatch:${lexer.pos}`);
+  }
+  return records;
+}
+
+/* the rules of a grammar in a plain Lexer, without rule actions or other states */
+function PlainLexer(grammar, input, mode) {
+  const lexer = new Lexer(input, mode);
+  for(let name of grammar.ruleNames) {
+    const [, expr, states] = grammar.getRule(name);
+    if(states.length == 0 || states.indexOf('INITIAL') != -1) lexer.addRule(name, expr);
+  }
+  return lexer;
+}
+
+/* tries every rule at every position, as lexer_peek() did before the dispatch tables */
+function ReferenceRecords(lexer, input) {
+  const rules = lexer.ruleNames.map(name => new RegExp(lexer.getRule(name)[1], 'gmy'));
+  const records = [];
+  for(let pos = 0; pos < input.length; ) {
+    let id = -1,
+      len = 0;
+    for(let i = 0; i < rules.length; i++) {
+      rules[i].lastIndex = pos;
+      const match = rules[i].exec(input);
+      if(!match || match[0].length == 0) continue;
+      if(lexer.mode != Lexer.LONGEST || id < 0 || match[0].length > len) {
+        id = i;
+        len = match[0].length;
+        if(lexer.mode == Lexer.FIRST) break;
+      }
+    }
+    if(id < 0) {
+      records.push(`nomatch:${pos}`);
+      break;
+    }
+    records.push(`${id}:${pos}:${len}`);
+    pos += len;
+  }
+  return records;
+}
+
+function CompareRecords(what, actual, expected) {
+  const i = actual.findIndex((record, i) => record !== expected[i]);
+  if(i != -1 || actual.length != expected.length)
+    throw new Error(`${what}: token #${i == -1 ? Math.min(actual.length, expected.length) : i} is ${actual[i]}, expected ${expected[i]}`);
+}
+
+/* the first-byte dispatch tables must select the same tokens as trying all rules in order */
+function TestDispatch(RelativePath) {
+  const input = std.loadFile(RelativePath('src/lexer.c')).replace(/[^\x00-\x7f]/g, ' ').slice(0, 16384);
+  const grammar = new CLexer('', 'c');
+
+  for(let mode of [Lexer.FIRST, Lexer.LAST, Lexer.LONGEST]) {
+    const lexer = PlainLexer(grammar, input, mode);
+    CompareRecords(`dispatch (mode ${mode})`, NativeRecords(lexer), ReferenceRecords(lexer, input));
+  }
+}
+
+/* literal rules which are prefixes of each other, shadow regex rules or repeat another literal */
+function TestLiteralTrie() {
+  const rules = [
+    ['if', 'if'],
+    ['iff', 'iff'],
+    ['shift', '>>'],
+    ['identifier', '[a-z]+'],
+    ['greater', '>'],
+    ['shift_assign', '>>='],
+    ['assign', '='],
+    ['then', 'then'],
+    ['then_again', 'then'],
+    ['else', 'else'],
+    ['space', '[ \\n]+']
+  ];
+  const input = 'if iff iffy then else elsewhere >>= >> > = >>>= ==\nthenelse ifelse >>>>';
+
+  for(let mode of [Lexer.FIRST, Lexer.LAST, Lexer.LONGEST]) {
+    const lexer = new Lexer(input, mode);
+    for(let [name, expr] of rules) lexer.addRule(name, expr);
+    CompareRecords(`literal trie (mode ${mode})`, NativeRecords(lexer), ReferenceRecords(lexer, input));
+  }
+}
+
+function TokenizeLexer(input) {
+  const lexer = new Lexer(input, Lexer.LONGEST);
+  for(let [name, expr] of [
+    ['keyword', 'int|return'],
+    ['identifier', '[a-z]+'],
+    ['number', '[0-9]+'],
+    ['punct', '[=;]'],
+    ['space', '[ \\n]+']
+  ])
+    lexer.addRule(name, expr);
+  return lexer;
+}
+
+/* [rule, text, line, column] of each record */
+function TokenizeRecords(lexer, table) {
+  const records = [];
+  for(let i = 0; i < table.length; i += Lexer.TOKEN_FIELDS) {
+    const offset = table[i + Lexer.TOKEN_OFFSET];
+    records.push([lexer.ruleNames[table[i + Lexer.TOKEN_ID]], lexer.getRange(offset, offset + table[i + Lexer.TOKEN_LENGTH]), table[i + Lexer.TOKEN_LINE], table[i + Lexer.TOKEN_COLUMN]].join(' '));
+  }
+  return records;
+}
+
+function TestTokenize() {
+  const input = 'int x = 42;\nreturn x;';
+  const expected = [
+    'keyword int 0 0',
+    'space   0 3',
+    'identifier x 0 4',
+    'space   0 5',
+    'punct = 0 6',
+    'space   0 7',
+    'number 42 0 8',
+    'punct ; 0 10',
+    'space \n 0 11',
+    'keyword return 1 0',
+    'space   1 6',
+    'identifier x 1 7',
+    'punct ; 1 8'
+  ];
+  let lexer = TokenizeLexer(input);
+  const table = lexer.tokenize();
+
+  if(!(table instanceof Uint32Array) || table.length != expected.length * Lexer.TOKEN_FIELDS) throw new Error(`tokenize() returned ${table.length / Lexer.TOKEN_FIELDS} records`);
+  CompareRecords('tokenize()', TokenizeRecords(lexer, table), expected);
+
+  /* in batches, until null at the end of input */
+  lexer = TokenizeLexer(input);
+  let records = [],
+    batches = 0;
+  for(let batch; (batch = lexer.tokenize(null, { batch: 4 })); batches++) records.push(...TokenizeRecords(lexer, batch));
+  if(batches != Math.ceil(expected.length / 4)) throw new Error(`tokenize({ batch: 4 }) returned ${batches} batches`);
+  CompareRecords('tokenize({ batch })', records, expected);
+
+  if(lexer.tokenize(null, { batch: 4 }) !== null) throw new Error(`tokenize({ batch }) didn't return null at the end`);
+}
+
+/* id, length, line and column of each record: the offsets of a stream are relative to its buffer */
+function StreamRecords(lexer, chunks = []) {
+  const records = [];
+  const drain = () => {
+    for(let table; (table = lexer.tokenize(null, { batch: 1024 })); )
+      for(let i = 0; i < table.length; i += Lexer.TOKEN_FIELDS)
+        records.push(`${table[i + Lexer.TOKEN_ID]}:${table[i + Lexer.TOKEN_LENGTH]}:${table[i + Lexer.TOKEN_LINE]}:${table[i + Lexer.TOKEN_COLUMN]}`);
+  };
+  try {
+    for(let chunk of chunks) {
+      lexer.feed(chunk);
+      drain();
+    }
+    if(chunks.length) lexer.end();
+    drain();
+  } catch(error) {
+    records.push('nomatch');
+  }
+  return records;
+}
+
+/* feeding the input in chunks, split inside every token, must yield the tokens of the whole buffer */
+function TestFeed() {
+  const input = [
+    '/* a block',
+    ' * comment **/ #define X(a) ((a) >> 2)',
+    'int main(int argc, char** argv) { // line comment',
+    '  static const char* s = "a \\"quoted\\" string", c = \'q\';',
+    '  unsigned long x = 0x1fUL, y = 017, z = 42; double f = 3.14e-2f, g = .5, h = 1.;',
+    '  x >>= 1; y <<= 2; argv->z++; /**/ z--; x != y && y <= z || !x ... ;',
+    '  return s[0] == \'\\\\\' ? -1 : x % y;',
+    '}',
+    ''
+  ].join('\n');
+  const grammar = new CLexer('', 'c');
+
+  for(let mode of [Lexer.FIRST, Lexer.LAST, Lexer.LONGEST]) {
+    const expected = StreamRecords(PlainLexer(grammar, input, mode));
+
+    for(let i = 1; i < input.length; i++) CompareRecords(`feed() split at ${i} (mode ${mode})`, StreamRecords(PlainLexer(grammar, '', mode), [input.slice(0, i), input.slice(i)]), expected);
+
+    CompareRecords(`feed() byte by byte (mode ${mode})`, StreamRecords(PlainLexer(grammar, '', mode), [...input]), expected);
+  }
+}
+
+/* compiled rules restored by deserialize() lex like freshly compiled ones, damaged or stale caches are rejected */
+function TestCache() {
+  const input = 'int x = 42;\nreturn x;';
+  const expected = TokenRecords(TokenizeLexer(input).tokenize());
+  const cache = TokenizeLexer(input).serialize();
+  let lexer = TokenizeLexer(input);
+
+  if(lexer.deserialize(cache) !== true) throw new Error(`deserialize() rejected its own cache`);
+  CompareRecords('deserialize()', TokenRecords(lexer.tokenize()), expected);
+
+  lexer = TokenizeLexer(input);
+
+  for(let n = 0; n < cache.byteLength; n++) if(lexer.deserialize(cache.slice(0, n)) !== false) throw new Error(`deserialize() accepted a cache truncated to ${n} bytes`);
+
+  for(let i = 0; i < cache.byteLength; i++) {
+    const bytes = new Uint8Array(cache.slice(0));
+    bytes[i] ^= 0x20;
+    if(lexer.deserialize(bytes.buffer) !== false) throw new Error(`deserialize() accepted a cache corrupted at byte ${i}`);
+  }
+
+  const extended = new Uint8Array(cache.byteLength + 1);
+  extended.set(new Uint8Array(cache));
+  if(lexer.deserialize(extended.buffer) !== false) throw new Error(`deserialize() accepted trailing data`);
+
+  /* the rejected caches left the rules alone */
+  CompareRecords('deserialize() rejected', TokenRecords(lexer.tokenize()), expected);
+
+  /* a cache of another rule set is stale */
+  lexer = TokenizeLexer(input);
+  lexer.addRule('comment', '#.*');
+  if(lexer.deserialize(cache) !== false) throw new Error(`deserialize() accepted a cache of other rules`);
+}
+
+/* all fields of each record */
+function TableRecords(table) {
+  const records = [];
+  for(let i = 0; i < table.length; i += Lexer.TOKEN_FIELDS) records.push(table.subarray(i, i + Lexer.TOKEN_FIELDS).join(':'));
+  return records;
+}
+
+/* tokenize({ threads }) must yield the records of sequential lexing, also when segments are cut inside tokens */
+function TestParallel() {
+  const grammar = new CLexer('', 'c');
+  const code = 'int x = 1; /* a comment\n   spanning lines */\nstatic char* s = "text";\n// line\nx >>= 2;\n';
+  const inputs = {
+    code: code.repeat(4096),
+    /* every newline after the first line is inside the comment */
+    comment: 'int x;\n/*' + ' comment line\n'.repeat(20000) + '*/\nint y;\n'
+  };
+
+  for(let name in inputs) {
+    const input = inputs[name];
+    const expected = TableRecords(PlainLexer(grammar, input, Lexer.LONGEST).tokenize());
+
+    CompareRecords(`tokenize({ threads: 4 }) of ${name}`, TableRecords(PlainLexer(grammar, input, Lexer.LONGEST).tokenize(null, { threads: 4 })), expected);
+  }
+
+  /* a callback needs the calling thread */
+  const lexer = PlainLexer(grammar, inputs.code, Lexer.LONGEST);
+  let calls = 0;
+  lexer.callback = () => calls++;
+
+  CompareRecords('tokenize({ threads: 4 }) with a callback', TableRecords(lexer.tokenize(null, { threads: 4 })), TableRecords(PlainLexer(grammar, inputs.code, Lexer.LONGEST).tokenize()));
+  if(calls == 0) throw new Error(`tokenize({ threads: 4 }) didn't fall back to lexing sequentially`);
+}
+
+const LocationRecord = tok => `${tok.lexeme}@${tok.loc.line}:${tok.loc.column}`;
+
+/* lazily resolved locations after seeking back past the start of the line index or forward, and at chunk edges */
+function TestSeek() {
+  const input = 'int x = 42;\nreturn x;\n\nint y =\n  7;\n';
+  const tokens = [];
+  let lexer = TokenizeLexer(input);
+  for(let tok; (tok = lexer.nextToken()); ) tokens.push(tok);
+  const expected = tokens.map(LocationRecord);
+
+  for(let start of [0, 4, 9, tokens.length]) {
+    for(let to = 0; to < tokens.length; to++) {
+      const records = [];
+      lexer = TokenizeLexer(input);
+      for(let i = 0; i < start; i++) lexer.nextToken();
+      lexer.lazy = true;
+      lexer.back(tokens[to]);
+      for(let tok; (tok = lexer.nextToken()); ) records.push(LocationRecord(tok));
+      CompareRecords(`seek from token #${start} to #${to}`, records, expected.slice(to + 1));
+    }
+  }
+
+  for(let i = 1; i < input.length; i++) {
+    const records = [];
+    lexer = TokenizeLexer('');
+    lexer.lazy = true;
+    for(let chunk of [input.slice(0, i), input.slice(i), null]) {
+      if(chunk === null) lexer.end();
+      else lexer.feed(chunk);
+      for(let tok; (tok = lexer.nextToken()); ) records.push(LocationRecord(tok));
+    }
+    CompareRecords(`lazy locations split at ${i}`, records, expected);
+  }
+}
+
+/* tokens keep the input they point into alive, short lexemes are held as atoms unless intern is 0 */
+function TestTokenSource() {
+  const input = 'int x = 42;\nreturn x;';
+  const expected = [];
+  for(let lexer = TokenizeLexer(input), tok; (tok = lexer.nextToken()); ) expected.push(LocationRecord(tok));
+
+  const lex = (text, intern) => {
+    const lexer = TokenizeLexer(text),
+      tokens = [];
+    if(intern !== undefined) lexer.intern = intern;
+    for(let tok; (tok = lexer.nextToken()); ) tokens.push(tok);
+    return [lexer, tokens];
+  };
+
+  let [lexer, tokens] = lex(input, 0);
+  lexer.setInput('return 7;');
+  if(lexer.nextToken().lexeme != 'return') throw new Error(`setInput() didn't replace the input`);
+  CompareRecords('tokens after setInput()', tokens.map(LocationRecord), expected);
+  if(tokens.some(tok => tok.interned)) throw new Error(`a lexeme was interned with intern = 0`);
+
+  lexer = null;
+  tokens = lex(input, 0)[1];
+  std.gc();
+  CompareRecords('tokens after the lexer is released', tokens.map(LocationRecord), expected);
+
+  tokens = lex(input)[1];
+  const xs = tokens.filter(tok => tok.lexeme == 'x');
+  if(xs.length != 2 || !xs.every(tok => tok.interned)) throw new Error(`identical short lexemes weren't interned`);
+
+  tokens = lex(input, 3)[1];
+  const interned = tokens.filter(tok => tok.lexeme.length > 1 && tok.interned).map(tok => tok.lexeme);
+  if(interned.join(',') != 'int,42') throw new Error(`intern = 3 interned ${interned}`);
+}
+
+/* a skipped run of spaces stops at a non-ASCII byte its class doesn't match, at any offset of a SIMD block */
+function TestSkipRun() {
+  for(let n = 1; n < 72; n++) {
+    const lexer = new Lexer('ab' + ' '.repeat(n) + 'é cd', Lexer.LONGEST);
+    lexer.addRule('space', '[ \\u00e9]+');
+    lexer.addRule('word', '[a-z]+');
+    lexer.addRule('other', '<OTHER>#');
+
+    let error;
+    try {
+      /* every rule of state #0 is skipped */
+      while(lexer.lex(1) != null) {}
+    } catch(e) {
+      error = e;
+    }
+    if(!error || lexer.pos != 2 + n) throw new Error(`skipping ${n} spaces stopped at ${lexer.pos}${error ? '' : ' without an error'}, expected ${2 + n}`);
+  }
+}
+
 function DumpLexer(lex) {
   const { size, pos, start, line, column, lineStart, lineEnd, columnIndex } = lex;
 
@@ -249,6 +600,16 @@ function main(...args) {
 
   const RelativePath = file => path.join(path.dirname(process.argv[1]), '..', file);
 
+  TestDispatch(RelativePath);
+  TestLiteralTrie();
+  TestTokenize();
+  TestFeed();
+  TestCache();
+  TestParallel();
+  TestSeek();
+  TestSkipRun();
+  TestTokenSource();
+
   if(!files.length) files.push(RelativePath('lib/util.js'));
 
   for(let file of files) ProcessFile(file);
@@ -489,6 +850,7 @@ function main(...args) {
     let end = Date.now();
 
     log(`took ${end - start}ms (${count} tokens)`);
+
     log('lexer', lexer);
     //log('tokens', tokens);
     log('lexer.rules', lexer.rules);
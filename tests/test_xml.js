@@ -4,6 +4,8 @@ import { escape, quote, isObject } from 'util';
 import inspect from 'inspect';
 import readXML from '../lib/xml/read.js';
 import writeXML from '../lib/xml/write.js';
+import { parse as parseXML, read as readNative, write as writeNative, parseCompact, parseRecords, reparse, encode, decode, select, selectFirst, XmlDocument, XmlParser, XmlSelector, XmlWriter, RETURN_PATH } from 'xml';
+import { mmap, munmap, toString, PROT_READ, MAP_PRIVATE } from 'mmap';
 import * as path from 'path';
 import * as deep from 'deep';
 import Console from '../lib/console.js';
@@ -45,6 +47,241 @@ function main(...args) {
   let numTags = tags.length;
   console.log(`Parsing '${/*path.basename*/ file}' took ${end - start}ms (${numTags} elements)`);
 
+  let fd = os.open(file, os.O_RDONLY),
+    events = { start: 0, text: 0, end: 0 };
+  start = Date.now();
+  parseXML(fd, {
+    onStart: (name, attributes) => events.start++,
+    onText: text => events.text++,
+    onEnd: name => events.end++
+  });
+  end = Date.now();
+  os.close(fd);
+  console.log(`Streaming '${file}' took ${end - start}ms`, events);
+
+  if(events.start != events.end) throw new Error(`onStart/onEnd mismatch: ${events.start} != ${events.end}`);
+
+  fd = os.open(file, os.O_RDONLY);
+  let map = mmap(0, os.seek(fd, 0, std.SEEK_END), PROT_READ, MAP_PRIVATE, fd, 0);
+  os.close(fd);
+  start = Date.now();
+  let lazy = readNative(map, file, { lazy: true, tolerant: true });
+  end = Date.now();
+  console.log(`Lazy parsing '${file}' took ${end - start}ms (${lazy.length} top-level nodes)`, lazy[lazy.length - 1]?.tagName);
+  lazy = null;
+
+  let doc = parseCompact(map, file, { tolerant: true });
+  console.log(
+    `Compact document: ${doc.length} nodes, ${doc.attrs.length / XmlDocument.ATTR_FIELDS} attributes, ${doc.names.length} distinct names`
+  );
+
+  /* the arenas are handed out as copies, writing to them can't corrupt the document */
+  const nodes = doc.nodes;
+  nodes.fill(0xffffffff);
+  if(doc.nodes.every(n => n == 0xffffffff) || doc.children.length != parseCompact(map, file, { tolerant: true }).children.length) throw new Error(`document.nodes aliases the node arena`);
+
+  const all = new XmlSelector('*');
+  start = Date.now();
+  let elements = all.select(doc);
+  end = Date.now();
+  console.log(`Selecting '${all.source}' took ${end - start}ms (${elements.length} elements)`);
+
+  if(elements.length != select(doc, '//*').length) throw new Error(`CSS '*' and XPath '//*' differ`);
+
+  if(elements.length) {
+    const { tagName } = elements[0],
+      [path] = select(doc, `${tagName}:first-of-type`, RETURN_PATH);
+
+    if(path.reduce((acc, key) => acc[key], doc).tagName != tagName) throw new Error(`path ${path} doesn't lead to <${tagName}>`);
+    if(select(result, `//${tagName}`).length != select(doc, tagName).length) throw new Error(`<${tagName}> count differs between the plain tree and the compact document`);
+  }
+
+  /* selectFirst() stops flattening a plain tree at the first match */
+  const plain = readNative('<a><b id="1" lang="en-US"><c/></b><b class="x y" lang="en"><d/><c k="v"/></b><e lang="de"><c/></e></a>', 'plain.xml');
+
+  for(let expr of ['c', 'b > c', 'a c[k]', '.y c', 'e c, b d', 'b:last-child c', 'b + e', '//b[2]/c', '*', 'f'])
+    for(let flags of [0, RETURN_PATH])
+      if(!deep.equals(selectFirst(plain, expr, flags), select(plain, expr, flags)[0] ?? null)) throw new Error(`selectFirst(plain, '${expr}', ${flags}) differs from select()`);
+
+  /* elements labelled by their position among the children of their parent, e.g. /a1/b2/c2 */
+  const labels = new Map();
+  const label = (nodes, prefix = '') =>
+    nodes.forEach((node, i) => {
+      if(!isObject(node) || !node.tagName) return;
+      labels.set(node, `${prefix}/${node.tagName}${i + 1}`);
+      label(node.children ?? [], labels.get(node));
+    });
+  label(plain);
+
+  for(let [expr, expected] of [
+    ['a *:nth-child(2n+1)', '/a1/b1 /a1/b1/c1 /a1/b2/d1 /a1/e3 /a1/e3/c1'],
+    ['a *:only-of-type', '/a1/b1/c1 /a1/b2/d1 /a1/b2/c2 /a1/e3 /a1/e3/c1'],
+    ['[class~=y]', '/a1/b2'],
+    ['[lang|=en]', '/a1/b1 /a1/b2'],
+    ['[lang^="en-"]', '/a1/b1'],
+    ['[lang$=e]', '/a1/e3'],
+    ['[lang*=n]', '/a1/b1 /a1/b2'],
+    ['//b[last()]', '/a1/b2'],
+    ["//*[contains(@lang, 'U')]", '/a1/b1'],
+    ["//b[contains(@class, 'y')]/c", '/a1/b2/c2'],
+    ["//*[starts-with(@lang, 'en')]", '/a1/b1 /a1/b2']
+  ]) {
+    const actual = select(plain, expr, RETURN_PATH)
+      .map(path => labels.get(path.reduce((acc, key) => acc[key], plain)))
+      .join(' ');
+    if(actual != expected) throw new Error(`select(plain, '${expr}') returned '${actual}', expected '${expected}'`);
+  }
+
+  const container = result.find(node => isObject(node) && Array.isArray(node.children)),
+    record = container?.children.find(node => isObject(node) && /^\w/.test(node.tagName));
+
+  if(record) {
+    const { tagName } = record;
+    start = Date.now();
+    let records = parseRecords(map, tagName, { name: file, threads: 4 });
+    end = Date.now();
+    console.log(`Parsing the <${tagName}> records took ${end - start}ms (${records.length} records)`);
+
+    const sequential = parseRecords(map, tagName, { name: file });
+
+    if(records.length != sequential.length || records[records.length - 1]?.tagName != tagName || !deep.equals(records, sequential))
+      throw new Error(`parallel and sequential <${tagName}> records differ`);
+
+    records = null;
+  }
+
+  /* enough records for every thread to get a segment of its own */
+  const feed =
+      '<?xml version="1.0"?>\n<feed>\n' +
+      Array.from({ length: 4000 }, (_, i) => `  <entry id="${i}" ${i % 3 ? 'draft ' : ''}lang="en"><title>Entry &amp; ${i}</title><tags><tag>t${i % 7}</tag></tags></entry>\n`).join('') +
+      '</feed>\n',
+    feedRecords = parseRecords(feed, 'entry', { threads: 4 });
+
+  if(feedRecords.length != 4000 || !deep.equals(feedRecords, parseRecords(feed, 'entry'))) throw new Error(`parseRecords() with threads differs from a sequential parse`);
+
+  const config = '<?xml version="1.0"?>\n<config>\n  <a x="1">one</a>\n  <b><c>two</c><d/></b>\n</config>\n';
+  const edit = config.indexOf('two'),
+    edited = config.slice(0, edit) + 'three' + config.slice(edit + 3);
+  let tree = readNative(config, 'config.xml', { spans: true }),
+    a = deep.find(tree, n => n?.tagName == 'a');
+
+  if(reparse(tree, edited, edit, 3, 5) !== tree) throw new Error(`reparse() didn't splice the edit in`);
+  if(!deep.equals(tree, readNative(edited, 'config.xml', { spans: true }))) throw new Error(`reparse() differs from read()`);
+  if(deep.find(tree, n => n?.tagName == 'a') !== a) throw new Error(`reparse() replaced an unchanged sibling`);
+
+  /* an edit which breaks the nesting fails in the edited element and then in the whole input */
+  const broken = config.slice(0, edit) + 'two</d>' + config.slice(edit + 3);
+  let thrown;
+
+  try {
+    reparse(readNative(config, 'config.xml', { spans: true }), broken, edit, 3, 7);
+  } catch(error) {
+    thrown = error;
+  }
+
+  if(!(thrown instanceof SyntaxError) || !/mismatch <\/d>/.test(thrown.message)) throw new Error(`reparse() of mismatched tags threw ${thrown}`);
+
+  const text = 'caf\u00e9 \u2014 1 < 2 & "3"';
+  if(decode(encode(text, true)) != text) throw new Error(`decode(encode()) doesn't round-trip`);
+  if(decode('&eacute;&#233;&#xE9;&bogus;') != '\u00e9\u00e9\u00e9&bogus;') throw new Error(`decode() of named and numeric entities failed`);
+  if(decode('&#xD7FF;&#xD800;&#55296;&#xDFFF;&#xE000;') != '\ud7ff&#xD800;&#55296;&#xDFFF;\ue000') throw new Error(`decode() accepted a surrogate reference`);
+  /* parsing knows only the entities predefined by XML, xml.decode() those of HTML 4 too */
+  const [para] = readNative('<p title="&lt;b&gt;">&amp;&nbsp;&apos;&#233;</p>', 'p.xml', { decode: true });
+  if(para.attributes.title != '<b>' || para.children[0] != "&&nbsp;'\u00e9") throw new Error(`read() with { decode: true } returned ${inspect(para)}`);
+  if(decode('&amp;&nbsp;') != '&\u00a0') throw new Error(`decode() of an HTML entity failed`);
+
+  /* lazy elements read like eager ones, each accessor turns into a data property when it is first read */
+  const sample = '<?xml version="1.0"?>\n<root a="1" b>\n  <x y="&lt;2&gt;">text<z/></x>\n  <!-- note -->\n  <w>more &amp; more</w>\n</root>\n',
+    readLazy = (node, key, where) => {
+      if(typeof Object.getOwnPropertyDescriptor(node, key)?.get != 'function') throw new Error(`${where}.${key} is not lazy`);
+
+      const value = node[key],
+        desc = Object.getOwnPropertyDescriptor(node, key);
+
+      if(!('value' in desc) || desc.value !== value || node[key] !== value) throw new Error(`${where}.${key} didn't turn into a data property`);
+      return value;
+    },
+    compareLazy = (nodes, expected, where) => {
+      if(nodes.length != expected.length) throw new Error(`${where} has ${nodes.length} nodes, expected ${expected.length}`);
+
+      nodes.forEach((node, i) => {
+        const at = `${where}[${i}]`;
+
+        if(!isObject(node)) {
+          if(node !== expected[i]) throw new Error(`${at} is ${inspect(node)}, expected ${inspect(expected[i])}`);
+          return;
+        }
+
+        if(Object.keys(node).sort().join() != Object.keys(expected[i]).sort().join()) throw new Error(`${at} has the properties ${Object.keys(node)}`);
+
+        for(let key of Object.keys(node)) {
+          const value = readLazy(node, key, at);
+
+          if(key == 'children') compareLazy(value, expected[i].children, `${at}.children`);
+          else if(!deep.equals(value, expected[i][key])) throw new Error(`${at}.${key} is ${inspect(value)}, expected ${inspect(expected[i][key])}`);
+        }
+      });
+    };
+
+  const eager = readNative(sample, 'sample.xml');
+  compareLazy(readNative(sample, 'sample.xml', { lazy: true }), eager, 'read({ lazy: true })');
+  compareLazy(readLazy(parseCompact(sample, 'sample.xml'), 'children', 'document'), eager, 'document.children');
+
+  /* markup cut off at any byte is picked up where the previous chunk left it */
+  const chunked = '<?xml version="1.0"?>\n<!DOCTYPE html>\n<html><!-- a > b -->\n  <p class="x>y" title=\'"\'>text <b>bold</b></p>\n' +
+      '  <![CDATA[ <raw> ]]><script>if(a < b && c > d) f("</p>");</script><br/>\n</html>\n',
+    parseEvents = chunks => {
+      const events = [],
+        parser = new XmlParser({
+          onStart: (name, attributes) => events.push(['start', name, attributes]),
+          onText: text => events.push(['text', text]),
+          onEnd: name => events.push(['end', name])
+        });
+      for(let chunk of chunks) parser.write(chunk);
+      parser.end();
+      return events;
+    };
+
+  if(!deep.equals(parseEvents([...chunked]), parseEvents([chunked]))) throw new Error(`XmlParser events differ when fed byte by byte`);
+
+  /* only SP, TAB, CR and LF separate attributes, in whole SIMD blocks and in their tails */
+  for(let n of [1, 15, 16, 17, 31, 32, 33, 47]) {
+    const space = ' '.repeat(n),
+      [element] = readNative(`<a${space}\vb="1"${space}\u00e9="2"${space}/>`, 'space.xml');
+
+    if(Object.keys(element.attributes).join(',') != '\vb,\u00e9') throw new Error(`attributes after ${n} spaces are ${inspect(element.attributes)}`);
+  }
+
+  /* tag and attribute names are shared per parse, a repeated attribute keeps its last value */
+  const names = '<r><i k="1" v="a" k="2"/><i k="1" v="a"/>t<i __proto__="p"></i></r>';
+  const flat = readNative(names, 'names.xml', { flat: true }),
+    expectedFlat = [
+      { tagName: 'r', attributes: {} },
+      { tagName: 'i', attributes: { k: '2', v: 'a' } },
+      { tagName: '/i' },
+      { tagName: 'i', attributes: { k: '1', v: 'a' } },
+      { tagName: '/i' },
+      't',
+      { tagName: 'i', attributes: { ['__proto__']: 'p' } },
+      { tagName: '/i' },
+      { tagName: '/r' }
+    ];
+
+  if(!deep.equals(flat, expectedFlat)) throw new Error(`flat read() returned ${JSON.stringify(flat)}`);
+
+  const [root] = readNative(names, 'names.xml'),
+    [first, second, , proto] = root.children;
+
+  if(first.tagName !== 'i' || second.tagName !== first.tagName || proto.tagName !== first.tagName) throw new Error(`repeated tag names differ`);
+  if(Object.keys(first.attributes).join() != 'k,v' || first.attributes.k !== '2') throw new Error(`a duplicate attribute didn't keep its last value: ${JSON.stringify(first.attributes)}`);
+  if(!deep.equals(second.attributes, { k: '1', v: 'a' }) || Object.keys(second.attributes).join() != Object.keys(first.attributes).join()) throw new Error(`repeated attribute names differ`);
+  if(!Object.prototype.hasOwnProperty.call(proto.attributes, '__proto__') || proto.attributes.__proto__ !== 'p' || Object.getPrototypeOf(proto.attributes) !== Object.prototype)
+    throw new Error(`an attribute named __proto__ didn't become an own property`);
+
+  doc = elements = null;
+  std.gc();
+  munmap(map);
+
   if(/NETSCAPE-Bookmark-file-1/i.test(result[0].tagName)) {
     let tag,
       group,
@@ -100,11 +337,76 @@ function main(...args) {
 
   WriteFile(base + '.xml', str);
 
+  fd = os.open(base + '.stream.xml', os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644);
+  writeNative(result, Infinity, fd);
+  os.close(fd);
+
+  if(std.loadFile(base + '.stream.xml') != writeNative(result)) throw new Error(`xml.write() to a file descriptor differs from the string output`);
+
+  const writer = new XmlWriter();
+  writer.startElement('?xml', { version: '1.0' });
+  writer.startElement('list', { count: 2 });
+  writer.startElement('item', { title: 'a "quoted" <title>' });
+  writer.text('1 < 2 & 3');
+  writer.endElement('item');
+  writer.startElement('empty');
+  const output = writer.end();
+
+  if(output != '<?xml version="1.0"?>\n<list count="2">\n  <item title="a &quot;quoted&quot; &lt;title&gt;">\n    1 &lt; 2 &amp; 3\n  </item>\n  <empty />\n</list>\n')
+    throw new Error(`XmlWriter output is ${inspect(output)}`);
+
   std.gc();
+
+  return TestBackpressure();
+}
+
+/* xml.write() of a flat list to a sink which takes two chunks before it wants the producer to wait */
+async function TestBackpressure() {
+  const list = Array.from({ length: 20000 }, (_, i) => ({ tagName: 'item', attributes: { n: i, name: `item #${i}` } })),
+    chunks = [],
+    sink = {
+      queued: 0,
+      ready: Promise.resolve(),
+      get desiredSize() {
+        return 2 - this.queued;
+      },
+      write(chunk) {
+        if(this.desiredSize <= 0) throw new Error(`xml.write() wrote to a full sink`);
+
+        chunks.push(toString(chunk));
+        if(++this.queued == 2) this.ready = new Promise(resolve => (this.drain = resolve));
+        return Promise.resolve();
+      }
+    };
+  let done = writeNative(list, Infinity, sink),
+    finished = false,
+    failure;
+
+  if(!(done instanceof Promise) || chunks.length != 2) throw new Error(`xml.write() didn't wait for the full sink (${chunks.length} chunks written)`);
+
+  done.then(
+    () => (finished = true),
+    error => (failure = error)
+  );
+
+  while(!finished && !failure) {
+    await new Promise(resolve => os.setTimeout(resolve, 0));
+
+    if(sink.queued == 2) {
+      sink.queued = 0;
+      sink.drain();
+    }
+  }
+
+  if(failure) throw failure;
+  if(chunks.join('') != writeNative(list)) throw new Error(`xml.write() to a sink differs from the string output`);
 }
 
 try {
-  main(...scriptArgs.slice(1));
+  main(...scriptArgs.slice(1)).catch(error => {
+    console.log(`FAIL: ${error.message}\n${error.stack}`);
+    std.exit(1);
+  });
 } catch(error) {
   console.log(`FAIL: ${error.message}\n${error.stack}`);
   std.exit(1);